@@ -0,0 +1,260 @@
+#include "BufferChain.h"
+#include "BufferPool.h"
+#include "LocalTransfer.h"
+#include <stdlib.h> // calloc, free
+#include <errno.h> // errno
+#include <string.h> // memset, memcpy, memmove
+#include <sys/uio.h> // readv, iovec
+#include <sys/socket.h> // sendmsg
+
+// readv 和 sendmsg 使用的数据向量，只在一次调用中使用，每个线程一份而不是每个连接一份
+static __thread struct iovec vectors[BUFFER_CHAIN_MAX_VECTORS];
+
+int BufferChainInit(struct BufferChain *chain, size_t segmentSize, size_t capacity) {
+    memset(chain, 0, sizeof(*chain));
+    if (0 == segmentSize) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (capacity < segmentSize) {
+        capacity = segmentSize;
+    }
+
+    chain->segmentSize = segmentSize;
+    chain->maxSegments = (capacity + segmentSize - 1) / segmentSize;
+    chain->capacity = chain->maxSegments * segmentSize;
+
+    chain->segments = (char **) calloc(chain->maxSegments, sizeof(char *));
+    if (NULL == chain->segments) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * 把借用的分段全部归还缓冲区池
+ * @param chain 缓冲区链
+ */
+static void ReleaseSegments(struct BufferChain *chain) {
+    for (size_t i = 0; i < chain->segmentCount; i++) {
+        BufferPoolRelease(chain->segments[i], chain->segmentSize);
+        chain->segments[i] = NULL;
+    }
+    chain->segmentCount = 0;
+}
+
+void BufferChainDestroy(struct BufferChain *chain) {
+    if (NULL != chain->segments) {
+        ReleaseSegments(chain);
+        free(chain->segments);
+    }
+    chain->segments = NULL;
+    chain->segmentCount = 0;
+    chain->offset = 0;
+    chain->length = 0;
+}
+
+/**
+ * 把链中 [begin, end) 范围的数据描述为数据向量
+ * @param chain 缓冲区链
+ * @param begin 起始偏移
+ * @param end 结束偏移，不超过已分配分段的总大小
+ * @return 数据向量数，最多 BUFFER_CHAIN_MAX_VECTORS 个，超出的部分留给下一次调用
+ */
+static int FillVectors(struct BufferChain *chain, size_t begin, size_t end) {
+    int count = 0;
+    while (begin < end && count < BUFFER_CHAIN_MAX_VECTORS) {
+        size_t index = begin / chain->segmentSize;
+        size_t segmentOffset = begin % chain->segmentSize;
+        size_t size = chain->segmentSize - segmentOffset;
+        if (size > end - begin) {
+            size = end - begin;
+        }
+
+        vectors[count].iov_base = chain->segments[index] + segmentOffset;
+        vectors[count].iov_len = size;
+        count++;
+        begin += size;
+    }
+    return count;
+}
+
+/**
+ * 借用更多分段：没有分段时借用一个，否则把分段数加倍，不超过总容量；借用失败时保持原来的分段数
+ * @param chain 缓冲区链
+ */
+static void GrowSegments(struct BufferChain *chain) {
+    size_t target = (0 == chain->segmentCount) ? 1 : chain->segmentCount * 2;
+    if (target > chain->maxSegments) {
+        target = chain->maxSegments;
+    }
+
+    while (chain->segmentCount < target) {
+        char *segment = (char *) BufferPoolAcquire(chain->segmentSize);
+        if (NULL == segment) {
+            break;
+        }
+        chain->segments[chain->segmentCount++] = segment;
+    }
+}
+
+ssize_t BufferChainRead(struct BufferChain *chain, int fd) {
+    if (0 == chain->segmentCount) {
+        // 空闲后第一次读取，从线程缓存借用一个分段
+        GrowSegments(chain);
+        if (0 == chain->segmentCount) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    size_t allocated = chain->segmentCount * chain->segmentSize;
+    if (chain->length >= allocated) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    int count = FillVectors(chain, chain->length, allocated);
+    ssize_t readSize = readv(fd, vectors, count);
+    if (readSize > 0) {
+        chain->length += (size_t) readSize;
+        if (chain->length == allocated) {
+            GrowSegments(chain);
+        }
+    } else if (0 == chain->length) {
+        // 连接进入空闲，只在有数据要回显时占用分段
+        int error = errno;
+        ReleaseSegments(chain);
+        errno = error;
+    }
+    return readSize;
+}
+
+ssize_t BufferChainReadMessage(struct BufferChain *chain, int sd, int *fd) {
+    // 一次借够整条记录的分段，recvmsg 不能像流一样分多次读取一条记录
+    size_t maxMessage = BufferChainMaxMessage(chain);
+    size_t target = (maxMessage + chain->segmentSize - 1) / chain->segmentSize;
+    while (chain->segmentCount < target) {
+        char *segment = (char *) BufferPoolAcquire(chain->segmentSize);
+        if (NULL == segment) {
+            errno = ENOMEM;
+            return -1;
+        }
+        chain->segments[chain->segmentCount++] = segment;
+    }
+
+    int count = FillVectors(chain, 0, maxMessage);
+    ssize_t recvSize = LocalReceiveWithDescriptor(sd, vectors, count, fd, 0);
+    if (recvSize > 0) {
+        chain->offset = 0;
+        chain->length = (size_t) recvSize;
+    } else {
+        int error = errno;
+        ReleaseSegments(chain);
+        errno = error;
+    }
+    return recvSize;
+}
+
+ssize_t BufferChainWriteMessage(struct BufferChain *chain, int sd, int fd) {
+    int count = FillVectors(chain, chain->offset, chain->length);
+    ssize_t sentSize = LocalSendWithDescriptor(sd, vectors, count, fd, 0);
+    if (sentSize > 0) {
+        chain->offset = 0;
+        chain->length = 0;
+    }
+    return sentSize;
+}
+
+ssize_t BufferChainWrite(struct BufferChain *chain, int sd) {
+    return BufferChainWriteRange(chain, sd, chain->length);
+}
+
+ssize_t BufferChainWriteRange(struct BufferChain *chain, int sd, size_t end) {
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = vectors;
+    message.msg_iovlen = (size_t) FillVectors(chain, chain->offset, end);
+
+    // 数据向量没有覆盖到 end 时还有后续的 sendmsg，先不要发出未满的报文段
+    int flags = MSG_NOSIGNAL;
+    size_t covered = 0;
+    for (size_t i = 0; i < message.msg_iovlen; i++) {
+        covered += vectors[i].iov_len;
+    }
+    if (chain->offset + covered < end) {
+        flags |= MSG_MORE;
+    }
+
+    ssize_t sentSize = sendmsg(sd, &message, flags);
+    if (sentSize > 0) {
+        chain->offset += (size_t) sentSize;
+        if (chain->offset == chain->length) {
+            chain->offset = 0;
+            chain->length = 0;
+        }
+    }
+    return sentSize;
+}
+
+void BufferChainConsume(struct BufferChain *chain, size_t size) {
+    chain->offset += size;
+    if (chain->offset == chain->length) {
+        chain->offset = 0;
+        chain->length = 0;
+    }
+}
+
+size_t BufferChainCopyOut(const struct BufferChain *chain, char *buffer, size_t size) {
+    size_t position = chain->offset;
+    size_t copied = 0;
+    while (position < chain->length && copied < size) {
+        size_t segmentOffset = position % chain->segmentSize;
+        size_t part = chain->segmentSize - segmentOffset;
+        if (part > chain->length - position) {
+            part = chain->length - position;
+        }
+        if (part > size - copied) {
+            part = size - copied;
+        }
+
+        memcpy(buffer + copied, chain->segments[position / chain->segmentSize] + segmentOffset,
+               part);
+        copied += part;
+        position += part;
+    }
+    return copied;
+}
+
+size_t BufferChainCompact(struct BufferChain *chain) {
+    size_t distance = chain->offset;
+    if (0 == distance) {
+        return 0;
+    }
+
+    // 目标在源之前，按从前往后的顺序逐块移动不会覆盖尚未移动的数据
+    size_t from = chain->offset;
+    size_t to = 0;
+    while (from < chain->length) {
+        size_t fromOffset = from % chain->segmentSize;
+        size_t toOffset = to % chain->segmentSize;
+        size_t part = chain->length - from;
+        if (part > chain->segmentSize - fromOffset) {
+            part = chain->segmentSize - fromOffset;
+        }
+        if (part > chain->segmentSize - toOffset) {
+            part = chain->segmentSize - toOffset;
+        }
+
+        memmove(chain->segments[to / chain->segmentSize] + toOffset,
+                chain->segments[from / chain->segmentSize] + fromOffset, part);
+        from += part;
+        to += part;
+    }
+
+    chain->length -= distance;
+    chain->offset = 0;
+    return distance;
+}
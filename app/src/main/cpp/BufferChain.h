@@ -0,0 +1,136 @@
+#ifndef ECHO_BUFFER_CHAIN_H
+#define ECHO_BUFFER_CHAIN_H
+
+#include <stddef.h> // size_t
+#include <sys/types.h> // ssize_t
+
+// 每次 readv/sendmsg 最多使用的数据向量数，不超过 IOV_MAX
+#define BUFFER_CHAIN_MAX_VECTORS 64
+
+/**
+ * 由固定大小的分段组成的缓冲区链
+ *     数据依次存放在各个分段中，readv 和 sendmsg 一次系统调用读写多个分段；
+ *     分段从缓冲区池借用，读取填满已借用的分段时加倍，直到总容量，小消息只占用一个分段；
+ *     读取时链中没有数据就把分段全部归还，空闲的连接不占用缓冲区
+ */
+struct BufferChain {
+    // 分段指针数组，前 segmentCount 个已经借用
+    char **segments;
+    size_t segmentCount;
+    size_t maxSegments;
+
+    // 每个分段的大小和总容量
+    size_t segmentSize;
+    size_t capacity;
+
+    // 尚未写出的数据在链中的起始偏移和结束偏移
+    size_t offset;
+    size_t length;
+};
+
+/**
+ * 初始化缓冲区链，分段在第一次读取时才借用
+ * @param chain 缓冲区链
+ * @param segmentSize 每个分段的大小
+ * @param capacity 总容量，至少为一个分段
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int BufferChainInit(struct BufferChain *chain, size_t segmentSize, size_t capacity);
+
+/**
+ * 归还全部分段并释放分段指针数组
+ * @param chain 缓冲区链
+ */
+void BufferChainDestroy(struct BufferChain *chain);
+
+/**
+ * 尚未写出的字节数
+ * @param chain 缓冲区链
+ * @return 字节数
+ */
+static inline size_t BufferChainPending(const struct BufferChain *chain) {
+    return chain->length - chain->offset;
+}
+
+/**
+ * 用一次 readv 把数据追加到链的末尾，填满已借用的分段时为下一次读取借用更多分段；
+ * 没有读到数据并且链为空时归还全部分段
+ * @param chain 缓冲区链
+ * @param fd 文件描述符
+ * @return 读取的字节数，文件结束返回 0，链已满时返回 -1 并设置 errno 为 ENOBUFS，
+ *         借用分段失败返回 -1 并设置 errno 为 ENOMEM，失败返回 -1 并设置 errno
+ */
+ssize_t BufferChainRead(struct BufferChain *chain, int fd);
+
+/**
+ * 用一次 recvmsg 接收一条完整的记录（SOCK_SEQPACKET）和它附带的描述符，链必须为空；
+ * 接收前借用足够的分段，记录最长为 BufferChainMaxMessage 字节；没有读到记录时归还全部分段
+ * @param chain 缓冲区链
+ * @param sd 本地 socket 描述符
+ * @param fd 记录附带的描述符，没有时为 -1，由调用者关闭
+ * @return 记录的字节数，对端关闭返回 0，记录超过最大长度时返回 -1 并设置 errno 为 EMSGSIZE，
+ *         借用分段失败返回 -1 并设置 errno 为 ENOMEM，失败返回 -1 并设置 errno
+ */
+ssize_t BufferChainReadMessage(struct BufferChain *chain, int sd, int *fd);
+
+/**
+ * 用一次 sendmsg 把链中的数据作为一条记录发送，可以附带一个描述符；记录的发送是原子的
+ * @param chain 缓冲区链
+ * @param sd 本地 socket 描述符
+ * @param fd 附带的描述符，-1 表示不附带
+ * @return 发送的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t BufferChainWriteMessage(struct BufferChain *chain, int sd, int fd);
+
+/**
+ * 一条记录的最大长度：总容量，不超过一次 recvmsg 的数据向量能够描述的大小
+ * @param chain 缓冲区链
+ * @return 字节数
+ */
+static inline size_t BufferChainMaxMessage(const struct BufferChain *chain) {
+    size_t limit = chain->segmentSize * BUFFER_CHAIN_MAX_VECTORS;
+    return (chain->capacity < limit) ? chain->capacity : limit;
+}
+
+/**
+ * 用一次 sendmsg 发送尚未写出的数据，全部写出后链被清空以便从头读取
+ * @param chain 缓冲区链
+ * @param sd socket 描述符，以 MSG_NOSIGNAL 发送，对端关闭时返回 EPIPE 而不是产生 SIGPIPE
+ * @return 发送的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t BufferChainWrite(struct BufferChain *chain, int sd);
+
+/**
+ * 用一次 sendmsg 发送 [offset, end) 范围内尚未写出的数据，其余数据留在链中；
+ * 数据向量放不下整个范围时带 MSG_MORE 发送，内核等后续数据一起组成报文段
+ * @param chain 缓冲区链
+ * @param sd socket 描述符
+ * @param end 结束偏移，不超过 length，等于 length 时与 BufferChainWrite 相同
+ * @return 发送的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t BufferChainWriteRange(struct BufferChain *chain, int sd, size_t end);
+
+/**
+ * 丢弃尚未写出的数据的开头部分，与写出了这部分数据相同；全部丢弃后链被清空以便从头读取
+ * @param chain 缓冲区链
+ * @param size 丢弃的字节数，不超过尚未写出的字节数
+ */
+void BufferChainConsume(struct BufferChain *chain, size_t size);
+
+/**
+ * 把尚未写出的数据移动到链的开头，为后续读取腾出空间
+ * @param chain 缓冲区链
+ * @return 数据移动的距离，即移动前的 offset
+ */
+size_t BufferChainCompact(struct BufferChain *chain);
+
+/**
+ * 把尚未写出的数据复制到连续的内存中，不改变链的状态
+ * @param chain 缓冲区链
+ * @param buffer 目标内存
+ * @param size 最多复制的字节数
+ * @return 复制的字节数
+ */
+size_t BufferChainCopyOut(const struct BufferChain *chain, char *buffer, size_t size);
+
+#endif // ECHO_BUFFER_CHAIN_H
@@ -0,0 +1,227 @@
+#include "BufferPool.h"
+#include <stdlib.h> // malloc, free
+#include <pthread.h> // pthread_mutex_lock, pthread_once, pthread_key_create, pthread_setspecific
+#include <sys/mman.h> // mmap, madvise
+
+/**
+ * 全局空闲链表，各尺寸等级共用一把锁，只在线程缓存批量补充和归还时加锁
+ */
+static struct {
+    pthread_mutex_t mutex;
+    void *heads[BUFFER_POOL_CLASS_COUNT];
+    size_t counts[BUFFER_POOL_CLASS_COUNT];
+    struct BufferPoolStats stats;
+    bool hugePages;
+} central = {PTHREAD_MUTEX_INITIALIZER, {}, {}, {}, false};
+
+/**
+ * 每个线程的缓冲区缓存，借用和归还只访问本线程的链表，不加锁
+ *     空闲缓冲区的前 8 个字节保存链表中下一个缓冲区的地址
+ */
+struct ThreadCache {
+    void *heads[BUFFER_POOL_CLASS_COUNT];
+    size_t counts[BUFFER_POOL_CLASS_COUNT];
+    bool registered;
+};
+
+static __thread struct ThreadCache threadCache;
+
+// 线程退出时归还缓存的键
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t cacheKey;
+
+/**
+ * 取得缓冲区大小对应的尺寸等级
+ * @param size 缓冲区大小
+ * @return 尺寸等级，不在尺寸等级范围内返回 -1
+ */
+static int ClassIndex(size_t size) {
+    if (size <= ((size_t) 1 << (BUFFER_POOL_MIN_SHIFT - 1))) {
+        return -1;
+    }
+
+    int shift = BUFFER_POOL_MIN_SHIFT;
+    while (shift <= BUFFER_POOL_MAX_SHIFT && ((size_t) 1 << shift) < size) {
+        shift++;
+    }
+    return (shift > BUFFER_POOL_MAX_SHIFT) ? -1 : shift - BUFFER_POOL_MIN_SHIFT;
+}
+
+static inline void *NextOf(void *buffer) {
+    return *(void **) buffer;
+}
+
+static inline void SetNext(void *buffer, void *next) {
+    *(void **) buffer = next;
+}
+
+/**
+ * 映射一块 slab，切分后全部放入全局空闲链表，调用时必须持有全局锁
+ * @param index 尺寸等级
+ * @return 成功返回 true，内存不足返回 false
+ */
+static bool AddSlab(int index) {
+    void *slab = MAP_FAILED;
+    bool hugePage = false;
+
+    if (central.hugePages) {
+        slab = mmap(NULL, BUFFER_POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        hugePage = (MAP_FAILED != slab);
+    }
+    if (MAP_FAILED == slab) {
+        // 没有预留的大页时回退到普通页
+        slab = mmap(NULL, BUFFER_POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == slab) {
+            return false;
+        }
+        if (central.hugePages) {
+            // 只是建议，内核不支持透明大页时忽略
+            madvise(slab, BUFFER_POOL_SLAB_SIZE, MADV_HUGEPAGE);
+        }
+    }
+
+    size_t bufferSize = (size_t) 1 << (index + BUFFER_POOL_MIN_SHIFT);
+    for (size_t offset = 0; offset < BUFFER_POOL_SLAB_SIZE; offset += bufferSize) {
+        void *buffer = (char *) slab + offset;
+        SetNext(buffer, central.heads[index]);
+        central.heads[index] = buffer;
+        central.counts[index]++;
+    }
+
+    central.stats.slabCount++;
+    if (hugePage) {
+        central.stats.hugePageSlabCount++;
+    }
+    return true;
+}
+
+/**
+ * 把线程缓存中最多 count 个缓冲区移回全局空闲链表
+ * @param cache 线程缓存
+ * @param index 尺寸等级
+ * @param count 移动的缓冲区数
+ */
+static void ReturnToCentral(struct ThreadCache *cache, int index, size_t count) {
+    pthread_mutex_lock(&central.mutex);
+    while (count > 0 && NULL != cache->heads[index]) {
+        void *buffer = cache->heads[index];
+        cache->heads[index] = NextOf(buffer);
+        cache->counts[index]--;
+
+        SetNext(buffer, central.heads[index]);
+        central.heads[index] = buffer;
+        central.counts[index]++;
+        count--;
+    }
+    pthread_mutex_unlock(&central.mutex);
+}
+
+/**
+ * 线程退出时把缓存中的全部缓冲区移回全局空闲链表
+ * @param value 线程缓存
+ */
+static void DestroyThreadCache(void *value) {
+    struct ThreadCache *cache = (struct ThreadCache *) value;
+    for (int i = 0; i < BUFFER_POOL_CLASS_COUNT; i++) {
+        ReturnToCentral(cache, i, cache->counts[i]);
+    }
+    cache->registered = false;
+}
+
+static void CreateCacheKey() {
+    pthread_key_create(&cacheKey, DestroyThreadCache);
+}
+
+/**
+ * 取得当前线程的缓存，第一次使用时注册线程退出时的清理
+ * @return 线程缓存
+ */
+static struct ThreadCache *GetThreadCache() {
+    struct ThreadCache *cache = &threadCache;
+    if (!cache->registered) {
+        pthread_once(&cacheKeyOnce, CreateCacheKey);
+        pthread_setspecific(cacheKey, cache);
+        cache->registered = true;
+    }
+    return cache;
+}
+
+/**
+ * 从全局空闲链表批量补充线程缓存，全局链表为空时映射新的 slab
+ * @param cache 线程缓存
+ * @param index 尺寸等级
+ */
+static void RefillFromCentral(struct ThreadCache *cache, int index) {
+    pthread_mutex_lock(&central.mutex);
+    if (NULL != central.heads[index] || AddSlab(index)) {
+        for (size_t i = 0; i < BUFFER_POOL_BATCH_SIZE && NULL != central.heads[index]; i++) {
+            void *buffer = central.heads[index];
+            central.heads[index] = NextOf(buffer);
+            central.counts[index]--;
+
+            SetNext(buffer, cache->heads[index]);
+            cache->heads[index] = buffer;
+            cache->counts[index]++;
+        }
+    }
+    pthread_mutex_unlock(&central.mutex);
+}
+
+void BufferPoolEnableHugePages() {
+    pthread_mutex_lock(&central.mutex);
+    central.hugePages = true;
+    pthread_mutex_unlock(&central.mutex);
+}
+
+void *BufferPoolAcquire(size_t size) {
+    int index = ClassIndex(size);
+    if (-1 == index) {
+        __atomic_fetch_add(&central.stats.unpooledCount, 1, __ATOMIC_RELAXED);
+        return malloc(size);
+    }
+
+    struct ThreadCache *cache = GetThreadCache();
+    if (NULL == cache->heads[index]) {
+        RefillFromCentral(cache, index);
+        if (NULL == cache->heads[index]) {
+            return NULL;
+        }
+    }
+
+    void *buffer = cache->heads[index];
+    cache->heads[index] = NextOf(buffer);
+    cache->counts[index]--;
+    return buffer;
+}
+
+void BufferPoolRelease(void *buffer, size_t size) {
+    if (NULL == buffer) {
+        return;
+    }
+
+    int index = ClassIndex(size);
+    if (-1 == index) {
+        free(buffer);
+        return;
+    }
+
+    // 缓冲区归还到释放线程的缓存，不论由哪个线程借用，多余的经全局链表回到其他线程
+    struct ThreadCache *cache = GetThreadCache();
+    SetNext(buffer, cache->heads[index]);
+    cache->heads[index] = buffer;
+    cache->counts[index]++;
+
+    if (cache->counts[index] > 2 * BUFFER_POOL_BATCH_SIZE) {
+        ReturnToCentral(cache, index, BUFFER_POOL_BATCH_SIZE);
+    }
+}
+
+void BufferPoolGetStats(struct BufferPoolStats *stats) {
+    pthread_mutex_lock(&central.mutex);
+    stats->slabCount = central.stats.slabCount;
+    stats->hugePageSlabCount = central.stats.hugePageSlabCount;
+    stats->unpooledCount = __atomic_load_n(&central.stats.unpooledCount, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&central.mutex);
+}
@@ -0,0 +1,60 @@
+#ifndef ECHO_BUFFER_POOL_H
+#define ECHO_BUFFER_POOL_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+// 最小和最大的尺寸等级，按 2 的幂划分：4K、8K、16K、32K、64K；
+// 不超过最小等级一半的小缓冲区放进 4K 太浪费，与超过最大等级的缓冲区一样直接用 malloc 分配
+#define BUFFER_POOL_MIN_SHIFT 12
+#define BUFFER_POOL_MAX_SHIFT 16
+#define BUFFER_POOL_CLASS_COUNT (BUFFER_POOL_MAX_SHIFT - BUFFER_POOL_MIN_SHIFT + 1)
+
+// 每块 slab 的大小，等于一个大页，切分为同一尺寸等级的缓冲区
+#define BUFFER_POOL_SLAB_SIZE (2 * 1024 * 1024)
+
+// 线程缓存与全局空闲链表之间每次移动的缓冲区数
+#define BUFFER_POOL_BATCH_SIZE 32
+
+/**
+ * 缓冲区池的统计信息
+ */
+struct BufferPoolStats {
+    // 已经映射的 slab 数和其中由大页支持的数量，slab 映射后不再归还系统
+    uint64_t slabCount;
+    uint64_t hugePageSlabCount;
+
+    // 不在尺寸等级范围内、直接用 malloc 分配的缓冲区数
+    uint64_t unpooledCount;
+};
+
+/**
+ * 允许新的 slab 使用 mmap(MAP_HUGETLB) 映射大页，系统没有预留大页时回退到普通页，
+ * 并用 madvise(MADV_HUGEPAGE) 建议内核使用透明大页；已经映射的 slab 不受影响
+ */
+void BufferPoolEnableHugePages();
+
+/**
+ * 从当前线程的缓存中借用一个缓冲区
+ *     线程缓存为空时从全局空闲链表批量补充，全局链表也为空时映射新的 slab；
+ *     不在尺寸等级范围内的请求直接用 malloc 分配
+ * @param size 缓冲区大小，归还时必须使用同样的大小
+ * @return 缓冲区，内存不足时返回 NULL
+ */
+void *BufferPoolAcquire(size_t size);
+
+/**
+ * 把缓冲区归还到当前线程的缓存，可以由借用线程以外的线程归还；
+ * 线程缓存超过两批时把一批移回全局空闲链表，线程退出时缓存全部移回
+ * @param buffer 缓冲区，可以为 NULL
+ * @param size 借用时的大小
+ */
+void BufferPoolRelease(void *buffer, size_t size);
+
+/**
+ * 读取缓冲区池的统计信息
+ * @param stats 统计信息
+ */
+void BufferPoolGetStats(struct BufferPoolStats *stats);
+
+#endif // ECHO_BUFFER_POOL_H
@@ -0,0 +1,187 @@
+#include "CoEchoServer.h"
+#include "BufferPool.h"
+#include "SocketProfile.h"
+#include <errno.h> // errno
+#include <unistd.h> // close
+
+// 描述符或者内存耗尽时暂停接受新连接的时间，单位毫秒
+#define ACCEPT_RETRY_MILLIS 100
+
+int CoEchoServerInit(struct CoEchoServer *server, const struct ServerOptions *options) {
+    if (options->bufferSize <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    server->bufferSize = (size_t) options->bufferSize;
+    if (server->bufferSize > ((size_t) 1 << BUFFER_POOL_MAX_SHIFT)) {
+        server->bufferSize = (size_t) 1 << BUFFER_POOL_MAX_SHIFT;
+    }
+    server->socketProfile = SocketProfileGet(options->socketProfile);
+    if (NULL == server->socketProfile) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (SOCKET_PROFILE_DEFAULT == options->socketProfile) {
+        server->socketProfile = NULL;
+    }
+    if (options->hugePages) {
+        BufferPoolEnableHugePages();
+    }
+    server->connectionCount = 0;
+    server->error = 0;
+
+    server->metrics = MetricsAcquireShard();
+    if (NULL == server->metrics) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (-1 == CoReactorInit(&server->reactor)) {
+        int error = errno;
+        MetricsReleaseShard(server->metrics);
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 回显一个连接直到对端关闭、出错或者服务器停止，然后关闭连接
+ * @param reactor 反应器
+ * @param server 服务器
+ * @param sd 连接描述符
+ */
+static CoTask EchoConnection(struct CoReactor *reactor, struct CoEchoServer *server, int sd) {
+    struct CoSocket socket;
+    char *buffer = (char *) BufferPoolAcquire(server->bufferSize);
+    if (NULL == buffer || -1 == CoSocketAdd(reactor, &socket, sd)) {
+        BufferPoolRelease(buffer, server->bufferSize);
+        close(sd);
+        MetricsAdd(&server->metrics->closedConnections, 1);
+        co_return;
+    }
+    server->connectionCount++;
+
+    while (true) {
+        // 接收客户端的数据
+        ssize_t recvSize = co_await CoRecv(&socket, buffer, server->bufferSize);
+        MetricsAdd(&server->metrics->syscalls, 1);
+        if (recvSize <= 0) {
+            break;
+        }
+        MetricsAdd(&server->metrics->bytesIn, (uint64_t) recvSize);
+        MetricsAdd(&server->metrics->messagesIn, 1);
+        uint64_t receivedAt = MetricsNow();
+
+        // 全部发回后再接收下一批
+        ssize_t sentTotal = 0;
+        while (sentTotal < recvSize) {
+            ssize_t sentSize = co_await CoSend(&socket, buffer + sentTotal,
+                                               (size_t) (recvSize - sentTotal));
+            MetricsAdd(&server->metrics->syscalls, 1);
+            if (-1 == sentSize) {
+                break;
+            }
+            sentTotal += sentSize;
+        }
+        if (sentTotal < recvSize) {
+            break;
+        }
+        MetricsAdd(&server->metrics->bytesOut, (uint64_t) sentTotal);
+        MetricsAdd(&server->metrics->messagesOut, 1);
+        MetricsRecordServiceTime(server->metrics, MetricsNow() - receivedAt, 1);
+    }
+
+    CoSocketRemove(&socket);
+    close(sd);
+    BufferPoolRelease(buffer, server->bufferSize);
+    server->connectionCount--;
+    MetricsAdd(&server->metrics->closedConnections, 1);
+}
+
+/**
+ * 接受监听 socket 上的连接，为每个连接启动回显协程，直到服务器停止或者接受失败
+ * @param reactor 反应器
+ * @param server 服务器
+ * @param sd 监听 socket 描述符，注册失败时设置服务器的错误号后立即结束
+ */
+static CoTask AcceptConnections(struct CoReactor *reactor, struct CoEchoServer *server, int sd) {
+    struct CoSocket listener;
+    if (-1 == CoSocketAdd(reactor, &listener, sd)) {
+        server->error = errno;
+        co_return;
+    }
+
+    while (true) {
+        int clientSocket = (int) co_await CoAccept(&listener);
+        if (-1 == clientSocket) {
+            // 连接在接受前被客户端重置，继续接受下一个
+            if (ECONNABORTED == errno || EPROTO == errno) {
+                continue;
+            }
+            // 描述符或者内存暂时耗尽，新连接留在积压队列中，等连接关闭释放资源后再接受
+            if (EMFILE == errno || ENFILE == errno || ENOBUFS == errno || ENOMEM == errno) {
+                MetricsAdd(&server->metrics->acceptPauses, 1);
+                if (-1 == co_await CoSleep(reactor, ACCEPT_RETRY_MILLIS)) {
+                    break;
+                }
+                continue;
+            }
+            // 停止时以 ECANCELED 结束，监听 socket 的其他错误停止服务器
+            if (ECANCELED != errno) {
+                server->error = errno;
+                CoReactorStop(reactor);
+            }
+            break;
+        }
+        MetricsAdd(&server->metrics->acceptedConnections, 1);
+
+        // TCP 连接从监听 socket 继承了其余选项，失败不影响回显
+        if (NULL != server->socketProfile) {
+            SocketProfileApply(server->socketProfile, clientSocket, SOCKET_ROLE_ACCEPTED);
+        }
+
+        // 帧分配失败时协程没有运行，连接由这里关闭
+        if (!EchoConnection(reactor, server, clientSocket).started) {
+            close(clientSocket);
+            MetricsAdd(&server->metrics->closedConnections, 1);
+        }
+    }
+
+    CoSocketRemove(&listener);
+}
+
+int CoEchoServerAddListener(struct CoEchoServer *server, int sd) {
+    // 接受协程立即开始运行，注册监听 socket 后在第一次 accept 时挂起
+    server->error = 0;
+    if (!AcceptConnections(&server->reactor, server, sd).started) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (0 != server->error) {
+        errno = server->error;
+        server->error = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int CoEchoServerRun(struct CoEchoServer *server) {
+    if (-1 == CoReactorRun(&server->reactor)) {
+        return -1;
+    }
+    if (0 != server->error) {
+        errno = server->error;
+        return -1;
+    }
+    return 0;
+}
+
+void CoEchoServerStop(struct CoEchoServer *server) {
+    CoReactorStop(&server->reactor);
+}
+
+void CoEchoServerDestroy(struct CoEchoServer *server) {
+    CoReactorDestroy(&server->reactor);
+    MetricsReleaseShard(server->metrics);
+}
@@ -0,0 +1,72 @@
+#ifndef ECHO_CO_ECHO_SERVER_H
+#define ECHO_CO_ECHO_SERVER_H
+
+#include <stddef.h> // size_t
+#include "CoReactor.h"
+#include "Metrics.h"
+#include "ServerOptions.h"
+
+/**
+ * 基于协程的流 socket 回显服务器
+ *     每个监听 socket 由一个接受协程服务，每个连接由一个回显协程以阻塞式的顺序写法
+ *     接收、发回直到对端关闭；全部协程在同一个线程的反应器上并发运行。
+ *     协程帧来自反应器的帧池，接收缓冲区来自缓冲区池，稳定运行后每个连接不再申请堆内存
+ */
+struct CoEchoServer {
+    // 反应器
+    struct CoReactor reactor;
+
+    // 每个连接的接收缓冲区大小
+    size_t bufferSize;
+
+    // 接受的连接补充应用的调优方案，默认方案时为 NULL
+    const struct SocketProfile *socketProfile;
+
+    // 活动连接数
+    size_t connectionCount;
+
+    // 接受协程遇到的致命错误号，0 表示没有
+    int error;
+
+    // 指标分片，只由运行反应器的线程写入
+    struct MetricsShard *metrics;
+};
+
+/**
+ * 初始化服务器
+ * @param server 服务器
+ * @param options 服务器选项，其中的缓冲区大小为每个连接的接收缓冲区大小，
+ *     超过缓冲区池的最大尺寸等级时按最大等级截断
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int CoEchoServerInit(struct CoEchoServer *server, const struct ServerOptions *options);
+
+/**
+ * 启动服务一个监听 socket 的接受协程，TCP 和本地 UNIX socket 均可
+ * @param server 服务器
+ * @param sd 已经处于监听状态的 socket，会被设置为非阻塞模式，仍由调用者关闭
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int CoEchoServerAddListener(struct CoEchoServer *server, int sd);
+
+/**
+ * 在当前线程运行服务器，直到调用 CoEchoServerStop 后全部连接关闭，或者监听 socket 出错；
+ * 描述符或者内存暂时耗尽时只暂停接受新连接
+ * @param server 服务器
+ * @return 正常停止返回 0，失败返回 -1 并设置 errno
+ */
+int CoEchoServerRun(struct CoEchoServer *server);
+
+/**
+ * 请求停止服务器，可以从任何线程调用
+ * @param server 服务器
+ */
+void CoEchoServerStop(struct CoEchoServer *server);
+
+/**
+ * 释放服务器资源，必须在 CoEchoServerRun 返回之后调用
+ * @param server 服务器
+ */
+void CoEchoServerDestroy(struct CoEchoServer *server);
+
+#endif // ECHO_CO_ECHO_SERVER_H
@@ -0,0 +1,478 @@
+#include "CoReactor.h"
+#include "EventLoop.h"
+#include <stdlib.h> // malloc, free
+#include <stdint.h> // uint64_t
+#include <errno.h> // errno
+#include <string.h> // memset
+#include <time.h> // clock_gettime
+#include <unistd.h> // close, read, write
+#include <sys/socket.h> // accept4, recv, send
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // eventfd
+
+// 每次 epoll_wait 最多取回的事件数
+#define MAX_EPOLL_EVENTS 256
+
+/**
+ * 帧头，位于协程帧之前，保持帧按 max_align_t 对齐
+ */
+struct alignas(16) CoFrameHeader {
+    // 空闲时为空闲链表的下一个块
+    union {
+        struct CoFramePool *pool;
+        struct CoFrameHeader *next;
+    };
+
+    // 尺寸等级，CO_FRAME_CLASS_COUNT 表示直接用 malloc 分配
+    size_t sizeClass;
+};
+
+void *CoFrameAllocate(struct CoFramePool *pool, size_t size) {
+    size_t total = sizeof(struct CoFrameHeader) + size;
+    size_t sizeClass = 0;
+    while (sizeClass < CO_FRAME_CLASS_COUNT
+           && ((size_t) 1 << (CO_FRAME_MIN_SHIFT + sizeClass)) < total) {
+        sizeClass++;
+    }
+
+    struct CoFrameHeader *header = NULL;
+    if (sizeClass < CO_FRAME_CLASS_COUNT && NULL != pool->freeLists[sizeClass]) {
+        header = (struct CoFrameHeader *) pool->freeLists[sizeClass];
+        pool->freeLists[sizeClass] = header->next;
+    } else {
+        header = (struct CoFrameHeader *) malloc(
+                (sizeClass < CO_FRAME_CLASS_COUNT)
+                ? ((size_t) 1 << (CO_FRAME_MIN_SHIFT + sizeClass)) : total);
+        if (NULL == header) {
+            return NULL;
+        }
+        pool->allocations++;
+    }
+
+    header->pool = pool;
+    header->sizeClass = sizeClass;
+    pool->liveFrames++;
+    return header + 1;
+}
+
+void CoFrameFree(void *frame) {
+    struct CoFrameHeader *header = (struct CoFrameHeader *) frame - 1;
+    struct CoFramePool *pool = header->pool;
+    pool->liveFrames--;
+    if (header->sizeClass < CO_FRAME_CLASS_COUNT) {
+        header->next = (struct CoFrameHeader *) pool->freeLists[header->sizeClass];
+        pool->freeLists[header->sizeClass] = header;
+    } else {
+        free(header);
+    }
+}
+
+int CoReactorInit(struct CoReactor *reactor) {
+    memset(reactor, 0, sizeof(*reactor));
+    reactor->wakeupFd = -1;
+    reactor->deferredTail = &reactor->deferred;
+    reactor->completedTail = &reactor->completed;
+
+    reactor->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == reactor->epollFd) {
+        return -1;
+    }
+
+    // eventfd 用于从其他线程唤醒 epoll_wait，事件的 data.ptr 为 NULL
+    reactor->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == reactor->wakeupFd) {
+        int error = errno;
+        close(reactor->epollFd);
+        errno = error;
+        return -1;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (-1 == epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, reactor->wakeupFd, &event)) {
+        int error = errno;
+        close(reactor->wakeupFd);
+        close(reactor->epollFd);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * 把操作放进队列尾部
+ * @param tail 队列尾部
+ * @param operation 操作
+ */
+static void Enqueue(struct CoOperation ***tail, struct CoOperation *operation) {
+    operation->next = NULL;
+    **tail = operation;
+    *tail = &operation->next;
+}
+
+/**
+ * 以错误结束操作，稍后恢复它的协程
+ * @param reactor 反应器
+ * @param operation 操作
+ * @param error 错误号
+ */
+static void Fail(struct CoReactor *reactor, struct CoOperation *operation, int error) {
+    operation->result = -1;
+    operation->error = error;
+    Enqueue(&reactor->completedTail, operation);
+}
+
+/**
+ * 执行一次操作的系统调用，EINTR 时重试
+ * @param operation 操作
+ * @return 完成（成功或者 EAGAIN 以外的错误）返回 true，EAGAIN 返回 false
+ */
+static bool Attempt(struct CoOperation *operation) {
+    int sd = operation->socket->fd;
+    ssize_t result;
+    do {
+        switch (operation->type) {
+            case CO_OPERATION_ACCEPT:
+                result = accept4(sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                break;
+
+            case CO_OPERATION_RECV:
+                result = recv(sd, operation->buffer, operation->length, 0);
+                break;
+
+            case CO_OPERATION_SEND:
+                result = send(sd, operation->buffer, operation->length, MSG_NOSIGNAL);
+                break;
+
+            default:
+                result = -1;
+                errno = EINVAL;
+                break;
+        }
+    } while (-1 == result && EINTR == errno);
+
+    operation->result = result;
+    operation->error = (-1 == result) ? errno : 0;
+    return !(-1 == result && (EAGAIN == errno || EWOULDBLOCK == errno));
+}
+
+/**
+ * 取得操作等待的方向
+ * @param operation 操作
+ * @return socket 上保存该方向等待操作的位置
+ */
+static struct CoOperation **WaitSlot(struct CoOperation *operation) {
+    return (CO_OPERATION_SEND == operation->type) ? &operation->socket->writer
+                                                  : &operation->socket->reader;
+}
+
+/**
+ * 读取单调时钟
+ * @return 毫秒
+ */
+static uint64_t NowMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+bool CoOperationStart(struct CoOperation *operation) {
+    struct CoReactor *reactor = operation->socket->reactor;
+    if (reactor->stopped) {
+        operation->result = -1;
+        operation->error = ECANCELED;
+        return true;
+    }
+
+    // 预算用完时不尝试，error 为 0 表示挂起后放进重试队列而不是等待就绪
+    if (reactor->immediateCount >= CO_IMMEDIATE_BUDGET) {
+        operation->error = 0;
+        return false;
+    }
+    if (Attempt(operation)) {
+        reactor->immediateCount++;
+        return true;
+    }
+    return false;
+}
+
+bool CoOperationPark(struct CoOperation *operation) {
+    struct CoReactor *reactor = operation->socket->reactor;
+    if (EAGAIN != operation->error && EWOULDBLOCK != operation->error) {
+        Enqueue(&reactor->deferredTail, operation);
+        return true;
+    }
+
+    struct CoOperation **slot = WaitSlot(operation);
+    if (NULL != *slot) {
+        operation->result = -1;
+        operation->error = EBUSY;
+        return false;
+    }
+    *slot = operation;
+    return true;
+}
+
+bool CoSleepStart(struct CoReactor *reactor, struct CoOperation *operation) {
+    if (reactor->stopped) {
+        operation->result = -1;
+        operation->error = ECANCELED;
+        return true;
+    }
+    if (0 == operation->length) {
+        operation->result = 0;
+        return true;
+    }
+    return false;
+}
+
+void CoSleepPark(struct CoReactor *reactor, struct CoOperation *operation) {
+    operation->deadline = NowMillis() + operation->length;
+    operation->next = reactor->sleepers;
+    reactor->sleepers = operation;
+}
+
+int CoSocketAdd(struct CoReactor *reactor, struct CoSocket *socket, int sd) {
+    if (-1 == SetNonBlocking(sd)) {
+        return -1;
+    }
+
+    socket->fd = sd;
+    socket->reactor = reactor;
+    socket->reader = NULL;
+    socket->writer = NULL;
+
+    // 边缘触发，同时关注两个方向，之后不再修改
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = socket;
+    if (-1 == epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, sd, &event)) {
+        return -1;
+    }
+
+    socket->prev = NULL;
+    socket->next = reactor->sockets;
+    if (NULL != reactor->sockets) {
+        reactor->sockets->prev = socket;
+    }
+    reactor->sockets = socket;
+    return 0;
+}
+
+/**
+ * 以错误结束 socket 上全部等待中的操作
+ * @param socket socket
+ * @param error 错误号
+ */
+static void FailWaiters(struct CoSocket *socket, int error) {
+    if (NULL != socket->reader) {
+        Fail(socket->reactor, socket->reader, error);
+        socket->reader = NULL;
+    }
+    if (NULL != socket->writer) {
+        Fail(socket->reactor, socket->writer, error);
+        socket->writer = NULL;
+    }
+}
+
+void CoSocketRemove(struct CoSocket *socket) {
+    struct CoReactor *reactor = socket->reactor;
+    epoll_ctl(reactor->epollFd, EPOLL_CTL_DEL, socket->fd, NULL);
+    FailWaiters(socket, EBADF);
+
+    // 重试队列中的操作还引用这个 socket
+    for (struct CoOperation **link = &reactor->deferred; NULL != *link;) {
+        struct CoOperation *operation = *link;
+        if (socket == operation->socket) {
+            *link = operation->next;
+            Fail(reactor, operation, EBADF);
+        } else {
+            link = &operation->next;
+        }
+    }
+    reactor->deferredTail = &reactor->deferred;
+    while (NULL != *reactor->deferredTail) {
+        reactor->deferredTail = &(*reactor->deferredTail)->next;
+    }
+
+    if (NULL != socket->prev) {
+        socket->prev->next = socket->next;
+    } else {
+        reactor->sockets = socket->next;
+    }
+    if (NULL != socket->next) {
+        socket->next->prev = socket->prev;
+    }
+    socket->prev = NULL;
+    socket->next = NULL;
+}
+
+/**
+ * socket 就绪后重试等待中的操作，完成的操作放进待恢复队列
+ * @param reactor 反应器
+ * @param slot socket 上保存等待操作的位置
+ */
+static void Retry(struct CoReactor *reactor, struct CoOperation **slot) {
+    struct CoOperation *operation = *slot;
+    if (NULL != operation && Attempt(operation)) {
+        *slot = NULL;
+        Enqueue(&reactor->completedTail, operation);
+    }
+}
+
+/**
+ * 处理停止请求：以 ECANCELED 结束全部等待中和待重试的操作
+ * @param reactor 反应器
+ */
+static void CancelAll(struct CoReactor *reactor) {
+    reactor->stopped = true;
+    for (struct CoSocket *socket = reactor->sockets; NULL != socket; socket = socket->next) {
+        FailWaiters(socket, ECANCELED);
+    }
+    struct CoOperation *operation = reactor->deferred;
+    reactor->deferred = NULL;
+    reactor->deferredTail = &reactor->deferred;
+    while (NULL != operation) {
+        struct CoOperation *next = operation->next;
+        Fail(reactor, operation, ECANCELED);
+        operation = next;
+    }
+    operation = reactor->sleepers;
+    reactor->sleepers = NULL;
+    while (NULL != operation) {
+        struct CoOperation *next = operation->next;
+        Fail(reactor, operation, ECANCELED);
+        operation = next;
+    }
+}
+
+/**
+ * 计算 epoll_wait 的超时：有待重试或者待恢复的操作时不等待，有休眠时等到最早的到期时间
+ * @param reactor 反应器
+ * @return 超时，单位毫秒，-1 表示一直等待
+ */
+static int WaitTimeout(struct CoReactor *reactor) {
+    if (NULL != reactor->deferred || NULL != reactor->completed) {
+        return 0;
+    }
+    if (NULL == reactor->sleepers) {
+        return -1;
+    }
+    uint64_t deadline = reactor->sleepers->deadline;
+    for (struct CoOperation *sleeper = reactor->sleepers; NULL != sleeper; sleeper = sleeper->next) {
+        if (sleeper->deadline < deadline) {
+            deadline = sleeper->deadline;
+        }
+    }
+    uint64_t now = NowMillis();
+    return (deadline > now) ? (int) (deadline - now) : 0;
+}
+
+/**
+ * 到期的休眠以 0 完成，放进待恢复队列
+ * @param reactor 反应器
+ */
+static void ExpireSleepers(struct CoReactor *reactor) {
+    uint64_t now = NowMillis();
+    for (struct CoOperation **link = &reactor->sleepers; NULL != *link;) {
+        struct CoOperation *operation = *link;
+        if (operation->deadline <= now) {
+            *link = operation->next;
+            operation->result = 0;
+            operation->error = 0;
+            Enqueue(&reactor->completedTail, operation);
+        } else {
+            link = &operation->next;
+        }
+    }
+}
+
+int CoReactorRun(struct CoReactor *reactor) {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (!reactor->stopped || 0 != reactor->frames.liveFrames) {
+        // 有待重试的操作时只检查就绪的 socket，不等待
+        int eventCount = epoll_wait(reactor->epollFd, events, MAX_EPOLL_EVENTS,
+                                    WaitTimeout(reactor));
+        if (-1 == eventCount) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+
+        // 先重试全部就绪的操作再恢复协程，恢复的协程可能注销本批事件中其他的 socket
+        for (int i = 0; i < eventCount; i++) {
+            struct CoSocket *socket = (struct CoSocket *) events[i].data.ptr;
+            if (NULL == socket) {
+                uint64_t value;
+                read(reactor->wakeupFd, &value, sizeof(value));
+                if (__atomic_load_n(&reactor->stopRequested, __ATOMIC_ACQUIRE)
+                    && !reactor->stopped) {
+                    CancelAll(reactor);
+                }
+                continue;
+            }
+            uint32_t flags = events[i].events;
+            if (0 != (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                Retry(reactor, &socket->reader);
+            }
+            if (0 != (flags & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+                Retry(reactor, &socket->writer);
+            }
+        }
+
+        ExpireSleepers(reactor);
+
+        // 上一轮超出预算的操作，仍然 EAGAIN 时挂在 socket 上
+        struct CoOperation *operation = reactor->deferred;
+        reactor->deferred = NULL;
+        reactor->deferredTail = &reactor->deferred;
+        while (NULL != operation) {
+            struct CoOperation *next = operation->next;
+            if (Attempt(operation)) {
+                Enqueue(&reactor->completedTail, operation);
+            } else if (!CoOperationPark(operation)) {
+                Enqueue(&reactor->completedTail, operation);
+            }
+            operation = next;
+        }
+
+        // 恢复本轮完成的操作的协程，它们新完成的操作留到下一轮
+        operation = reactor->completed;
+        reactor->completed = NULL;
+        reactor->completedTail = &reactor->completed;
+        while (NULL != operation) {
+            struct CoOperation *next = operation->next;
+            reactor->immediateCount = 0;
+            operation->waiter.resume();
+            operation = next;
+        }
+    }
+
+    return 0;
+}
+
+void CoReactorStop(struct CoReactor *reactor) {
+    __atomic_store_n(&reactor->stopRequested, true, __ATOMIC_RELEASE);
+    uint64_t value = 1;
+    write(reactor->wakeupFd, &value, sizeof(value));
+}
+
+void CoReactorDestroy(struct CoReactor *reactor) {
+    for (int i = 0; i < CO_FRAME_CLASS_COUNT; i++) {
+        struct CoFrameHeader *header = (struct CoFrameHeader *) reactor->frames.freeLists[i];
+        while (NULL != header) {
+            struct CoFrameHeader *next = header->next;
+            free(header);
+            header = next;
+        }
+        reactor->frames.freeLists[i] = NULL;
+    }
+    close(reactor->wakeupFd);
+    close(reactor->epollFd);
+}
@@ -0,0 +1,380 @@
+#ifndef ECHO_CO_REACTOR_H
+#define ECHO_CO_REACTOR_H
+
+#include <coroutine> // coroutine_handle, suspend_never
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <errno.h> // errno
+#include <stdlib.h> // abort
+#include <sys/types.h> // ssize_t
+
+// 协程帧池的尺寸等级，按 2 的幂划分：128、256、512、1K、2K、4K；更大的帧直接用 malloc 分配
+#define CO_FRAME_MIN_SHIFT 7
+#define CO_FRAME_MAX_SHIFT 12
+#define CO_FRAME_CLASS_COUNT (CO_FRAME_MAX_SHIFT - CO_FRAME_MIN_SHIFT + 1)
+
+// 一个协程连续立即完成的操作数上限，超过后让出反应器，避免数据源源不断的连接饿死其他协程
+#define CO_IMMEDIATE_BUDGET 16
+
+struct CoReactor;
+struct CoSocket;
+
+/**
+ * 操作类型
+ */
+enum CoOperationType {
+    CO_OPERATION_ACCEPT,
+    CO_OPERATION_RECV,
+    CO_OPERATION_SEND,
+    CO_OPERATION_SLEEP
+};
+
+/**
+ * 一次等待中的 accept、recv、send 或者休眠，位于等待它的协程帧中
+ *     先直接尝试一次系统调用，EAGAIN 时挂在 socket 上，socket 就绪后由反应器重试，
+ *     完成后才恢复协程，所以协程看到的结果与阻塞调用相同；休眠没有 socket，到期后完成
+ */
+struct CoOperation {
+    // CoOperationType
+    int type;
+
+    // 操作的 socket，休眠时为 NULL
+    struct CoSocket *socket;
+
+    // 接收或者发送的数据
+    void *buffer;
+    size_t length;
+
+    // 系统调用的返回值和失败时的错误号
+    ssize_t result;
+    int error;
+
+    // 休眠到期的单调时钟时间，单位毫秒
+    uint64_t deadline;
+
+    // 等待操作完成的协程
+    std::coroutine_handle<> waiter;
+
+    // 反应器的待重试队列、待恢复队列和休眠链表
+    struct CoOperation *next;
+};
+
+/**
+ * 注册到反应器的非阻塞 socket，边缘触发地同时关注可读和可写，
+ * 每个方向同时最多有一个等待中的操作
+ */
+struct CoSocket {
+    // 文件描述符
+    int fd;
+
+    // 所属的反应器
+    struct CoReactor *reactor;
+
+    // 等待可读（accept、recv）和可写（send）的操作
+    struct CoOperation *reader;
+    struct CoOperation *writer;
+
+    // socket 链表，用于停止时取消全部等待中的操作
+    struct CoSocket *prev;
+    struct CoSocket *next;
+};
+
+/**
+ * 协程帧池，帧按尺寸等级放在空闲链表中重复使用，不归还系统
+ */
+struct CoFramePool {
+    // 每个尺寸等级的空闲链表
+    void *freeLists[CO_FRAME_CLASS_COUNT];
+
+    // 向系统申请内存的次数，稳定运行后不再增加
+    uint64_t allocations;
+
+    // 尚未结束的协程数
+    size_t liveFrames;
+};
+
+/**
+ * 单线程的协程反应器：协程以顺序的写法 co_await 非阻塞 socket 上的操作，
+ * 反应器用边缘触发的 epoll 等待就绪并恢复它们
+ */
+struct CoReactor {
+    // epoll 实例
+    int epollFd;
+
+    // 用于跨线程停止反应器的 eventfd
+    int wakeupFd;
+
+    // 其他线程的停止请求，用 __atomic 读写
+    bool stopRequested;
+
+    // 已经停止：等待中的操作全部以 ECANCELED 完成，新的操作立即以 ECANCELED 失败
+    bool stopped;
+
+    // 本次恢复以来立即完成的操作数
+    unsigned immediateCount;
+
+    // 超出预算、下一轮重试的操作
+    struct CoOperation *deferred;
+    struct CoOperation **deferredTail;
+
+    // 已经完成、等待恢复协程的操作
+    struct CoOperation *completed;
+    struct CoOperation **completedTail;
+
+    // 休眠中的操作，数量很少，不排序
+    struct CoOperation *sleepers;
+
+    // 已注册的 socket 链表
+    struct CoSocket *sockets;
+
+    // 协程帧池
+    struct CoFramePool frames;
+};
+
+/**
+ * 初始化反应器
+ * @param reactor 反应器
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int CoReactorInit(struct CoReactor *reactor);
+
+/**
+ * 在当前线程运行反应器，直到停止后全部协程结束或者发生致命错误
+ * @param reactor 反应器
+ * @return 正常停止返回 0，失败返回 -1 并设置 errno
+ */
+int CoReactorRun(struct CoReactor *reactor);
+
+/**
+ * 请求停止反应器，可以从任何线程调用：等待中的操作以 ECANCELED 完成，协程据此退出
+ * @param reactor 反应器
+ */
+void CoReactorStop(struct CoReactor *reactor);
+
+/**
+ * 释放反应器资源，必须在全部协程结束、全部 socket 关闭之后调用
+ * @param reactor 反应器
+ */
+void CoReactorDestroy(struct CoReactor *reactor);
+
+/**
+ * 把 socket 设置为非阻塞模式并注册到反应器
+ * @param reactor 反应器
+ * @param socket 未注册的 socket，通常位于使用它的协程帧中
+ * @param sd socket 描述符，仍由调用者关闭
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int CoSocketAdd(struct CoReactor *reactor, struct CoSocket *socket, int sd);
+
+/**
+ * 从反应器注销 socket，不关闭描述符；其他协程等待中的操作以 EBADF 完成
+ * @param socket 已注册的 socket
+ */
+void CoSocketRemove(struct CoSocket *socket);
+
+/**
+ * 开始操作：已经停止时以 ECANCELED 完成，预算未用完时直接尝试一次系统调用
+ * @param operation 操作
+ * @return 已经完成返回 true，需要挂起协程时返回 false
+ */
+bool CoOperationStart(struct CoOperation *operation);
+
+/**
+ * 挂起协程：直接尝试过的操作挂在 socket 上等待就绪，超出预算的操作放进下一轮重试的队列
+ * @param operation 操作，waiter 已经设置
+ * @return 挂起返回 true；同一方向已经有等待的操作时以 EBUSY 完成并返回 false，协程不挂起
+ */
+bool CoOperationPark(struct CoOperation *operation);
+
+/**
+ * co_await 的等待体，结果与对应的阻塞系统调用相同：成功返回非负数，失败返回 -1 并设置 errno
+ */
+struct CoAwaiter {
+    struct CoOperation operation;
+
+    bool await_ready() {
+        return CoOperationStart(&operation);
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        operation.waiter = handle;
+        return CoOperationPark(&operation);
+    }
+
+    ssize_t await_resume() {
+        if (-1 == operation.result) {
+            errno = operation.error;
+        }
+        return operation.result;
+    }
+};
+
+/**
+ * 开始休眠：已经停止时以 ECANCELED 完成，时长为 0 时立即完成
+ * @param reactor 反应器
+ * @param operation 休眠操作，length 为时长，单位毫秒
+ * @return 已经完成返回 true，需要挂起协程时返回 false
+ */
+bool CoSleepStart(struct CoReactor *reactor, struct CoOperation *operation);
+
+/**
+ * 挂起休眠的协程，到期后由反应器恢复，停止时以 ECANCELED 完成
+ * @param reactor 反应器
+ * @param operation 休眠操作，waiter 已经设置
+ */
+void CoSleepPark(struct CoReactor *reactor, struct CoOperation *operation);
+
+/**
+ * 休眠的等待体：成功返回 0，停止时返回 -1 并设置 errno 为 ECANCELED
+ */
+struct CoSleepAwaiter {
+    struct CoReactor *reactor;
+    struct CoOperation operation;
+
+    bool await_ready() {
+        return CoSleepStart(reactor, &operation);
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        operation.waiter = handle;
+        CoSleepPark(reactor, &operation);
+    }
+
+    ssize_t await_resume() {
+        if (-1 == operation.result) {
+            errno = operation.error;
+        }
+        return operation.result;
+    }
+};
+
+/**
+ * 构造等待体
+ * @param type CoOperationType
+ * @param socket socket
+ * @param buffer 数据
+ * @param length 数据长度
+ * @return 等待体
+ */
+static inline CoAwaiter CoMakeAwaiter(int type, struct CoSocket *socket,
+                                      void *buffer, size_t length) {
+    CoAwaiter awaiter;
+    awaiter.operation.type = type;
+    awaiter.operation.socket = socket;
+    awaiter.operation.buffer = buffer;
+    awaiter.operation.length = length;
+    awaiter.operation.result = -1;
+    awaiter.operation.error = 0;
+    awaiter.operation.next = NULL;
+    return awaiter;
+}
+
+/**
+ * 等待接受一个连接，得到的描述符为非阻塞模式
+ * @param listener 监听 socket
+ * @return co_await 得到连接描述符，失败返回 -1 并设置 errno
+ */
+static inline CoAwaiter CoAccept(struct CoSocket *listener) {
+    return CoMakeAwaiter(CO_OPERATION_ACCEPT, listener, NULL, 0);
+}
+
+/**
+ * 等待接收数据，与 recv 一样可能只接收到一部分
+ * @param socket 连接
+ * @param buffer 缓冲区
+ * @param length 缓冲区长度
+ * @return co_await 得到接收的字节数，对端关闭时为 0，失败返回 -1 并设置 errno
+ */
+static inline CoAwaiter CoRecv(struct CoSocket *socket, void *buffer, size_t length) {
+    return CoMakeAwaiter(CO_OPERATION_RECV, socket, buffer, length);
+}
+
+/**
+ * 等待发送数据，与 send 一样可能只发送一部分
+ * @param socket 连接
+ * @param buffer 数据
+ * @param length 数据长度
+ * @return co_await 得到发送的字节数，失败返回 -1 并设置 errno
+ */
+static inline CoAwaiter CoSend(struct CoSocket *socket, const void *buffer, size_t length) {
+    return CoMakeAwaiter(CO_OPERATION_SEND, socket, (void *) buffer, length);
+}
+
+/**
+ * 等待一段时间，期间反应器照常运行其他协程
+ * @param reactor 反应器
+ * @param millis 时长，单位毫秒
+ * @return co_await 得到 0，停止时返回 -1 并设置 errno 为 ECANCELED
+ */
+static inline CoSleepAwaiter CoSleep(struct CoReactor *reactor, unsigned millis) {
+    CoSleepAwaiter awaiter;
+    awaiter.reactor = reactor;
+    awaiter.operation = CoMakeAwaiter(CO_OPERATION_SLEEP, NULL, NULL, millis).operation;
+    return awaiter;
+}
+
+/**
+ * 从帧池分配协程帧
+ * @param pool 帧池
+ * @param size 帧大小
+ * @return 帧，内存不足时返回 NULL
+ */
+void *CoFrameAllocate(struct CoFramePool *pool, size_t size);
+
+/**
+ * 把协程帧归还帧池
+ * @param frame 帧
+ */
+void CoFrameFree(void *frame);
+
+/**
+ * 由反应器调度的协程的返回类型：调用时立即开始运行，直到第一次挂起，结束后帧自动归还帧池。
+ * 协程函数的第一个参数必须是 struct CoReactor *，帧从它的帧池分配
+ */
+struct CoTask {
+    // 帧分配失败时为 false，协程没有运行
+    bool started;
+
+    struct promise_type {
+        // 协程的其余参数用 C 可变参数接收，只能是指针、整数等平凡类型；模板形式的分配函数
+        // 与帧结束时使用的非模板释放函数不成对，GCC 会报告 -Wmismatched-new-delete
+        static void *operator new(size_t size, struct CoReactor *reactor, ...) noexcept {
+            return CoFrameAllocate(&reactor->frames, size);
+        }
+
+        // 帧结束时的释放函数：有带尺寸的版本时编译器选用它
+        static void operator delete(void *frame, size_t) noexcept {
+            CoFrameFree(frame);
+        }
+
+        // 与分配函数参数相同的版本，和 operator new 成对，帧也归还帧池
+        static void operator delete(void *frame, struct CoReactor *, ...) noexcept {
+            CoFrameFree(frame);
+        }
+
+        static CoTask get_return_object_on_allocation_failure() {
+            return CoTask{false};
+        }
+
+        CoTask get_return_object() {
+            return CoTask{true};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {
+        }
+
+        void unhandled_exception() {
+            abort();
+        }
+    };
+};
+
+#endif // ECHO_CO_REACTOR_H
@@ -0,0 +1,359 @@
+#include "ConnectionPool.h"
+#include <stdlib.h> // calloc, free
+#include <errno.h> // errno
+#include <string.h> // memset
+#include <unistd.h> // close
+#include <time.h> // clock_gettime
+#include <sys/socket.h> // socket, connect, recv
+
+/**
+ * 读取单调时钟
+ * @return 毫秒
+ */
+static uint64_t NowMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+int ConnectionPoolInit(struct ConnectionPool *pool, int maxPerHost, uint64_t idleTimeout,
+                       const struct SocketProfile *socketProfile) {
+    // 没有连接可借的池会让每次借出都等到超时
+    if (maxPerHost <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->maxPerHost = maxPerHost;
+    pool->idleTimeout = idleTimeout;
+    pool->socketProfile = socketProfile;
+
+    int error = pthread_mutex_init(&pool->mutex, NULL);
+    if (0 != error) {
+        errno = error;
+        return -1;
+    }
+
+    // 等待超时按单调时钟计算，不受系统时间调整影响
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    error = pthread_cond_init(&pool->released, &attributes);
+    pthread_condattr_destroy(&attributes);
+    if (0 != error) {
+        pthread_mutex_destroy(&pool->mutex);
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * 关闭连接并减少主机的连接数，调用者持有锁
+ * @param pool 连接池
+ * @param connection 连接
+ */
+static void CloseConnection(struct ConnectionPool *pool, struct PooledConnection *connection) {
+    close(connection->sd);
+    connection->host->openCount--;
+    free(connection);
+    pthread_cond_broadcast(&pool->released);
+}
+
+/**
+ * 关闭主机上空闲超时的连接，调用者持有锁
+ * @param pool 连接池
+ * @param host 主机
+ * @param now 当前时间
+ */
+static void EvictIdleConnections(struct ConnectionPool *pool, struct PoolHost *host,
+                                 uint64_t now) {
+    // 空闲链表按归还时间从新到旧排列，第一个超时的连接之后全部超时
+    struct PooledConnection **link = &host->idle;
+    while (NULL != *link && now - (*link)->idleSince < pool->idleTimeout) {
+        link = &(*link)->next;
+    }
+
+    struct PooledConnection *connection = *link;
+    *link = NULL;
+    while (NULL != connection) {
+        struct PooledConnection *next = connection->next;
+        CloseConnection(pool, connection);
+        pool->evicted++;
+        connection = next;
+    }
+}
+
+/**
+ * 关闭主机上全部空闲连接，调用者持有锁
+ * @param pool 连接池
+ * @param host 主机
+ */
+static void CloseIdleConnections(struct ConnectionPool *pool, struct PoolHost *host) {
+    struct PooledConnection *connection = host->idle;
+    host->idle = NULL;
+    while (NULL != connection) {
+        struct PooledConnection *next = connection->next;
+        CloseConnection(pool, connection);
+        connection = next;
+    }
+}
+
+/**
+ * 一个使用者离开连接池：借出失败或者归还了连接，调用者持有锁
+ * @param pool 连接池
+ * @return 连接池已经被放弃并且没有其他使用者时返回 true，调用者解锁后释放连接池
+ */
+static bool Leave(struct ConnectionPool *pool) {
+    pool->users--;
+    return pool->detached && 0 == pool->users;
+}
+
+/**
+ * 销毁并释放已经放弃、没有使用者的连接池
+ * @param pool 连接池
+ */
+static void Free(struct ConnectionPool *pool) {
+    ConnectionPoolDestroy(pool);
+    free(pool);
+}
+
+/**
+ * 检查空闲连接是否仍然可用：对端没有关闭、没有出错，也没有遗留的未读数据
+ * @param sd socket
+ * @return 可用返回 true
+ */
+static bool IsConnectionHealthy(int sd) {
+    char byte;
+    ssize_t result = recv(sd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return -1 == result && (EAGAIN == errno || EWOULDBLOCK == errno);
+}
+
+/**
+ * 查找主机，不存在时新建，调用者持有锁
+ * @param pool 连接池
+ * @param address 主机地址
+ * @return 主机，内存不足时返回 NULL
+ */
+static struct PoolHost *FindHost(struct ConnectionPool *pool, const struct sockaddr_in *address) {
+    for (struct PoolHost *host = pool->hosts; NULL != host; host = host->next) {
+        if (host->address.sin_addr.s_addr == address->sin_addr.s_addr
+            && host->address.sin_port == address->sin_port) {
+            return host;
+        }
+    }
+
+    struct PoolHost *host = (struct PoolHost *) calloc(1, sizeof(struct PoolHost));
+    if (NULL != host) {
+        host->address = *address;
+        host->next = pool->hosts;
+        pool->hosts = host;
+    }
+    return host;
+}
+
+/**
+ * 新建到主机的连接，不持有锁
+ * @param pool 连接池
+ * @param host 主机
+ * @return socket，失败返回 -1 并设置 errno
+ */
+static int ConnectToHost(const struct ConnectionPool *pool, const struct PoolHost *host) {
+    int sd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == sd) {
+        return -1;
+    }
+
+    // 连接之前应用调优方案
+    int result = SocketProfileApply(pool->socketProfile, sd, SOCKET_ROLE_CLIENT);
+    if (0 == result) {
+        do {
+            result = connect(sd, (const struct sockaddr *) &host->address, sizeof(host->address));
+        } while (-1 == result && EINTR == errno);
+    }
+
+    if (-1 == result) {
+        int error = errno;
+        close(sd);
+        errno = error;
+        return -1;
+    }
+    return sd;
+}
+
+struct PooledConnection *ConnectionPoolAcquire(struct ConnectionPool *pool,
+                                               const struct sockaddr_in *address, int timeout) {
+    struct timespec deadline;
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long) (timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->closed) {
+        pthread_mutex_unlock(&pool->mutex);
+        errno = ECANCELED;
+        return NULL;
+    }
+
+    // 从这里开始到借出失败或者归还连接为止，连接池不会被释放
+    pool->users++;
+    struct PoolHost *host = FindHost(pool, address);
+    int error = ENOMEM;
+    while (NULL != host) {
+        EvictIdleConnections(pool, host, NowMillis());
+
+        // 复用最近归还的空闲连接，检查失败的直接关闭
+        while (NULL != host->idle) {
+            struct PooledConnection *connection = host->idle;
+            host->idle = connection->next;
+            connection->next = NULL;
+
+            if (IsConnectionHealthy(connection->sd)) {
+                pool->reused++;
+                pthread_mutex_unlock(&pool->mutex);
+                return connection;
+            }
+
+            CloseConnection(pool, connection);
+            pool->broken++;
+        }
+
+        // 没有空闲连接并且未达上限时新建连接
+        if (host->openCount < pool->maxPerHost) {
+            break;
+        }
+
+        // 等待其他调用者归还或者关闭连接，连接池关闭时同样被唤醒
+        error = (timeout < 0) ? pthread_cond_wait(&pool->released, &pool->mutex)
+                              : pthread_cond_timedwait(&pool->released, &pool->mutex, &deadline);
+        if (pool->closed) {
+            error = ECANCELED;
+            break;
+        }
+        if (ETIMEDOUT == error) {
+            break;
+        }
+    }
+    if (NULL == host || pool->closed || ETIMEDOUT == error) {
+        bool last = Leave(pool);
+        pthread_mutex_unlock(&pool->mutex);
+        if (last) {
+            Free(pool);
+        }
+        errno = error;
+        return NULL;
+    }
+
+    // 先占用名额，握手期间不持有锁
+    host->openCount++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    struct PooledConnection *connection =
+            (struct PooledConnection *) calloc(1, sizeof(struct PooledConnection));
+    int sd = -1;
+    if (NULL == connection) {
+        errno = ENOMEM;
+    } else {
+        sd = ConnectToHost(pool, host);
+    }
+
+    error = errno;
+    pthread_mutex_lock(&pool->mutex);
+    if (-1 == sd) {
+        // 归还名额
+        host->openCount--;
+        pthread_cond_broadcast(&pool->released);
+        bool last = Leave(pool);
+        pthread_mutex_unlock(&pool->mutex);
+        free(connection);
+        if (last) {
+            Free(pool);
+        }
+        errno = error;
+        return NULL;
+    }
+    pool->created++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    connection->sd = sd;
+    connection->host = host;
+    return connection;
+}
+
+void ConnectionPoolRelease(struct ConnectionPool *pool, struct PooledConnection *connection,
+                           bool reusable) {
+    pthread_mutex_lock(&pool->mutex);
+
+    struct PoolHost *host = connection->host;
+    uint64_t now = NowMillis();
+    if (reusable && pool->idleTimeout > 0 && !pool->closed) {
+        // 放在空闲链表头部，下次优先借出
+        connection->idleSince = now;
+        connection->next = host->idle;
+        host->idle = connection;
+        pthread_cond_broadcast(&pool->released);
+    } else {
+        CloseConnection(pool, connection);
+    }
+
+    EvictIdleConnections(pool, host, now);
+
+    bool last = Leave(pool);
+    pthread_mutex_unlock(&pool->mutex);
+    if (last) {
+        Free(pool);
+    }
+}
+
+void ConnectionPoolDestroy(struct ConnectionPool *pool) {
+    struct PoolHost *host = pool->hosts;
+    while (NULL != host) {
+        struct PoolHost *next = host->next;
+
+        struct PooledConnection *connection = host->idle;
+        while (NULL != connection) {
+            struct PooledConnection *nextConnection = connection->next;
+            close(connection->sd);
+            free(connection);
+            connection = nextConnection;
+        }
+
+        free(host);
+        host = next;
+    }
+    pool->hosts = NULL;
+
+    pthread_cond_destroy(&pool->released);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+void ConnectionPoolClose(struct ConnectionPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->closed = true;
+    for (struct PoolHost *host = pool->hosts; NULL != host; host = host->next) {
+        CloseIdleConnections(pool, host);
+    }
+
+    // 唤醒等待的借出者，它们看到关闭后失败返回
+    pthread_cond_broadcast(&pool->released);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void ConnectionPoolDetach(struct ConnectionPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->detached = true;
+    bool idle = (0 == pool->users);
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (idle) {
+        Free(pool);
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef ECHO_CONNECTION_POOL_H
+#define ECHO_CONNECTION_POOL_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <pthread.h> // pthread_mutex_t, pthread_cond_t
+#include <netinet/in.h> // sockaddr_in
+#include "SocketProfile.h"
+
+struct PoolHost;
+
+/**
+ * 池中的一个 TCP 连接，借出时由调用者独占
+ */
+struct PooledConnection {
+    // 已连接的 socket
+    int sd;
+
+    // 所属的主机
+    struct PoolHost *host;
+
+    // 归还到池中的时间，单位毫秒
+    uint64_t idleSince;
+
+    // 空闲链表
+    struct PooledConnection *next;
+};
+
+/**
+ * 一个 ip:port 的连接
+ */
+struct PoolHost {
+    // 主机地址
+    struct sockaddr_in address;
+
+    // 空闲连接，最近归还的在前面
+    struct PooledConnection *idle;
+
+    // 已建立的连接数，包括空闲、借出和正在建立的连接
+    int openCount;
+
+    // 主机链表
+    struct PoolHost *next;
+};
+
+/**
+ * 按 ip:port 保持空闲 TCP 连接的线程安全连接池，借出前检查连接是否仍然可用，
+ * 空闲超时的连接在借出和归还时关闭
+ */
+struct ConnectionPool {
+    pthread_mutex_t mutex;
+
+    // 有连接归还或者关闭时通知等待的借出者
+    pthread_cond_t released;
+
+    // 主机链表
+    struct PoolHost *hosts;
+
+    // 每个主机最多的连接数
+    int maxPerHost;
+
+    // 空闲连接的最长保留时间，单位毫秒
+    uint64_t idleTimeout;
+
+    // 新建连接使用的调优方案
+    const struct SocketProfile *socketProfile;
+
+    // 借出未归还的连接数与正在借出的调用者数之和
+    int users;
+
+    // 已经关闭：不再借出，归还的连接直接关闭
+    bool closed;
+
+    // 所有者已经放弃连接池，users 降到 0 时由最后一个使用者释放
+    bool detached;
+
+    // 累计新建、复用、因空闲超时关闭和因检查失败关闭的连接数
+    uint64_t created;
+    uint64_t reused;
+    uint64_t evicted;
+    uint64_t broken;
+};
+
+/**
+ * 初始化连接池
+ * @param pool 连接池
+ * @param maxPerHost 每个主机最多的连接数，必须为正数
+ * @param idleTimeout 空闲连接的最长保留时间，单位毫秒
+ * @param socketProfile 新建连接使用的调优方案
+ * @return 成功返回 0，失败返回 -1 并设置 errno，maxPerHost 不为正数时为 EINVAL
+ */
+int ConnectionPoolInit(struct ConnectionPool *pool, int maxPerHost, uint64_t idleTimeout,
+                       const struct SocketProfile *socketProfile);
+
+/**
+ * 借出一个到给定地址的连接，优先复用空闲连接，没有时新建连接，
+ * 主机的连接数已达上限时等待其他调用者归还
+ * @param pool 连接池
+ * @param address 服务器地址
+ * @param timeout 等待归还的最长时间，单位毫秒，小于 0 表示一直等待
+ * @return 连接，失败返回 NULL 并设置 errno，等待超时时为 ETIMEDOUT，连接池已经关闭时为 ECANCELED
+ */
+struct PooledConnection *ConnectionPoolAcquire(struct ConnectionPool *pool,
+                                               const struct sockaddr_in *address, int timeout);
+
+/**
+ * 归还借出的连接，连接池已经关闭时关闭连接，最后一个归还的连接释放连接池
+ * @param pool 连接池
+ * @param connection 借出的连接
+ * @param reusable 连接是否可以复用，出错的连接应当关闭
+ */
+void ConnectionPoolRelease(struct ConnectionPool *pool, struct PooledConnection *connection,
+                           bool reusable);
+
+/**
+ * 关闭全部空闲连接并释放连接池，调用前必须归还所有借出的连接
+ * @param pool 连接池
+ */
+void ConnectionPoolDestroy(struct ConnectionPool *pool);
+
+/**
+ * 关闭连接池：立即关闭空闲连接，等待中和之后的借出以 ECANCELED 失败，之后归还的连接直接关闭
+ * @param pool 连接池
+ */
+void ConnectionPoolClose(struct ConnectionPool *pool);
+
+/**
+ * 放弃已经关闭的连接池：没有借出的连接和正在借出的调用者时立即销毁并 free，
+ * 否则由最后一个归还连接或者借出失败的调用者释放
+ * @param pool 用 malloc 分配并已经关闭的连接池，之后不能再借出
+ */
+void ConnectionPoolDetach(struct ConnectionPool *pool);
+
+#endif // ECHO_CONNECTION_POOL_H
@@ -0,0 +1,290 @@
+#include "Crc32c.h"
+#include <string.h> // memcpy
+#include <pthread.h> // pthread_once
+
+#if defined(__x86_64__)
+#include <nmmintrin.h> // _mm_crc32_u8, _mm_crc32_u64
+#define CRC32C_HAVE_HARDWARE 1
+#define HARDWARE_TARGET __attribute__((target("sse4.2")))
+#elif defined(__aarch64__)
+#include <arm_acle.h> // __crc32cb, __crc32cd
+#include <sys/auxv.h> // getauxval, AT_HWCAP
+#include <asm/hwcap.h> // HWCAP_CRC32
+#define CRC32C_HAVE_HARDWARE 1
+#if defined(__clang__)
+#define HARDWARE_TARGET __attribute__((target("crc")))
+#else
+#define HARDWARE_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+// 反射形式的 Castagnoli 多项式
+#define CRC32C_POLYNOMIAL 0x82f63b78u
+
+// 三路交错的长块和短块大小，必须是 2 的幂，合并时用查表把前一路的校验和移过后两路的长度
+#define LONG_BLOCK_SIZE 8192
+#define SHORT_BLOCK_SIZE 256
+
+// 可移植实现的切片表，table[k][n] 为字节 n 后面再跟 k 个零字节的校验和
+static uint32_t sliceTable[8][256];
+
+// 把校验和移过 LONG_BLOCK_SIZE 和 SHORT_BLOCK_SIZE 个零字节的表，按校验和的每个字节查表
+static uint32_t longShiftTable[4][256];
+static uint32_t shortShiftTable[4][256];
+
+// Crc32cUpdate 选中的实现
+static int selected = CRC32C_PORTABLE;
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * GF(2) 上的 32x32 矩阵乘向量，矩阵按列存放
+ * @param matrix 矩阵
+ * @param vector 向量
+ * @return 乘积
+ */
+static uint32_t MatrixTimes(const uint32_t *matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    for (; 0 != vector; vector >>= 1, matrix++) {
+        if (0 != (vector & 1)) {
+            sum ^= *matrix;
+        }
+    }
+    return sum;
+}
+
+/**
+ * 矩阵平方
+ * @param square 结果
+ * @param matrix 矩阵
+ */
+static void MatrixSquare(uint32_t *square, const uint32_t *matrix) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = MatrixTimes(matrix, matrix[n]);
+    }
+}
+
+/**
+ * 构造把校验和移过 length 个零字节的查表
+ * @param table 结果
+ * @param length 零字节数，必须是 2 的幂
+ */
+static void BuildShiftTable(uint32_t table[4][256], size_t length) {
+    // 一个零比特的算子，反复平方得到 2、4、8 个零比特，再按 length 的位数继续平方
+    uint32_t odd[32];
+    uint32_t even[32];
+    odd[0] = CRC32C_POLYNOMIAL;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = 1u << (n - 1);
+    }
+    MatrixSquare(even, odd);
+    MatrixSquare(odd, even);
+    uint32_t *op = odd;
+    for (size_t bits = length * 8 / 4; bits > 1; bits >>= 1) {
+        if (op == odd) {
+            MatrixSquare(even, odd);
+            op = even;
+        } else {
+            MatrixSquare(odd, even);
+            op = odd;
+        }
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        table[0][n] = MatrixTimes(op, n);
+        table[1][n] = MatrixTimes(op, n << 8);
+        table[2][n] = MatrixTimes(op, n << 16);
+        table[3][n] = MatrixTimes(op, n << 24);
+    }
+}
+
+/**
+ * 用查表把校验和移过固定数量的零字节
+ * @param table BuildShiftTable 构造的表
+ * @param crc 校验和
+ * @return 移位后的校验和
+ */
+static inline uint32_t Shift(const uint32_t table[4][256], uint32_t crc) {
+    return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff]
+           ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+/**
+ * 检测处理器并构造查表
+ */
+static void Init() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) {
+            crc = (0 != (crc & 1)) ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        }
+        sliceTable[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = sliceTable[0][n];
+        for (int k = 1; k < 8; k++) {
+            crc = sliceTable[0][crc & 0xff] ^ (crc >> 8);
+            sliceTable[k][n] = crc;
+        }
+    }
+
+#if defined(CRC32C_HAVE_HARDWARE)
+    BuildShiftTable(longShiftTable, LONG_BLOCK_SIZE);
+    BuildShiftTable(shortShiftTable, SHORT_BLOCK_SIZE);
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        selected = CRC32C_HARDWARE;
+    }
+#else
+    if (0 != (getauxval(AT_HWCAP) & HWCAP_CRC32)) {
+        selected = CRC32C_HARDWARE;
+    }
+#endif
+#endif
+}
+
+/**
+ * 读取 8 字节小端序的字
+ * @param data 数据，不要求对齐
+ * @return 字
+ */
+static inline uint64_t LoadWord(const unsigned char *data) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/**
+ * 可移植实现，每次查 8 张表处理 8 字节
+ * @param crc 取反后的校验和
+ * @param next 数据
+ * @param length 数据长度
+ * @return 取反后的校验和
+ */
+static uint32_t UpdatePortable(uint32_t crc, const unsigned char *next, size_t length) {
+    while (length >= 8) {
+        uint64_t word = LoadWord(next) ^ crc;
+        crc = sliceTable[7][word & 0xff] ^ sliceTable[6][(word >> 8) & 0xff]
+              ^ sliceTable[5][(word >> 16) & 0xff] ^ sliceTable[4][(word >> 24) & 0xff]
+              ^ sliceTable[3][(word >> 32) & 0xff] ^ sliceTable[2][(word >> 40) & 0xff]
+              ^ sliceTable[1][(word >> 48) & 0xff] ^ sliceTable[0][word >> 56];
+        next += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc = sliceTable[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(CRC32C_HAVE_HARDWARE)
+
+#if defined(__x86_64__)
+#define CRC32C_BYTE(crc, byte) _mm_crc32_u8((uint32_t) (crc), (byte))
+#define CRC32C_WORD(crc, word) _mm_crc32_u64((crc), (word))
+#else
+#define CRC32C_BYTE(crc, byte) __crc32cb((uint32_t) (crc), (byte))
+#define CRC32C_WORD(crc, word) __crc32cd((uint32_t) (crc), (word))
+#endif
+
+/**
+ * 三路交错处理 3 * blockSize 字节：指令延迟为 3 个周期、吞吐为每周期 1 条，
+ * 三条独立的依赖链才能让 CRC 单元满载；后两路从 0 开始，最后移位合并
+ * @param crc 第一路的校验和
+ * @param next 数据
+ * @param blockSize 每一路的长度
+ * @param table 移过 blockSize 个零字节的查表
+ * @return 合并后的校验和
+ */
+HARDWARE_TARGET
+static inline uint64_t UpdateInterleaved(uint64_t crc, const unsigned char *next, size_t blockSize,
+                                         const uint32_t table[4][256]) {
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    const unsigned char *end = next + blockSize;
+    do {
+        crc = CRC32C_WORD(crc, LoadWord(next));
+        crc1 = CRC32C_WORD(crc1, LoadWord(next + blockSize));
+        crc2 = CRC32C_WORD(crc2, LoadWord(next + 2 * blockSize));
+        next += 8;
+    } while (next < end);
+    crc = Shift(table, (uint32_t) crc) ^ crc1;
+    return Shift(table, (uint32_t) crc) ^ crc2;
+}
+
+/**
+ * 硬件实现
+ * @param crc 取反后的校验和
+ * @param next 数据
+ * @param length 数据长度
+ * @return 取反后的校验和
+ */
+HARDWARE_TARGET
+static uint32_t UpdateHardware(uint32_t crc, const unsigned char *next, size_t length) {
+    uint64_t crc0 = crc;
+
+    // 先对齐到 8 字节，之后的读取不跨缓存行边界
+    while (length > 0 && 0 != ((uintptr_t) next & 7)) {
+        crc0 = CRC32C_BYTE(crc0, *next++);
+        length--;
+    }
+
+    while (length >= 3 * LONG_BLOCK_SIZE) {
+        crc0 = UpdateInterleaved(crc0, next, LONG_BLOCK_SIZE, longShiftTable);
+        next += 3 * LONG_BLOCK_SIZE;
+        length -= 3 * LONG_BLOCK_SIZE;
+    }
+    while (length >= 3 * SHORT_BLOCK_SIZE) {
+        crc0 = UpdateInterleaved(crc0, next, SHORT_BLOCK_SIZE, shortShiftTable);
+        next += 3 * SHORT_BLOCK_SIZE;
+        length -= 3 * SHORT_BLOCK_SIZE;
+    }
+
+    while (length >= 8) {
+        crc0 = CRC32C_WORD(crc0, LoadWord(next));
+        next += 8;
+        length -= 8;
+    }
+    while (length-- > 0) {
+        crc0 = CRC32C_BYTE(crc0, *next++);
+    }
+    return (uint32_t) crc0;
+}
+
+#endif
+
+uint32_t Crc32cUpdateWith(int requested, uint32_t crc, const void *data, size_t length) {
+    pthread_once(&initOnce, Init);
+    const unsigned char *next = (const unsigned char *) data;
+#if defined(CRC32C_HAVE_HARDWARE)
+    if (CRC32C_HARDWARE == requested && CRC32C_HARDWARE == selected) {
+        return ~UpdateHardware(~crc, next, length);
+    }
+#endif
+    return ~UpdatePortable(~crc, next, length);
+}
+
+uint32_t Crc32cUpdate(uint32_t crc, const void *data, size_t length) {
+    pthread_once(&initOnce, Init);
+    return Crc32cUpdateWith(selected, crc, data, length);
+}
+
+int Crc32cGetImplementation() {
+    pthread_once(&initOnce, Init);
+    return selected;
+}
+
+const char *Crc32cImplementationName(int implementation) {
+    switch (implementation) {
+        case CRC32C_HARDWARE:
+#if defined(__aarch64__)
+            return "armv8-crc";
+#else
+            return "sse4.2";
+#endif
+        default:
+            return "portable";
+    }
+}
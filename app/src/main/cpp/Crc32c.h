@@ -0,0 +1,64 @@
+#ifndef ECHO_CRC32C_H
+#define ECHO_CRC32C_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+
+// 校验和的长度
+#define CRC32C_SIZE 4
+
+/**
+ * 计算实现
+ */
+enum Crc32cImplementation {
+    // 按 8 字节切片查表，任何处理器都可用
+    CRC32C_PORTABLE,
+
+    // x86-64 SSE4.2 或者 ARMv8 的 CRC32C 指令，三路交错隐藏指令延迟
+    CRC32C_HARDWARE
+};
+
+/**
+ * 继续计算 CRC32C（Castagnoli，iSCSI 和 ext4 使用的多项式）
+ *     第一次调用时检测处理器，之后总是使用同一个实现
+ * @param crc 之前数据的校验和，第一段数据传 0
+ * @param data 数据
+ * @param length 数据长度
+ * @return 到这段数据为止的校验和
+ */
+uint32_t Crc32cUpdate(uint32_t crc, const void *data, size_t length);
+
+/**
+ * 计算一段数据的 CRC32C
+ * @param data 数据
+ * @param length 数据长度
+ * @return 校验和
+ */
+static inline uint32_t Crc32c(const void *data, size_t length) {
+    return Crc32cUpdate(0, data, length);
+}
+
+/**
+ * 用指定的实现计算，用于比较各实现的结果和速度
+ * @param implementation Crc32cImplementation
+ * @param crc 之前数据的校验和
+ * @param data 数据
+ * @param length 数据长度
+ * @return 校验和；处理器不支持该实现时用可移植实现计算
+ */
+uint32_t Crc32cUpdateWith(int implementation, uint32_t crc, const void *data, size_t length);
+
+/**
+ * 查询 Crc32cUpdate 使用的实现
+ * @return Crc32cImplementation
+ */
+int Crc32cGetImplementation();
+
+/**
+ * 实现的名称，用于日志
+ * @param implementation Crc32cImplementation
+ * @return 名称
+ */
+const char *Crc32cImplementationName(int implementation);
+
+#endif // ECHO_CRC32C_H
@@ -0,0 +1,246 @@
+#include "DatagramBatch.h"
+#include <stdlib.h> // calloc, malloc, free
+#include <errno.h> // errno
+#include <string.h> // memset, memcpy
+
+// 每个消息槽的控制消息缓冲区大小，足够放下 UDP_GRO 的 int 或者 UDP_SEGMENT 的 uint16_t
+#define SEGMENT_CONTROL_SIZE CMSG_SPACE(sizeof(int))
+
+int DatagramBatchInit(struct DatagramBatch *batch, unsigned capacity, size_t bufferSize,
+                      bool segmentOffload) {
+    memset(batch, 0, sizeof(*batch));
+    batch->capacity = capacity;
+    batch->bufferSize = bufferSize;
+    batch->segmentOffload = segmentOffload;
+
+    batch->metrics = MetricsAcquireShard();
+    batch->messages = (struct mmsghdr *) calloc(capacity, sizeof(struct mmsghdr));
+    batch->vectors = (struct iovec *) calloc(capacity, sizeof(struct iovec));
+    batch->addresses = (struct sockaddr_in *) calloc(capacity, sizeof(struct sockaddr_in));
+    batch->buffers = (char *) malloc(capacity * bufferSize);
+    if (segmentOffload) {
+        batch->controls = (char *) calloc(capacity, SEGMENT_CONTROL_SIZE);
+    }
+    if (NULL == batch->metrics || NULL == batch->messages || NULL == batch->vectors
+        || NULL == batch->addresses || NULL == batch->buffers
+        || (segmentOffload && NULL == batch->controls)) {
+        DatagramBatchDestroy(batch);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * 重置消息槽以便接收，recvmmsg 会改写地址长度、数据长度和控制消息长度
+ * @param batch 批量消息
+ */
+static void PrepareToReceive(struct DatagramBatch *batch) {
+    for (unsigned i = 0; i < batch->capacity; i++) {
+        batch->vectors[i].iov_base = batch->buffers + i * batch->bufferSize;
+        batch->vectors[i].iov_len = batch->bufferSize;
+
+        struct msghdr *header = &batch->messages[i].msg_hdr;
+        header->msg_name = &batch->addresses[i];
+        header->msg_namelen = sizeof(struct sockaddr_in);
+        header->msg_iov = &batch->vectors[i];
+        header->msg_iovlen = 1;
+        if (batch->segmentOffload) {
+            header->msg_control = batch->controls + i * SEGMENT_CONTROL_SIZE;
+            header->msg_controllen = SEGMENT_CONTROL_SIZE;
+        } else {
+            header->msg_control = NULL;
+            header->msg_controllen = 0;
+        }
+        header->msg_flags = 0;
+    }
+}
+
+/**
+ * 从收到的控制消息中取出 UDP_GRO 分段长度
+ * @param header 收到的消息头
+ * @return 分段长度，数据报没有被合并时返回 0
+ */
+static size_t GetGroSegmentSize(struct msghdr *header) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); NULL != cmsg;
+         cmsg = CMSG_NXTHDR(header, cmsg)) {
+        if (IPPROTO_UDP == cmsg->cmsg_level && UDP_GRO == cmsg->cmsg_type) {
+            int segmentSize;
+            memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+            return (size_t) segmentSize;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 在消息头的控制消息缓冲区写入 UDP_SEGMENT 分段长度
+ * @param header 待发送的消息头，msg_control 至少 SEGMENT_CONTROL_SIZE 字节
+ * @param segmentSize 分段长度
+ */
+static void SetGsoSegmentSize(struct msghdr *header, size_t segmentSize) {
+    header->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(header);
+    cmsg->cmsg_level = IPPROTO_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t value = (uint16_t) segmentSize;
+    memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+}
+
+int DatagramBatchEcho(struct DatagramBatch *batch, int sd) {
+    PrepareToReceive(batch);
+
+    // MSG_WAITFORONE：阻塞到第一个数据报到达，之后只取已经到达的
+    int received;
+    do {
+        received = recvmmsg(sd, batch->messages, batch->capacity, MSG_WAITFORONE, NULL);
+    } while (-1 == received && EINTR == errno);
+    if (-1 == received) {
+        return -1;
+    }
+    batch->syscalls++;
+    MetricsAdd(&batch->metrics->syscalls, 1);
+    uint64_t receivedAt = MetricsNow();
+
+    // socket 被 shutdown 后 recvmmsg 返回没有发送者地址的空数据报
+    if (0 == batch->messages[0].msg_hdr.msg_namelen) {
+        return 0;
+    }
+
+    // 发送长度为各自收到的长度，地址已经由 recvmmsg 填好
+    uint64_t datagrams = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < received; i++) {
+        size_t length = batch->messages[i].msg_len;
+        batch->vectors[i].iov_len = length;
+        datagrams++;
+        bytes += length;
+
+        if (batch->segmentOffload) {
+            // 合并接收的数据按原来的分段长度发回，对端仍然收到同样大小的数据报
+            struct msghdr *header = &batch->messages[i].msg_hdr;
+            size_t segmentSize = GetGroSegmentSize(header);
+            if (segmentSize > 0 && length > segmentSize) {
+                SetGsoSegmentSize(header, segmentSize);
+                datagrams += (length - 1) / segmentSize;
+            } else {
+                header->msg_controllen = 0;
+            }
+        }
+    }
+
+    MetricsAdd(&batch->metrics->bytesIn, bytes);
+    MetricsAdd(&batch->metrics->messagesIn, (uint64_t) received);
+
+    // sendmmsg 可能只发送一部分，发送失败的单个数据报直接丢弃
+    int sent = 0;
+    uint64_t sentBytes = 0;
+    uint64_t sentMessages = 0;
+    while (sent < received) {
+        int result = sendmmsg(sd, batch->messages + sent, (unsigned) (received - sent), 0);
+        batch->syscalls++;
+        MetricsAdd(&batch->metrics->syscalls, 1);
+        if (-1 == result) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno || ENOBUFS == errno) {
+                MetricsAdd(&batch->metrics->eagain, 1);
+                break;
+            }
+            sent++;
+        } else {
+            for (int i = sent; i < sent + result; i++) {
+                sentBytes += batch->messages[i].msg_len;
+            }
+            sentMessages += (uint64_t) result;
+            sent += result;
+        }
+    }
+
+    // 同一批数据报共用一个服务时间
+    MetricsAdd(&batch->metrics->bytesOut, sentBytes);
+    MetricsAdd(&batch->metrics->messagesOut, sentMessages);
+    if (sentMessages > 0) {
+        MetricsRecordServiceTime(batch->metrics, MetricsNow() - receivedAt, sentMessages);
+    }
+
+    batch->datagrams += datagrams;
+    return received;
+}
+
+void DatagramBatchDestroy(struct DatagramBatch *batch) {
+    free(batch->messages);
+    free(batch->vectors);
+    free(batch->addresses);
+    free(batch->buffers);
+    free(batch->controls);
+    MetricsReleaseShard(batch->metrics);
+    batch->metrics = NULL;
+    batch->messages = NULL;
+    batch->vectors = NULL;
+    batch->addresses = NULL;
+    batch->buffers = NULL;
+    batch->controls = NULL;
+}
+
+int DatagramEnableGro(int sd) {
+    int on = 1;
+    return setsockopt(sd, IPPROTO_UDP, UDP_GRO, &on, sizeof(on));
+}
+
+ssize_t DatagramSendSegmented(int sd, const struct sockaddr_in *address,
+                              const char *buffer, size_t length, size_t segmentSize) {
+    struct iovec vector;
+    vector.iov_base = (void *) buffer;
+    vector.iov_len = length;
+
+    char control[SEGMENT_CONTROL_SIZE];
+    memset(control, 0, sizeof(control));
+
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = (void *) address;
+    header.msg_namelen = (NULL == address) ? 0 : sizeof(struct sockaddr_in);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    SetGsoSegmentSize(&header, segmentSize);
+
+    ssize_t sentSize;
+    do {
+        sentSize = sendmsg(sd, &header, 0);
+    } while (-1 == sentSize && EINTR == errno);
+    return sentSize;
+}
+
+ssize_t DatagramReceiveCoalesced(int sd, struct sockaddr_in *address,
+                                 char *buffer, size_t bufferSize, size_t *segmentSize) {
+    struct iovec vector;
+    vector.iov_base = buffer;
+    vector.iov_len = bufferSize;
+
+    char control[SEGMENT_CONTROL_SIZE];
+
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = address;
+    header.msg_namelen = (NULL == address) ? 0 : sizeof(struct sockaddr_in);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    ssize_t recvSize;
+    do {
+        recvSize = recvmsg(sd, &header, 0);
+    } while (-1 == recvSize && EINTR == errno);
+
+    if (-1 != recvSize) {
+        size_t groSize = GetGroSegmentSize(&header);
+        *segmentSize = (groSize > 0) ? groSize : (size_t) recvSize;
+    }
+    return recvSize;
+}
@@ -0,0 +1,112 @@
+#ifndef ECHO_DATAGRAM_BATCH_H
+#define ECHO_DATAGRAM_BATCH_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <sys/socket.h> // mmsghdr
+#include <sys/uio.h> // iovec
+#include <netinet/in.h> // sockaddr_in
+#include <netinet/udp.h> // UDP_SEGMENT, UDP_GRO
+#include "Metrics.h"
+
+// 较旧的 C 库头文件没有分段卸载选项，值与内核一致
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// 分段卸载时一个合并缓冲区的最大长度，即一个 UDP 负载的上限
+#define DATAGRAM_COALESCED_BUFFER_SIZE 65535
+
+// 一次 UDP_SEGMENT 发送最多携带的分段数，取较旧内核的 UDP_MAX_SEGMENTS，6.9 起内核允许 128 个
+#define DATAGRAM_MAX_SEGMENTS 64
+
+/**
+ * 批量收发数据报用的预分配消息槽，一次系统调用收发多个数据报
+ */
+struct DatagramBatch {
+    // 消息槽数量
+    unsigned capacity;
+
+    // 每个消息槽的数据缓冲区大小
+    size_t bufferSize;
+
+    // recvmmsg/sendmmsg 使用的消息、数据向量、对端地址和数据缓冲区
+    struct mmsghdr *messages;
+    struct iovec *vectors;
+    struct sockaddr_in *addresses;
+    char *buffers;
+
+    // 是否启用分段卸载，启用时每个消息槽带有控制消息缓冲区，
+    // 接收时读取 UDP_GRO 分段长度，发送时用 UDP_SEGMENT 按同样的长度重新分段
+    bool segmentOffload;
+    char *controls;
+
+    // 累计收发的数据报数（按线上的分段计）和系统调用数
+    uint64_t datagrams;
+    uint64_t syscalls;
+
+    // 指标分片，只由调用 DatagramBatchEcho 的线程写入
+    struct MetricsShard *metrics;
+};
+
+/**
+ * 分配消息槽
+ * @param batch 批量消息
+ * @param capacity 每次系统调用最多收发的数据报数
+ * @param bufferSize 每个数据报的最大长度，分段卸载时为合并后的最大长度
+ * @param segmentOffload 是否启用分段卸载，socket 需要先用 DatagramEnableGro 启用合并接收
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int DatagramBatchInit(struct DatagramBatch *batch, unsigned capacity, size_t bufferSize,
+                      bool segmentOffload);
+
+/**
+ * 阻塞直到至少收到一个数据报，再取走 socket 中已经到达的数据报，最多 capacity 个，
+ * 然后用一次 sendmmsg 把它们发回各自的发送者
+ * @param batch 批量消息
+ * @param sd 已绑定的数据报 socket
+ * @return 回显的数据报数，socket 被 shutdown 时返回 0，失败返回 -1 并设置 errno
+ */
+int DatagramBatchEcho(struct DatagramBatch *batch, int sd);
+
+/**
+ * 释放消息槽
+ * @param batch 批量消息
+ */
+void DatagramBatchDestroy(struct DatagramBatch *batch);
+
+/**
+ * 让内核把同一个流上相同长度的数据报合并后再交给 socket（UDP_GRO）
+ * @param sd 数据报 socket
+ * @return 成功返回 0，内核不支持时返回 -1 并设置 errno 为 ENOPROTOOPT
+ */
+int DatagramEnableGro(int sd);
+
+/**
+ * 用一次 sendmsg 发送一个缓冲区，内核按 segmentSize 把它切分成多个数据报（UDP_SEGMENT）
+ * @param sd 数据报 socket
+ * @param address 目标地址，socket 已连接时可以为 NULL
+ * @param buffer 数据缓冲区
+ * @param length 数据长度，分段数不能超过 DATAGRAM_MAX_SEGMENTS
+ * @param segmentSize 每个数据报的长度，最后一个可以更短
+ * @return 发送的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t DatagramSendSegmented(int sd, const struct sockaddr_in *address,
+                              const char *buffer, size_t length, size_t segmentSize);
+
+/**
+ * 接收一个可能被合并的缓冲区，并取得合并时每个数据报的长度
+ * @param sd 已经启用 UDP_GRO 的数据报 socket
+ * @param address 发送者地址，可以为 NULL
+ * @param buffer 数据缓冲区，至少 DATAGRAM_COALESCED_BUFFER_SIZE 字节才能放下合并后的数据
+ * @param bufferSize 缓冲区大小
+ * @param segmentSize 每个数据报的长度，没有合并时为收到的长度
+ * @return 收到的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t DatagramReceiveCoalesced(int sd, struct sockaddr_in *address,
+                                 char *buffer, size_t bufferSize, size_t *segmentSize);
+
+#endif // ECHO_DATAGRAM_BATCH_H
@@ -0,0 +1,183 @@
+#include "DatagramBenchmark.h"
+#include "DatagramBatch.h"
+#include <stdlib.h> // malloc, free
+#include <errno.h> // errno
+#include <string.h> // memset
+#include <unistd.h> // close
+#include <fcntl.h> // fcntl, O_NONBLOCK
+#include <poll.h> // poll
+#include <time.h> // clock_gettime
+#include <sys/socket.h> // socket, bind, connect, send, recv
+#include <netinet/in.h> // sockaddr_in, INADDR_LOOPBACK
+#include <arpa/inet.h> // htonl
+
+// 一个 IPv4 UDP 数据报的最大负载
+#define MAX_UDP_PAYLOAD 65507
+
+// 接收端的缓冲区大小，避免测试过程中因为缓冲区满而丢包
+#define RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+
+// 发送结束后等待剩余数据到达的最长时间，单位毫秒
+#define DRAIN_TIMEOUT 100
+
+/**
+ * 读取单调时钟
+ * @return 纳秒
+ */
+static uint64_t NowNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * 取走接收端已经到达的全部数据
+ * @param sd 非阻塞的接收端 socket
+ * @param segmentOffload 是否按合并的缓冲区接收
+ * @param buffer 接收缓冲区
+ * @param result 测试结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int DrainReceiver(int sd, bool segmentOffload, char *buffer,
+                         struct DatagramBenchmarkResult *result) {
+    while (true) {
+        ssize_t recvSize;
+        size_t segmentSize = 0;
+        if (segmentOffload) {
+            recvSize = DatagramReceiveCoalesced(sd, NULL, buffer, DATAGRAM_COALESCED_BUFFER_SIZE,
+                                                &segmentSize);
+        } else {
+            recvSize = recv(sd, buffer, DATAGRAM_COALESCED_BUFFER_SIZE, 0);
+        }
+        result->syscalls++;
+
+        if (-1 == recvSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return (EAGAIN == errno || EWOULDBLOCK == errno) ? 0 : -1;
+        }
+
+        result->receivedBytes += (uint64_t) recvSize;
+        if (segmentSize > 0 && (size_t) recvSize > segmentSize) {
+            result->datagrams += ((size_t) recvSize + segmentSize - 1) / segmentSize;
+        } else {
+            result->datagrams++;
+        }
+    }
+}
+
+int DatagramBenchmarkRun(bool segmentOffload, size_t segmentSize, size_t totalBytes,
+                         struct DatagramBenchmarkResult *result) {
+    memset(result, 0, sizeof(*result));
+    if (0 == segmentSize || segmentSize > MAX_UDP_PAYLOAD) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int status = -1;
+    int receiver = -1;
+    int sender = -1;
+    char *buffer = NULL;
+    size_t roundSize;
+    uint64_t start;
+
+    // 接收端绑定到回环地址上的随机端口
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+
+    int receiveBufferSize = RECEIVE_BUFFER_SIZE;
+
+    receiver = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (-1 == receiver
+        || -1 == bind(receiver, (struct sockaddr *) &address, sizeof(address))
+        || -1 == getsockname(receiver, (struct sockaddr *) &address, &addressLength)) {
+        goto exit;
+    }
+    setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+    if (segmentOffload && -1 == DatagramEnableGro(receiver)) {
+        goto exit;
+    }
+
+    // 发送端连接到接收端，之后不必每次指定地址
+    sender = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (-1 == sender || -1 == connect(sender, (struct sockaddr *) &address, sizeof(address))) {
+        goto exit;
+    }
+
+    buffer = (char *) malloc(DATAGRAM_COALESCED_BUFFER_SIZE);
+    if (NULL == buffer) {
+        errno = ENOMEM;
+        goto exit;
+    }
+    memset(buffer, 'x', DATAGRAM_COALESCED_BUFFER_SIZE);
+
+    // 每一轮发送一次 UDP_SEGMENT 能携带的数据量，两种方式每轮之后都取走已到达的数据
+    roundSize = MAX_UDP_PAYLOAD / segmentSize;
+    if (roundSize > DATAGRAM_MAX_SEGMENTS) {
+        roundSize = DATAGRAM_MAX_SEGMENTS;
+    }
+    roundSize *= segmentSize;
+
+    start = NowNanos();
+    while (result->sentBytes < totalBytes) {
+        size_t length = totalBytes - (size_t) result->sentBytes;
+        if (length > roundSize) {
+            length = roundSize;
+        }
+
+        if (segmentOffload) {
+            if (-1 == DatagramSendSegmented(sender, NULL, buffer, length, segmentSize)) {
+                goto exit;
+            }
+            result->syscalls++;
+        } else {
+            for (size_t offset = 0; offset < length; offset += segmentSize) {
+                size_t size = (length - offset < segmentSize) ? length - offset : segmentSize;
+                ssize_t sentSize;
+                do {
+                    sentSize = send(sender, buffer, size, 0);
+                } while (-1 == sentSize && EINTR == errno);
+                if (-1 == sentSize) {
+                    goto exit;
+                }
+                result->syscalls++;
+            }
+        }
+        result->sentBytes += length;
+
+        if (-1 == DrainReceiver(receiver, segmentOffload, buffer, result)) {
+            goto exit;
+        }
+    }
+
+    // 等待仍在途中的数据，超时未到达的计为丢失
+    while (result->receivedBytes < result->sentBytes) {
+        struct pollfd pfd;
+        pfd.fd = receiver;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, DRAIN_TIMEOUT) <= 0) {
+            break;
+        }
+        if (-1 == DrainReceiver(receiver, segmentOffload, buffer, result)) {
+            goto exit;
+        }
+    }
+    result->elapsedNanos = NowNanos() - start;
+    status = 0;
+
+    exit:
+    int error = errno;
+    free(buffer);
+    if (-1 != sender) {
+        close(sender);
+    }
+    if (-1 != receiver) {
+        close(receiver);
+    }
+    errno = error;
+    return status;
+}
@@ -0,0 +1,37 @@
+#ifndef ECHO_DATAGRAM_BENCHMARK_H
+#define ECHO_DATAGRAM_BENCHMARK_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+/**
+ * 一次回环数据报基准测试的结果
+ */
+struct DatagramBenchmarkResult {
+    // 发送和接收的字节数，两者之差为丢失的数据
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+
+    // 线上的数据报数
+    uint64_t datagrams;
+
+    // 收发两端的系统调用数
+    uint64_t syscalls;
+
+    // 耗时，单位纳秒
+    uint64_t elapsedNanos;
+};
+
+/**
+ * 在回环地址上把 totalBytes 字节切成 segmentSize 长的数据报从一个 socket 发给另一个 socket，
+ * 比较逐个数据报 send/recv 和 UDP_SEGMENT/UDP_GRO 分段卸载的开销
+ * @param segmentOffload 是否使用分段卸载
+ * @param segmentSize 每个数据报的长度
+ * @param totalBytes 发送的总字节数
+ * @param result 测试结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno，内核不支持分段卸载时 errno 为 ENOPROTOOPT
+ */
+int DatagramBenchmarkRun(bool segmentOffload, size_t segmentSize, size_t totalBytes,
+                         struct DatagramBenchmarkResult *result);
+
+#endif // ECHO_DATAGRAM_BENCHMARK_H
@@ -1,10 +1,25 @@
-#include "com_liu_echo_EchoServerActivity.h"
-#include "com_liu_echo_EchoClientActivity.h"
-#include "com_liu_echo_LocalSocketActivity.h"
+#include <jni.h> // JNIEnv, JNI_OnLoad, RegisterNatives
+#include "EventLoop.h"
+#include "Frame.h"
+#include "Crc32c.h"
+#include "UringLoop.h"
+#include "CoEchoServer.h"
+#include "ServerOptions.h"
+#include "SocketProfile.h"
+#include "LoopbackBenchmark.h"
+#include "DatagramBatch.h"
+#include "DatagramBenchmark.h"
+#include "NativeLog.h"
+#include "ConnectionPool.h"
+#include "PipelinedClient.h"
+#include "Metrics.h"
+#include "BufferChain.h"
+#include "LocalTransfer.h"
+#include "ShmRing.h"
+#include "Handoff.h"
 #include <stdio.h> // NULL
-#include <stdarg.h> // va_list, vsnprintf
 #include <errno.h> // errno
-#include <string.h> // strerror_r, memset
+#include <string.h> // strerror_r, memset, memcpy, memcmp
 
 // socket, bind, getsockname, listen, accept, recv, send, connect
 #include <sys/types.h>
@@ -13,79 +28,112 @@
 #include <sys/un.h> // sockaddr_un
 #include <netinet/in.h> // htons, sockaddr_in
 #include <arpa/inet.h> // inet_ntop
-#include <unistd.h> // close, unlink
+#include <unistd.h> // close, unlink, sysconf
 #include <stddef.h> // offsetof
+#include <stdlib.h> // calloc, malloc, free
+#include <pthread.h> // pthread_create, pthread_join
+#include <sched.h> // sched_setaffinity, CPU_SET
+#include <sys/mman.h> // munmap
+#include <sys/eventfd.h> // eventfd
+#include <poll.h> // poll
 
 // 最大日志消息长度
 #define MAX_LOG_MESSAGE_LENGTH 256
 
-// 最大数据缓冲区大小
-#define MAX_BUFFER_SIZE 80
+// 一次交给 Java 层的日志批量大小
+#define LOG_DRAIN_BUFFER_SIZE (16 * 1024)
 
-/**
- * 将给定的消息记录到应用程序
- * @param env
- * @param obj
- * @param format
- * @param ...
- */
-static void LogMessage(JNIEnv *env, jobject obj, const char *format, ...) {
-    // 缓存日志方法ID
-    static jmethodID methodID = NULL;
+// 数据报的最大长度，即一个 UDP 负载的上限
+#define MAX_DATAGRAM_SIZE 65535
 
-    // 如果方法ID未缓存
-    if (methodID == NULL) {
-        // 从对象类获取类
-        jclass clazz = env->GetObjectClass(obj);
-        // 从获取的类获取方法ID
-        methodID = env->GetMethodID(clazz, "logMessage", "(Ljava/lang/String;)V");
-        // 释放类的引用
-        env->DeleteLocalRef(clazz);
-    } else { // 找到方法
-        // 格式化日志消息
-        char buffer[MAX_LOG_MESSAGE_LENGTH];
+// 控制 socket 的监听 backlog，服务器的 backlog 由调优方案决定
+#define SERVER_LISTEN_BACKLOG SOMAXCONN
 
-        va_list ap; // 一个指向参数的指针
-        va_start(ap, format); // 初始化ap, 指向参数format之后的参数的地址
-        vsnprintf(buffer, MAX_LOG_MESSAGE_LENGTH, format, ap);
-        va_end(ap);
+// 注册原生方法的类和服务器选项类
+#define ABSTRACT_ECHO_ACTIVITY_CLASS "com/liu/echo/AbstractEchoActivity"
+#define ECHO_SERVER_ACTIVITY_CLASS "com/liu/echo/EchoServerActivity"
+#define ECHO_CLIENT_ACTIVITY_CLASS "com/liu/echo/EchoClientActivity"
+#define LOCAL_SOCKET_ACTIVITY_CLASS "com/liu/echo/LocalSocketActivity"
+#define ECHO_CLIENT_CLASS "com/liu/echo/EchoClient"
+#define CONNECTION_POOL_CLASS "com/liu/echo/ConnectionPool"
+#define SERVER_OPTIONS_CLASS "com/liu/echo/ServerOptions"
 
-        // 将缓冲区转换为Java字符串
-        jstring message = env->NewStringUTF(buffer);
+/**
+ * JNI_OnLoad 时查找并缓存的类和成员 ID，之后的调用和错误路径不再按名字查找
+ */
+static struct {
+    // 抛出的异常类，全局引用
+    jclass ioExceptionClass;
+    jclass outOfMemoryErrorClass;
+    jclass illegalArgumentExceptionClass;
+
+    // com.liu.echo.ServerOptions 的字段
+    jfieldID backendField;
+    jfieldID zeroCopyField;
+    jfieldID datagramBatchSizeField;
+    jfieldID segmentOffloadField;
+    jfieldID bufferSizeField;
+    jfieldID hugePagesField;
+    jfieldID framingField;
+    jfieldID integrityField;
+    jfieldID seqPacketField;
+    jfieldID socketProfileField;
+    jfieldID busyPollField;
+    jfieldID busyPollIdleMicrosField;
+    jfieldID busyPollCpuField;
+    jfieldID messageHandlerField;
+    jfieldID handlerThreadsField;
+    jfieldID writeHighWatermarkField;
+    jfieldID writeLowWatermarkField;
+} jniCache;
 
-        // 如果字符串构造正确
-        if (NULL != message) {
-            // 记录消息
-            env->CallVoidMethod(obj, methodID, message);
+/**
+ * 取出原生日志环形缓冲区中的一批日志，由 Java 层在 UI 线程上定期调用，
+ * 数据路径上只写环形缓冲区，不做任何 JNI 调用
+ * @param env
+ * @param clazz
+ * @return 以换行符分隔的日志，没有日志时返回 NULL
+ */
+static jstring
+Java_com_liu_echo_AbstractEchoActivity_nativeDrainLog(JNIEnv *env, jclass clazz) {
+    char buffer[LOG_DRAIN_BUFFER_SIZE];
 
-            // 释放消息引用
-            env->DeleteLocalRef(message);
-        }
+    if (0 == NativeLogDrain(buffer, LOG_DRAIN_BUFFER_SIZE)) {
+        return NULL;
     }
 
+    return env->NewStringUTF(buffer);
 }
 
-static void ThrowException(JNIEnv *env, const char *className, const char *message) {
-    // 获取异常类
-    jclass clazz = env->FindClass(className);
-
-    // 如果异常类找到
-    if (NULL != clazz) {
-        // 抛出异常
-        env->ThrowNew(clazz, message);
+/**
+ * 设置原生日志的运行期级别
+ * @param env
+ * @param clazz
+ * @param level 最低记录的级别
+ */
+static void
+Java_com_liu_echo_AbstractEchoActivity_nativeSetLogLevel(JNIEnv *env, jclass clazz, jint level) {
+    NativeLogSetLevel(level);
+}
 
-        // 释放原生类引用
-        env->DeleteLocalRef(clazz);
-    }
+/**
+ * 用给定异常类和错误消息抛出新异常
+ * @param env
+ * @param clazz jniCache 中缓存的异常类
+ * @param message
+ */
+static void ThrowException(JNIEnv *env, jclass clazz, const char *message) {
+    // 抛出异常
+    env->ThrowNew(clazz, message);
 }
 
 /**
  * 用给定异常类和基于错误号的错误消息抛出新异常
  * @param env
- * @param className
+ * @param clazz jniCache 中缓存的异常类
  * @param errnum
  */
-static void ThrowErrnoException(JNIEnv *env, const char *className, int errnum) {
+static void ThrowErrnoException(JNIEnv *env, jclass clazz, int errnum) {
 
     char buffer[MAX_LOG_MESSAGE_LENGTH];
 
@@ -95,12 +143,12 @@ static void ThrowErrnoException(JNIEnv *env, const char *className, int errnum)
     }
 
     // 抛出异常
-    ThrowException(env, className, buffer);
+    ThrowException(env, clazz, buffer);
 }
 
 static int NewTcpSocket(JNIEnv *env, jobject obj) {
     // 构造Socket
-    LogMessage(env, obj, "Constructing a new TCP socket...");
+    LOGI("Constructing a new TCP socket...");
     /*
      * 用 socket 函数来创建Socket
      *      int socket(int domain, int type, int protocol);
@@ -117,7 +165,7 @@ static int NewTcpSocket(JNIEnv *env, jobject obj) {
     // 检查 socket 构造是否正确
     if (-1 == tcpSocket) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     }
 
     return tcpSocket;
@@ -129,8 +177,10 @@ static int NewTcpSocket(JNIEnv *env, jobject obj) {
  * @param obj jobject instance
  * @param sd socket 描述符来表示socket
  * @param port 端口号或者设置为 0 将随机分配第一个可用端口号
+ * @param reusePort 是否设置 SO_REUSEPORT，允许多个 socket 绑定同一端口并由内核分配连接
  */
-static void BindSocketToPort(JNIEnv *env, jobject obj, int sd, unsigned short port) {
+static void BindSocketToPort(JNIEnv *env, jobject obj, int sd, unsigned short port,
+                             bool reusePort) {
     /*
      * struct sockaddr_in {
      *     sa_family sin_family;
@@ -150,8 +200,18 @@ static void BindSocketToPort(JNIEnv *env, jobject obj, int sd, unsigned short po
     // 将端口转换为网络字节顺序
     address.sin_port = htons(port);
 
+    // SO_REUSEPORT 必须在绑定之前设置
+    if (reusePort) {
+        int enable = 1;
+        if (-1 == setsockopt(sd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable))) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            return;
+        }
+    }
+
     // 绑定 socket
-    LogMessage(env, obj, "Binding to port %hu.", port);
+    LOGI("Binding to port %hu%s.", port, reusePort ? " with SO_REUSEPORT" : "");
     /*
      * socket 与地址绑定
      * 新建的 socket 在 socket 族空间中，并没为其分配协议地址。为让客户能定位到这个 socket 并与之相连，需绑定
@@ -162,7 +222,7 @@ static void BindSocketToPort(JNIEnv *env, jobject obj, int sd, unsigned short po
      */
     if (-1 == bind(sd, (struct sockaddr *) &address, sizeof(address))) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     }
 }
 
@@ -184,22 +244,44 @@ static unsigned short GetSocketPort(JNIEnv *env, jobject obj, int sd) {
      */
     if (-1 == getsockname(sd, (struct sockaddr *) &address, &addressLenght)) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else {
         // 将端口转换为主机字节顺序
         port = ntohs(address.sin_port);
-        LogMessage(env, obj, "Binded to random port %hu.", port);
+        LOGI("Binded to random port %hu.", port);
     }
     return port;
 }
 
 static void ListenOnSocket(JNIEnv *env, jobject obj, int sd, int backlog) {
     // 监听给定 backlog 的 socket
-    LogMessage(env, obj, "Listening on socket with a backlog of %d pending connections.", backlog);
+    LOGI("Listening on socket with a backlog of %d pending connections.", backlog);
 
     if (-1 == listen(sd, backlog)) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+    }
+}
+
+/**
+ * 对 socket 应用调优方案，必须在 listen 或 connect 之前调用
+ * @param env
+ * @param obj
+ * @param sd socket 描述符
+ * @param socketProfile SocketProfileId
+ * @param role SocketRole
+ */
+static void ApplySocketProfile(JNIEnv *env, jobject obj, int sd, int socketProfile, int role) {
+    const struct SocketProfile *profile = SocketProfileGet(socketProfile);
+    if (NULL == profile) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass, "Unknown socket profile");
+        return;
+    }
+
+    LOGI("Applying the %s socket profile.", profile->name);
+    if (-1 == SocketProfileApply(profile, sd, role)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     }
 }
 
@@ -212,118 +294,416 @@ static void ListenOnSocket(JNIEnv *env, jobject obj, int sd, int backlog) {
  */
 static void LogAddress(
         JNIEnv *env, jobject obj, const char *message, const struct sockaddr_in *address) {
+    // 地址只在数据路径上记录，级别被过滤时不做转换
+    if (LOG_LEVEL_DEBUG < LOG_COMPILE_LEVEL || !NativeLogIsEnabled(LOG_LEVEL_DEBUG)) {
+        return;
+    }
+
     char ip[INET_ADDRSTRLEN];
     // 将 IP 地址转换为字符串
     if (NULL == inet_ntop(PF_INET, &(address->sin_addr), ip, INET_ADDRSTRLEN)) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else {
         // 将端口号转换为主机字节顺序
         unsigned short port = ntohs(address->sin_port);
 
         // 记录地址
-        LogMessage(env, obj, "%s %s:%hu.", message, ip, port);
+        LOGD("%s %s:%hu.", message, ip, port);
     }
 }
 
-static int AcceptOnSocket(JNIEnv *env, jobject obj, int sd) {
-    struct sockaddr_in address;
-    socklen_t addressLength = sizeof(address);
+/**
+ * 将数据缓冲区的数据全部发送到 socket，send 只发送了一部分时继续发送剩余的部分
+ * @param env
+ * @param obj
+ * @param sd
+ * @param buffer
+ * @param bufferSize
+ * @return 全部发送返回 bufferSize，失败返回 -1 并抛出异常
+ */
+static ssize_t SendToSocket(
+        JNIEnv *env, jobject obj, int sd, const char *buffer, size_t bufferSize) {
+    // 将数据缓冲区发送到 socket
+    LOGD("Sending to the socket...");
+    size_t sentTotal = 0;
+    while (sentTotal < bufferSize) {
+        // 对端关闭时返回 EPIPE，不产生 SIGPIPE
+        ssize_t sentSize = send(sd, buffer + sentTotal, bufferSize - sentTotal, MSG_NOSIGNAL);
+
+        // 如果发送失败
+        if (-1 == sentSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            return -1;
+        }
+        sentTotal += (size_t) sentSize;
+    }
+    LOGD("Send %d bytes: %s", (int) sentTotal, buffer);
+    return (ssize_t) sentTotal;
+}
+
+/**
+ * 读取 Java 层的服务器选项
+ * @param env
+ * @param options com.liu.echo.ServerOptions 实例，为 NULL 时使用默认值
+ * @param serverOptions 读取到的选项
+ */
+static void GetServerOptions(JNIEnv *env, jobject options, struct ServerOptions *serverOptions) {
+    ServerOptionsInit(serverOptions);
+    if (NULL == options) {
+        return;
+    }
+
+    // 字段 ID 已在 JNI_OnLoad 中缓存
+    serverOptions->backend = env->GetIntField(options, jniCache.backendField);
+    serverOptions->zeroCopy = (JNI_TRUE == env->GetBooleanField(options, jniCache.zeroCopyField));
+    serverOptions->datagramBatchSize = env->GetIntField(options, jniCache.datagramBatchSizeField);
+    serverOptions->segmentOffload =
+            (JNI_TRUE == env->GetBooleanField(options, jniCache.segmentOffloadField));
+    serverOptions->bufferSize = env->GetIntField(options, jniCache.bufferSizeField);
+    serverOptions->hugePages =
+            (JNI_TRUE == env->GetBooleanField(options, jniCache.hugePagesField));
+    serverOptions->framing = (JNI_TRUE == env->GetBooleanField(options, jniCache.framingField));
+    serverOptions->integrity =
+            (JNI_TRUE == env->GetBooleanField(options, jniCache.integrityField));
+    if (serverOptions->integrity) {
+        // 校验和在帧尾，只有分帧时才能找到
+        serverOptions->framing = true;
+    }
+    serverOptions->seqPacket =
+            (JNI_TRUE == env->GetBooleanField(options, jniCache.seqPacketField));
+    serverOptions->socketProfile = env->GetIntField(options, jniCache.socketProfileField);
+    serverOptions->busyPoll = (JNI_TRUE == env->GetBooleanField(options, jniCache.busyPollField));
+    serverOptions->busyPollIdleMicros =
+            env->GetIntField(options, jniCache.busyPollIdleMicrosField);
+    serverOptions->busyPollCpu = env->GetIntField(options, jniCache.busyPollCpuField);
+    serverOptions->messageHandler = env->GetIntField(options, jniCache.messageHandlerField);
+    serverOptions->handlerThreads = env->GetIntField(options, jniCache.handlerThreadsField);
+    serverOptions->writeHighWatermark =
+            env->GetIntField(options, jniCache.writeHighWatermarkField);
+    serverOptions->writeLowWatermark = env->GetIntField(options, jniCache.writeLowWatermarkField);
+
+    if (serverOptions->bufferSize <= 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Buffer size must be positive");
+    } else if (NULL == SocketProfileGet(serverOptions->socketProfile)) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass, "Unknown socket profile");
+    } else if (serverOptions->busyPollIdleMicros < 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Busy poll idle time must not be negative");
+    } else if (NULL == MessageHandlerGet(serverOptions->messageHandler)) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass, "Unknown message handler");
+    } else if (serverOptions->handlerThreads < 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Handler threads must not be negative");
+    } else if (serverOptions->writeLowWatermark < 0
+               || serverOptions->writeHighWatermark < serverOptions->writeLowWatermark) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Write watermarks must satisfy 0 <= low <= high");
+    }
+}
 
-    // 阻塞和等待进来的客户链接
-    // 并且接受它
-    LogMessage(env, obj, "Waiting for a client connection...");
+/**
+ * 正在运行、可以停止和交接的 TCP 服务器，按启动顺序排列；
+ * 交接期间新旧两个实例同时运行，停止入口总是作用于最早启动的实例
+ */
+struct RunningServer {
+    // 以下三者只有一个不为空：事件循环数组（分片服务器每个工作线程一个）、io_uring 事件循环或者协程服务器
+    struct EventLoop **eventLoops;
+    size_t eventLoopCount;
+    struct UringLoop *uringLoop;
+    struct CoEchoServer *coServer;
+
+    struct RunningServer *next;
+};
+
+static pthread_mutex_t runningServersLock = PTHREAD_MUTEX_INITIALIZER;
+static struct RunningServer *runningServers = NULL;
+
+/**
+ * 登记正在运行的 TCP 服务器
+ * @param server 服务器，在调用者的栈上，运行结束前必须取消登记
+ */
+static void PublishServer(struct RunningServer *server) {
+    server->next = NULL;
+    pthread_mutex_lock(&runningServersLock);
+    struct RunningServer **tail = &runningServers;
+    while (NULL != *tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = server;
+    pthread_mutex_unlock(&runningServersLock);
+}
+
+/**
+ * 取消登记，之后停止入口不会再访问它的事件循环
+ * @param server 服务器
+ */
+static void UnpublishServer(struct RunningServer *server) {
+    pthread_mutex_lock(&runningServersLock);
+    for (struct RunningServer **link = &runningServers; NULL != *link; link = &(*link)->next) {
+        if (server == *link) {
+            *link = server->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&runningServersLock);
+}
 
-    int clientSocket = accept(sd, (struct sockaddr *) &address, &addressLength);
+/**
+ * 尝试在当前线程用 io_uring 事件循环服务 socket，直到停止
+ * @param env
+ * @param obj
+ * @param sd 监听 socket 或者已绑定的数据报 socket
+ * @param datagram sd 是否为数据报 socket
+ * @param bufferSize 每个缓冲区的大小，由 UringLoopInit 限制在 URING_MAX_BUFFER_SIZE 以内
+ * @param socketProfile 接受的连接使用的调优方案，SocketProfileId
+ * @param stoppable 是否登记为可以用 nativeStopTcpServer 停止的 TCP 服务器
+ * @return 内核不支持 io_uring 时返回 false，调用者应回退到默认实现
+ */
+static bool ServeWithUringLoop(JNIEnv *env, jobject obj, int sd, bool datagram,
+                               size_t bufferSize, int socketProfile, bool stoppable) {
+    struct UringLoop loop;
+
+    // 初始化 io_uring，失败说明内核不支持或者被禁用
+    if (-1 == UringLoopInit(&loop, bufferSize, (SOCKET_PROFILE_DEFAULT == socketProfile)
+                                               ? NULL : SocketProfileGet(socketProfile))) {
+        LOGW("io_uring is not available (errno %d), falling back.", errno);
+        return false;
+    }
 
-    // 如果客户 socket 无效
-    if (-1 == clientSocket) {
+    int result = datagram ? UringLoopAddDatagramSocket(&loop, sd)
+                          : UringLoopAddListener(&loop, sd);
+    if (-1 == result) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else {
-        // 记录地址
-        LogAddress(env, obj, "Client connection from ", &address);
+        LOGI("Serving %s with io_uring...", datagram ? "datagrams" : "client connections");
+
+        struct RunningServer server = {NULL, 0, &loop, NULL, NULL};
+        if (stoppable) {
+            PublishServer(&server);
+        }
+
+        // 运行事件循环直到停止
+        int runResult = UringLoopRun(&loop);
+        int error = errno;
+        if (stoppable) {
+            UnpublishServer(&server);
+        }
+        if (-1 == runResult) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, error);
+        }
     }
 
-    return clientSocket;
+    // 关闭全部客户连接
+    UringLoopDestroy(&loop);
+    return true;
 }
 
 /**
- * 阻塞并接收来自 socket 的数据放到缓冲区
+ * 在当前线程用非阻塞、边缘触发的事件循环服务监听 socket 上的全部客户连接，
+ * TCP 和本地 UNIX socket 通用
  * @param env
  * @param obj
- * @param sd
- * @param buffer
- * @param bufferSize
- * @return
+ * @param serverSocket 已经处于监听状态的 socket，-1 表示只服务交接来的监听 socket
+ * @param handoffSocket 连接到旧实例的交接 socket，事件循环接管；-1 表示不接收交接
+ * @param serverOptions 服务器选项
+ * @param stoppable 是否登记为可以用 nativeStopTcpServer 停止和交接的 TCP 服务器
  */
-static ssize_t ReceiveFromSocket(
-        JNIEnv *env, jobject obj, int sd, char *buffer, size_t bufferSize) {
-    // 阻塞并接收来自 socket 的数据放到缓冲区
-    LogMessage(env, obj, "Receiving from the socket...");
-    /*
-     * recv 函数
-     *     socket descriptor: 指定接收数据的 socket 实例
-     *     buffer pointer: 指向内存地址的指针，用于保存接收数据
-     *     buffer length: 数据缓冲区大小
-     *     flags: 指定接收所需的额外标志
-     */
-    ssize_t recvSize = recv(sd, buffer, bufferSize - 1, 0);
+static void ServeWithEventLoop(JNIEnv *env, jobject obj, int serverSocket, int handoffSocket,
+                               const struct ServerOptions *serverOptions, bool stoppable) {
+    struct EventLoop loop;
 
-    // 如果接收失败
-    if (-1 == recvSize) {
+    // 初始化事件循环
+    if (-1 == EventLoopInit(&loop, serverOptions)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        if (-1 != handoffSocket) {
+            close(handoffSocket);
+        }
+        return;
+    }
+
+    // 注册监听 socket 和交接 socket
+    if (-1 != serverSocket && -1 == EventLoopAddListener(&loop, serverSocket)) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        if (-1 != handoffSocket) {
+            close(handoffSocket);
+        }
+    } else if (-1 != handoffSocket && -1 == EventLoopAddHandoff(&loop, handoffSocket)) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        close(handoffSocket);
     } else {
-        // 以 NULL 结尾缓冲区形成一个字符串
-        buffer[recvSize] = NULL;
+        LOGI("Serving client connections with the event loop%s%s%s%s%s...",
+                   loop.zeroCopy ? " using splice()" : "",
+                   loop.framing ? (loop.checksums ? " with CRC32C-checked framing"
+                                                  : " with length-prefixed framing") : "",
+                   loop.messages ? " record by record" : "",
+                   loop.busyPoll ? " busy polling" : "",
+                   (-1 != handoffSocket) ? " taken over from a running server" : "");
+        if (NULL != loop.handler) {
+            LOGI("Handling frames with the %s handler on %d handler threads", loop.handler->name,
+                 (NULL != loop.handlerPool) ? loop.handlerPool->workerCount : 0);
+        }
 
-        // 如果接收数据成功
-        if (recvSize > 0) {
-            LogMessage(env, obj, "Received %d byte: %s", recvSize, buffer);
-        } else {
-            LogMessage(env, obj, "Client disconnected");
+        struct EventLoop *loops[] = {&loop};
+        struct RunningServer server = {loops, 1, NULL, NULL, NULL};
+        if (stoppable) {
+            PublishServer(&server);
+        }
+
+        // 运行事件循环直到停止，或者排空后全部连接已经交出或关闭
+        int result = EventLoopRun(&loop);
+        int error = errno;
+        if (stoppable) {
+            UnpublishServer(&server);
+        }
+        if (loop.draining) {
+            LOGI("Server drained.");
+        }
+
+        // 报告零拷贝模式下每次 splice 调用平均移动的字节数
+        if (loop.zeroCopy) {
+            LOGI("Spliced %llu bytes in %llu calls (%llu bytes per call).",
+                       (unsigned long long) loop.splicedBytes,
+                       (unsigned long long) loop.spliceCalls,
+                       (unsigned long long) ((0 == loop.spliceCalls) ? 0
+                                             : loop.splicedBytes / loop.spliceCalls));
+        }
+
+        // 报告忙轮询的空转次数和退回阻塞等待的次数
+        if (loop.busyPoll) {
+            LOGI("Busy polled %llu empty rounds and blocked %llu times when idle.",
+                       (unsigned long long) loop.busyPollSpins,
+                       (unsigned long long) loop.busyPollSleeps);
+        }
+
+        if (-1 == result) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, error);
         }
     }
-    return recvSize;
+
+    // 交接来的监听 socket 由这里关闭，调用者只关闭自己的监听 socket
+    for (size_t i = 0; i < loop.listenerCount; i++) {
+        if (serverSocket != loop.listeners[i]->fd) {
+            close(loop.listeners[i]->fd);
+        }
+    }
+
+    // 关闭全部客户连接
+    EventLoopDestroy(&loop);
 }
 
 /**
- * 将数据缓冲区的数据发送到 socket
+ * 在当前线程用协程服务监听 socket 上的全部客户连接，每个连接由一个顺序执行的回显协程处理，
+ * TCP 和本地 UNIX socket 通用
  * @param env
  * @param obj
- * @param sd
- * @param buffer
- * @param bufferSize
- * @return
+ * @param serverSocket 已经处于监听状态的 socket
+ * @param serverOptions 服务器选项
+ * @param stoppable 是否登记为可以用 nativeStopTcpServer 停止的 TCP 服务器
  */
-static ssize_t SendToSocket(
-        JNIEnv *env, jobject obj, int sd, const char *buffer, size_t bufferSize) {
-    // 将数据缓冲区发送到 socket
-    LogMessage(env, obj, "Sending to the socket...");
-    ssize_t sentSize = send(sd, buffer, bufferSize, 0);
+static void ServeWithCoroutines(JNIEnv *env, jobject obj, int serverSocket,
+                                const struct ServerOptions *serverOptions, bool stoppable) {
+    struct CoEchoServer coServer;
 
-    // 如果发送失败
-    if (-1 == sentSize) {
+    // 初始化反应器
+    if (-1 == CoEchoServerInit(&coServer, serverOptions)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+
+    // 启动接受协程
+    if (-1 == CoEchoServerAddListener(&coServer, serverSocket)) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else {
-        if (sentSize > 0) {
-            LogMessage(env, obj, "Send %d bytes: %s", sentSize, buffer);
-        } else {
-            LogMessage(env, obj, "Client disconnected.");
+        LOGI("Serving client connections with coroutines...");
+
+        struct RunningServer server = {NULL, 0, NULL, &coServer, NULL};
+        if (stoppable) {
+            PublishServer(&server);
+        }
+
+        // 运行反应器直到停止后全部连接关闭
+        int result = CoEchoServerRun(&coServer);
+        int error = errno;
+        if (stoppable) {
+            UnpublishServer(&server);
+        }
+
+        // 报告帧池向系统申请内存的次数，稳定运行后不随连接数增加
+        LOGI("Coroutine frames were allocated %llu times.",
+                   (unsigned long long) coServer.reactor.frames.allocations);
+
+        if (-1 == result) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, error);
         }
     }
-    return sentSize;
+
+    // 释放反应器和帧池
+    CoEchoServerDestroy(&coServer);
 }
 
-void
-Java_com_liu_echo_EchoServerActivity_nativeStartTcpServer(JNIEnv *env, jobject obj, jint port) {
+/**
+ * 用选项指定的 I/O 后端服务监听 socket 上的全部客户连接
+ * @param env
+ * @param obj
+ * @param serverSocket 已经处于监听状态的 socket
+ * @param serverOptions 服务器选项
+ * @param stoppable 是否登记为可以用 nativeStopTcpServer 停止的 TCP 服务器
+ */
+static void ServeListener(JNIEnv *env, jobject obj, int serverSocket,
+                          const struct ServerOptions *serverOptions, bool stoppable) {
+    // 协程只实现了普通的流回显
+    if ((IO_BACKEND_COROUTINE == serverOptions->backend) && !serverOptions->zeroCopy
+        && !serverOptions->framing && !serverOptions->seqPacket && !serverOptions->busyPoll) {
+        ServeWithCoroutines(env, obj, serverSocket, serverOptions, stoppable);
+        return;
+    }
+
+    // 零拷贝、分帧、记录和忙轮询模式只由 epoll 事件循环实现；io_uring 不可用时同样回退到 epoll 事件循环
+    if ((IO_BACKEND_IO_URING == serverOptions->backend) && !serverOptions->zeroCopy
+        && !serverOptions->framing && !serverOptions->seqPacket && !serverOptions->busyPoll
+        && ServeWithUringLoop(env, obj, serverSocket, false, (size_t) serverOptions->bufferSize,
+                              serverOptions->socketProfile, stoppable)) {
+        return;
+    }
+    ServeWithEventLoop(env, obj, serverSocket, -1, serverOptions, stoppable);
+}
+
+static void
+Java_com_liu_echo_EchoServerActivity_nativeStartTcpServer(JNIEnv *env, jobject obj, jint port,
+                                                          jobject options) {
+    // 读取服务器选项
+    struct ServerOptions serverOptions;
+    GetServerOptions(env, options, &serverOptions);
+    if (NULL != env->ExceptionOccurred()) {
+        return;
+    }
+
     // 构造新的 TCP socket。
     int serverSocket = NewTcpSocket(env, obj);
     if (NULL == env->ExceptionOccurred()) {
+        // 接受的连接继承监听 socket 的选项
+        ApplySocketProfile(env, obj, serverSocket, serverOptions.socketProfile,
+                           SOCKET_ROLE_LISTENER);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
         // 将 socket 绑定到某端口号
-        BindSocketToPort(env, obj, serverSocket, (unsigned short) port);
+        BindSocketToPort(env, obj, serverSocket, (unsigned short) port, false);
         if (NULL != env->ExceptionOccurred()) {
             goto exit;
         }
@@ -336,53 +716,229 @@ Java_com_liu_echo_EchoServerActivity_nativeStartTcpServer(JNIEnv *env, jobject o
             }
         }
 
-        // 监听有4个等待连接的 backlog 的 socket
-        ListenOnSocket(env, obj, serverSocket, 4);
+        // 监听 socket
+        ListenOnSocket(env, obj, serverSocket,
+                       SocketProfileGet(serverOptions.socketProfile)->backlog);
         if (NULL != env->ExceptionOccurred()) {
             goto exit;
         }
 
-        // 接受 socket 的一个客户连接
-        int clientSocket = AcceptOnSocket(env, obj, serverSocket);
+        // 用选择的 I/O 后端服务全部客户连接
+        ServeListener(env, obj, serverSocket, &serverOptions, true);
+    }
+
+    exit:
+    if (serverSocket > 0) {
+        close(serverSocket);
+    }
+}
+
+/**
+ * 分片 TCP 服务器的工作线程，每个工作线程拥有独立的监听 socket 和事件循环，互相之间不共享锁
+ */
+struct ServerWorker {
+    // 工作线程
+    pthread_t thread;
+
+    // 工作线程是否已经启动
+    bool started;
+
+    // 以 SO_REUSEPORT 绑定的监听 socket
+    int serverSocket;
+
+    // 绑定的 CPU 核心，-1 表示不绑定
+    int cpu;
+
+    // 工作线程自己的事件循环
+    struct EventLoop loop;
+
+    // 事件循环失败时的错误号
+    int error;
+};
+
+/**
+ * 工作线程入口，可选地绑定 CPU 核心后运行事件循环
+ * @param arg ServerWorker 实例
+ * @return NULL
+ */
+static void *RunServerWorker(void *arg) {
+    struct ServerWorker *worker = (struct ServerWorker *) arg;
+
+    // 将线程绑定到指定的 CPU 核心，失败时继续以不绑定的方式运行
+    if (worker->cpu >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(worker->cpu, &cpuSet);
+        sched_setaffinity(0, sizeof(cpuSet), &cpuSet);
+    }
+
+    if (-1 == EventLoopRun(&worker->loop)) {
+        worker->error = errno;
+    }
+    return NULL;
+}
+
+/**
+ * 启动分片 TCP 服务器
+ *     每个工作线程用 SO_REUSEPORT 绑定同一端口，由内核在各个监听 socket 之间分配新连接，
+ *     吞吐量随核心数线性增长。工作线程总是使用 epoll 事件循环，全部工作线程作为一个服务器登记，
+ *     nativeStopTcpServer 同时排空它们
+ * @param env
+ * @param obj
+ * @param port 端口号，0 表示随机分配
+ * @param options 服务器选项，每个工作线程的事件循环和监听 socket 都按它配置
+ * @param workerCount 工作线程数，小于等于 0 表示使用在线 CPU 核心数
+ * @param pinToCores 是否将每个工作线程绑定到一个 CPU 核心
+ */
+static void Java_com_liu_echo_EchoServerActivity_nativeStartShardedTcpServer
+        (JNIEnv *env, jobject obj, jint port, jobject options, jint workerCount,
+         jboolean pinToCores) {
+    // 读取服务器选项
+    struct ServerOptions serverOptions;
+    GetServerOptions(env, options, &serverOptions);
+    if (NULL != env->ExceptionOccurred()) {
+        return;
+    }
+
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpuCount < 1) {
+        cpuCount = 1;
+    }
+    if (workerCount <= 0) {
+        workerCount = (jint) cpuCount;
+    }
+
+    struct ServerWorker *workers =
+            (struct ServerWorker *) calloc((size_t) workerCount, sizeof(struct ServerWorker));
+    struct EventLoop **loops =
+            (struct EventLoop **) calloc((size_t) workerCount, sizeof(struct EventLoop *));
+    if (NULL == workers || NULL == loops) {
+        ThrowException(env, jniCache.outOfMemoryErrorClass, "Unable to allocate server workers");
+        free(workers);
+        free(loops);
+        return;
+    }
+    for (jint i = 0; i < workerCount; i++) {
+        workers[i].serverSocket = -1;
+        loops[i] = &workers[i].loop;
+    }
+    struct RunningServer server = {loops, (size_t) workerCount, NULL, NULL, NULL};
+
+    // 在调用线程中构造全部监听 socket，以便用 JNI 报告错误
+    unsigned short serverPort = (unsigned short) port;
+    jint i;
+    for (i = 0; i < workerCount; i++) {
+        struct ServerWorker *worker = &workers[i];
+
+        // 构造新的 TCP socket
+        worker->serverSocket = NewTcpSocket(env, obj);
         if (NULL != env->ExceptionOccurred()) {
             goto exit;
         }
 
-        char buffer[MAX_BUFFER_SIZE];
-        ssize_t recvSize;
-        ssize_t sentSize;
+        // 接受的连接继承监听 socket 的选项
+        ApplySocketProfile(env, obj, worker->serverSocket, serverOptions.socketProfile,
+                           SOCKET_ROLE_LISTENER);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
 
-        // 接收并发送数据
-        while (1) {
-            // 从 socket 中接收
-            recvSize = ReceiveFromSocket(env, obj, clientSocket, buffer, MAX_BUFFER_SIZE);
+        // 所有工作线程绑定同一端口
+        BindSocketToPort(env, obj, worker->serverSocket, serverPort, true);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
 
-            if ((0 == recvSize) || (NULL != env->ExceptionOccurred())) {
-                break;
+        // 如果请求了随机端口号，其余工作线程复用第一个绑定到的端口号
+        if (0 == serverPort) {
+            serverPort = GetSocketPort(env, obj, worker->serverSocket);
+            if (NULL != env->ExceptionOccurred()) {
+                goto exit;
             }
+        }
 
-            // 发送给 socket
-            sentSize = SendToSocket(env, obj, clientSocket, buffer, (size_t) recvSize);
+        // 监听 socket
+        ListenOnSocket(env, obj, worker->serverSocket,
+                       SocketProfileGet(serverOptions.socketProfile)->backlog);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
 
-            if ((0 == sentSize) || (NULL != env->ExceptionOccurred())) {
-                break;
-            }
+        // 初始化工作线程自己的事件循环
+        if (-1 == EventLoopInit(&worker->loop, &serverOptions)) {
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
+        }
+        if (-1 == EventLoopAddListener(&worker->loop, worker->serverSocket)) {
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            EventLoopDestroy(&worker->loop);
+            goto exit;
         }
 
-        // 关闭客户端
-        close(clientSocket);
+        worker->cpu = pinToCores ? (int) (i % cpuCount) : -1;
+        worker->started = (0 == pthread_create(&worker->thread, NULL, RunServerWorker, worker));
+        if (!worker->started) {
+            ThrowException(env, jniCache.ioExceptionClass, "Unable to start server worker");
+            EventLoopDestroy(&worker->loop);
+            goto exit;
+        }
     }
 
+    LOGI("Serving client connections with %d workers%s...", workerCount,
+               pinToCores ? " pinned to cores" : "");
+    PublishServer(&server);
+
     exit:
-    if (serverSocket > 0) {
-        close(serverSocket);
+    // 如果启动失败，停止已经启动的工作线程
+    if (NULL != env->ExceptionOccurred()) {
+        for (jint j = 0; j < workerCount; j++) {
+            if (workers[j].started) {
+                EventLoopStop(&workers[j].loop);
+            }
+        }
+    }
+
+    // 等待全部工作线程结束，任一工作线程失败时停止其余的工作线程
+    int error = 0;
+    for (jint j = 0; j < workerCount; j++) {
+        struct ServerWorker *worker = &workers[j];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+            if (0 != worker->error && 0 == error) {
+                error = worker->error;
+                for (jint k = j + 1; k < workerCount; k++) {
+                    if (workers[k].started) {
+                        EventLoopStop(&workers[k].loop);
+                    }
+                }
+            }
+        }
+    }
+
+    // 取消登记后才能释放事件循环，停止入口可能正在访问它们；未启动时没有登记，取消登记不做任何事
+    UnpublishServer(&server);
+    for (jint j = 0; j < workerCount; j++) {
+        struct ServerWorker *worker = &workers[j];
+        if (worker->started) {
+            EventLoopDestroy(&worker->loop);
+        }
+        if (worker->serverSocket >= 0) {
+            close(worker->serverSocket);
+        }
+    }
+    free(loops);
+    free(workers);
+
+    if (0 != error && NULL == env->ExceptionOccurred()) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, error);
     }
 }
 
 static void ConnectToAddress(
         JNIEnv *env, jobject obj, int sd, const char *ip, unsigned short port) {
     // 连接到给定的 IP 地址和端口号
-    LogMessage(env, obj, "Connecting to %s:%uh...", ip, port);
+    LOGI("Connecting to %s:%uh...", ip, port);
 
     struct sockaddr_in address;
 
@@ -392,39 +948,136 @@ static void ConnectToAddress(
     // 将 IP 地址字符串转换为网络地址
     if (0 == inet_aton(ip, &(address.sin_addr))) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else {
         // 将端口号转换为网络字节顺序
         address.sin_port = htons(port);
         // 转换为地址
         if (-1 == connect(sd, (const sockaddr *) &address, sizeof(address))) {
             // 抛出带错误号的异常
-            ThrowErrnoException(env, "java/io/IOException", errno);
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
         } else {
-            LogMessage(env, obj, "Connected.");
+            LOGI("Connected.");
         }
     }
 }
 
-void
-Java_com_liu_echo_EchoClientActivity_nativeStartTcpClient(JNIEnv *env, jobject obj, jstring ip,
-                                                          jint port,
-                                                          jstring message) {
-    // 构造新的 TCP socket
-    int clientSocket = NewTcpSocket(env, obj);
-    if (NULL == env->ExceptionOccurred()) {
+/**
+ * 接收完整的回显
+ *     流 socket 不保留消息边界，一次 recv 只能收到回显的一部分，需要一直接收到与发送的长度相同；
+ *     缓冲区链按 bufferSize 分段，每次 readv 读入多个分段
+ * @param env
+ * @param obj
+ * @param sd
+ * @param messageSize 回显的长度
+ * @param bufferSize 缓冲区链的分段大小
+ * @param frame 发送的帧头，校验回显时与回显的帧头比较；不校验时为 NULL
+ */
+static void ReceiveEchoFromSocket(JNIEnv *env, jobject obj, int sd, size_t messageSize,
+                                  size_t bufferSize, const char *frame) {
+    struct BufferChain chain;
+    size_t readCount = 0;
 
-        // 以 C 字符串形式获取 IP 地址
-        const char *ipAddress = env->GetStringUTFChars(ip, NULL);
-        if (NULL == ipAddress) {
+    if (-1 == BufferChainInit(&chain, bufferSize, messageSize)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+
+    LOGD("Receiving from the socket...");
+    while (BufferChainPending(&chain) < messageSize) {
+        ssize_t recvSize = BufferChainRead(&chain, sd);
+        if (-1 == recvSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
+        }
+        if (0 == recvSize) {
+            ThrowException(env, jniCache.ioExceptionClass,
+                           "Connection closed before the whole echo was received");
             goto exit;
         }
+        readCount++;
+    }
 
-        // 连接到 IP 地址和端口
-        ConnectToAddress(env, obj, clientSocket, ipAddress, (unsigned short) port);
+    LOGI("Received %llu bytes in %llu reads.", (unsigned long long) messageSize,
+         (unsigned long long) readCount);
 
-        // 释放已经用完的 IP 地址，
-        env->ReleaseStringUTFChars(ip, ipAddress);
+    // 回显的帧头必须与发送的相同，帧尾必须与回显的负载一致
+    if (NULL != frame) {
+        char header[FRAME_HEADER_SIZE];
+        BufferChainCopyOut(&chain, header, sizeof(header));
+        if (0 != memcmp(header, frame, sizeof(header))
+            || !FrameVerifyChecksum(&chain, chain.offset, messageSize)) {
+            ThrowException(env, jniCache.ioExceptionClass, "Echo checksum mismatch");
+            goto exit;
+        }
+        LOGI("Echo checksum verified with %s CRC32C.",
+             Crc32cImplementationName(Crc32cGetImplementation()));
+    }
+
+    // 只记录回显的开头，日志消息本身有长度限制
+    if (NativeLogIsEnabled(LOG_LEVEL_DEBUG)) {
+        char text[NATIVE_LOG_MESSAGE_LENGTH];
+        size_t textLength = BufferChainCopyOut(&chain, text, sizeof(text) - 1);
+        text[textLength] = 0;
+        LOGD("Received: %s", text);
+    }
+
+    exit:
+    BufferChainDestroy(&chain);
+}
+
+/**
+ * 根据给定服务器 IP 地址和端口号启动 TCP 客户端，发送给定消息并接收完整的回显
+ * @param env
+ * @param obj
+ * @param ip
+ * @param port
+ * @param message
+ * @param bufferSize 接收缓冲区链的分段大小
+ * @param socketProfile
+ * @param integrity 是否把消息作为带 CRC32C 帧尾的帧发送并校验回显，服务器需要启用 integrity
+ */
+static void
+Java_com_liu_echo_EchoClientActivity_nativeStartTcpClient(JNIEnv *env, jobject obj, jstring ip,
+                                                          jint port,
+                                                          jstring message,
+                                                          jint bufferSize,
+                                                          jint socketProfile,
+                                                          jboolean integrity) {
+    if (bufferSize <= 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Buffer size must be positive");
+        return;
+    }
+
+    // 校验模式下发送的帧
+    char *frame = NULL;
+
+    // 构造新的 TCP socket
+    int clientSocket = NewTcpSocket(env, obj);
+    if (NULL == env->ExceptionOccurred()) {
+        // 连接之前应用调优方案
+        ApplySocketProfile(env, obj, clientSocket, socketProfile, SOCKET_ROLE_CLIENT);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        // 以 C 字符串形式获取 IP 地址
+        const char *ipAddress = env->GetStringUTFChars(ip, NULL);
+        if (NULL == ipAddress) {
+            goto exit;
+        }
+
+        // 连接到 IP 地址和端口
+        ConnectToAddress(env, obj, clientSocket, ipAddress, (unsigned short) port);
+
+        // 释放已经用完的 IP 地址，
+        env->ReleaseStringUTFChars(ip, ipAddress);
 
         // 如果连接不成功
         if (NULL != env->ExceptionOccurred()) {
@@ -438,10 +1091,30 @@ Java_com_liu_echo_EchoClientActivity_nativeStartTcpClient(JNIEnv *env, jobject o
         }
 
         // 获取消息大小
-        jsize messageSize = env->GetStringUTFLength(message);
+        size_t messageSize = (size_t) env->GetStringUTFLength(message);
+
+        // 校验模式下在消息前后加上帧头和 CRC32C 帧尾，整个帧放进一个缓冲区一次发送；
+        // 多一个结尾的 0 字节，调试日志可以把缓冲区当作字符串输出
+        const char *sendData = messageText;
+        if (JNI_TRUE == integrity) {
+            frame = (char *) malloc(FRAME_HEADER_SIZE + messageSize + FRAME_CHECKSUM_SIZE + 1);
+            if (NULL == frame) {
+                env->ReleaseStringUTFChars(message, messageText);
+                ThrowErrnoException(env, jniCache.ioExceptionClass, ENOMEM);
+                goto exit;
+            }
+            FrameEncodeHeader(frame, (uint32_t) (messageSize + FRAME_CHECKSUM_SIZE));
+            memcpy(frame + FRAME_HEADER_SIZE, messageText, messageSize);
+            // 帧尾与帧头一样按大端序存放
+            FrameEncodeHeader(frame + FRAME_HEADER_SIZE + messageSize,
+                              Crc32c(messageText, messageSize));
+            messageSize += FRAME_HEADER_SIZE + FRAME_CHECKSUM_SIZE;
+            frame[messageSize] = 0;
+            sendData = frame;
+        }
 
         // 发送消息给 socket
-        SendToSocket(env, obj, clientSocket, messageText, (size_t) messageSize);
+        SendToSocket(env, obj, clientSocket, sendData, messageSize);
 
         // 释放已经用完的消息文本
         env->ReleaseStringUTFChars(message, messageText);
@@ -451,12 +1124,19 @@ Java_com_liu_echo_EchoClientActivity_nativeStartTcpClient(JNIEnv *env, jobject o
             goto exit;
         }
 
-        char buffer[MAX_BUFFER_SIZE];
+        // 每次只读取回显剩余的长度，可以使用方案的接收低水位
+        if (-1 == SocketProfileSetReceiveLowWatermark(SocketProfileGet(socketProfile),
+                                                      clientSocket)) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
+        }
 
-        // 从 socket 接收
-        ReceiveFromSocket(env, obj, clientSocket, buffer, MAX_BUFFER_SIZE);
+        // 从 socket 接收完整的回显
+        ReceiveEchoFromSocket(env, obj, clientSocket, messageSize, (size_t) bufferSize, frame);
     }
     exit:
+    free(frame);
     if (clientSocket > -1) {
         close(clientSocket);
     }
@@ -470,13 +1150,13 @@ Java_com_liu_echo_EchoClientActivity_nativeStartTcpClient(JNIEnv *env, jobject o
  */
 static int NewUdpSocket(JNIEnv *env, jobject obj) {
     // 构造 socket
-    LogMessage(env, obj, "Constructing a new UDP socket...");
+    LOGI("Constructing a new UDP socket...");
     int udpSocket = socket(PF_INET, SOCK_DGRAM, 0);
 
     // 检查 socket 构造是否正确
     if (-1 == udpSocket) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     }
 
     return udpSocket;
@@ -490,7 +1170,7 @@ static int NewUdpSocket(JNIEnv *env, jobject obj) {
  * @param sd
  * @param address
  * @param buffer
- * @param bufferSize
+ * @param bufferSize 缓冲区大小，包括结尾的 0 字节
  * @return
  */
 static ssize_t ReceiveDatagramFromSocket(JNIEnv *env, jobject obj,
@@ -501,16 +1181,16 @@ static ssize_t ReceiveDatagramFromSocket(JNIEnv *env, jobject obj,
     socklen_t addressLength = sizeof(struct sockaddr_in);
 
     // 从 socket 中接收数据
-    LogMessage(env, obj, "Receiving from the socket...");
+    LOGD("Receiving from the socket...");
     /*
      * ssize_t recvfrom(int __fd, void* __buf, size_t __n, int __flags, struct sockaddr* __src_addr, socklen_t* __src_addr_length);
      */
-    ssize_t recvSize = recvfrom(sd, buffer, bufferSize, 0, (struct sockaddr *) address,
+    ssize_t recvSize = recvfrom(sd, buffer, bufferSize - 1, 0, (struct sockaddr *) address,
                                 &addressLength);
 
     if (-1 == recvSize) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else {
         // 记录地址
         LogAddress(env, obj, "Received from", address);
@@ -520,7 +1200,7 @@ static ssize_t ReceiveDatagramFromSocket(JNIEnv *env, jobject obj,
 
         // 如果数据已经接收
         if (recvSize > 0) {
-            LogMessage(env, obj, "Received %d byte: %s", recvSize, buffer);
+            LOGD("Received %d byte: %s", (int) recvSize, buffer);
         }
     }
     return recvSize;
@@ -547,27 +1227,90 @@ static ssize_t SendDatagramToSocket(JNIEnv *env, jobject obj,
                               sizeof(struct sockaddr_in));
     // 如果发送失败
     if (-1 == sentSize) {
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     } else if (sentSize > 0) {
-        LogMessage(env, obj, "Sent %d bytes: %s", sentSize, buffer);
+        LOGD("Sent %d bytes: %s", (int) sentSize, buffer);
     }
     return sentSize;
 }
 
+/**
+ * 持续回显数据报，每次 recvmmsg 取走最多 batchSize 个数据报并用一次 sendmmsg 发回
+ * @param env
+ * @param obj
+ * @param sd 已绑定的 UDP socket
+ * @param batchSize 每次系统调用收发的最大数据报数
+ * @param segmentOffload 是否启用 UDP_GRO/UDP_SEGMENT 分段卸载
+ * @param datagramSize 不启用分段卸载时每个数据报的最大长度
+ */
+static void ServeDatagramBatches(JNIEnv *env, jobject obj, int sd, unsigned batchSize,
+                                 bool segmentOffload, size_t datagramSize) {
+    struct DatagramBatch batch;
+
+    // 内核不支持 UDP_GRO 时回退到逐个数据报收发
+    if (segmentOffload && -1 == DatagramEnableGro(sd)) {
+        LOGW("UDP segmentation offload is not available, falling back.");
+        segmentOffload = false;
+    }
+
+    // 预分配消息槽，分段卸载时每个消息槽要放下合并后的数据
+    size_t bufferSize = segmentOffload ? DATAGRAM_COALESCED_BUFFER_SIZE : datagramSize;
+    if (-1 == DatagramBatchInit(&batch, batchSize, bufferSize, segmentOffload)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+
+    LOGI("Serving datagrams in batches of up to %u%s...", batchSize,
+               segmentOffload ? " with segmentation offload" : "");
+
+    // 接收并发送回数据报直到 socket 被关闭或者出错
+    int result;
+    do {
+        result = DatagramBatchEcho(&batch, sd);
+    } while (result > 0);
+    int error = errno;
+
+    LOGI("Echoed %llu datagrams in %llu system calls.",
+               (unsigned long long) batch.datagrams, (unsigned long long) batch.syscalls);
+
+    if (-1 == result) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, error);
+    }
+
+    DatagramBatchDestroy(&batch);
+}
+
 /**
  * 启动 UDP 服务器
  *     流程：socket->bind->(recvfrom/sendto)->close
+ *     选择 io_uring 后端或者批量模式时持续回显数据报直到停止
  * @param env
  * @param obj
  * @param port
+ * @param options 服务器选项
  */
-void Java_com_liu_echo_EchoServerActivity_nativeStartUdpServer
-        (JNIEnv *env, jobject obj, jint port) {
+static void Java_com_liu_echo_EchoServerActivity_nativeStartUdpServer
+        (JNIEnv *env, jobject obj, jint port, jobject options) {
+    // 读取服务器选项
+    struct ServerOptions serverOptions;
+    GetServerOptions(env, options, &serverOptions);
+    if (NULL != env->ExceptionOccurred()) {
+        return;
+    }
+
     // 构造一个新的 UDP socket
     int serverSocket = NewUdpSocket(env, obj);
     if (NULL == env->ExceptionOccurred()) {
+        ApplySocketProfile(env, obj, serverSocket, serverOptions.socketProfile,
+                           SOCKET_ROLE_LISTENER);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
         // 将 socket 绑定到某一个端口号
-        BindSocketToPort(env, obj, serverSocket, (unsigned short) port);
+        BindSocketToPort(env, obj, serverSocket, (unsigned short) port, false);
         if (NULL != env->ExceptionOccurred()) {
             goto exit;
         }
@@ -581,25 +1324,45 @@ void Java_com_liu_echo_EchoServerActivity_nativeStartUdpServer
             }
         }
 
+        // io_uring 不可用时回退到阻塞的 recvfrom/sendto
+        if ((IO_BACKEND_IO_URING == serverOptions.backend)
+            && ServeWithUringLoop(env, obj, serverSocket, true, (size_t) serverOptions.bufferSize,
+                                  serverOptions.socketProfile, false)) {
+            goto exit;
+        }
+
+        // 数据报的最大长度
+        size_t datagramSize = (serverOptions.bufferSize < MAX_DATAGRAM_SIZE)
+                              ? (size_t) serverOptions.bufferSize : MAX_DATAGRAM_SIZE;
+
+        // 批量模式下持续回显数据报
+        if (serverOptions.datagramBatchSize > 0) {
+            ServeDatagramBatches(env, obj, serverSocket, (unsigned) serverOptions.datagramBatchSize,
+                                 serverOptions.segmentOffload, datagramSize);
+            goto exit;
+        }
+
         // 客户端地址
         struct sockaddr_in address;
         memset(&address, 0, sizeof(address));
 
-        char buffer[MAX_BUFFER_SIZE];
-        ssize_t recvSize;
-        ssize_t sentSize;
+        // 多留一个字节给结尾的 0 字节
+        char *buffer = (char *) malloc(datagramSize + 1);
+        if (NULL == buffer) {
+            ThrowException(env, jniCache.outOfMemoryErrorClass, "Cannot allocate the buffer");
+            goto exit;
+        }
 
         // 从 socket 中接收
-        recvSize = ReceiveDatagramFromSocket(env, obj, serverSocket, &address, buffer,
-                                             MAX_BUFFER_SIZE);
+        ssize_t recvSize = ReceiveDatagramFromSocket(env, obj, serverSocket, &address, buffer,
+                                                     datagramSize + 1);
 
-        if ((0 == recvSize) || (NULL != env->ExceptionOccurred())) {
-            goto exit;
+        if ((recvSize > 0) && (NULL == env->ExceptionOccurred())) {
+            // 发送给 socket
+            SendDatagramToSocket(env, obj, serverSocket, &address, buffer, (size_t) recvSize);
         }
 
-        // 发送给 socket
-        sentSize = SendDatagramToSocket(env, obj, serverSocket, &address, buffer,
-                                        (size_t) recvSize);
+        free(buffer);
     }
 
     exit:
@@ -608,6 +1371,78 @@ void Java_com_liu_echo_EchoServerActivity_nativeStartUdpServer
     }
 }
 
+/**
+ * 用一次 UDP_SEGMENT 发送把消息切分成多个数据报发给服务器，再合并接收服务器的回显
+ * @param env
+ * @param obj
+ * @param sd UDP socket
+ * @param address 服务器地址
+ * @param message 消息
+ * @param messageSize 消息长度
+ * @param segmentSize 每个数据报的长度
+ */
+static void EchoSegmentedMessage(JNIEnv *env, jobject obj, int sd,
+                                 const struct sockaddr_in *address,
+                                 const char *message, size_t messageSize, size_t segmentSize) {
+    char *buffer = NULL;
+    size_t receivedSize = 0;
+
+    // 启用合并接收，服务器按原长度发回的数据报可以一次收完
+    if (-1 == DatagramEnableGro(sd)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+
+    // 由内核按分段长度切分后发送
+    LogAddress(env, obj, "Sending segmented to", address);
+    ssize_t sentSize = DatagramSendSegmented(sd, address, message, messageSize, segmentSize);
+    if (-1 == sentSize) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+    LOGD("Sent %d bytes in %d datagrams of %d bytes.", (int) sentSize,
+               (int) ((messageSize + segmentSize - 1) / segmentSize), (int) segmentSize);
+
+    // 合并后的数据最长为一个 UDP 负载，多留一个字节用于 NULL 终止
+    buffer = (char *) malloc(DATAGRAM_COALESCED_BUFFER_SIZE + 1);
+    if (NULL == buffer) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, ENOMEM);
+        return;
+    }
+
+    // 接收直到收齐全部回显
+    while (receivedSize < messageSize) {
+        struct sockaddr_in from;
+        memset(&from, 0, sizeof(from));
+        size_t receivedSegmentSize;
+
+        ssize_t recvSize = DatagramReceiveCoalesced(sd, &from, buffer,
+                                                    DATAGRAM_COALESCED_BUFFER_SIZE,
+                                                    &receivedSegmentSize);
+        if (-1 == recvSize) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            break;
+        } else if (0 == recvSize) {
+            break;
+        }
+
+        // 记录地址
+        LogAddress(env, obj, "Received from", &from);
+
+        // 以 NULL 终止缓冲区使其为一个字符串
+        buffer[recvSize] = NULL;
+        LOGD("Received %d bytes in datagrams of %d bytes: %s", (int) recvSize,
+                   (int) receivedSegmentSize, buffer);
+
+        receivedSize += (size_t) recvSize;
+    }
+
+    free(buffer);
+}
+
 /**
  * 启动 UDP 客户端
  *     流程：socket->(sendto/recvfrom)->close
@@ -616,12 +1451,19 @@ void Java_com_liu_echo_EchoServerActivity_nativeStartUdpServer
  * @param ip
  * @param port
  * @param message
+ * @param segmentSize 大于 0 并且小于消息长度时用 UDP_SEGMENT 把消息切分成多个数据报发送
  */
-void Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient
-        (JNIEnv *env, jobject obj, jstring ip, jint port, jstring message) {
+static void Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient
+        (JNIEnv *env, jobject obj, jstring ip, jint port, jstring message, jint segmentSize,
+         jint socketProfile) {
     // 构造一个新的 UDP socket
     int clientSocket = NewUdpSocket(env, obj);
     if (NULL == env->ExceptionOccurred()) {
+        ApplySocketProfile(env, obj, clientSocket, socketProfile, SOCKET_ROLE_CLIENT);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
         struct sockaddr_in address;
 
         memset(&address, 0, sizeof(address));
@@ -652,7 +1494,7 @@ void Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient
         // 如果转换失败
         if (0 == result) {
             // 抛出带错误号的异常
-            ThrowErrnoException(env, "java/io/IOException", errno);
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
             goto exit;
         }
 
@@ -668,6 +1510,14 @@ void Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient
         // 获取消息大小
         jsize messageSize = env->GetStringUTFLength(message);
 
+        // 分段发送时由内核切分消息并合并接收回显
+        if ((segmentSize > 0) && (messageSize > segmentSize)) {
+            EchoSegmentedMessage(env, obj, clientSocket, &address, messageText,
+                                 (size_t) messageSize, (size_t) segmentSize);
+            env->ReleaseStringUTFChars(message, messageText);
+            goto exit;
+        }
+
         // 发送消息给 socket
         SendDatagramToSocket(env, obj, clientSocket, &address, messageText, messageSize);
 
@@ -679,14 +1529,21 @@ void Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient
             goto exit;
         }
 
-        char buffer[MAX_BUFFER_SIZE];
+        // 回显不会比消息长，多留一个字节给结尾的 0 字节
+        char *buffer = (char *) malloc((size_t) messageSize + 1);
+        if (NULL == buffer) {
+            ThrowException(env, jniCache.outOfMemoryErrorClass, "Cannot allocate the buffer");
+            goto exit;
+        }
 
         // 清除地址
         memset(&address, 0, sizeof(address));
 
         // 从 socket 接收
-        ReceiveDatagramFromSocket(env, obj, clientSocket, &address, buffer, MAX_BUFFER_SIZE);
+        ReceiveDatagramFromSocket(env, obj, clientSocket, &address, buffer,
+                                  (size_t) messageSize + 1);
 
+        free(buffer);
     }
 
     exit:
@@ -695,32 +1552,209 @@ void Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient
     }
 }
 
+/**
+ * 记录一次回环数据报基准测试的结果
+ * @param env
+ * @param obj
+ * @param name 收发方式
+ * @param result 测试结果
+ */
+static void LogDatagramBenchmark(JNIEnv *env, jobject obj, const char *name,
+                                 const struct DatagramBenchmarkResult *result) {
+    double seconds = (double) result->elapsedNanos / 1e9;
+    LOGI("%s: %.1f MB/s, %.0f datagrams/s, %llu system calls, %llu bytes lost.",
+               name,
+               (seconds > 0) ? (double) result->receivedBytes / seconds / (1024 * 1024) : 0.0,
+               (seconds > 0) ? (double) result->datagrams / seconds : 0.0,
+               (unsigned long long) result->syscalls,
+               (unsigned long long) (result->sentBytes - result->receivedBytes));
+}
+
+/**
+ * 在回环地址上比较逐个数据报收发和 UDP 分段卸载的吞吐量
+ * @param env
+ * @param obj
+ * @param segmentSize 每个数据报的长度
+ * @param totalBytes 每种方式发送的总字节数
+ */
+static void Java_com_liu_echo_EchoClientActivity_nativeRunUdpBenchmark
+        (JNIEnv *env, jobject obj, jint segmentSize, jint totalBytes) {
+    if (segmentSize <= 0 || totalBytes <= 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Benchmark sizes must be positive");
+        return;
+    }
+
+    struct DatagramBenchmarkResult plain;
+    struct DatagramBenchmarkResult offload;
+
+    LOGI("Sending %d bytes in datagrams of %d bytes over loopback...",
+               totalBytes, segmentSize);
+
+    // 逐个数据报 send/recv
+    if (-1 == DatagramBenchmarkRun(false, (size_t) segmentSize, (size_t) totalBytes, &plain)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+    LogDatagramBenchmark(env, obj, "Per-datagram", &plain);
+
+    // UDP_SEGMENT 发送，UDP_GRO 接收
+    if (-1 == DatagramBenchmarkRun(true, (size_t) segmentSize, (size_t) totalBytes, &offload)) {
+        if (ENOPROTOOPT == errno) {
+            LOGW("UDP segmentation offload is not available.");
+        } else {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        }
+        return;
+    }
+    LogDatagramBenchmark(env, obj, "Segmentation offload", &offload);
+
+    if (offload.elapsedNanos > 0) {
+        LOGI("Segmentation offload is %.1fx as fast.",
+                   (double) plain.elapsedNanos / (double) offload.elapsedNanos);
+    }
+}
+
+/**
+ * 在回环地址上依次用每个调优方案运行 epoll 服务器和客户端，比较往返延迟、大块吞吐量和缓冲区占用
+ * @param env
+ * @param obj
+ * @param payloadSize 一问一答的消息长度
+ * @param exchanges 每个方案交换的消息数
+ * @param bulkBytes 每个方案大块回显的字节数
+ */
+static void Java_com_liu_echo_EchoClientActivity_nativeRunSocketProfileBenchmark
+        (JNIEnv *env, jobject obj, jint payloadSize, jint exchanges, jint bulkBytes) {
+    if (payloadSize <= 0 || exchanges <= 0 || bulkBytes < 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Benchmark sizes must be positive");
+        return;
+    }
+
+    struct LoopbackBenchmarkResult *result = (struct LoopbackBenchmarkResult *) malloc(
+            sizeof(struct LoopbackBenchmarkResult));
+    if (NULL == result) {
+        ThrowException(env, jniCache.outOfMemoryErrorClass, "Unable to allocate benchmark result");
+        return;
+    }
+
+    LOGI("Exchanging %d messages of %d bytes and echoing %d bytes per socket profile...",
+               exchanges, payloadSize, bulkBytes);
+
+    struct ServerOptions serverOptions;
+    ServerOptionsInit(&serverOptions);
+    for (int profile = 0; profile < SOCKET_PROFILE_COUNT; profile++) {
+        serverOptions.socketProfile = profile;
+        if (-1 == LoopbackBenchmarkRun(&serverOptions, (size_t) payloadSize, exchanges,
+                                       (size_t) bulkBytes, result)) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            break;
+        }
+
+        double seconds = (double) result->bulkNanos / 1e9;
+        LOGI("%s: p50 %.1f us, p99 %.1f us, %.1f MB/s, buffers %d/%d bytes.",
+                   SocketProfileGet(profile)->name,
+                   (double) HistogramValueAtPercentile(&result->latency, 50.0) / 1000.0,
+                   (double) HistogramValueAtPercentile(&result->latency, 99.0) / 1000.0,
+                   (seconds > 0) ? (double) result->bulkBytes / seconds / (1024 * 1024) : 0.0,
+                   result->receiveBufferSize, result->sendBufferSize);
+    }
+
+    free(result);
+}
+
+/**
+ * 在回环地址上比较阻塞等待的 epoll 服务器和忙轮询服务器的一问一答延迟分布，
+ * 多核时忙轮询线程绑定到最后一个核心
+ * @param env
+ * @param obj
+ * @param payloadSize 消息长度
+ * @param exchanges 每种模式交换的消息数
+ * @param idleMicros 忙轮询退回阻塞等待之前的空闲时间，单位微秒
+ */
+static void Java_com_liu_echo_EchoClientActivity_nativeRunBusyPollBenchmark
+        (JNIEnv *env, jobject obj, jint payloadSize, jint exchanges, jint idleMicros) {
+    if (payloadSize <= 0 || exchanges <= 0 || idleMicros < 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Benchmark sizes must be positive");
+        return;
+    }
+
+    struct LoopbackBenchmarkResult *results = (struct LoopbackBenchmarkResult *) calloc(
+            2, sizeof(struct LoopbackBenchmarkResult));
+    if (NULL == results) {
+        ThrowException(env, jniCache.outOfMemoryErrorClass, "Unable to allocate benchmark result");
+        return;
+    }
+
+    long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    LOGI("Exchanging %d messages of %d bytes with a blocking and a busy polling server...",
+               exchanges, payloadSize);
+
+    for (int i = 0; i < 2; i++) {
+        struct ServerOptions serverOptions;
+        ServerOptionsInit(&serverOptions);
+        serverOptions.busyPoll = (1 == i);
+        serverOptions.busyPollIdleMicros = idleMicros;
+        serverOptions.busyPollCpu = (cpuCount > 1) ? (int) (cpuCount - 1) : -1;
+
+        if (-1 == LoopbackBenchmarkRun(&serverOptions, (size_t) payloadSize, exchanges, 0,
+                                       &results[i])) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
+        }
+        LOGI("%s: p50 %.1f us, p99 %.1f us, p99.9 %.1f us.",
+                   serverOptions.busyPoll ? "Busy polling" : "Blocking",
+                   (double) HistogramValueAtPercentile(&results[i].latency, 50.0) / 1000.0,
+                   (double) HistogramValueAtPercentile(&results[i].latency, 99.0) / 1000.0,
+                   (double) HistogramValueAtPercentile(&results[i].latency, 99.9) / 1000.0);
+    }
+
+    {
+        uint64_t busyP99 = HistogramValueAtPercentile(&results[1].latency, 99.0);
+        if (busyP99 > 0) {
+            LOGI("Busy polling p99 is %.2fx the blocking p99.",
+                       (double) busyP99
+                       / (double) HistogramValueAtPercentile(&results[0].latency, 99.0));
+        }
+    }
+
+    exit:
+    free(results);
+}
+
 /**
  *  构造一个新的原生 UNIX socket
  * @param env JNIEnv 接口
  * @param obj Java 对象实例
+ * @param type SOCK_STREAM 或者保留消息边界的 SOCK_SEQPACKET
  * @return sd socket 描述
  */
-static int NewLocalSocket(JNIEnv *env, jobject obj) {
+static int NewLocalSocket(JNIEnv *env, jobject obj, int type) {
     // 构造 Socket
-    LogMessage(env, obj, "Constructing a new local UNIX Socket...");
-    int localSocket = socket(PF_LOCAL, SOCK_STREAM, 0);
+    LOGI("Constructing a new local UNIX %s Socket...",
+         (SOCK_SEQPACKET == type) ? "seqpacket" : "stream");
+    int localSocket = socket(PF_LOCAL, type, 0);
     // 检查 socket 构造是否正确
     if (-1 == localSocket) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     }
     return localSocket;
 }
 
 /**
- * 将本地 UNIX socket 与某一名称绑定，之后就能等待并接收数据了
+ * 构造本地 UNIX socket 地址
  * @param env JNIEnv 接口
- * @param obj Java 对象实例
- * @param sd socket 描述符
- * @param name socket 名称
+ * @param name socket 名称，不以 '/' 开头时在抽象命名空间中
+ * @param address 构造的地址
+ * @return 地址长度，名称太长时抛出异常并返回 0
  */
-static void BindLocalSocketToName(JNIEnv *env, jobject obj, int sd, const char *name) {
+static socklen_t NewLocalAddress(JNIEnv *env, const char *name, struct sockaddr_un *address) {
 
     /*
     sockaddr_un 地址结构体指定本地 socket 的协议地址
@@ -730,8 +1764,6 @@ static void BindLocalSocketToName(JNIEnv *env, jobject obj, int sd, const char *
     };
      */
 
-    struct sockaddr_un address;
-
     // 名字长度
     const size_t nameLength = strlen(name);
 
@@ -748,128 +1780,1352 @@ static void BindLocalSocketToName(JNIEnv *env, jobject obj, int sd, const char *
     }
 
     // 检查路径长度
-    if (pathLength > sizeof(address.sun_path)) {
+    if (pathLength > sizeof(address->sun_path)) {
         // 抛出带错误号的异常
-        ThrowException(env, "java/io/IOException", "Name is too big");
-    } else {
-        // 清除地址字节
-        memset(&address, 0, sizeof(address));
-        address.sun_family = PF_LOCAL;
+        ThrowException(env, jniCache.ioExceptionClass, "Name is too big");
+        return 0;
+    }
 
-        // socket 路径
-        char *sunPath = address.sun_path;
+    // 清除地址字节
+    memset(address, 0, sizeof(*address));
+    address->sun_family = PF_LOCAL;
 
-        // 第一个字节必须是 0 以使用抽象命名空间
-        if (abstractNamespace) {
-            // ++优先级大于* 先运算 ++ 再运算 *
-            // 指针指向第二项，并把第一项设置为 NULL
-            *sunPath++ = NULL;
-        }
+    // socket 路径
+    char *sunPath = address->sun_path;
 
-        // 追加本地名字
-        strcpy(sunPath, name);
+    // 第一个字节必须是 0 以使用抽象命名空间
+    if (abstractNamespace) {
+        // ++优先级大于* 先运算 ++ 再运算 *
+        // 指针指向第二项，并把第一项设置为 NULL
+        *sunPath++ = NULL;
+    }
 
-        // 地址长度
-        socklen_t addressLength =
-                (offsetof(struct sockaddr_un, sun_path)) // 获取 sun_path 在结构体 sockaddr_un 中的偏移量
-                + pathLength;
+    // 追加本地名字
+    strcpy(sunPath, name);
 
-        // 如果 Socket 名已经绑定，取消连接
-        unlink(address.sun_path);
+    // 地址长度
+    return (offsetof(struct sockaddr_un, sun_path)) // 获取 sun_path 在结构体 sockaddr_un 中的偏移量
+           + pathLength;
+}
 
-        // 绑定 Socket
-        LogMessage(env, obj, "Binding to local name %s%s.", (abstractNamespace) ? "(null)" : "",
-                   name);
+/**
+ * 将本地 UNIX socket 与某一名称绑定，之后就能等待并接收数据了
+ * @param env JNIEnv 接口
+ * @param obj Java 对象实例
+ * @param sd socket 描述符
+ * @param name socket 名称
+ */
+static void BindLocalSocketToName(JNIEnv *env, jobject obj, int sd, const char *name) {
+    struct sockaddr_un address;
+    socklen_t addressLength = NewLocalAddress(env, name, &address);
+    if (0 == addressLength) {
+        return;
+    }
 
-        if (-1 == bind(sd, (struct sockaddr *) &address, addressLength)) {
-            // 抛出带错误号的异常
-            ThrowErrnoException(env, "java/io/IOException", errno);
-        }
+    // 如果 Socket 名已经绑定，取消连接
+    unlink(address.sun_path);
 
+    // 绑定 Socket
+    LOGI("Binding to local name %s%s.", ('/' != name[0]) ? "(null)" : "",
+               name);
 
+    if (-1 == bind(sd, (struct sockaddr *) &address, addressLength)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
     }
 }
 
 /**
- * 阻塞并等待即将到来的客户端连接
+ * 将本地 UNIX socket 连接到绑定了某一名称的服务器
  * @param env JNIEnv 接口
  * @param obj Java 对象实例
- * @param sd Socket描述符
- * @return 接受后的客户端 Socket描述符
+ * @param sd socket 描述符
+ * @param name socket 名称
  */
-static int AcceptOnLocalSocket(JNIEnv *env, jobject obj, int sd) {
-    // 阻塞并等待即将到来的客户端连接并接收它
-    LogMessage(env, obj, "Waiting for a client connection...");
-    int clientSocket = accept(sd, NULL, NULL);
+static void ConnectLocalSocketToName(JNIEnv *env, jobject obj, int sd, const char *name) {
+    struct sockaddr_un address;
+    socklen_t addressLength = NewLocalAddress(env, name, &address);
+    if (0 == addressLength) {
+        return;
+    }
 
-    // 如果客户端 Socket 无效
-    if (-1 == clientSocket) {
+    LOGI("Connecting to local name %s%s...", ('/' != name[0]) ? "(null)" : "", name);
+    if (-1 == connect(sd, (struct sockaddr *) &address, addressLength)) {
         // 抛出带错误号的异常
-        ThrowErrnoException(env, "java/io/IOException", errno);
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+    } else {
+        LOGI("Connected.");
     }
-    return clientSocket;
 }
 
-void Java_com_liu_echo_LocalSocketActivity_nativeStartLocalServer
-        (JNIEnv *env, jobject obj, jstring name) {
-    // 构造一个新的本地 UNIX Socket
-    int serverSocket = NewLocalSocket(env, obj);
-    if (NULL == env->ExceptionOccurred()) {
-        // 以 C 字符串的形式获取名称
-        const char *nameText = env->GetStringUTFChars(name, NULL);
+/**
+ * 停止最早启动的 TCP 服务器
+ *     不给交接名称时排空：停止接受新连接，每个连接回显完已经收到的数据后关闭；
+ *     给出交接名称时先把监听 socket 交给在该名称上等待的新实例，再把每个空闲的连接交过去，
+ *     升级期间客户端不会被拒绝。分片服务器的全部工作线程一起排空，不能交接。
+ *     只请求停止，不等待；nativeStartTcpServer 在排空后返回
+ * @param env
+ * @param obj
+ * @param handoffName nativeTakeOverTcpServer 等待的本地 socket 名称，为 NULL 时只排空
+ */
+static void Java_com_liu_echo_EchoServerActivity_nativeStopTcpServer
+        (JNIEnv *env, jobject obj, jstring handoffName) {
+    int handoffSocket = -1;
+    if (NULL != handoffName) {
+        // 阻塞模式的交接 socket，批次按顺序完整发送
+        handoffSocket = NewLocalSocket(env, obj, SOCK_SEQPACKET);
+        if (NULL != env->ExceptionOccurred()) {
+            return;
+        }
+        const char *nameText = env->GetStringUTFChars(handoffName, NULL);
         if (NULL == nameText) {
-            goto exit;
+            close(handoffSocket);
+            return;
+        }
+        ConnectLocalSocketToName(env, obj, handoffSocket, nameText);
+        env->ReleaseStringUTFChars(handoffName, nameText);
+        if (NULL != env->ExceptionOccurred()) {
+            close(handoffSocket);
+            return;
         }
+    }
 
-        // 绑定 Socket 到某一端口号
-        BindLocalSocketToName(env, obj, serverSocket, nameText);
+    pthread_mutex_lock(&runningServersLock);
+    struct RunningServer *server = runningServers;
+    if (NULL == server) {
+        ThrowException(env, jniCache.ioExceptionClass, "No TCP server is running");
+    } else if (0 != server->eventLoopCount && -1 == handoffSocket) {
+        LOGI("Draining the server...");
+        for (size_t i = 0; i < server->eventLoopCount; i++) {
+            EventLoopDrain(server->eventLoops[i]);
+        }
+    } else if (1 == server->eventLoopCount) {
+        LOGI("Handing the server off...");
+        EventLoopHandoff(server->eventLoops[0], handoffSocket);
+        handoffSocket = -1;
+    } else if (0 != server->eventLoopCount) {
+        // 新实例只接手一个事件循环的交接
+        ThrowException(env, jniCache.ioExceptionClass, "Handoff requires a single event loop");
+    } else if (-1 != handoffSocket) {
+        // io_uring 事件循环中的连接有在途的请求，协程中的连接状态在协程帧里，都不能在空闲时取出
+        ThrowException(env, jniCache.ioExceptionClass, "Handoff requires the epoll event loop");
+    } else if (NULL != server->uringLoop) {
+        UringLoopStop(server->uringLoop);
+    } else {
+        CoEchoServerStop(server->coServer);
+    }
+    pthread_mutex_unlock(&runningServersLock);
 
-        // 释放 name 文本
-        env->ReleaseStringUTFChars(name, nameText);
+    if (-1 != handoffSocket) {
+        close(handoffSocket);
+    }
+}
 
-        // 如果绑定失败、
-        if (NULL != env->ExceptionOccurred()) {
+/**
+ * 接手正在运行的 TCP 服务器：在本地 socket 名称上等待旧实例连接，接收它交出的监听 socket
+ * 和连接并用事件循环服务，直到被停止或者再次交出
+ * @param env
+ * @param obj
+ * @param handoffName 交接用的本地 socket 名称
+ * @param options 服务器选项，为 null 时使用默认值
+ */
+static void Java_com_liu_echo_EchoServerActivity_nativeTakeOverTcpServer
+        (JNIEnv *env, jobject obj, jstring handoffName, jobject options) {
+    struct ServerOptions serverOptions;
+    GetServerOptions(env, options, &serverOptions);
+    if (NULL != env->ExceptionOccurred()) {
+        return;
+    }
+
+    int handoffListener = NewLocalSocket(env, obj, SOCK_SEQPACKET);
+    if (NULL == env->ExceptionOccurred()) {
+        const char *nameText = env->GetStringUTFChars(handoffName, NULL);
+        if (NULL == nameText) {
             goto exit;
         }
-
-        // 监听有 4 个挂起连接的带 backlog 的 socket
-        ListenOnSocket(env, obj, serverSocket, 4);
+        BindLocalSocketToName(env, obj, handoffListener, nameText);
+        env->ReleaseStringUTFChars(handoffName, nameText);
         if (NULL != env->ExceptionOccurred()) {
             goto exit;
         }
 
-        // 接受 socket 的一个客户连接
-        int clientSocket = AcceptOnLocalSocket(env, obj, serverSocket);
+        ListenOnSocket(env, obj, handoffListener, 1);
         if (NULL != env->ExceptionOccurred()) {
             goto exit;
         }
 
-        char buffer[MAX_BUFFER_SIZE];
-        ssize_t recvSize;
-        ssize_t sentSize;
-
-        // 接受并发送回数据
-        while (1) {
-            // 从 socket 中接受
-            recvSize = ReceiveFromSocket(env, obj, clientSocket, buffer, MAX_BUFFER_SIZE);
-
-            if ((0 == recvSize) || (NULL != env->ExceptionOccurred())) {
-                break;
-            }
-
-            // 发送给 socket
-            sentSize = SendToSocket(env, obj, clientSocket, buffer, (size_t) recvSize);
-            if ((0 == sentSize) || (NULL != env->ExceptionOccurred())) {
-                break;
-            }
+        // 只接手一个旧实例
+        LOGI("Waiting for a running server to hand off...");
+        int handoffSocket;
+        do {
+            handoffSocket = accept4(handoffListener, NULL, NULL, SOCK_CLOEXEC);
+        } while (-1 == handoffSocket && EINTR == errno);
+        if (-1 == handoffSocket) {
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
         }
+        close(handoffListener);
+        handoffListener = -1;
 
-        // 关闭客户端 socket
-        close(clientSocket);
+        ServeWithEventLoop(env, obj, -1, handoffSocket, &serverOptions, true);
     }
 
     exit:
-    if (serverSocket > 0) {
-        close(serverSocket);
+    if (handoffListener > 0) {
+        close(handoffListener);
     }
-}
\ No newline at end of file
+}
+
+static void Java_com_liu_echo_LocalSocketActivity_nativeStartLocalServer
+        (JNIEnv *env, jobject obj, jstring name, jobject options) {
+    // 读取服务器选项
+    struct ServerOptions serverOptions;
+    GetServerOptions(env, options, &serverOptions);
+    if (NULL != env->ExceptionOccurred()) {
+        return;
+    }
+
+    // 构造一个新的本地 UNIX Socket
+    int serverSocket = NewLocalSocket(env, obj,
+                                      serverOptions.seqPacket ? SOCK_SEQPACKET : SOCK_STREAM);
+    if (NULL == env->ExceptionOccurred()) {
+        // 以 C 字符串的形式获取名称
+        const char *nameText = env->GetStringUTFChars(name, NULL);
+        if (NULL == nameText) {
+            goto exit;
+        }
+
+        // 绑定 Socket 到某一端口号
+        BindLocalSocketToName(env, obj, serverSocket, nameText);
+
+        // 释放 name 文本
+        env->ReleaseStringUTFChars(name, nameText);
+
+        // 如果绑定失败、
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        // 监听 socket，本地 socket 的缓冲区在接受连接时由事件循环设置
+        ListenOnSocket(env, obj, serverSocket,
+                       SocketProfileGet(serverOptions.socketProfile)->backlog);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        // 用选择的 I/O 后端服务全部客户连接
+        ServeListener(env, obj, serverSocket, &serverOptions, false);
+    }
+
+    exit:
+    if (serverSocket > 0) {
+        close(serverSocket);
+    }
+}
+
+/**
+ * 以大消息模式回显一个负载
+ *     流程：memfd_create->pwrite->F_ADD_SEALS->socket(SOCK_SEQPACKET)->connect->
+ *     sendmsg(SCM_RIGHTS)->recvmsg(SCM_RIGHTS)->mmap，
+ *     socket 上只传递 8 字节的长度和描述符，负载不经过内核 socket 缓冲区复制
+ * @param env
+ * @param obj
+ * @param name 以记录模式运行的本地服务器名称
+ * @param payloadSize 负载长度
+ */
+static void Java_com_liu_echo_LocalSocketActivity_nativeSendLocalPayload
+        (JNIEnv *env, jobject obj, jstring name, jint payloadSize) {
+    if (payloadSize <= 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Payload size must be positive");
+        return;
+    }
+
+    size_t size = (size_t) payloadSize;
+    int payloadFd = -1;
+    int echoFd = -1;
+    int clientSocket = -1;
+    const char *nameText = NULL;
+    const void *echo = NULL;
+    uint64_t echoSize = 0;
+    uint64_t startTime = 0;
+
+    // 准备负载并放进加封的 memfd
+    char *payload = (char *) malloc(size);
+    if (NULL == payload) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, ENOMEM);
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        payload[i] = (char) ('a' + i % 26);
+    }
+
+    payloadFd = LocalCreatePayload("echo-payload", payload, size);
+    if (-1 == payloadFd) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        goto exit;
+    }
+
+    // 连接到记录模式的本地服务器
+    clientSocket = NewLocalSocket(env, obj, SOCK_SEQPACKET);
+    if (NULL != env->ExceptionOccurred()) {
+        goto exit;
+    }
+    nameText = env->GetStringUTFChars(name, NULL);
+    if (NULL == nameText) {
+        goto exit;
+    }
+    ConnectLocalSocketToName(env, obj, clientSocket, nameText);
+    env->ReleaseStringUTFChars(name, nameText);
+    if (NULL != env->ExceptionOccurred()) {
+        goto exit;
+    }
+
+    // 发送描述符，接收回显的描述符
+    startTime = MetricsNow();
+    if (-1 == LocalSendPayload(clientSocket, payloadFd, size)) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        goto exit;
+    }
+    echoFd = LocalReceivePayload(clientSocket, &echoSize);
+    if (-1 == echoFd) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        goto exit;
+    }
+
+    // 映射回显的 memfd 并与发送的负载比较
+    echo = LocalMapPayload(echoFd, (size_t) echoSize);
+    if (NULL == echo) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        goto exit;
+    }
+    if (echoSize != size || 0 != memcmp(echo, payload, size)) {
+        ThrowException(env, jniCache.ioExceptionClass, "Echoed payload differs");
+    } else {
+        LOGI("Echoed %zu bytes through a memfd in %llu us.", size,
+             (unsigned long long) ((MetricsNow() - startTime) / 1000));
+    }
+    munmap((void *) echo, (size_t) echoSize);
+
+    exit:
+    if (-1 != echoFd) {
+        close(echoFd);
+    }
+    if (-1 != clientSocket) {
+        close(clientSocket);
+    }
+    if (-1 != payloadFd) {
+        close(payloadFd);
+    }
+    free(payload);
+}
+
+/**
+ * 正在运行的共享内存服务器，同时只运行一个，由 nativeStopShmServer 停止
+ */
+struct ShmServer {
+    // 唤醒等待接受的服务器线程的 eventfd，-1 表示没有服务器在运行
+    int stopFd;
+
+    // 是否已经请求停止
+    bool stopping;
+
+    // 正在服务的通道，没有客户端时为 NULL
+    struct ShmChannel *channel;
+};
+
+static pthread_mutex_t shmServerLock = PTHREAD_MUTEX_INITIALIZER;
+static struct ShmServer shmServer = {-1, false, NULL};
+
+/**
+ * 设置正在服务的通道，停止时关闭它
+ * @param channel 通道，为 NULL 表示客户端已经结束
+ * @return 已经请求停止返回 false，此时不设置通道
+ */
+static bool SetShmServerChannel(struct ShmChannel *channel) {
+    pthread_mutex_lock(&shmServerLock);
+    bool stopping = shmServer.stopping;
+    shmServer.channel = stopping ? NULL : channel;
+    pthread_mutex_unlock(&shmServerLock);
+    return !stopping;
+}
+
+/**
+ * 等待握手 socket 上的下一个客户端，请求停止时返回
+ * @param serverSocket 握手 socket
+ * @param stopFd 停止 eventfd
+ * @return 客户端 socket，请求停止返回 -1 并设置 errno 为 ECANCELED，失败返回 -1 并设置 errno
+ */
+static int AcceptShmClient(int serverSocket, int stopFd) {
+    struct pollfd descriptors[2];
+    descriptors[0].fd = serverSocket;
+    descriptors[0].events = POLLIN;
+    descriptors[1].fd = stopFd;
+    descriptors[1].events = POLLIN;
+    while (true) {
+        descriptors[0].revents = 0;
+        descriptors[1].revents = 0;
+        if (-1 == poll(descriptors, 2, -1)) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        if (0 != descriptors[1].revents) {
+            errno = ECANCELED;
+            return -1;
+        }
+
+        int clientSocket = accept4(serverSocket, NULL, NULL, SOCK_CLOEXEC);
+        if (-1 != clientSocket || (EINTR != errno && ECONNABORTED != errno)) {
+            return clientSocket;
+        }
+    }
+}
+
+/**
+ * 启动共享内存通道回显服务器
+ *     本地 SOCK_SEQPACKET socket 只用于握手：客户端把通道的 memfd 传过来，之后请求和回复都经过
+ *     共享内存中的两个环，稳定收发时没有系统调用；逐个服务客户端，一个客户端关闭通道或者退出后
+ *     接受下一个，直到调用 nativeStopShmServer
+ * @param env
+ * @param obj
+ * @param name 握手 socket 名称
+ */
+static void Java_com_liu_echo_LocalSocketActivity_nativeStartShmServer
+        (JNIEnv *env, jobject obj, jstring name) {
+    // 登记停止用的 eventfd
+    int stopFd = eventfd(0, EFD_CLOEXEC);
+    if (-1 == stopFd) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return;
+    }
+    pthread_mutex_lock(&shmServerLock);
+    bool published = (-1 == shmServer.stopFd);
+    if (published) {
+        shmServer.stopFd = stopFd;
+        shmServer.stopping = false;
+        shmServer.channel = NULL;
+    }
+    pthread_mutex_unlock(&shmServerLock);
+    if (!published) {
+        close(stopFd);
+        ThrowException(env, jniCache.ioExceptionClass, "A shared memory server is already running");
+        return;
+    }
+
+    // 构造握手用的本地 UNIX Socket
+    int serverSocket = NewLocalSocket(env, obj, SOCK_SEQPACKET);
+    if (NULL == env->ExceptionOccurred()) {
+        const char *nameText = env->GetStringUTFChars(name, NULL);
+        if (NULL == nameText) {
+            goto exit;
+        }
+        BindLocalSocketToName(env, obj, serverSocket, nameText);
+        env->ReleaseStringUTFChars(name, nameText);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        ListenOnSocket(env, obj, serverSocket, SERVER_LISTEN_BACKLOG);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        while (true) {
+            int clientSocket = AcceptShmClient(serverSocket, stopFd);
+            if (-1 == clientSocket) {
+                if (ECANCELED == errno) {
+                    LOGI("Shared memory server stopped.");
+                } else {
+                    ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+                }
+                goto exit;
+            }
+
+            // 接收并映射通道，单个客户端的错误只结束这个客户端
+            uint64_t regionSize = 0;
+            struct ShmChannel channel;
+            int regionFd = LocalReceivePayload(clientSocket, &regionSize);
+            if (-1 == regionFd || -1 == ShmChannelAttach(&channel, regionFd, (size_t) regionSize)) {
+                LOGW("Shared memory handshake failed: %d.", errno);
+            } else {
+                // 停止时关闭通道，客户端收完已有的回显后收到 EPIPE
+                if (SetShmServerChannel(&channel)) {
+                    LOGI("Serving a %llu byte shared memory channel.",
+                         (unsigned long long) regionSize);
+                    if (-1 == ShmChannelServeEcho(&channel, clientSocket)) {
+                        LOGW("Shared memory channel failed: %d.", errno);
+                    } else {
+                        LOGI("Shared memory channel closed.");
+                    }
+                    SetShmServerChannel(NULL);
+                } else {
+                    ShmChannelClose(&channel);
+                }
+                ShmChannelDestroy(&channel);
+            }
+            close(clientSocket);
+        }
+    }
+
+    exit:
+    if (serverSocket > 0) {
+        close(serverSocket);
+    }
+    pthread_mutex_lock(&shmServerLock);
+    shmServer.stopFd = -1;
+    shmServer.channel = NULL;
+    pthread_mutex_unlock(&shmServerLock);
+    close(stopFd);
+}
+
+/**
+ * 停止共享内存服务器：不再接受新的客户端，关闭正在服务的通道。只请求停止，不等待；
+ * nativeStartShmServer 在当前客户端结束后返回
+ * @param env
+ * @param obj
+ */
+static void Java_com_liu_echo_LocalSocketActivity_nativeStopShmServer(JNIEnv *env, jobject obj) {
+    pthread_mutex_lock(&shmServerLock);
+    if (-1 == shmServer.stopFd) {
+        ThrowException(env, jniCache.ioExceptionClass, "No shared memory server is running");
+    } else {
+        shmServer.stopping = true;
+        if (NULL != shmServer.channel) {
+            ShmChannelClose(shmServer.channel);
+        }
+        uint64_t value = 1;
+        write(shmServer.stopFd, &value, sizeof(value));
+    }
+    pthread_mutex_unlock(&shmServerLock);
+}
+
+/**
+ * 经过共享内存通道逐条回显消息并记录往返延迟
+ *     流程：memfd_create->F_ADD_SEALS->mmap->socket(SOCK_SEQPACKET)->connect->
+ *     sendmsg(SCM_RIGHTS)，之后每次往返只读写共享内存中的环
+ * @param env
+ * @param obj
+ * @param name 共享内存服务器的握手 socket 名称
+ * @param message 消息
+ * @param count 往返次数
+ */
+static void Java_com_liu_echo_LocalSocketActivity_nativeSendShmMessages
+        (JNIEnv *env, jobject obj, jstring name, jstring message, jint count) {
+    if (count <= 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Message count must be positive");
+        return;
+    }
+
+    struct ShmChannel channel;
+    bool hasChannel = false;
+    int clientSocket = -1;
+    const char *nameText = NULL;
+    const char *messageText = NULL;
+    size_t messageSize = 0;
+    char *echo = NULL;
+
+    struct Histogram *latency = (struct Histogram *) calloc(1, sizeof(struct Histogram));
+    if (NULL == latency) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, ENOMEM);
+        return;
+    }
+    HistogramReset(latency);
+
+    // 创建通道
+    if (-1 == ShmChannelCreate(&channel, SHM_CHANNEL_DEFAULT_CAPACITY)) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        goto exit;
+    }
+    hasChannel = true;
+
+    // 连接到服务器并把通道交给它
+    clientSocket = NewLocalSocket(env, obj, SOCK_SEQPACKET);
+    if (NULL != env->ExceptionOccurred()) {
+        goto exit;
+    }
+    nameText = env->GetStringUTFChars(name, NULL);
+    if (NULL == nameText) {
+        goto exit;
+    }
+    ConnectLocalSocketToName(env, obj, clientSocket, nameText);
+    env->ReleaseStringUTFChars(name, nameText);
+    if (NULL != env->ExceptionOccurred()) {
+        goto exit;
+    }
+    if (-1 == LocalSendPayload(clientSocket, channel.fd, channel.regionSize)) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        goto exit;
+    }
+
+    messageText = env->GetStringUTFChars(message, NULL);
+    if (NULL == messageText) {
+        goto exit;
+    }
+    messageSize = strlen(messageText);
+    echo = (char *) malloc(messageSize + 1);
+    if (NULL == echo) {
+        ThrowErrnoException(env, jniCache.ioExceptionClass, ENOMEM);
+        goto exit;
+    }
+
+    // 一问一答，每次往返的延迟记入直方图
+    for (jint i = 0; i < count; i++) {
+        uint64_t startTime = MetricsNow();
+        if (-1 == ShmChannelSend(&channel, clientSocket, messageText, messageSize)) {
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
+        }
+        ssize_t recvSize = ShmChannelReceive(&channel, clientSocket, echo, messageSize + 1);
+        if (-1 == recvSize) {
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+            goto exit;
+        }
+        HistogramRecord(latency, MetricsNow() - startTime);
+
+        if ((size_t) recvSize != messageSize || 0 != memcmp(echo, messageText, messageSize)) {
+            ThrowException(env, jniCache.ioExceptionClass, "Echoed message differs");
+            goto exit;
+        }
+    }
+
+    LOGI("Echoed %d messages through shared memory: p50 %llu ns, p99 %llu ns, max %llu ns.",
+         (int) count,
+         (unsigned long long) HistogramValueAtPercentile(latency, 50),
+         (unsigned long long) HistogramValueAtPercentile(latency, 99),
+         (unsigned long long) latency->max);
+
+    exit:
+    if (NULL != messageText) {
+        env->ReleaseStringUTFChars(message, messageText);
+    }
+    if (hasChannel) {
+        // 先关闭通道，服务器正常结束这个客户端
+        ShmChannelClose(&channel);
+        ShmChannelDestroy(&channel);
+    }
+    if (-1 != clientSocket) {
+        close(clientSocket);
+    }
+    free(echo);
+    free(latency);
+}
+
+/**
+ * 合计全部服务器事件循环的指标
+ * @param env
+ * @param clazz
+ * @return 每行一个指标的文本
+ */
+static jstring
+Java_com_liu_echo_AbstractEchoActivity_nativeGetMetrics(JNIEnv *env, jclass clazz) {
+    struct MetricsSnapshot snapshot;
+    char text[METRICS_TEXT_SIZE];
+
+    MetricsTakeSnapshot(&snapshot);
+    MetricsFormat(&snapshot, text, sizeof(text));
+
+    return env->NewStringUTF(text);
+}
+
+/**
+ * 启动指标服务器
+ *     流程：socket->bind->listen->(accept->send->close)，
+ *     外部采集端每次连接都得到一份最新的指标文本，例如 adb shell 中的 socat - ABSTRACT-CONNECT:name
+ * @param env
+ * @param clazz
+ * @param name 本地 socket 名称
+ */
+static void Java_com_liu_echo_AbstractEchoActivity_nativeStartStatsServer
+        (JNIEnv *env, jclass clazz, jstring name) {
+    // 构造一个新的本地 UNIX Socket
+    int serverSocket = NewLocalSocket(env, clazz, SOCK_STREAM);
+    if (NULL == env->ExceptionOccurred()) {
+        // 以 C 字符串的形式获取名称
+        const char *nameText = env->GetStringUTFChars(name, NULL);
+        if (NULL == nameText) {
+            goto exit;
+        }
+
+        // 绑定 Socket 到某一名称
+        BindLocalSocketToName(env, clazz, serverSocket, nameText);
+
+        // 释放 name 文本
+        env->ReleaseStringUTFChars(name, nameText);
+
+        // 如果绑定失败
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        // 监听 socket
+        ListenOnSocket(env, clazz, serverSocket, SERVER_LISTEN_BACKLOG);
+        if (NULL != env->ExceptionOccurred()) {
+            goto exit;
+        }
+
+        LOGI("Serving metrics...");
+
+        // 为每个连接写入一份指标快照，直到 socket 被关闭
+        if (-1 == MetricsServe(serverSocket)) {
+            // 抛出带错误号的异常
+            ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        }
+    }
+
+    exit:
+    if (serverSocket > 0) {
+        close(serverSocket);
+    }
+}
+
+/**
+ * 取得直接缓冲区中给定范围的地址
+ * @param env
+ * @param buffer 直接 ByteBuffer
+ * @param offset 起始位置
+ * @param length 长度
+ * @return 范围的起始地址，不是直接缓冲区或者范围越界时抛出 IllegalArgumentException 并返回 NULL
+ */
+static char *GetDirectBufferRange(JNIEnv *env, jobject buffer, jint offset, jint length) {
+    char *address = (char *) env->GetDirectBufferAddress(buffer);
+    if (NULL == address) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Buffer is not a direct buffer");
+        return NULL;
+    }
+
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (offset < 0 || length < 0 || (jlong) offset + length > capacity) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Range is outside of the buffer");
+        return NULL;
+    }
+
+    return address + offset;
+}
+
+/**
+ * 连接到给定地址的 socket，失败时关闭 socket
+ * @param env
+ * @param clazz
+ * @param sd 新构造的 socket
+ * @param ip IP 地址
+ * @param port 端口号
+ * @param socketProfile 连接之前应用的调优方案，SocketProfileId
+ * @return 连接好的 socket，失败返回 -1
+ */
+static int ConnectClientSocket(JNIEnv *env, jclass clazz, int sd, jstring ip, jint port,
+                               jint socketProfile) {
+    if (NULL != env->ExceptionOccurred()) {
+        return -1;
+    }
+
+    ApplySocketProfile(env, clazz, sd, socketProfile, SOCKET_ROLE_CLIENT);
+    if (NULL != env->ExceptionOccurred()) {
+        close(sd);
+        return -1;
+    }
+
+    // 以 C 字符串形式获取 IP 地址
+    const char *ipAddress = env->GetStringUTFChars(ip, NULL);
+    if (NULL == ipAddress) {
+        close(sd);
+        return -1;
+    }
+
+    // 连接到 IP 地址和端口，UDP socket 连接后只和该地址收发
+    ConnectToAddress(env, clazz, sd, ipAddress, (unsigned short) port);
+    env->ReleaseStringUTFChars(ip, ipAddress);
+
+    if (NULL != env->ExceptionOccurred()) {
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
+/**
+ * 构造 TCP socket 并连接到给定地址
+ * @param env
+ * @param clazz
+ * @param ip IP 地址
+ * @param port 端口号
+ * @param socketProfile 调优方案，SocketProfileId
+ * @return socket 描述符
+ */
+static jint Java_com_liu_echo_EchoClient_nativeConnectTcp
+        (JNIEnv *env, jclass clazz, jstring ip, jint port, jint socketProfile) {
+    return ConnectClientSocket(env, clazz, NewTcpSocket(env, clazz), ip, port, socketProfile);
+}
+
+/**
+ * 构造 UDP socket 并连接到给定地址
+ * @param env
+ * @param clazz
+ * @param ip IP 地址
+ * @param port 端口号
+ * @param socketProfile 调优方案，SocketProfileId
+ * @return socket 描述符
+ */
+static jint Java_com_liu_echo_EchoClient_nativeConnectUdp
+        (JNIEnv *env, jclass clazz, jstring ip, jint port, jint socketProfile) {
+    return ConnectClientSocket(env, clazz, NewUdpSocket(env, clazz), ip, port, socketProfile);
+}
+
+/**
+ * 直接从 ByteBuffer 的内存发送数据，不经过 Java 字符串和数组的复制
+ * @param env
+ * @param clazz
+ * @param sd 已连接的 socket
+ * @param buffer 直接 ByteBuffer
+ * @param offset 起始位置
+ * @param length 长度
+ * @return 发送的字节数
+ */
+static jint Java_com_liu_echo_EchoClient_nativeSend
+        (JNIEnv *env, jclass clazz, jint sd, jobject buffer, jint offset, jint length) {
+    const char *data = GetDirectBufferRange(env, buffer, offset, length);
+    if (NULL == data) {
+        return 0;
+    }
+
+    ssize_t sentSize;
+    do {
+        sentSize = send(sd, data, (size_t) length, MSG_NOSIGNAL);
+    } while (-1 == sentSize && EINTR == errno);
+
+    if (-1 == sentSize) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return 0;
+    }
+
+    LOGD("Sent %d bytes.", (int) sentSize);
+    return (jint) sentSize;
+}
+
+/**
+ * 直接接收到 ByteBuffer 的内存中，数据可以是任意二进制内容
+ * @param env
+ * @param clazz
+ * @param sd 已连接的 socket
+ * @param buffer 直接 ByteBuffer
+ * @param offset 起始位置
+ * @param length 最多接收的长度
+ * @return 收到的字节数，TCP 连接被对端关闭时返回 0
+ */
+static jint Java_com_liu_echo_EchoClient_nativeReceive
+        (JNIEnv *env, jclass clazz, jint sd, jobject buffer, jint offset, jint length) {
+    char *data = GetDirectBufferRange(env, buffer, offset, length);
+    if (NULL == data) {
+        return 0;
+    }
+
+    ssize_t recvSize;
+    do {
+        recvSize = recv(sd, data, (size_t) length, 0);
+    } while (-1 == recvSize && EINTR == errno);
+
+    if (-1 == recvSize) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return 0;
+    }
+
+    LOGD("Received %d bytes.", (int) recvSize);
+    return (jint) recvSize;
+}
+
+/**
+ * 以流水线方式在 TCP 连接上发送相同的请求并按顺序核对回显
+ * @param env
+ * @param clazz
+ * @param sd 已连接的 TCP socket
+ * @param buffer 直接 ByteBuffer，保存请求内容
+ * @param offset 请求在缓冲区中的起始位置
+ * @param length 请求长度
+ * @param requestCount 请求数
+ * @param window 最多同时在途的请求数
+ * @return 收齐回显的请求数
+ */
+static jint Java_com_liu_echo_EchoClient_nativePipeline
+        (JNIEnv *env, jclass clazz, jint sd, jobject buffer, jint offset, jint length,
+         jint requestCount, jint window) {
+    const char *payload = GetDirectBufferRange(env, buffer, offset, length);
+    if (NULL == payload) {
+        return 0;
+    }
+    if (requestCount < 0 || window <= 0 || 0 == length) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Invalid request count, window or length");
+        return 0;
+    }
+
+    struct PipelineResult result;
+    if (-1 == PipelinedClientRun(sd, payload, (size_t) length, (unsigned) requestCount,
+                                 (unsigned) window, &result)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return (jint) result.completed;
+    }
+
+    double seconds = (double) result.elapsedNanos / 1e9;
+    LOGI("Pipelined %llu requests with a window of %d: %.0f requests/s, "
+         "average latency %.3f ms, max %.3f ms.",
+         (unsigned long long) result.completed, window,
+         (seconds > 0) ? (double) result.completed / seconds : 0.0,
+         (result.completed > 0) ? (double) result.totalLatencyNanos / result.completed / 1e6 : 0.0,
+         (double) result.maxLatencyNanos / 1e6);
+
+    return (jint) result.completed;
+}
+
+/**
+ * 关闭 socket
+ * @param env
+ * @param clazz
+ * @param sd socket 描述符
+ */
+static void Java_com_liu_echo_EchoClient_nativeClose(JNIEnv *env, jclass clazz, jint sd) {
+    close(sd);
+}
+
+/**
+ * 构造连接池
+ * @param env
+ * @param clazz
+ * @param maxPerHost 每个主机最多的连接数
+ * @param idleTimeout 空闲连接的最长保留时间，单位毫秒
+ * @param socketProfile 新建连接使用的调优方案，SocketProfileId
+ * @return 连接池句柄
+ */
+static jlong Java_com_liu_echo_ConnectionPool_nativeCreate
+        (JNIEnv *env, jclass clazz, jint maxPerHost, jint idleTimeout, jint socketProfile) {
+    const struct SocketProfile *profile = SocketProfileGet(socketProfile);
+    if (NULL == profile) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass, "Unknown socket profile");
+        return 0;
+    }
+    if (maxPerHost <= 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Connections per host must be positive");
+        return 0;
+    }
+    if (idleTimeout < 0) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass,
+                       "Idle timeout must not be negative");
+        return 0;
+    }
+
+    struct ConnectionPool *pool = (struct ConnectionPool *) malloc(sizeof(struct ConnectionPool));
+    if (NULL == pool) {
+        ThrowException(env, jniCache.outOfMemoryErrorClass, "Unable to allocate connection pool");
+        return 0;
+    }
+
+    if (-1 == ConnectionPoolInit(pool, maxPerHost, (uint64_t) idleTimeout, profile)) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        free(pool);
+        return 0;
+    }
+
+    return (jlong) (intptr_t) pool;
+}
+
+/**
+ * 借出一个到给定地址的连接
+ * @param env
+ * @param clazz
+ * @param poolHandle 连接池句柄
+ * @param ip IP 地址
+ * @param port 端口号
+ * @param timeout 主机连接数已达上限时等待归还的最长时间，单位毫秒，小于 0 表示一直等待
+ * @return 连接句柄
+ */
+static jlong Java_com_liu_echo_ConnectionPool_nativeAcquire
+        (JNIEnv *env, jclass clazz, jlong poolHandle, jstring ip, jint port, jint timeout) {
+    struct ConnectionPool *pool = (struct ConnectionPool *) (intptr_t) poolHandle;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_port = htons((unsigned short) port);
+
+    // 将 IP 地址字符串转换为网络地址
+    const char *ipAddress = env->GetStringUTFChars(ip, NULL);
+    if (NULL == ipAddress) {
+        return 0;
+    }
+    int result = inet_aton(ipAddress, &(address.sin_addr));
+    env->ReleaseStringUTFChars(ip, ipAddress);
+    if (0 == result) {
+        ThrowException(env, jniCache.illegalArgumentExceptionClass, "Invalid IP address");
+        return 0;
+    }
+
+    struct PooledConnection *connection = ConnectionPoolAcquire(pool, &address, timeout);
+    if (NULL == connection) {
+        // 抛出带错误号的异常
+        ThrowErrnoException(env, jniCache.ioExceptionClass, errno);
+        return 0;
+    }
+
+    return (jlong) (intptr_t) connection;
+}
+
+/**
+ * 取得借出连接的 socket
+ * @param env
+ * @param clazz
+ * @param connectionHandle 连接句柄
+ * @return socket 描述符
+ */
+static jint Java_com_liu_echo_ConnectionPool_nativeGetSocket
+        (JNIEnv *env, jclass clazz, jlong connectionHandle) {
+    return ((struct PooledConnection *) (intptr_t) connectionHandle)->sd;
+}
+
+/**
+ * 归还借出的连接
+ * @param env
+ * @param clazz
+ * @param poolHandle 连接池句柄
+ * @param connectionHandle 连接句柄
+ * @param reusable 连接是否可以复用
+ */
+static void Java_com_liu_echo_ConnectionPool_nativeRelease
+        (JNIEnv *env, jclass clazz, jlong poolHandle, jlong connectionHandle, jboolean reusable) {
+    ConnectionPoolRelease((struct ConnectionPool *) (intptr_t) poolHandle,
+                          (struct PooledConnection *) (intptr_t) connectionHandle,
+                          JNI_TRUE == reusable);
+}
+
+/**
+ * 关闭连接池：关闭空闲连接，等待的借出者以 ECANCELED 失败
+ * @param env
+ * @param clazz
+ * @param poolHandle 连接池句柄
+ */
+static void Java_com_liu_echo_ConnectionPool_nativeClose
+        (JNIEnv *env, jclass clazz, jlong poolHandle) {
+    struct ConnectionPool *pool = (struct ConnectionPool *) (intptr_t) poolHandle;
+
+    pthread_mutex_lock(&pool->mutex);
+    LOGI("Connection pool created %llu, reused %llu, evicted %llu idle and %llu broken connections.",
+         (unsigned long long) pool->created, (unsigned long long) pool->reused,
+         (unsigned long long) pool->evicted, (unsigned long long) pool->broken);
+    pthread_mutex_unlock(&pool->mutex);
+
+    ConnectionPoolClose(pool);
+}
+
+/**
+ * 放弃已经关闭的连接池，全部借出的连接归还后释放
+ * @param env
+ * @param clazz
+ * @param poolHandle 连接池句柄
+ */
+static void Java_com_liu_echo_ConnectionPool_nativeDestroy
+        (JNIEnv *env, jclass clazz, jlong poolHandle) {
+    ConnectionPoolDetach((struct ConnectionPool *) (intptr_t) poolHandle);
+}
+
+// AbstractEchoActivity 的原生方法
+static const JNINativeMethod abstractEchoActivityMethods[] = {
+        {"nativeDrainLog",    "()Ljava/lang/String;",
+                (void *) Java_com_liu_echo_AbstractEchoActivity_nativeDrainLog},
+        {"nativeSetLogLevel", "(I)V",
+                (void *) Java_com_liu_echo_AbstractEchoActivity_nativeSetLogLevel},
+        {"nativeGetMetrics",  "()Ljava/lang/String;",
+                (void *) Java_com_liu_echo_AbstractEchoActivity_nativeGetMetrics},
+        {"nativeStartStatsServer", "(Ljava/lang/String;)V",
+                (void *) Java_com_liu_echo_AbstractEchoActivity_nativeStartStatsServer},
+};
+
+// EchoServerActivity 的原生方法
+static const JNINativeMethod echoServerActivityMethods[] = {
+        {"nativeStartTcpServer",        "(ILcom/liu/echo/ServerOptions;)V",
+                (void *) Java_com_liu_echo_EchoServerActivity_nativeStartTcpServer},
+        {"nativeStartUdpServer",        "(ILcom/liu/echo/ServerOptions;)V",
+                (void *) Java_com_liu_echo_EchoServerActivity_nativeStartUdpServer},
+        {"nativeStartShardedTcpServer", "(ILcom/liu/echo/ServerOptions;IZ)V",
+                (void *) Java_com_liu_echo_EchoServerActivity_nativeStartShardedTcpServer},
+        {"nativeStopTcpServer",         "(Ljava/lang/String;)V",
+                (void *) Java_com_liu_echo_EchoServerActivity_nativeStopTcpServer},
+        {"nativeTakeOverTcpServer",     "(Ljava/lang/String;Lcom/liu/echo/ServerOptions;)V",
+                (void *) Java_com_liu_echo_EchoServerActivity_nativeTakeOverTcpServer},
+};
+
+// EchoClientActivity 的原生方法
+static const JNINativeMethod echoClientActivityMethods[] = {
+        {"nativeStartTcpClient",  "(Ljava/lang/String;ILjava/lang/String;IIZ)V",
+                (void *) Java_com_liu_echo_EchoClientActivity_nativeStartTcpClient},
+        {"nativeStartUdpClient",  "(Ljava/lang/String;ILjava/lang/String;II)V",
+                (void *) Java_com_liu_echo_EchoClientActivity_nativeStartUdpClient},
+        {"nativeRunUdpBenchmark", "(II)V",
+                (void *) Java_com_liu_echo_EchoClientActivity_nativeRunUdpBenchmark},
+        {"nativeRunSocketProfileBenchmark", "(III)V",
+                (void *) Java_com_liu_echo_EchoClientActivity_nativeRunSocketProfileBenchmark},
+        {"nativeRunBusyPollBenchmark", "(III)V",
+                (void *) Java_com_liu_echo_EchoClientActivity_nativeRunBusyPollBenchmark},
+};
+
+// EchoClient 的原生方法
+static const JNINativeMethod echoClientMethods[] = {
+        {"nativeConnectTcp", "(Ljava/lang/String;II)I",
+                (void *) Java_com_liu_echo_EchoClient_nativeConnectTcp},
+        {"nativeConnectUdp", "(Ljava/lang/String;II)I",
+                (void *) Java_com_liu_echo_EchoClient_nativeConnectUdp},
+        {"nativeSend",       "(ILjava/nio/ByteBuffer;II)I",
+                (void *) Java_com_liu_echo_EchoClient_nativeSend},
+        {"nativeReceive",    "(ILjava/nio/ByteBuffer;II)I",
+                (void *) Java_com_liu_echo_EchoClient_nativeReceive},
+        {"nativePipeline",   "(ILjava/nio/ByteBuffer;IIII)I",
+                (void *) Java_com_liu_echo_EchoClient_nativePipeline},
+        {"nativeClose",      "(I)V",
+                (void *) Java_com_liu_echo_EchoClient_nativeClose},
+};
+
+// ConnectionPool 的原生方法
+static const JNINativeMethod connectionPoolMethods[] = {
+        {"nativeCreate",    "(III)J",
+                (void *) Java_com_liu_echo_ConnectionPool_nativeCreate},
+        {"nativeAcquire",   "(JLjava/lang/String;II)J",
+                (void *) Java_com_liu_echo_ConnectionPool_nativeAcquire},
+        {"nativeGetSocket", "(J)I",
+                (void *) Java_com_liu_echo_ConnectionPool_nativeGetSocket},
+        {"nativeRelease",   "(JJZ)V",
+                (void *) Java_com_liu_echo_ConnectionPool_nativeRelease},
+        {"nativeClose",     "(J)V",
+                (void *) Java_com_liu_echo_ConnectionPool_nativeClose},
+        {"nativeDestroy",   "(J)V",
+                (void *) Java_com_liu_echo_ConnectionPool_nativeDestroy},
+};
+
+// LocalSocketActivity 的原生方法
+static const JNINativeMethod localSocketActivityMethods[] = {
+        {"nativeStartLocalServer", "(Ljava/lang/String;Lcom/liu/echo/ServerOptions;)V",
+                (void *) Java_com_liu_echo_LocalSocketActivity_nativeStartLocalServer},
+        {"nativeSendLocalPayload", "(Ljava/lang/String;I)V",
+                (void *) Java_com_liu_echo_LocalSocketActivity_nativeSendLocalPayload},
+        {"nativeStartShmServer", "(Ljava/lang/String;)V",
+                (void *) Java_com_liu_echo_LocalSocketActivity_nativeStartShmServer},
+        {"nativeStopShmServer", "()V",
+                (void *) Java_com_liu_echo_LocalSocketActivity_nativeStopShmServer},
+        {"nativeSendShmMessages", "(Ljava/lang/String;Ljava/lang/String;I)V",
+                (void *) Java_com_liu_echo_LocalSocketActivity_nativeSendShmMessages},
+};
+
+/**
+ * 向给定类注册原生方法
+ * @param env
+ * @param className 类名
+ * @param methods 原生方法
+ * @param methodCount 方法数
+ * @return 成功返回 true
+ */
+static bool RegisterClassNatives(JNIEnv *env, const char *className,
+                                 const JNINativeMethod *methods, jint methodCount) {
+    jclass clazz = env->FindClass(className);
+    if (NULL == clazz) {
+        return false;
+    }
+
+    jint result = env->RegisterNatives(clazz, methods, methodCount);
+    env->DeleteLocalRef(clazz);
+
+    return JNI_OK == result;
+}
+
+/**
+ * 查找类并创建全局引用
+ * @param env
+ * @param className 类名
+ * @return 类的全局引用，找不到时返回 NULL
+ */
+static jclass NewGlobalClassRef(JNIEnv *env, const char *className) {
+    jclass clazz = env->FindClass(className);
+    if (NULL == clazz) {
+        return NULL;
+    }
+
+    jclass globalClass = (jclass) env->NewGlobalRef(clazz);
+    env->DeleteLocalRef(clazz);
+
+    return globalClass;
+}
+
+/**
+ * 缓存 com.liu.echo.ServerOptions 的字段 ID
+ * @param env
+ * @return 成功返回 true
+ */
+static bool CacheServerOptionsFields(JNIEnv *env) {
+    bool cached = false;
+
+    jclass clazz = env->FindClass(SERVER_OPTIONS_CLASS);
+    if (NULL == clazz) {
+        return false;
+    }
+
+    jniCache.backendField = env->GetFieldID(clazz, "backend", "I");
+    if (NULL == jniCache.backendField) {
+        goto exit;
+    }
+
+    jniCache.zeroCopyField = env->GetFieldID(clazz, "zeroCopy", "Z");
+    if (NULL == jniCache.zeroCopyField) {
+        goto exit;
+    }
+
+    jniCache.datagramBatchSizeField = env->GetFieldID(clazz, "datagramBatchSize", "I");
+    if (NULL == jniCache.datagramBatchSizeField) {
+        goto exit;
+    }
+
+    jniCache.segmentOffloadField = env->GetFieldID(clazz, "segmentOffload", "Z");
+    if (NULL == jniCache.segmentOffloadField) {
+        goto exit;
+    }
+
+    jniCache.bufferSizeField = env->GetFieldID(clazz, "bufferSize", "I");
+    if (NULL == jniCache.bufferSizeField) {
+        goto exit;
+    }
+
+    jniCache.hugePagesField = env->GetFieldID(clazz, "hugePages", "Z");
+    if (NULL == jniCache.hugePagesField) {
+        goto exit;
+    }
+
+    jniCache.framingField = env->GetFieldID(clazz, "framing", "Z");
+    if (NULL == jniCache.framingField) {
+        goto exit;
+    }
+
+    jniCache.integrityField = env->GetFieldID(clazz, "integrity", "Z");
+    if (NULL == jniCache.integrityField) {
+        goto exit;
+    }
+
+    jniCache.seqPacketField = env->GetFieldID(clazz, "seqPacket", "Z");
+    if (NULL == jniCache.seqPacketField) {
+        goto exit;
+    }
+
+    jniCache.socketProfileField = env->GetFieldID(clazz, "socketProfile", "I");
+    if (NULL == jniCache.socketProfileField) {
+        goto exit;
+    }
+
+    jniCache.busyPollField = env->GetFieldID(clazz, "busyPoll", "Z");
+    if (NULL == jniCache.busyPollField) {
+        goto exit;
+    }
+
+    jniCache.busyPollIdleMicrosField = env->GetFieldID(clazz, "busyPollIdleMicros", "I");
+    if (NULL == jniCache.busyPollIdleMicrosField) {
+        goto exit;
+    }
+
+    jniCache.busyPollCpuField = env->GetFieldID(clazz, "busyPollCpu", "I");
+    if (NULL == jniCache.busyPollCpuField) {
+        goto exit;
+    }
+
+    jniCache.messageHandlerField = env->GetFieldID(clazz, "messageHandler", "I");
+    if (NULL == jniCache.messageHandlerField) {
+        goto exit;
+    }
+
+    jniCache.handlerThreadsField = env->GetFieldID(clazz, "handlerThreads", "I");
+    if (NULL == jniCache.handlerThreadsField) {
+        goto exit;
+    }
+
+    jniCache.writeHighWatermarkField = env->GetFieldID(clazz, "writeHighWatermark", "I");
+    if (NULL == jniCache.writeHighWatermarkField) {
+        goto exit;
+    }
+
+    jniCache.writeLowWatermarkField = env->GetFieldID(clazz, "writeLowWatermark", "I");
+    if (NULL == jniCache.writeLowWatermarkField) {
+        goto exit;
+    }
+
+    cached = true;
+
+    exit:
+    // 字段 ID 在类卸载前一直有效，不需要保留类的引用
+    env->DeleteLocalRef(clazz);
+    return cached;
+}
+
+/**
+ * 库加载时注册全部原生方法并缓存类和成员 ID，
+ * 之后不再通过 Java_ 符号查找原生方法，也不在调用和错误路径上查找类
+ * @param vm
+ * @param reserved
+ * @return 需要的 JNI 版本，失败返回 JNI_ERR
+ */
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
+    JNIEnv *env;
+    if (JNI_OK != vm->GetEnv((void **) &env, JNI_VERSION_1_6)) {
+        return JNI_ERR;
+    }
+
+    // 缓存异常类
+    jniCache.ioExceptionClass = NewGlobalClassRef(env, "java/io/IOException");
+    jniCache.outOfMemoryErrorClass = NewGlobalClassRef(env, "java/lang/OutOfMemoryError");
+    jniCache.illegalArgumentExceptionClass =
+            NewGlobalClassRef(env, "java/lang/IllegalArgumentException");
+    if (NULL == jniCache.ioExceptionClass || NULL == jniCache.outOfMemoryErrorClass
+        || NULL == jniCache.illegalArgumentExceptionClass) {
+        return JNI_ERR;
+    }
+
+    // 缓存字段 ID
+    if (!CacheServerOptionsFields(env)) {
+        return JNI_ERR;
+    }
+
+    // 注册原生方法
+    if (!RegisterClassNatives(env, ABSTRACT_ECHO_ACTIVITY_CLASS, abstractEchoActivityMethods,
+                              sizeof(abstractEchoActivityMethods) / sizeof(JNINativeMethod))
+        || !RegisterClassNatives(env, ECHO_SERVER_ACTIVITY_CLASS, echoServerActivityMethods,
+                                 sizeof(echoServerActivityMethods) / sizeof(JNINativeMethod))
+        || !RegisterClassNatives(env, ECHO_CLIENT_ACTIVITY_CLASS, echoClientActivityMethods,
+                                 sizeof(echoClientActivityMethods) / sizeof(JNINativeMethod))
+        || !RegisterClassNatives(env, LOCAL_SOCKET_ACTIVITY_CLASS, localSocketActivityMethods,
+                                 sizeof(localSocketActivityMethods) / sizeof(JNINativeMethod))
+        || !RegisterClassNatives(env, ECHO_CLIENT_CLASS, echoClientMethods,
+                                 sizeof(echoClientMethods) / sizeof(JNINativeMethod))
+        || !RegisterClassNatives(env, CONNECTION_POOL_CLASS, connectionPoolMethods,
+                                 sizeof(connectionPoolMethods) / sizeof(JNINativeMethod))) {
+        return JNI_ERR;
+    }
+
+    return JNI_VERSION_1_6;
+}
+
+/**
+ * 库卸载时释放缓存的全局引用
+ * @param vm
+ * @param reserved
+ */
+JNIEXPORT void JNICALL JNI_OnUnload(JavaVM *vm, void *reserved) {
+    JNIEnv *env;
+    if (JNI_OK != vm->GetEnv((void **) &env, JNI_VERSION_1_6)) {
+        return;
+    }
+
+    env->DeleteGlobalRef(jniCache.ioExceptionClass);
+    env->DeleteGlobalRef(jniCache.outOfMemoryErrorClass);
+    env->DeleteGlobalRef(jniCache.illegalArgumentExceptionClass);
+    memset(&jniCache, 0, sizeof(jniCache));
+}
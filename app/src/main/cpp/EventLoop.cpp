@@ -0,0 +1,1267 @@
+#include "EventLoop.h"
+#include "BufferPool.h"
+#include <stdlib.h> // malloc, calloc, realloc, free
+#include <stdint.h> // uint64_t
+#include <errno.h> // errno
+#include <string.h> // memset
+#include <fcntl.h> // fcntl, pipe2, splice
+#include <unistd.h> // close, read, write
+#include <sys/socket.h> // accept4, recv, send, sendmsg, setsockopt
+#include <sys/uio.h> // iovec
+#include <sys/epoll.h> // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // eventfd
+#include <sys/ioctl.h> // ioctl
+#include <sched.h> // sched_setaffinity, CPU_SET
+
+// <linux/eventpoll.h> 与 <sys/epoll.h> 的定义冲突，按 6.9 内核的定义自己声明 epoll 忙轮询参数
+struct EpollBusyPollParams {
+    uint32_t busyPollMicros;
+    uint16_t busyPollBudget;
+    uint8_t preferBusyPoll;
+    uint8_t pad;
+};
+
+#define EPOLL_IOC_SET_PARAMS _IOW(0x8A, 0x01, struct EpollBusyPollParams)
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+// 每次 epoll_wait 最多取回的事件数
+#define MAX_EPOLL_EVENTS 256
+
+// 零拷贝模式下每次从 socket 移入管道的最大字节数，等于默认的管道容量
+#define SPLICE_CHUNK_SIZE 65536
+
+// 缓冲区链的分段大小，缓冲区大小更小时使用缓冲区大小
+#define BUFFER_SEGMENT_SIZE 16384
+
+// 描述符或者内存耗尽时暂停接受新连接的最长时间，单位毫秒
+#define ACCEPT_RETRY_MILLIS 100
+
+// 忙轮询模式下内核在 socket 读取和 epoll_wait 中轮询网卡队列的时间，单位微秒
+#define BUSY_POLL_MICROS 50
+
+// 忙轮询模式下每次轮询网卡队列最多处理的数据包数
+#define BUSY_POLL_BUDGET 64
+
+/**
+ * 交给处理器的一个帧和它的响应
+ */
+struct HandledFrame {
+    // 必须是第一个成员，完成队列中的任务直接转换为 HandledFrame；owner 为所属的连接，
+    // 连接在处理期间关闭时为 NULL，交还后直接释放
+    struct HandlerTask task;
+
+    // 还在处理线程中
+    bool running;
+
+    // 响应的帧头和校验模式下的帧尾
+    char header[FRAME_HEADER_SIZE];
+    char trailer[FRAME_CHECKSUM_SIZE];
+
+    // 响应帧已经发出的字节数
+    size_t sent;
+
+    // frame 的容量
+    size_t capacity;
+
+    // 请求帧的副本，包括帧头和帧尾
+    char frame[];
+};
+
+int SetNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (-1 == flags) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int EventLoopInit(struct EventLoop *loop, const struct ServerOptions *options) {
+    memset(loop, 0, sizeof(*loop));
+    if (options->bufferSize <= 0 || options->busyPollIdleMicros < 0
+        || options->handlerThreads < 0 || NULL == MessageHandlerGet(options->messageHandler)
+        || options->writeLowWatermark < 0
+        || options->writeHighWatermark < options->writeLowWatermark) {
+        errno = EINVAL;
+        return -1;
+    }
+    loop->bufferSize = (size_t) options->bufferSize;
+    loop->segmentSize = (loop->bufferSize < BUFFER_SEGMENT_SIZE) ? loop->bufferSize
+                                                                 : BUFFER_SEGMENT_SIZE;
+    loop->messages = options->seqPacket;
+    loop->framing = (options->framing || options->integrity) && !loop->messages;
+    loop->checksums = options->integrity && loop->framing;
+    loop->zeroCopy = options->zeroCopy && !loop->framing && !loop->messages;
+    if (loop->framing && (MESSAGE_HANDLER_ECHO != options->messageHandler
+                          || options->handlerThreads > 0)) {
+        loop->handler = MessageHandlerGet(options->messageHandler);
+    }
+    if (!loop->framing && !loop->messages && !loop->zeroCopy) {
+        loop->writeHighWatermark = (size_t) options->writeHighWatermark;
+        loop->writeLowWatermark = (size_t) options->writeLowWatermark;
+    }
+    loop->socketProfile = SocketProfileGet(options->socketProfile);
+    if (NULL == loop->socketProfile) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (SOCKET_PROFILE_DEFAULT == options->socketProfile) {
+        loop->socketProfile = NULL;
+    }
+    loop->busyPoll = options->busyPoll;
+    loop->busyPollIdleNanos = (uint64_t) options->busyPollIdleMicros * 1000;
+    loop->busyPollCpu = options->busyPollCpu;
+    if (options->hugePages && !loop->zeroCopy) {
+        BufferPoolEnableHugePages();
+    }
+    loop->wakeup.type = EVENT_SOURCE_WAKEUP;
+    loop->wakeup.fd = -1;
+    loop->running = true;
+    loop->handoffRequest = -1;
+    loop->handoffSocket = -1;
+    loop->handoffSource.type = EVENT_SOURCE_HANDOFF;
+    loop->handoffSource.fd = -1;
+
+    loop->metrics = MetricsAcquireShard();
+    if (NULL == loop->metrics) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == loop->epollFd) {
+        int error = errno;
+        MetricsReleaseShard(loop->metrics);
+        errno = error;
+        return -1;
+    }
+
+    // eventfd 用于从其他线程唤醒 epoll_wait
+    loop->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == loop->wakeup.fd) {
+        int error = errno;
+        close(loop->epollFd);
+        MetricsReleaseShard(loop->metrics);
+        errno = error;
+        return -1;
+    }
+
+    // 6.9 以上内核可以让 epoll_wait 自己轮询已注册 socket 的网卡队列，没有权限或者不支持时忽略
+    if (loop->busyPoll) {
+        struct EpollBusyPollParams params;
+        memset(&params, 0, sizeof(params));
+        params.busyPollMicros = BUSY_POLL_MICROS;
+        params.busyPollBudget = BUSY_POLL_BUDGET;
+        params.preferBusyPoll = 1;
+        ioctl(loop->epollFd, EPOLL_IOC_SET_PARAMS, &params);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->wakeup;
+    if (-1 == epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeup.fd, &event)) {
+        int error = errno;
+        close(loop->wakeup.fd);
+        close(loop->epollFd);
+        MetricsReleaseShard(loop->metrics);
+        errno = error;
+        return -1;
+    }
+
+    // 处理线程完成后写入同一个唤醒 eventfd
+    HandlerCompletionQueueInit(&loop->completions, loop->wakeup.fd);
+    if (NULL != loop->handler && options->handlerThreads > 0) {
+        loop->handlerPool = (struct HandlerPool *) malloc(sizeof(struct HandlerPool));
+        int error = ENOMEM;
+        if (NULL == loop->handlerPool || -1 == HandlerPoolInit(loop->handlerPool,
+                                                               options->handlerThreads)) {
+            if (NULL != loop->handlerPool) {
+                error = errno;
+            }
+            free(loop->handlerPool);
+            close(loop->wakeup.fd);
+            close(loop->epollFd);
+            MetricsReleaseShard(loop->metrics);
+            errno = error;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * 把监听 socket 加入 epoll
+ * @param loop 事件循环
+ * @param listener 监听 socket 的事件源
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int WatchListener(struct EventLoop *loop, struct EventSource *listener) {
+    // 监听 socket 使用水平触发，接受队列中还有连接时每一轮都会得到通知
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = listener;
+    return epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, listener->fd, &event);
+}
+
+/**
+ * accept 因为描述符或者内存耗尽而失败时暂停接受新连接，否则水平触发的监听 socket
+ * 会让每一轮 epoll_wait 立即返回，空转占满 CPU。待接受的连接留在内核的接受队列中
+ * @param loop 事件循环
+ */
+static void PauseAccepting(struct EventLoop *loop) {
+    for (size_t i = 0; i < loop->listenerCount; i++) {
+        epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, loop->listeners[i]->fd, NULL);
+    }
+    loop->acceptPausedUntil = MetricsNow() + (uint64_t) ACCEPT_RETRY_MILLIS * 1000000;
+    MetricsAdd(&loop->metrics->acceptPauses, 1);
+}
+
+/**
+ * 有连接关闭或者暂停到期后恢复接受新连接，排空时监听 socket 不再加入 epoll
+ * @param loop 事件循环
+ */
+static void ResumeAccepting(struct EventLoop *loop) {
+    if (0 == loop->acceptPausedUntil) {
+        return;
+    }
+    loop->acceptPausedUntil = 0;
+    if (loop->draining) {
+        return;
+    }
+    for (size_t i = 0; i < loop->listenerCount; i++) {
+        WatchListener(loop, loop->listeners[i]);
+    }
+}
+
+int EventLoopAddListener(struct EventLoop *loop, int sd) {
+    if (-1 == SetNonBlocking(sd)) {
+        return -1;
+    }
+
+    // 事件源的地址保存在 epoll 中，因此每个监听 socket 单独分配，数组只保存指针
+    struct EventSource **listeners = (struct EventSource **) realloc(
+            loop->listeners, (loop->listenerCount + 1) * sizeof(struct EventSource *));
+    if (NULL == listeners) {
+        errno = ENOMEM;
+        return -1;
+    }
+    loop->listeners = listeners;
+
+    struct EventSource *listener = (struct EventSource *) malloc(sizeof(struct EventSource));
+    if (NULL == listener) {
+        errno = ENOMEM;
+        return -1;
+    }
+    listener->fd = sd;
+    listener->type = EVENT_SOURCE_LISTENER;
+
+    if (-1 == WatchListener(loop, listener)) {
+        int error = errno;
+        free(listener);
+        errno = error;
+        return -1;
+    }
+
+    loop->listeners[loop->listenerCount++] = listener;
+    return 0;
+}
+
+/**
+ * 释放处理完的帧；还在处理线程中时让它成为孤儿，交还事件循环时再释放
+ * @param handled 帧
+ */
+static void ReleaseHandledFrame(struct HandledFrame *handled) {
+    if (handled->running) {
+        handled->task.owner = NULL;
+        return;
+    }
+    HandlerOutputDestroy(&handled->task.output);
+    free(handled);
+}
+
+/**
+ * 为下一个帧取得 HandledFrame：优先复用连接上次发完响应的帧，放不下时重新分配；
+ * 新分配的帧至少能放下一个分段，之后不超过分段的帧都能复用
+ * @param loop 事件循环
+ * @param connection 连接
+ * @param frameSize 帧的长度，包括帧头和帧尾
+ * @return 帧，内存不足时返回 NULL
+ */
+static struct HandledFrame *NewHandledFrame(struct EventLoop *loop, struct Connection *connection,
+                                            size_t frameSize) {
+    struct HandledFrame *handled = connection->spareFrame;
+    connection->spareFrame = NULL;
+    if (NULL != handled) {
+        if (handled->capacity >= frameSize) {
+            HandlerOutputClear(&handled->task.output);
+            return handled;
+        }
+        ReleaseHandledFrame(handled);
+    }
+
+    size_t capacity = (frameSize < loop->segmentSize) ? loop->segmentSize : frameSize;
+    handled = (struct HandledFrame *) malloc(sizeof(struct HandledFrame) + capacity);
+    if (NULL == handled) {
+        return NULL;
+    }
+    handled->capacity = capacity;
+    size_t trailerSize = loop->checksums ? FRAME_CHECKSUM_SIZE : 0;
+    HandlerOutputInit(&handled->task.output, loop->bufferSize - FRAME_HEADER_SIZE - trailerSize);
+    return handled;
+}
+
+/**
+ * 发完响应后把帧留给连接的下一个帧复用；超过一个分段的帧或者响应缓冲区直接释放，
+ * 空闲的连接最多占用两个分段
+ * @param loop 事件循环
+ * @param connection 连接
+ * @param handled 已经发完响应的帧
+ */
+static void RecycleHandledFrame(struct EventLoop *loop, struct Connection *connection,
+                                struct HandledFrame *handled) {
+    if (handled->capacity > loop->segmentSize) {
+        ReleaseHandledFrame(handled);
+        return;
+    }
+    if (handled->task.output.capacity > loop->segmentSize) {
+        HandlerOutputDestroy(&handled->task.output);
+    }
+    connection->spareFrame = handled;
+}
+
+/**
+ * 关闭连接并释放其资源
+ * @param loop 事件循环
+ * @param connection 连接
+ */
+static void CloseConnection(struct EventLoop *loop, struct Connection *connection) {
+    // 关闭描述符会自动将其从 epoll 中移除；已经交出的连接描述符为 -1
+    if (-1 != connection->source.fd) {
+        close(connection->source.fd);
+    }
+
+    // 从连接链表中移除
+    if (NULL != connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        loop->connections = connection->next;
+    }
+    if (NULL != connection->next) {
+        connection->next->prev = connection->prev;
+    }
+    __atomic_store_n(&loop->connectionCount, loop->connectionCount - 1, __ATOMIC_RELAXED);
+    MetricsAdd(&loop->metrics->closedConnections, 1);
+
+    // 释放了描述符，暂停的接受可以立即恢复
+    ResumeAccepting(loop);
+
+    if (-1 != connection->pipeRead) {
+        close(connection->pipeRead);
+        close(connection->pipeWrite);
+    }
+    if (-1 != connection->passedFd) {
+        close(connection->passedFd);
+    }
+    if (NULL != connection->handled) {
+        ReleaseHandledFrame(connection->handled);
+    }
+    if (NULL != connection->spareFrame) {
+        ReleaseHandledFrame(connection->spareFrame);
+    }
+    BufferChainDestroy(&connection->chain);
+    free(connection);
+}
+
+/**
+ * 为接受的客户 socket 分配连接，零拷贝模式下分配中转管道，否则分配数据缓冲区
+ * @param loop 事件循环
+ * @param clientSocket 客户 socket
+ * @return 连接，失败返回 NULL
+ */
+static struct Connection *NewConnection(struct EventLoop *loop, int clientSocket) {
+    struct Connection *connection = (struct Connection *) calloc(1, sizeof(struct Connection));
+    if (NULL == connection) {
+        return NULL;
+    }
+    connection->source.fd = clientSocket;
+    connection->source.type = EVENT_SOURCE_CONNECTION;
+    connection->pipeRead = -1;
+    connection->pipeWrite = -1;
+    connection->passedFd = -1;
+
+    if (loop->zeroCopy) {
+        int pipeFds[2];
+        if (-1 == pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC)) {
+            free(connection);
+            return NULL;
+        }
+        connection->pipeRead = pipeFds[0];
+        connection->pipeWrite = pipeFds[1];
+    } else {
+        if (-1 == BufferChainInit(&connection->chain, loop->segmentSize, loop->bufferSize)) {
+            free(connection);
+            return NULL;
+        }
+        FrameParserInit(&connection->frames, loop->checksums);
+
+        if (loop->messages) {
+            // 一条记录必须整个放进发送缓冲区，否则回显时 sendmsg 返回 EMSGSIZE；
+            // 内核把请求的大小加倍并限制在 wmem_max 以内，设置失败时保留默认大小
+            int sendBufferSize = (int) BufferChainMaxMessage(&connection->chain);
+            setsockopt(clientSocket, SOL_SOCKET, SO_SNDBUF, &sendBufferSize,
+                       sizeof(sendBufferSize));
+        }
+    }
+    return connection;
+}
+
+/**
+ * 把客户 socket 加入事件循环，失败时关闭它
+ * @param loop 事件循环
+ * @param clientSocket 非阻塞的客户 socket
+ * @return 成功返回 0，失败返回 -1
+ */
+static int AddConnection(struct EventLoop *loop, int clientSocket) {
+    // 忙轮询时读取不再等待中断，而是在内核中直接轮询网卡队列；需要 CAP_NET_ADMIN，
+    // 没有权限时只有用户空间的空转生效
+    if (loop->busyPoll) {
+        int micros = BUSY_POLL_MICROS;
+        setsockopt(clientSocket, SOL_SOCKET, SO_BUSY_POLL, &micros, sizeof(micros));
+        int on = 1;
+        setsockopt(clientSocket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+    }
+
+    struct Connection *connection = NewConnection(loop, clientSocket);
+    if (NULL == connection) {
+        close(clientSocket);
+        return -1;
+    }
+
+    // 连接注册一次后不再修改，边缘触发同时关注可读和可写；
+    // 交接来的连接在注册时如果已经有数据，epoll 同样会报告一次
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = connection;
+    if (-1 == epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, clientSocket, &event)) {
+        if (-1 != connection->pipeRead) {
+            close(connection->pipeRead);
+            close(connection->pipeWrite);
+        }
+        BufferChainDestroy(&connection->chain);
+        free(connection);
+        close(clientSocket);
+        return -1;
+    }
+
+    // 加入连接链表
+    connection->next = loop->connections;
+    if (NULL != loop->connections) {
+        loop->connections->prev = connection;
+    }
+    loop->connections = connection;
+    __atomic_store_n(&loop->connectionCount, loop->connectionCount + 1, __ATOMIC_RELAXED);
+    MetricsAdd(&loop->metrics->acceptedConnections, 1);
+    return 0;
+}
+
+/**
+ * 接受监听 socket 上全部等待中的客户连接
+ * @param loop 事件循环
+ * @param listener 监听 socket
+ */
+static void AcceptConnections(struct EventLoop *loop, struct EventSource *listener) {
+    while (1) {
+        int clientSocket = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (-1 == clientSocket) {
+            if (EINTR == errno || ECONNABORTED == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                MetricsAdd(&loop->metrics->eagain, 1);
+            } else if (EMFILE == errno || ENFILE == errno || ENOBUFS == errno || ENOMEM == errno) {
+                PauseAccepting(loop);
+            }
+            // EAGAIN 表示已经全部接受，其他错误留到下一轮再处理
+            break;
+        }
+
+        // 补上不从监听 socket 继承的选项，失败时仍然以默认值服务
+        if (NULL != loop->socketProfile) {
+            SocketProfileApply(loop->socketProfile, clientSocket, SOCKET_ROLE_ACCEPTED);
+        }
+
+        AddConnection(loop, clientSocket);
+    }
+}
+
+/**
+ * 待发送的数据已经全部发出，记录从接收到发送完成的服务时间
+ * @param loop 事件循环
+ * @param connection 连接
+ */
+static void RecordServiceTime(struct EventLoop *loop, struct Connection *connection) {
+    if (0 != connection->receivedAt) {
+        MetricsRecordServiceTime(loop->metrics, MetricsNow() - connection->receivedAt, 1);
+        connection->receivedAt = 0;
+    }
+}
+
+/**
+ * 尽可能发送连接中待发送的数据
+ * @param loop 事件循环
+ * @param connection 连接
+ * @return 全部发送返回 1，socket 发送缓冲区已满返回 0，连接出错返回 -1
+ */
+static int FlushConnection(struct EventLoop *loop, struct Connection *connection) {
+    // 分帧模式下只发送完整的帧，不完整的帧留在链中
+    struct BufferChain *chain = &connection->chain;
+    size_t end = loop->framing ? connection->frames.position : chain->length;
+
+    while (chain->offset < end) {
+        // 一次 sendmsg 发送多个分段，分帧模式下包括一次读取得到的全部完整帧，
+        // 记录模式下是一整条记录
+        ssize_t sentSize = loop->messages
+                           ? BufferChainWriteMessage(chain, connection->source.fd,
+                                                     connection->passedFd)
+                           : BufferChainWriteRange(chain, connection->source.fd, end);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (-1 == sentSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                MetricsAdd(&loop->metrics->eagain, 1);
+                return 0;
+            }
+            return -1;
+        }
+        MetricsAdd(&loop->metrics->bytesOut, (uint64_t) sentSize);
+        if (!loop->framing) {
+            MetricsAdd(&loop->metrics->messagesOut, 1);
+        }
+        if (-1 != connection->passedFd) {
+            // 描述符已经随记录发回，关闭本进程中的副本
+            close(connection->passedFd);
+            connection->passedFd = -1;
+        }
+        if (0 == chain->length) {
+            // 全部写出后链被清空
+            break;
+        }
+    }
+
+    if (loop->framing) {
+        MetricsAdd(&loop->metrics->messagesOut, FrameParserSettle(&connection->frames, chain));
+    }
+    RecordServiceTime(loop, connection);
+    return 1;
+}
+
+/**
+ * 尽可能发送处理完的帧的响应：帧头、响应和校验模式下的帧尾
+ * @param loop 事件循环
+ * @param connection 连接
+ * @param handled 处理完的帧
+ * @return 全部发送返回 1，socket 发送缓冲区已满返回 0，连接出错返回 -1
+ */
+static int SendResponse(struct EventLoop *loop, struct Connection *connection,
+                        struct HandledFrame *handled) {
+    struct HandlerOutput *output = &handled->task.output;
+    size_t trailerSize = loop->checksums ? FRAME_CHECKSUM_SIZE : 0;
+    if (0 == handled->sent) {
+        FrameEncodeHeader(handled->header, (uint32_t) (output->length + trailerSize));
+        if (loop->checksums) {
+            FrameEncodeHeader(handled->trailer, Crc32c(output->data, output->length));
+        }
+    }
+
+    size_t total = FRAME_HEADER_SIZE + output->length + trailerSize;
+    while (handled->sent < total) {
+        // 跳过已经发出的部分
+        struct iovec parts[3] = {
+                {handled->header, FRAME_HEADER_SIZE},
+                {output->data, output->length},
+                {handled->trailer, trailerSize}
+        };
+        struct iovec vectors[3];
+        int count = 0;
+        size_t skip = handled->sent;
+        for (struct iovec part : parts) {
+            if (skip >= part.iov_len) {
+                skip -= part.iov_len;
+                continue;
+            }
+            vectors[count].iov_base = (char *) part.iov_base + skip;
+            vectors[count].iov_len = part.iov_len - skip;
+            count++;
+            skip = 0;
+        }
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vectors;
+        message.msg_iovlen = (size_t) count;
+        ssize_t sentSize = sendmsg(connection->source.fd, &message, MSG_NOSIGNAL);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (-1 == sentSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                MetricsAdd(&loop->metrics->eagain, 1);
+                return 0;
+            }
+            return -1;
+        }
+        MetricsAdd(&loop->metrics->bytesOut, (uint64_t) sentSize);
+        handled->sent += (size_t) sentSize;
+    }
+    MetricsAdd(&loop->metrics->messagesOut, 1);
+    return 1;
+}
+
+/**
+ * 处理器模式下逐个处理缓冲区链中完整的帧并发回响应：有线程池时提交一个帧后等待交还，
+ * 否则在当前线程直接处理
+ * @param loop 事件循环
+ * @param connection 连接
+ * @return 全部处理并发送返回 1，socket 发送缓冲区已满或者等待处理线程返回 0，连接出错返回 -1
+ */
+static int FlushHandledFrames(struct EventLoop *loop, struct Connection *connection) {
+    size_t trailerSize = loop->checksums ? FRAME_CHECKSUM_SIZE : 0;
+    while (1) {
+        struct HandledFrame *handled = connection->handled;
+        if (NULL != handled) {
+            if (handled->running) {
+                return 0;
+            }
+            if (-1 == handled->task.result) {
+                // 处理器无法处理这个请求
+                return -1;
+            }
+            int sent = SendResponse(loop, connection, handled);
+            if (1 != sent) {
+                return sent;
+            }
+            connection->handled = NULL;
+            RecycleHandledFrame(loop, connection, handled);
+        }
+
+        size_t frameSize = FrameParserPeek(&connection->frames, &connection->chain);
+        if (0 == frameSize) {
+            break;
+        }
+        handled = NewHandledFrame(loop, connection, frameSize);
+        if (NULL == handled) {
+            return -1;
+        }
+        FrameParserTake(&connection->frames, &connection->chain, handled->frame, frameSize);
+        handled->task.handler = loop->handler;
+        handled->task.request = handled->frame + FRAME_HEADER_SIZE;
+        handled->task.requestLength = frameSize - FRAME_HEADER_SIZE - trailerSize;
+        handled->task.completions = &loop->completions;
+        handled->task.owner = connection;
+        handled->sent = 0;
+        connection->handled = handled;
+
+        if (NULL != loop->handlerPool) {
+            handled->running = true;
+            HandlerPoolSubmit(loop->handlerPool, &handled->task);
+            return 0;
+        }
+        handled->running = false;
+        handled->task.result = loop->handler->handle(handled->task.request,
+                                                     handled->task.requestLength,
+                                                     &handled->task.output);
+    }
+
+    RecordServiceTime(loop, connection);
+    return 1;
+}
+
+/**
+ * 发送阻塞时连接的发送队列是否已满，需要暂停读取：未暂停时按高水位判断，已暂停时按低水位判断，
+ * 积压在两者之间时保持原来的状态；高水位为 0 或者链中没有空间时总是已满
+ * @param loop 事件循环
+ * @param connection 发送阻塞的连接
+ * @return 需要暂停或者继续暂停读取返回 true
+ */
+static bool IsSendQueueFull(struct EventLoop *loop, struct Connection *connection) {
+    size_t pending = BufferChainPending(&connection->chain);
+    if (0 == loop->writeHighWatermark || pending >= connection->chain.capacity) {
+        return true;
+    }
+    return connection->readPaused ? pending > loop->writeLowWatermark
+                                  : pending >= loop->writeHighWatermark;
+}
+
+/**
+ * 读取连接上的全部数据并回显，边缘触发要求一直读到 EAGAIN
+ * @param loop 事件循环
+ * @param connection 连接
+ * @return 连接仍然有效返回 0，连接已关闭返回 -1
+ */
+static int ServeConnection(struct EventLoop *loop, struct Connection *connection) {
+    // socket 发送缓冲区已满之后不再尝试发送，等待 EPOLLOUT
+    bool writable = true;
+    while (1) {
+        // 先把上一次没有发送完的数据发送出去，处理器模式下先处理完已经收到的帧
+        if (writable) {
+            int flushed = (NULL != loop->handler) ? FlushHandledFrames(loop, connection)
+                                                  : FlushConnection(loop, connection);
+            if (-1 == flushed) {
+                CloseConnection(loop, connection);
+                return -1;
+            }
+            writable = (1 == flushed);
+        }
+        if (!writable) {
+            if (IsSendQueueFull(loop, connection)) {
+                // 客户端读取太慢，暂停读取直到积压降到低水位；或者等待处理线程交还
+                if (!connection->readPaused && NULL == loop->handler) {
+                    MetricsAdd(&loop->metrics->backpressurePauses, 1);
+                }
+                connection->readPaused = true;
+                return 0;
+            }
+            if (connection->chain.length == connection->chain.capacity) {
+                // 积压的数据移到链的开头，为继续读取腾出空间
+                BufferChainCompact(&connection->chain);
+            }
+        }
+        connection->readPaused = false;
+
+        // 缓冲区链此时为空、只有不完整的帧或者只有低于水位的积压，一次 readv 读入多个分段，
+        // 记录模式下一次 recvmsg 读入一整条记录
+        ssize_t recvSize = loop->messages
+                           ? BufferChainReadMessage(&connection->chain, connection->source.fd,
+                                                    &connection->passedFd)
+                           : BufferChainRead(&connection->chain, connection->source.fd);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (recvSize > 0) {
+            MetricsAdd(&loop->metrics->bytesIn, (uint64_t) recvSize);
+            if (loop->framing) {
+                ssize_t frameCount = FrameParserScan(&connection->frames, &connection->chain);
+                if (-1 == frameCount) {
+                    // 帧超过缓冲区容量无法回显，或者帧在传输中损坏
+                    if (EBADMSG == errno) {
+                        MetricsAdd(&loop->metrics->checksumErrors, 1);
+                    }
+                    CloseConnection(loop, connection);
+                    return -1;
+                }
+                if (frameCount > 0) {
+                    MetricsAdd(&loop->metrics->messagesIn, (uint64_t) frameCount);
+                    connection->receivedAt = MetricsNow();
+                }
+            } else {
+                MetricsAdd(&loop->metrics->messagesIn, 1);
+                connection->receivedAt = MetricsNow();
+            }
+        } else if (0 == recvSize) {
+            // 客户端断开连接
+            CloseConnection(loop, connection);
+            return -1;
+        } else if (EINTR == errno) {
+            continue;
+        } else if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            MetricsAdd(&loop->metrics->eagain, 1);
+            return 0;
+        } else {
+            CloseConnection(loop, connection);
+            return -1;
+        }
+    }
+}
+
+/**
+ * 把管道中的数据尽可能 splice 回客户 socket
+ * @param loop 事件循环
+ * @param connection 连接
+ * @return 全部发送返回 1，socket 发送缓冲区已满返回 0，连接出错返回 -1
+ */
+static int FlushPipe(struct EventLoop *loop, struct Connection *connection) {
+    while (connection->pendingLength > 0) {
+        ssize_t movedSize = splice(connection->pipeRead, NULL, connection->source.fd, NULL,
+                                   connection->pendingLength, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (-1 == movedSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                MetricsAdd(&loop->metrics->eagain, 1);
+                return 0;
+            }
+            return -1;
+        }
+        MetricsAdd(&loop->metrics->bytesOut, (uint64_t) movedSize);
+        MetricsAdd(&loop->metrics->messagesOut, 1);
+        loop->splicedBytes += (uint64_t) movedSize;
+        loop->spliceCalls++;
+        connection->pendingLength -= (size_t) movedSize;
+    }
+    RecordServiceTime(loop, connection);
+    return 1;
+}
+
+/**
+ * 零拷贝回显：socket->管道->socket，数据只在内核中移动，同样一直读到 EAGAIN
+ * @param loop 事件循环
+ * @param connection 连接
+ * @return 连接仍然有效返回 0，连接已关闭返回 -1
+ */
+static int SpliceConnection(struct EventLoop *loop, struct Connection *connection) {
+    while (1) {
+        // 先把管道中剩余的数据送回客户端，管道清空之后才继续读取
+        int flushed = FlushPipe(loop, connection);
+        if (-1 == flushed) {
+            CloseConnection(loop, connection);
+            return -1;
+        }
+        if (0 == flushed) {
+            connection->readPaused = true;
+            return 0;
+        }
+        connection->readPaused = false;
+
+        // 管道此时为空，EAGAIN 只能说明 socket 中没有数据了
+        ssize_t movedSize = splice(connection->source.fd, NULL, connection->pipeWrite, NULL,
+                                   SPLICE_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (movedSize > 0) {
+            MetricsAdd(&loop->metrics->bytesIn, (uint64_t) movedSize);
+            MetricsAdd(&loop->metrics->messagesIn, 1);
+            connection->receivedAt = MetricsNow();
+            loop->splicedBytes += (uint64_t) movedSize;
+            loop->spliceCalls++;
+            connection->pendingLength = (size_t) movedSize;
+        } else if (0 == movedSize) {
+            // 客户端断开连接
+            CloseConnection(loop, connection);
+            return -1;
+        } else if (EINTR == errno) {
+            continue;
+        } else if (EAGAIN == errno || EWOULDBLOCK == errno) {
+            MetricsAdd(&loop->metrics->eagain, 1);
+            return 0;
+        } else {
+            CloseConnection(loop, connection);
+            return -1;
+        }
+    }
+}
+
+/**
+ * 处理单个连接上的 epoll 事件
+ * @param loop 事件循环
+ * @param connection 连接
+ * @param events epoll 事件位
+ * @return 连接仍然有效返回 0，连接已关闭返回 -1
+ */
+static int HandleConnectionEvents(struct EventLoop *loop,
+                                  struct Connection *connection,
+                                  unsigned int events) {
+    if (events & EPOLLERR) {
+        CloseConnection(loop, connection);
+        return -1;
+    }
+
+    // 可读、对端关闭，或者因发送阻塞暂停的读取现在可以继续
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+        || ((events & EPOLLOUT) && connection->readPaused)) {
+        return loop->zeroCopy ? SpliceConnection(loop, connection)
+                              : ServeConnection(loop, connection);
+    }
+    if (events & EPOLLOUT) {
+        int flushed = loop->zeroCopy ? FlushPipe(loop, connection)
+                                     : (NULL != loop->handler)
+                                       ? FlushHandledFrames(loop, connection)
+                                       : FlushConnection(loop, connection);
+        if (-1 == flushed) {
+            CloseConnection(loop, connection);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 连接是否处于消息边界：已经收到的数据全部回显，没有不完整的帧，也没有暂停的读取
+ * @param loop 事件循环
+ * @param connection 连接
+ * @return 可以交出或者关闭返回 true
+ */
+static bool IsConnectionIdle(struct EventLoop *loop, struct Connection *connection) {
+    if (connection->readPaused) {
+        return false;
+    }
+    if (loop->zeroCopy) {
+        return 0 == connection->pendingLength;
+    }
+    return 0 == connection->chain.length && -1 == connection->passedFd
+           && NULL == connection->handled;
+}
+
+/**
+ * 把等待交出的连接一次发给新实例，然后关闭本进程中的副本
+ * @param loop 事件循环
+ */
+static void FlushRetiredConnections(struct EventLoop *loop) {
+    if (0 == loop->retiredCount) {
+        return;
+    }
+    if (-1 == HandoffSend(loop->handoffSocket, HANDOFF_CONNECTIONS, loop->retiredFds,
+                          loop->retiredCount)) {
+        // 新实例已经不可用，这一批和之后空闲的连接只能关闭
+        close(loop->handoffSocket);
+        loop->handoffSocket = -1;
+    }
+    for (size_t i = 0; i < loop->retiredCount; i++) {
+        close(loop->retiredFds[i]);
+    }
+    loop->retiredCount = 0;
+}
+
+/**
+ * 排空时让空闲的连接离开事件循环：有新实例时交出，否则关闭
+ * @param loop 事件循环
+ * @param connection 空闲的连接
+ */
+static void RetireConnection(struct EventLoop *loop, struct Connection *connection) {
+    if (-1 == loop->handoffSocket) {
+        CloseConnection(loop, connection);
+        return;
+    }
+
+    // 新实例也引用同一个打开的文件，关闭本进程的描述符不会把它从 epoll 中移除，必须显式删除
+    epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, connection->source.fd, NULL);
+    if (LOCAL_MAX_DESCRIPTORS == loop->retiredCount) {
+        FlushRetiredConnections(loop);
+    }
+    loop->retiredFds[loop->retiredCount++] = connection->source.fd;
+    connection->source.fd = -1;
+    CloseConnection(loop, connection);
+}
+
+/**
+ * 继续服务处理线程交还了帧的连接，在一轮事件全部处理完之后调用，关闭连接不会留下指向已释放连接的事件
+ * @param loop 事件循环
+ */
+static void CompleteHandledFrames(struct EventLoop *loop) {
+    struct HandlerTask *task = HandlerCompletionQueueTake(&loop->completions);
+    while (NULL != task) {
+        struct HandlerTask *next = task->next;
+        struct HandledFrame *handled = (struct HandledFrame *) task;
+        struct Connection *connection = (struct Connection *) task->owner;
+        handled->running = false;
+        if (NULL == connection) {
+            ReleaseHandledFrame(handled);
+        } else if (0 == ServeConnection(loop, connection)
+                   && loop->draining && IsConnectionIdle(loop, connection)) {
+            RetireConnection(loop, connection);
+        }
+        task = next;
+    }
+}
+
+/**
+ * 处理其他线程的排空和交接请求，在一轮事件全部处理完之后调用，
+ * 此时交出连接不会留下指向已释放连接的事件
+ * @param loop 事件循环
+ */
+static void HandleDrainRequest(struct EventLoop *loop) {
+    if (!__atomic_load_n(&loop->drainRequested, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    int sd = __atomic_exchange_n(&loop->handoffRequest, -1, __ATOMIC_ACQ_REL);
+    if (loop->draining) {
+        if (-1 != sd) {
+            close(sd);
+        }
+        return;
+    }
+
+    if (-1 != sd) {
+        // 先交出监听 socket，失败时新实例没有接手，放弃交接继续服务
+        for (size_t i = 0; i < loop->listenerCount; i++) {
+            if (-1 == HandoffSend(sd, HANDOFF_LISTENERS, &loop->listeners[i]->fd, 1)) {
+                close(sd);
+                __atomic_store_n(&loop->drainRequested, false, __ATOMIC_RELEASE);
+                return;
+            }
+        }
+        loop->handoffSocket = sd;
+    }
+
+    // 停止接受新连接，之后到达的连接留在内核的接受队列中
+    __atomic_store_n(&loop->draining, true, __ATOMIC_RELAXED);
+    for (size_t i = 0; i < loop->listenerCount; i++) {
+        epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, loop->listeners[i]->fd, NULL);
+    }
+
+    struct Connection *connection = loop->connections;
+    while (NULL != connection) {
+        struct Connection *next = connection->next;
+        if (IsConnectionIdle(loop, connection)) {
+            RetireConnection(loop, connection);
+        }
+        connection = next;
+    }
+}
+
+/**
+ * 关闭交接 socket，之后不会再有描述符
+ * @param loop 事件循环
+ */
+static void CloseHandoffSource(struct EventLoop *loop) {
+    close(loop->handoffSource.fd);
+    loop->handoffSource.fd = -1;
+}
+
+/**
+ * 接收旧实例交出的描述符，一直读到 EAGAIN
+ * @param loop 事件循环
+ */
+static void ReceiveHandoff(struct EventLoop *loop) {
+    struct HandoffBatch batch;
+    while (1) {
+        int result = HandoffReceive(loop->handoffSource.fd, &batch);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (-1 == result && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            MetricsAdd(&loop->metrics->eagain, 1);
+            return;
+        }
+        if (1 != result || HANDOFF_END == batch.kind) {
+            // 结束标记、对端关闭或者出错，之后不会再收到描述符
+            CloseHandoffSource(loop);
+            return;
+        }
+
+        for (int i = 0; i < batch.fdCount; i++) {
+            if (HANDOFF_LISTENERS == batch.kind) {
+                if (-1 == EventLoopAddListener(loop, batch.fds[i])) {
+                    close(batch.fds[i]);
+                }
+            } else {
+                AddConnection(loop, batch.fds[i]);
+            }
+        }
+    }
+}
+
+int EventLoopRun(struct EventLoop *loop) {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    // 忙轮询线程独占一个核心，绑定失败时继续以不绑定的方式运行
+    if (loop->busyPoll && loop->busyPollCpu >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(loop->busyPollCpu, &cpuSet);
+        sched_setaffinity(0, sizeof(cpuSet), &cpuSet);
+    }
+    uint64_t lastEventAt = MetricsNow();
+
+    while (__atomic_load_n(&loop->running, __ATOMIC_ACQUIRE)) {
+        // 忙轮询时空闲不久就不让出 CPU，省去调度器唤醒的延迟；空闲太久退回阻塞等待
+        int timeout = -1;
+        if (loop->busyPoll) {
+            if (MetricsNow() - lastEventAt < loop->busyPollIdleNanos) {
+                timeout = 0;
+            } else {
+                loop->busyPollSleeps++;
+            }
+        }
+
+        // 暂停接受期间最多等到暂停到期
+        if (0 != loop->acceptPausedUntil) {
+            uint64_t now = MetricsNow();
+            if (now >= loop->acceptPausedUntil) {
+                ResumeAccepting(loop);
+            } else if (0 != timeout) {
+                timeout = (int) ((loop->acceptPausedUntil - now + 999999) / 1000000);
+            }
+        }
+
+        int eventCount = epoll_wait(loop->epollFd, events, MAX_EPOLL_EVENTS, timeout);
+        MetricsAdd(&loop->metrics->syscalls, 1);
+        if (-1 == eventCount) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        if (loop->busyPoll) {
+            if (eventCount > 0) {
+                lastEventAt = MetricsNow();
+            } else {
+                loop->busyPollSpins++;
+            }
+        }
+
+        for (int i = 0; i < eventCount; i++) {
+            struct EventSource *source = (struct EventSource *) events[i].data.ptr;
+            switch (source->type) {
+                case EVENT_SOURCE_LISTENER:
+                    AcceptConnections(loop, source);
+                    break;
+
+                case EVENT_SOURCE_WAKEUP: {
+                    uint64_t value;
+                    read(source->fd, &value, sizeof(value));
+                    break;
+                }
+
+                case EVENT_SOURCE_CONNECTION: {
+                    struct Connection *connection = (struct Connection *) source;
+                    if (0 == HandleConnectionEvents(loop, connection, events[i].events)
+                        && loop->draining && IsConnectionIdle(loop, connection)) {
+                        RetireConnection(loop, connection);
+                    }
+                    break;
+                }
+
+                case EVENT_SOURCE_HANDOFF:
+                    ReceiveHandoff(loop);
+                    break;
+            }
+        }
+
+        if (NULL != loop->handlerPool) {
+            CompleteHandledFrames(loop);
+        }
+        HandleDrainRequest(loop);
+        if (loop->draining) {
+            FlushRetiredConnections(loop);
+            if (0 == loop->connectionCount) {
+                // 全部连接已经交出或者关闭
+                if (-1 != loop->handoffSocket) {
+                    HandoffSendEnd(loop->handoffSocket);
+                    close(loop->handoffSocket);
+                    loop->handoffSocket = -1;
+                }
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+void EventLoopStop(struct EventLoop *loop) {
+    __atomic_store_n(&loop->running, false, __ATOMIC_RELEASE);
+
+    // 唤醒阻塞在 epoll_wait 中的线程
+    uint64_t value = 1;
+    write(loop->wakeup.fd, &value, sizeof(value));
+}
+
+void EventLoopDrain(struct EventLoop *loop) {
+    __atomic_store_n(&loop->drainRequested, true, __ATOMIC_RELEASE);
+
+    uint64_t value = 1;
+    write(loop->wakeup.fd, &value, sizeof(value));
+}
+
+void EventLoopHandoff(struct EventLoop *loop, int sd) {
+    int previous = __atomic_exchange_n(&loop->handoffRequest, sd, __ATOMIC_ACQ_REL);
+    if (-1 != previous) {
+        close(previous);
+    }
+    EventLoopDrain(loop);
+}
+
+int EventLoopAddHandoff(struct EventLoop *loop, int sd) {
+    if (-1 != loop->handoffSource.fd) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (-1 == SetNonBlocking(sd)) {
+        return -1;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &loop->handoffSource;
+    if (-1 == epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, sd, &event)) {
+        return -1;
+    }
+    loop->handoffSource.fd = sd;
+    return 0;
+}
+
+size_t EventLoopConnectionCount(const struct EventLoop *loop) {
+    return __atomic_load_n(&loop->connectionCount, __ATOMIC_RELAXED);
+}
+
+bool EventLoopIsDraining(const struct EventLoop *loop) {
+    return __atomic_load_n(&loop->draining, __ATOMIC_RELAXED);
+}
+
+void EventLoopDestroy(struct EventLoop *loop) {
+    // 提前停止时已经空闲的连接仍然交给新实例
+    if (-1 != loop->handoffSocket) {
+        FlushRetiredConnections(loop);
+        if (-1 != loop->handoffSocket) {
+            close(loop->handoffSocket);
+            loop->handoffSocket = -1;
+        }
+    }
+    int handoffRequest = __atomic_exchange_n(&loop->handoffRequest, -1, __ATOMIC_ACQ_REL);
+    if (-1 != handoffRequest) {
+        close(handoffRequest);
+    }
+    if (-1 != loop->handoffSource.fd) {
+        CloseHandoffSource(loop);
+    }
+
+    while (NULL != loop->connections) {
+        CloseConnection(loop, loop->connections);
+    }
+
+    // 处理中的帧在关闭连接时成为孤儿，停止线程池后全部在完成队列中
+    if (NULL != loop->handlerPool) {
+        HandlerPoolDestroy(loop->handlerPool);
+        free(loop->handlerPool);
+        loop->handlerPool = NULL;
+        struct HandlerTask *task = HandlerCompletionQueueTake(&loop->completions);
+        while (NULL != task) {
+            struct HandlerTask *next = task->next;
+            struct HandledFrame *handled = (struct HandledFrame *) task;
+            handled->running = false;
+            ReleaseHandledFrame(handled);
+            task = next;
+        }
+    }
+
+    for (size_t i = 0; i < loop->listenerCount; i++) {
+        free(loop->listeners[i]);
+    }
+    free(loop->listeners);
+    loop->listeners = NULL;
+    loop->listenerCount = 0;
+
+    if (-1 != loop->wakeup.fd) {
+        close(loop->wakeup.fd);
+        loop->wakeup.fd = -1;
+    }
+    if (-1 != loop->epollFd) {
+        close(loop->epollFd);
+        loop->epollFd = -1;
+    }
+
+    MetricsReleaseShard(loop->metrics);
+    loop->metrics = NULL;
+}
@@ -0,0 +1,261 @@
+#ifndef ECHO_EVENT_LOOP_H
+#define ECHO_EVENT_LOOP_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <sys/types.h> // ssize_t
+#include "ServerOptions.h"
+#include "Metrics.h"
+#include "BufferChain.h"
+#include "Frame.h"
+#include "Handoff.h"
+#include "HandlerPool.h"
+
+/**
+ * 事件源类型，保存在 epoll_event.data.ptr 指向的结构体开头，
+ * 事件分发时据此区分监听 socket、唤醒 eventfd、客户端连接和接收交接的本地 socket
+ */
+enum EventSourceType {
+    EVENT_SOURCE_LISTENER,
+    EVENT_SOURCE_WAKEUP,
+    EVENT_SOURCE_CONNECTION,
+    EVENT_SOURCE_HANDOFF
+};
+
+/**
+ * 注册到 epoll 中的事件源
+ */
+struct EventSource {
+    // 文件描述符
+    int fd;
+
+    // 事件源类型
+    EventSourceType type;
+};
+
+struct HandledFrame;
+
+/**
+ * 单个客户端连接的读写状态
+ */
+struct Connection {
+    // 必须是第一个成员，epoll 事件直接转换为 EventSource
+    struct EventSource source;
+
+    // 数据缓冲区链，零拷贝模式下不分配分段
+    struct BufferChain chain;
+
+    // 分帧模式下缓冲区链上的帧解析状态
+    struct FrameParser frames;
+
+    // 记录模式下与待回显的记录一起收到的描述符，没有时为 -1
+    int passedFd;
+
+    // 零拷贝模式下中转数据的管道，其他模式下为 -1
+    int pipeRead;
+    int pipeWrite;
+
+    // 零拷贝模式下管道中尚未发回客户端的字节数
+    size_t pendingLength;
+
+    // 因为发送阻塞或者等待处理线程而暂停了读取，socket 可写或者处理完成后需要继续读取
+    bool readPaused;
+
+    // 处理器模式下正在处理或者等待发回的帧，没有时为 NULL；
+    // 同一个连接同时只处理一个帧，响应按请求的顺序发回
+    struct HandledFrame *handled;
+
+    // 处理器模式下发完响应的帧，连同响应缓冲区留给下一个帧复用，没有时为 NULL
+    struct HandledFrame *spareFrame;
+
+    // 待发送数据的接收时间，用于记录服务时间，没有待发送数据时为 0
+    uint64_t receivedAt;
+
+    // 连接链表，用于关闭事件循环时释放全部连接
+    struct Connection *prev;
+    struct Connection *next;
+};
+
+/**
+ * 单线程、非阻塞、边缘触发的 epoll 事件循环
+ */
+struct EventLoop {
+    // epoll 实例
+    int epollFd;
+
+    // 用于跨线程停止事件循环的 eventfd
+    struct EventSource wakeup;
+
+    // 监听 socket 数组
+    struct EventSource **listeners;
+    size_t listenerCount;
+
+    // 每个连接的缓冲区链的分段大小和总容量
+    size_t segmentSize;
+    size_t bufferSize;
+
+    // 流回显时缓冲区链也是连接的发送队列：发送阻塞后继续读取，直到尚未发出的字节数达到高水位，
+    // 暂停读取后降到低水位以下才恢复；分帧、记录和零拷贝模式下为 0，有数据没有发出就暂停读取
+    size_t writeHighWatermark;
+    size_t writeLowWatermark;
+
+    // 是否用 splice 经管道回显，数据不进入用户空间
+    bool zeroCopy;
+
+    // 是否按长度前缀帧回显，一次读取得到的多个帧合并为一次 sendmsg
+    bool framing;
+
+    // 分帧模式下是否校验每个帧尾的 CRC32C，不匹配时关闭连接
+    bool checksums;
+
+    // 分帧模式下处理每个帧的处理器，响应编码为帧发回；原样回显并且没有处理线程时为 NULL，
+    // 完整的帧直接从缓冲区链发回。可以在 EventLoopRun 之前替换为自定义的处理器
+    const struct MessageHandler *handler;
+
+    // 运行处理器的线程池，在 I/O 线程中直接处理时为 NULL；
+    // 处理完的帧经完成队列交还事件循环，由唤醒 eventfd 通知
+    struct HandlerPool *handlerPool;
+    struct HandlerCompletionQueue completions;
+
+    // 是否按记录回显（SOCK_SEQPACKET），每次 recvmsg 读取一条记录并原样发回，
+    // 记录附带的描述符随回显一起发回
+    bool messages;
+
+    // 接受的连接补充应用的调优方案，默认方案时为 NULL
+    const struct SocketProfile *socketProfile;
+
+    // 零拷贝模式下 splice 移动的总字节数和调用次数
+    uint64_t splicedBytes;
+    uint64_t spliceCalls;
+
+    // 忙轮询：零超时反复 epoll_wait，空闲超过 busyPollIdleNanos 后退回阻塞等待，有事件后恢复空转
+    bool busyPoll;
+    uint64_t busyPollIdleNanos;
+
+    // 忙轮询线程绑定的 CPU 核心，-1 表示不绑定
+    int busyPollCpu;
+
+    // 忙轮询模式下没有事件的空转次数和退回阻塞等待的次数
+    uint64_t busyPollSpins;
+    uint64_t busyPollSleeps;
+
+    // 停止标志，由 EventLoopStop 从其他线程清除，用 __atomic 读写
+    bool running;
+
+    // 描述符或者内存耗尽时暂停接受新连接：监听 socket 移出 epoll，
+    // 有连接关闭或者到达这个时间（MetricsNow 纳秒）后恢复，0 表示没有暂停
+    uint64_t acceptPausedUntil;
+
+    // 其他线程的排空请求和交接 socket，-1 表示没有交接请求
+    bool drainRequested;
+    int handoffRequest;
+
+    // 正在排空：不再接受新连接，连接空闲时交出或者关闭，全部结束后 EventLoopRun 返回；
+    // 只由运行事件循环的线程写入，其他线程用 EventLoopIsDraining 读取
+    bool draining;
+
+    // 排空时向新实例交出描述符的 socket，-1 表示空闲的连接直接关闭
+    int handoffSocket;
+
+    // 本轮事件中变为空闲、等待一次交出的连接
+    int retiredFds[LOCAL_MAX_DESCRIPTORS];
+    size_t retiredCount;
+
+    // 从旧实例接收监听 socket 和连接的本地 socket
+    struct EventSource handoffSource;
+
+    // 活动连接链表及数量，其他线程用 EventLoopConnectionCount 读取数量
+    struct Connection *connections;
+    size_t connectionCount;
+
+    // 指标分片，只由运行事件循环的线程写入
+    struct MetricsShard *metrics;
+};
+
+/**
+ * 将文件描述符设置为非阻塞模式
+ * @param fd 文件描述符
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int SetNonBlocking(int fd);
+
+/**
+ * 初始化事件循环
+ * @param loop 事件循环
+ * @param options 服务器选项，其中的缓冲区大小为每个连接最多缓存的字节数，
+ *     分帧模式下按其中的处理线程数启动线程池
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int EventLoopInit(struct EventLoop *loop, const struct ServerOptions *options);
+
+/**
+ * 添加一个已经处于监听状态的 socket，TCP 和本地 UNIX socket 均可
+ * @param loop 事件循环
+ * @param sd 监听 socket 描述符，会被设置为非阻塞模式
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int EventLoopAddListener(struct EventLoop *loop, int sd);
+
+/**
+ * 在当前线程运行事件循环，直到调用 EventLoopStop 或者发生致命错误；
+ * 忙轮询模式下先把当前线程绑定到选项指定的 CPU 核心
+ * @param loop 事件循环
+ * @return 正常停止返回 0，失败返回 -1 并设置 errno
+ */
+int EventLoopRun(struct EventLoop *loop);
+
+/**
+ * 请求停止事件循环，可以从任何线程调用
+ * @param loop 事件循环
+ */
+void EventLoopStop(struct EventLoop *loop);
+
+/**
+ * 请求排空事件循环，可以从任何线程调用
+ *     停止接受新连接，监听 socket 留在内核中继续排队；每个连接回显完已经收到的数据、
+ *     没有不完整的帧时关闭，全部连接关闭后 EventLoopRun 返回 0
+ * @param loop 事件循环
+ */
+void EventLoopDrain(struct EventLoop *loop);
+
+/**
+ * 请求把事件循环交给新的服务器实例，可以从任何线程调用
+ *     先交出全部监听 socket 再停止接受；每个连接在排空时变为空闲后交出而不是关闭，
+ *     全部交出后发送结束标记，EventLoopRun 返回 0。交出监听 socket 失败时放弃交接继续服务；
+ *     已经在排空时忽略请求
+ * @param loop 事件循环
+ * @param sd 已经连接到新实例的阻塞模式本地 SOCK_SEQPACKET socket，事件循环接管并关闭它
+ */
+void EventLoopHandoff(struct EventLoop *loop, int sd);
+
+/**
+ * 接收旧实例交出的监听 socket 和连接：socket 可读时接收批次，把描述符加入事件循环，
+ * 收到结束标记或者对端关闭后关闭 socket。收到的监听 socket 加入 listeners，同样由调用者关闭
+ * @param loop 事件循环
+ * @param sd 连接到旧实例的本地 SOCK_SEQPACKET socket，事件循环接管并关闭它
+ * @return 成功返回 0，已经在接收时返回 -1 并设置 errno 为 EBUSY，失败返回 -1 并设置 errno
+ */
+int EventLoopAddHandoff(struct EventLoop *loop, int sd);
+
+/**
+ * 取得活动连接数，可以从任何线程调用
+ * @param loop 事件循环
+ * @return 连接数
+ */
+size_t EventLoopConnectionCount(const struct EventLoop *loop);
+
+/**
+ * 是否正在排空，可以从任何线程调用
+ * @param loop 事件循环
+ * @return 已经开始排空返回 true
+ */
+bool EventLoopIsDraining(const struct EventLoop *loop);
+
+/**
+ * 关闭全部客户端连接并释放事件循环资源，监听 socket 由调用者关闭；
+ * 线程池先处理完已经提交的帧再停止，这些帧的响应不再发送
+ * @param loop 事件循环
+ */
+void EventLoopDestroy(struct EventLoop *loop);
+
+#endif // ECHO_EVENT_LOOP_H
@@ -0,0 +1,120 @@
+#include "Frame.h"
+#include <errno.h> // errno
+
+void FrameParserInit(struct FrameParser *parser, bool checksums) {
+    parser->position = 0;
+    parser->readyFrames = 0;
+    parser->checksums = checksums;
+}
+
+/**
+ * 读取缓冲区链中给定偏移处的帧头或者帧尾，可能跨越两个分段
+ * @param chain 缓冲区链
+ * @param position 帧头或者帧尾的偏移，之后至少有 FRAME_HEADER_SIZE 字节数据
+ * @return 帧头中的负载长度或者帧尾中的校验和
+ */
+static uint32_t PeekHeader(const struct BufferChain *chain, size_t position) {
+    char header[FRAME_HEADER_SIZE];
+    for (size_t i = 0; i < FRAME_HEADER_SIZE; i++) {
+        size_t offset = position + i;
+        header[i] = chain->segments[offset / chain->segmentSize][offset % chain->segmentSize];
+    }
+    return FrameDecodeHeader(header);
+}
+
+/**
+ * 计算缓冲区链中一段数据的 CRC32C，数据可能跨越多个分段
+ * @param chain 缓冲区链
+ * @param position 数据在链中的偏移
+ * @param length 数据长度
+ * @return 校验和
+ */
+static uint32_t FrameChecksum(const struct BufferChain *chain, size_t position, size_t length) {
+    uint32_t crc = 0;
+    while (length > 0) {
+        size_t segmentOffset = position % chain->segmentSize;
+        size_t chunk = chain->segmentSize - segmentOffset;
+        if (chunk > length) {
+            chunk = length;
+        }
+        crc = Crc32cUpdate(crc, chain->segments[position / chain->segmentSize] + segmentOffset,
+                           chunk);
+        position += chunk;
+        length -= chunk;
+    }
+    return crc;
+}
+
+bool FrameVerifyChecksum(const struct BufferChain *chain, size_t position, size_t frameSize) {
+    if (frameSize < FRAME_HEADER_SIZE + FRAME_CHECKSUM_SIZE) {
+        return false;
+    }
+    // 帧尾与帧头一样可能跨越两个分段
+    size_t payload = position + FRAME_HEADER_SIZE;
+    size_t payloadSize = frameSize - FRAME_HEADER_SIZE - FRAME_CHECKSUM_SIZE;
+    return FrameChecksum(chain, payload, payloadSize) == PeekHeader(chain, payload + payloadSize);
+}
+
+ssize_t FrameParserScan(struct FrameParser *parser, const struct BufferChain *chain) {
+    ssize_t frameCount = 0;
+    while (chain->length - parser->position >= FRAME_HEADER_SIZE) {
+        size_t frameSize = FRAME_HEADER_SIZE + (size_t) PeekHeader(chain, parser->position);
+        if (frameSize > chain->capacity) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if (chain->length - parser->position < frameSize) {
+            break;
+        }
+
+        if (parser->checksums && !FrameVerifyChecksum(chain, parser->position, frameSize)) {
+            errno = EBADMSG;
+            return -1;
+        }
+
+        parser->position += frameSize;
+        parser->readyFrames++;
+        frameCount++;
+    }
+    return frameCount;
+}
+
+size_t FrameParserSettle(struct FrameParser *parser, struct BufferChain *chain) {
+    size_t frameCount = parser->readyFrames;
+    parser->readyFrames = 0;
+
+    if (0 == chain->length) {
+        // 全部写出后缓冲区链已经从头开始
+        parser->position = 0;
+        return frameCount;
+    }
+
+    // 不完整的帧至少还需要读到哪里
+    size_t needed = parser->position + FRAME_HEADER_SIZE;
+    if (chain->length - parser->position >= FRAME_HEADER_SIZE) {
+        needed = parser->position + FRAME_HEADER_SIZE + PeekHeader(chain, parser->position);
+    }
+    if (needed > chain->capacity) {
+        // 帧不超过容量，移到开头后一定放得下
+        size_t distance = BufferChainCompact(chain);
+        parser->position -= distance;
+    }
+    return frameCount;
+}
+
+size_t FrameParserPeek(const struct FrameParser *parser, const struct BufferChain *chain) {
+    if (0 == parser->readyFrames) {
+        return 0;
+    }
+    return FRAME_HEADER_SIZE + (size_t) PeekHeader(chain, chain->offset);
+}
+
+void FrameParserTake(struct FrameParser *parser, struct BufferChain *chain, char *frame,
+                     size_t frameSize) {
+    BufferChainCopyOut(chain, frame, frameSize);
+    BufferChainConsume(chain, frameSize);
+    parser->readyFrames--;
+    if (0 == parser->readyFrames) {
+        FrameParserSettle(parser, chain);
+    }
+}
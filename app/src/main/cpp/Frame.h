@@ -0,0 +1,108 @@
+#ifndef ECHO_FRAME_H
+#define ECHO_FRAME_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+#include <sys/types.h> // ssize_t
+#include "BufferChain.h"
+#include "Crc32c.h"
+
+// 帧头长度，帧头是大端序的 32 位负载长度，不包括帧头本身
+#define FRAME_HEADER_SIZE 4
+
+// 校验模式下帧尾的长度，帧尾是大端序的负载 CRC32C，计入帧头的长度
+#define FRAME_CHECKSUM_SIZE CRC32C_SIZE
+
+/**
+ * 写入帧头
+ * @param header 帧头，至少 FRAME_HEADER_SIZE 字节
+ * @param length 负载长度
+ */
+static inline void FrameEncodeHeader(char *header, uint32_t length) {
+    header[0] = (char) (length >> 24);
+    header[1] = (char) (length >> 16);
+    header[2] = (char) (length >> 8);
+    header[3] = (char) length;
+}
+
+/**
+ * 读取帧头
+ * @param header 帧头
+ * @return 负载长度
+ */
+static inline uint32_t FrameDecodeHeader(const char *header) {
+    const unsigned char *bytes = (const unsigned char *) header;
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16)
+           | ((uint32_t) bytes[2] << 8) | (uint32_t) bytes[3];
+}
+
+/**
+ * 校验缓冲区链中一个完整的帧：帧尾是否等于负载的 CRC32C，帧可能跨越多个分段
+ * @param chain 缓冲区链
+ * @param position 帧头的偏移
+ * @param frameSize 帧的总长度，包括帧头和帧尾，链中至少有这么多数据
+ * @return 帧尾与负载一致返回 true，帧短于帧头加帧尾或者不一致返回 false
+ */
+bool FrameVerifyChecksum(const struct BufferChain *chain, size_t position, size_t frameSize);
+
+/**
+ * 缓冲区链上的长度前缀帧解析状态
+ *     完整的帧原样回显，末尾不完整的帧留在链中等待后续读取；
+ *     一次读取得到的多个完整帧由一次 sendmsg 合并发回
+ */
+struct FrameParser {
+    // 下一个帧头在缓冲区链中的偏移，也是完整的帧的结束偏移，之前的数据可以回显
+    size_t position;
+
+    // 完整但尚未全部回显的帧数
+    size_t readyFrames;
+
+    // 每个帧是否以负载的 CRC32C 结尾，校验通过的帧才回显
+    bool checksums;
+};
+
+/**
+ * 初始化解析状态
+ * @param parser 解析状态
+ * @param checksums 是否校验帧尾的 CRC32C
+ */
+void FrameParserInit(struct FrameParser *parser, bool checksums);
+
+/**
+ * 在新读入的数据中查找完整的帧，校验模式下同时校验每个完整的帧
+ * @param parser 解析状态
+ * @param chain 缓冲区链
+ * @return 新找到的完整帧数，帧的总长度超过缓冲区链的容量时返回 -1 并设置 errno 为 EMSGSIZE，
+ *         校验模式下帧短于帧尾或者校验和不匹配时返回 -1 并设置 errno 为 EBADMSG
+ */
+ssize_t FrameParserScan(struct FrameParser *parser, const struct BufferChain *chain);
+
+/**
+ * 完整的帧全部回显后调用：缓冲区链已经清空时重置解析状态，
+ * 末尾不完整的帧在链中剩余的空间放不下时把它移到链的开头
+ * @param parser 解析状态
+ * @param chain 缓冲区链
+ * @return 回显的帧数
+ */
+size_t FrameParserSettle(struct FrameParser *parser, struct BufferChain *chain);
+
+/**
+ * 处理器模式下查看缓冲区链开头的完整帧
+ * @param parser 解析状态
+ * @param chain 缓冲区链
+ * @return 帧的总长度，包括帧头和校验模式下的帧尾；没有完整的帧时返回 0
+ */
+size_t FrameParserPeek(const struct FrameParser *parser, const struct BufferChain *chain);
+
+/**
+ * 处理器模式下把缓冲区链开头的完整帧复制出来并从链中移除，
+ * 完整的帧全部取出后与 FrameParserSettle 一样整理缓冲区链
+ * @param parser 解析状态
+ * @param chain 缓冲区链
+ * @param frame 帧的副本，至少有 FrameParserPeek 返回的长度
+ * @param frameSize FrameParserPeek 返回的长度
+ */
+void FrameParserTake(struct FrameParser *parser, struct BufferChain *chain, char *frame,
+                     size_t frameSize);
+
+#endif // ECHO_FRAME_H
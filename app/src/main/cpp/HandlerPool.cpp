@@ -0,0 +1,225 @@
+#include "HandlerPool.h"
+#include <stdlib.h> // calloc, free
+#include <errno.h> // errno
+#include <unistd.h> // write
+
+void HandlerCompletionQueueInit(struct HandlerCompletionQueue *queue, int wakeupFd) {
+    queue->head = NULL;
+    queue->wakeupFd = wakeupFd;
+}
+
+/**
+ * 把完成的任务压入完成队列，可以由多个线程同时调用
+ * @param queue 完成队列
+ * @param task 任务
+ */
+static void CompleteTask(struct HandlerCompletionQueue *queue, struct HandlerTask *task) {
+    // 消费者总是一次取走整个链表，压入的节点不会被单独弹出，不存在 ABA 问题
+    struct HandlerTask *head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while (!__atomic_compare_exchange_n(&queue->head, &head, task, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // 队列原来不为空时消费者已经被唤醒过，取走时会连同这个任务一起取走
+    if (NULL == head) {
+        uint64_t value = 1;
+        write(queue->wakeupFd, &value, sizeof(value));
+    }
+}
+
+struct HandlerTask *HandlerCompletionQueueTake(struct HandlerCompletionQueue *queue) {
+    struct HandlerTask *task = __atomic_exchange_n(&queue->head, NULL, __ATOMIC_ACQUIRE);
+
+    // 压入顺序是后完成的在前，反转为完成顺序
+    struct HandlerTask *ordered = NULL;
+    while (NULL != task) {
+        struct HandlerTask *next = task->next;
+        task->next = ordered;
+        ordered = task;
+        task = next;
+    }
+    return ordered;
+}
+
+/**
+ * 从线程自己的队头取最早提交的任务
+ * @param worker 处理线程
+ * @return 任务，队列为空时返回 NULL
+ */
+static struct HandlerTask *PopTask(struct HandlerWorker *worker) {
+    pthread_mutex_lock(&worker->mutex);
+    struct HandlerTask *task = worker->head;
+    if (NULL != task) {
+        worker->head = task->next;
+        if (NULL != worker->head) {
+            worker->head->prev = NULL;
+        } else {
+            __atomic_store_n(&worker->tail, (struct HandlerTask *) NULL, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&worker->mutex);
+    return task;
+}
+
+/**
+ * 从其他线程的队尾窃取任务，与队列的所有者从两端取，很少争用同一个任务
+ * @param worker 窃取的处理线程
+ * @return 任务，其他线程的队列都为空时返回 NULL
+ */
+static struct HandlerTask *StealTask(struct HandlerWorker *worker) {
+    struct HandlerPool *pool = worker->pool;
+    int self = (int) (worker - pool->workers);
+    for (int i = 1; i < pool->workerCount; i++) {
+        struct HandlerWorker *victim = &pool->workers[(self + i) % pool->workerCount];
+
+        // 不加锁看一眼，空队列不值得加锁；队尾总是用原子操作写入
+        if (NULL == __atomic_load_n(&victim->tail, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        pthread_mutex_lock(&victim->mutex);
+        struct HandlerTask *task = victim->tail;
+        if (NULL != task) {
+            __atomic_store_n(&victim->tail, task->prev, __ATOMIC_RELAXED);
+            if (NULL != task->prev) {
+                task->prev->next = NULL;
+            } else {
+                victim->head = NULL;
+            }
+        }
+        pthread_mutex_unlock(&victim->mutex);
+        if (NULL != task) {
+            __atomic_add_fetch(&pool->stolenTasks, 1, __ATOMIC_RELAXED);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 处理线程：先取自己队列中的任务，再窃取其他线程的任务，都没有时等待提交
+ * @param arg HandlerWorker
+ * @return NULL
+ */
+static void *RunWorker(void *arg) {
+    struct HandlerWorker *worker = (struct HandlerWorker *) arg;
+    struct HandlerPool *pool = worker->pool;
+
+    while (true) {
+        struct HandlerTask *task = PopTask(worker);
+        if (NULL == task) {
+            task = StealTask(worker);
+        }
+        if (NULL != task) {
+            __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+            task->result = task->handler->handle(task->request, task->requestLength,
+                                                 &task->output);
+            __atomic_add_fetch(&pool->executedTasks, 1, __ATOMIC_RELAXED);
+            CompleteTask(task->completions, task);
+            continue;
+        }
+
+        // 提交在 sleepMutex 下增加 pending，检查和等待之间不会漏掉唤醒；
+        // pending 不为 0 而队列暂时为空时，另一个线程刚取走任务还没有减少计数，重新查找即可
+        pthread_mutex_lock(&pool->sleepMutex);
+        while (0 == __atomic_load_n(&pool->pending, __ATOMIC_RELAXED) && !pool->stopping) {
+            pool->sleepers++;
+            pthread_cond_wait(&pool->wake, &pool->sleepMutex);
+            pool->sleepers--;
+        }
+        bool finished = pool->stopping && 0 == __atomic_load_n(&pool->pending, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pool->sleepMutex);
+        if (finished) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 等已经启动的线程取完剩余的任务后退出，然后释放线程池的资源
+ * @param pool 线程池
+ * @param started 已经启动的线程数，启动线程失败时少于 workerCount
+ */
+static void StopWorkers(struct HandlerPool *pool, int started) {
+    pthread_mutex_lock(&pool->sleepMutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleepMutex);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->workerCount; i++) {
+        pthread_mutex_destroy(&pool->workers[i].mutex);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->sleepMutex);
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->workerCount = 0;
+}
+
+int HandlerPoolInit(struct HandlerPool *pool, int threads) {
+    if (threads < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    pool->workers = (struct HandlerWorker *) calloc((size_t) threads,
+                                                    sizeof(struct HandlerWorker));
+    if (NULL == pool->workers) {
+        errno = ENOMEM;
+        return -1;
+    }
+    pool->workerCount = threads;
+    pool->nextWorker = 0;
+    pool->pending = 0;
+    pool->sleepers = 0;
+    pool->stopping = false;
+    pool->executedTasks = 0;
+    pool->stolenTasks = 0;
+    pthread_mutex_init(&pool->sleepMutex, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    // 先初始化全部队列，线程启动后马上可能窃取其他线程的队列；还没有启动的线程的队列为空
+    for (int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pthread_mutex_init(&pool->workers[i].mutex, NULL);
+    }
+    for (int i = 0; i < threads; i++) {
+        int error = pthread_create(&pool->workers[i].thread, NULL, RunWorker, &pool->workers[i]);
+        if (0 != error) {
+            StopWorkers(pool, i);
+            errno = error;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void HandlerPoolSubmit(struct HandlerPool *pool, struct HandlerTask *task) {
+    unsigned int index = __atomic_fetch_add(&pool->nextWorker, 1, __ATOMIC_RELAXED);
+    struct HandlerWorker *worker = &pool->workers[index % (unsigned int) pool->workerCount];
+
+    task->next = NULL;
+    pthread_mutex_lock(&worker->mutex);
+    task->prev = worker->tail;
+    if (NULL != worker->tail) {
+        worker->tail->next = task;
+    } else {
+        worker->head = task;
+    }
+    __atomic_store_n(&worker->tail, task, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&worker->mutex);
+
+    pthread_mutex_lock(&pool->sleepMutex);
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);
+    if (pool->sleepers > 0) {
+        pthread_cond_signal(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->sleepMutex);
+}
+
+void HandlerPoolDestroy(struct HandlerPool *pool) {
+    StopWorkers(pool, pool->workerCount);
+}
@@ -0,0 +1,131 @@
+#ifndef ECHO_HANDLER_POOL_H
+#define ECHO_HANDLER_POOL_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <pthread.h> // pthread_t, pthread_mutex_t, pthread_cond_t
+#include "MessageHandler.h"
+
+struct HandlerCompletionQueue;
+
+/**
+ * 提交给处理线程池的一条请求
+ *     提交前由 I/O 线程填写，处理期间只由处理线程访问，完成后经完成队列交还提交者
+ */
+struct HandlerTask {
+    // 处理器
+    const struct MessageHandler *handler;
+
+    // 请求负载
+    const char *request;
+    size_t requestLength;
+
+    // 响应缓冲区
+    struct HandlerOutput output;
+
+    // 处理器的返回值
+    int result;
+
+    // 完成后放入的队列
+    struct HandlerCompletionQueue *completions;
+
+    // 提交者的上下文，线程池不使用
+    void *owner;
+
+    // 在线程的双端队列中时是前后任务，在完成队列中时 next 是下一个完成的任务
+    struct HandlerTask *prev;
+    struct HandlerTask *next;
+};
+
+/**
+ * 多生产者单消费者的无锁完成队列
+ *     处理线程用 CAS 把完成的任务压入，消费者（提交任务的 I/O 线程）一次取走全部任务；
+ *     队列从空变为非空时写入 eventfd 唤醒消费者，之后的压入不再产生系统调用
+ */
+struct HandlerCompletionQueue {
+    // 后完成的在前
+    struct HandlerTask *head;
+
+    // 消费者的 eventfd
+    int wakeupFd;
+};
+
+/**
+ * 处理线程和它的双端队列
+ *     提交的任务放在队尾，线程自己从队头取最早的任务；空闲的线程从其他线程的队尾窃取
+ */
+struct HandlerWorker {
+    struct HandlerPool *pool;
+
+    // 双端队列
+    pthread_mutex_t mutex;
+    struct HandlerTask *head;
+    struct HandlerTask *tail;
+
+    pthread_t thread;
+};
+
+/**
+ * 工作窃取的处理线程池
+ *     I/O 线程轮流把任务提交给各线程的双端队列，慢的任务只占用一个处理线程，
+ *     排在它后面的任务被空闲线程窃取，不会被它阻塞
+ */
+struct HandlerPool {
+    struct HandlerWorker *workers;
+    int workerCount;
+
+    // 下一个接收提交的线程
+    unsigned int nextWorker;
+
+    // 已经提交、尚未被取走的任务数，增加时持有 sleepMutex
+    int pending;
+
+    // 没有任务时线程在条件变量上等待
+    pthread_mutex_t sleepMutex;
+    pthread_cond_t wake;
+    int sleepers;
+
+    // 正在停止，取完剩余的任务后线程退出
+    bool stopping;
+
+    // 执行的任务数和其中从其他线程窃取的任务数
+    uint64_t executedTasks;
+    uint64_t stolenTasks;
+};
+
+/**
+ * 初始化完成队列
+ * @param queue 完成队列
+ * @param wakeupFd 消费者的 eventfd，队列从空变为非空时写入 1
+ */
+void HandlerCompletionQueueInit(struct HandlerCompletionQueue *queue, int wakeupFd);
+
+/**
+ * 取走全部完成的任务，只能由消费者调用
+ * @param queue 完成队列
+ * @return 按完成顺序以 next 连接的任务，没有时返回 NULL
+ */
+struct HandlerTask *HandlerCompletionQueueTake(struct HandlerCompletionQueue *queue);
+
+/**
+ * 启动处理线程
+ * @param pool 线程池
+ * @param threads 线程数，至少为 1
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int HandlerPoolInit(struct HandlerPool *pool, int threads);
+
+/**
+ * 提交一个任务，可以从任何线程调用；完成后放入任务的完成队列
+ * @param pool 线程池
+ * @param task 任务，完成前不能修改或者释放
+ */
+void HandlerPoolSubmit(struct HandlerPool *pool, struct HandlerTask *task);
+
+/**
+ * 执行完已经提交的任务后停止全部线程并释放资源，完成的任务仍然放入各自的完成队列
+ * @param pool 线程池
+ */
+void HandlerPoolDestroy(struct HandlerPool *pool);
+
+#endif // ECHO_HANDLER_POOL_H
@@ -0,0 +1,88 @@
+#include "Handoff.h"
+#include <errno.h> // errno
+#include <unistd.h> // close
+
+/**
+ * 批次头
+ */
+struct HandoffHeader {
+    uint32_t kind;
+    uint32_t count;
+};
+
+/**
+ * 发送一条记录，被信号中断时重试
+ * @param sd 交接 socket 描述符
+ * @param kind 批次类型
+ * @param fds 描述符
+ * @param count 描述符数
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int SendBatch(int sd, uint32_t kind, const int *fds, int count) {
+    struct HandoffHeader header;
+    header.kind = kind;
+    header.count = (uint32_t) count;
+
+    struct iovec vector;
+    vector.iov_base = &header;
+    vector.iov_len = sizeof(header);
+
+    ssize_t sentSize;
+    do {
+        sentSize = LocalSendDescriptors(sd, &vector, 1, fds, count, 0);
+    } while (-1 == sentSize && EINTR == errno);
+    return (-1 == sentSize) ? -1 : 0;
+}
+
+int HandoffSend(int sd, uint32_t kind, const int *fds, size_t count) {
+    for (size_t offset = 0; offset < count; offset += LOCAL_MAX_DESCRIPTORS) {
+        size_t batchSize = count - offset;
+        if (batchSize > LOCAL_MAX_DESCRIPTORS) {
+            batchSize = LOCAL_MAX_DESCRIPTORS;
+        }
+        if (-1 == SendBatch(sd, kind, fds + offset, (int) batchSize)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int HandoffSendEnd(int sd) {
+    return SendBatch(sd, HANDOFF_END, NULL, 0);
+}
+
+int HandoffReceive(int sd, struct HandoffBatch *batch) {
+    struct HandoffHeader header;
+    struct iovec vector;
+    vector.iov_base = &header;
+    vector.iov_len = sizeof(header);
+
+    ssize_t recvSize;
+    do {
+        batch->fdCount = LOCAL_MAX_DESCRIPTORS;
+        recvSize = LocalReceiveDescriptors(sd, &vector, 1, batch->fds, &batch->fdCount, 0);
+    } while (-1 == recvSize && EINTR == errno);
+
+    if (-1 == recvSize) {
+        return -1;
+    }
+    if (0 == recvSize) {
+        return 0;
+    }
+
+    // 批次头必须与实际收到的描述符一致
+    bool valid = (sizeof(header) == (size_t) recvSize)
+                 && (header.count == (uint32_t) batch->fdCount)
+                 && (HANDOFF_LISTENERS == header.kind || HANDOFF_CONNECTIONS == header.kind
+                     || (HANDOFF_END == header.kind && 0 == batch->fdCount));
+    if (!valid) {
+        for (int i = 0; i < batch->fdCount; i++) {
+            close(batch->fds[i]);
+        }
+        batch->fdCount = 0;
+        errno = EBADMSG;
+        return -1;
+    }
+    batch->kind = header.kind;
+    return 1;
+}
@@ -0,0 +1,60 @@
+#ifndef ECHO_HANDOFF_H
+#define ECHO_HANDOFF_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+#include "LocalTransfer.h"
+
+/**
+ * 服务器交接协议
+ *     旧实例经过本地 SOCK_SEQPACKET socket 用 SCM_RIGHTS 把监听 socket 和空闲的客户连接
+ *     交给新实例；每条记录是一个批次：8 字节的批次头（类型和描述符数）加最多
+ *     LOCAL_MAX_DESCRIPTORS 个描述符；最后一条记录是结束标记。监听 socket 在内核中一直
+ *     处于监听状态，交接期间到达的连接留在接受队列中由新实例接受，客户端不会被拒绝
+ */
+
+/**
+ * 批次类型
+ */
+enum HandoffKind {
+    HANDOFF_LISTENERS = 1,
+    HANDOFF_CONNECTIONS = 2,
+    HANDOFF_END = 3
+};
+
+/**
+ * 收到的一个批次
+ */
+struct HandoffBatch {
+    uint32_t kind;
+    int fdCount;
+    int fds[LOCAL_MAX_DESCRIPTORS];
+};
+
+/**
+ * 发送一组描述符，超过 LOCAL_MAX_DESCRIPTORS 时分成多个批次；发送后调用者仍然需要关闭
+ * @param sd 交接 socket 描述符
+ * @param kind HANDOFF_LISTENERS 或者 HANDOFF_CONNECTIONS
+ * @param fds 描述符
+ * @param count 描述符数
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int HandoffSend(int sd, uint32_t kind, const int *fds, size_t count);
+
+/**
+ * 发送结束标记，之后不再有批次
+ * @param sd 交接 socket 描述符
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int HandoffSendEnd(int sd);
+
+/**
+ * 接收一个批次
+ * @param sd 交接 socket 描述符，可以是非阻塞的
+ * @param batch 收到的批次，其中的描述符由调用者接管
+ * @return 收到批次返回 1，对端关闭返回 0；批次头无效时关闭收到的描述符并返回 -1，
+ *         errno 为 EBADMSG，失败（包括非阻塞模式下的 EAGAIN）返回 -1 并设置 errno
+ */
+int HandoffReceive(int sd, struct HandoffBatch *batch);
+
+#endif // ECHO_HANDOFF_H
@@ -0,0 +1,99 @@
+#include "Histogram.h"
+#include <string.h> // memset
+
+// 子桶数和每个 2 的幂区间的桶数
+#define SUB_BUCKET_COUNT (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define SUB_BUCKET_HALF_COUNT (1 << (HISTOGRAM_SUB_BUCKET_BITS - 1))
+
+// 可记录的最大值
+#define MAX_VALUE ((1ULL << HISTOGRAM_VALUE_BITS) - 1)
+
+int HistogramBucketIndex(uint64_t value) {
+    if (value > MAX_VALUE) {
+        value = MAX_VALUE;
+    }
+
+    // 值小于 SUB_BUCKET_COUNT 时每个值一个桶；
+    // 否则右移 shift 位使其落在 [SUB_BUCKET_HALF_COUNT, SUB_BUCKET_COUNT)，按 shift 和移位后的值分桶
+    if (value < SUB_BUCKET_COUNT) {
+        return (int) value;
+    }
+
+    int shift = (63 - __builtin_clzll(value)) - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+    return SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF_COUNT
+           + (int) ((value >> shift) - SUB_BUCKET_HALF_COUNT);
+}
+
+/**
+ * 计算桶内最大的值
+ * @param index 桶的下标
+ * @return 值
+ */
+static uint64_t BucketHighestValue(int index) {
+    if (index < SUB_BUCKET_COUNT) {
+        return (uint64_t) index;
+    }
+
+    int shift = (index - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF_COUNT + 1;
+    uint64_t subBucket = (uint64_t) ((index - SUB_BUCKET_COUNT) % SUB_BUCKET_HALF_COUNT
+                                     + SUB_BUCKET_HALF_COUNT);
+    return ((subBucket + 1) << shift) - 1;
+}
+
+void HistogramReset(struct Histogram *histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->min = UINT64_MAX;
+}
+
+void HistogramRecord(struct Histogram *histogram, uint64_t value) {
+    if (value > MAX_VALUE) {
+        value = MAX_VALUE;
+    }
+
+    histogram->counts[HistogramBucketIndex(value)]++;
+    histogram->totalCount++;
+    histogram->sum += value;
+    if (value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+void HistogramMerge(struct Histogram *histogram, const struct Histogram *other) {
+    for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        histogram->counts[i] += other->counts[i];
+    }
+    histogram->totalCount += other->totalCount;
+    histogram->sum += other->sum;
+    if (other->min < histogram->min) {
+        histogram->min = other->min;
+    }
+    if (other->max > histogram->max) {
+        histogram->max = other->max;
+    }
+}
+
+uint64_t HistogramValueAtPercentile(const struct Histogram *histogram, double percentile) {
+    if (0 == histogram->totalCount) {
+        return 0;
+    }
+
+    // 需要覆盖的记录数，至少一个
+    double fraction = (percentile < 100.0) ? percentile / 100.0 : 1.0;
+    uint64_t target = (uint64_t) (fraction * (double) histogram->totalCount + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+
+    uint64_t cumulative = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+        cumulative += histogram->counts[i];
+        if (cumulative >= target) {
+            uint64_t value = BucketHighestValue(i);
+            return (value < histogram->max) ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
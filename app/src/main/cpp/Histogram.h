@@ -0,0 +1,67 @@
+#ifndef ECHO_HISTOGRAM_H
+#define ECHO_HISTOGRAM_H
+
+#include <stdint.h> // uint64_t
+
+// 分桶精度的位数，7 表示小于 128 的值逐一计数，之后每个 2 的幂区间分成 64 个等宽的子桶，
+// 桶宽不超过桶内最小值的 1/64，相对误差不超过 1/64（约 1.6%）
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+
+// 可记录的最大值的位数，超过 2^HISTOGRAM_VALUE_BITS - 1 的值按最大值记录
+#define HISTOGRAM_VALUE_BITS 48
+
+// 桶数：前 2^SUB_BUCKET_BITS 个值逐一计数，之后每个 2 的幂区间 2^(SUB_BUCKET_BITS - 1) 个桶
+#define HISTOGRAM_BUCKET_COUNT \
+    ((1 << HISTOGRAM_SUB_BUCKET_BITS) \
+     + (HISTOGRAM_VALUE_BITS - HISTOGRAM_SUB_BUCKET_BITS) * (1 << (HISTOGRAM_SUB_BUCKET_BITS - 1)))
+
+/**
+ * HDR 风格的对数线性直方图，固定内存，记录 O(1)，按有效数字而不是固定宽度分桶，
+ * 用于记录纳秒级的请求延迟
+ */
+struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKET_COUNT];
+
+    // 记录的值的个数、总和与精确的最小值和最大值
+    uint64_t totalCount;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+};
+
+/**
+ * 清空直方图
+ * @param histogram 直方图
+ */
+void HistogramReset(struct Histogram *histogram);
+
+/**
+ * 记录一个值
+ * @param histogram 直方图
+ * @param value 值
+ */
+void HistogramRecord(struct Histogram *histogram, uint64_t value);
+
+/**
+ * 计算值所在的桶，供需要自己维护计数的调用者使用
+ * @param value 值，超过可记录的最大值时按最大值计算
+ * @return 桶的下标
+ */
+int HistogramBucketIndex(uint64_t value);
+
+/**
+ * 把另一个直方图的记录合并进来
+ * @param histogram 目标直方图
+ * @param other 来源直方图
+ */
+void HistogramMerge(struct Histogram *histogram, const struct Histogram *other);
+
+/**
+ * 取得百分位数
+ * @param histogram 直方图
+ * @param percentile 百分位，0 到 100
+ * @return 至少 percentile% 的记录不超过的值，按桶的上界计算，不超过精确的最大值
+ */
+uint64_t HistogramValueAtPercentile(const struct Histogram *histogram, double percentile);
+
+#endif // ECHO_HISTOGRAM_H
@@ -0,0 +1,509 @@
+#include "LoadGenerator.h"
+#include "Frame.h"
+#include "SocketProfile.h"
+#include <stdlib.h> // calloc, malloc, free
+#include <errno.h> // errno
+#include <string.h> // memset, memcmp, strlen, strcpy
+#include <unistd.h> // close
+#include <fcntl.h> // fcntl
+#include <pthread.h> // pthread_create, pthread_join
+#include <poll.h> // ppoll
+#include <time.h> // clock_gettime
+#include <sys/socket.h> // socket, connect, send, recv
+#include <sys/un.h> // sockaddr_un
+#include <stddef.h> // offsetof
+
+/**
+ * 一个负载连接，同时只有一个请求在途；socket 是非阻塞的，大请求分多次发送，发送的同时接收回显
+ */
+struct LoadConnection {
+    // 非阻塞 socket，出错后为 -1
+    int sd;
+
+    // 是否有请求在途
+    bool inFlight;
+
+    // 在途请求的开始时间，开环模式下为计划发送时间
+    uint64_t startedAt;
+
+    // 在途请求实际发送的时间，用于判断超时
+    uint64_t sentAt;
+
+    // 开环模式下下一个请求的计划发送时间
+    uint64_t nextSendAt;
+
+    // 在途请求已发送的长度和已收到的回显长度
+    size_t sent;
+    size_t received;
+};
+
+/**
+ * 负载线程，服务分给它的连接
+ */
+struct LoadWorker {
+    const struct LoadOptions *options;
+
+    // 分给该线程的连接
+    struct LoadConnection *connections;
+    int connectionCount;
+
+    // 开环模式下每个连接的请求间隔，闭环模式为 0
+    uint64_t interval;
+
+    // 结束时间
+    uint64_t deadline;
+
+    // 请求内容和接收缓冲区
+    char *payload;
+    char *buffer;
+
+    // 结果
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t checksumErrors;
+    struct Histogram latency;
+
+    pthread_t thread;
+};
+
+/**
+ * 读取单调时钟
+ * @return 纳秒
+ */
+static uint64_t NowNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void LoadOptionsInit(struct LoadOptions *options) {
+    memset(options, 0, sizeof(*options));
+    options->protocol = LOAD_PROTOCOL_TCP;
+    options->address.sin_family = AF_INET;
+    options->connections = 1;
+    options->threads = 1;
+    options->payloadSize = 64;
+    options->duration = 10000;
+    options->rate = 0;
+    options->timeout = 1000;
+    options->socketProfile = SOCKET_PROFILE_LOW_LATENCY;
+}
+
+/**
+ * 按协议建立一个到服务器的连接
+ * @param options 负载参数
+ * @return socket，失败返回 -1 并设置 errno
+ */
+static int OpenConnection(const struct LoadOptions *options) {
+    const struct SocketProfile *profile = SocketProfileGet(options->socketProfile);
+    int sd;
+    int result;
+
+    if (LOAD_PROTOCOL_LOCAL == options->protocol) {
+        // 与 BindLocalSocketToName 相同：不以 '/' 开头的名称在抽象命名空间中
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = PF_LOCAL;
+
+        const char *name = options->localName;
+        bool abstractNamespace = ('/' != name[0]);
+        size_t pathLength = strlen(name) + (abstractNamespace ? 1 : 0);
+        if (pathLength > sizeof(address.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(address.sun_path + (abstractNamespace ? 1 : 0), name);
+
+        sd = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (-1 == sd) {
+            return -1;
+        }
+        result = SocketProfileApply(profile, sd, SOCKET_ROLE_CLIENT);
+        if (0 == result) {
+            result = connect(sd, (struct sockaddr *) &address,
+                             (socklen_t) (offsetof(struct sockaddr_un, sun_path) + pathLength));
+        }
+    } else {
+        bool datagram = (LOAD_PROTOCOL_UDP == options->protocol);
+        sd = socket(PF_INET, (datagram ? SOCK_DGRAM : SOCK_STREAM) | SOCK_CLOEXEC, 0);
+        if (-1 == sd) {
+            return -1;
+        }
+        // UDP socket 连接后只和服务器收发
+        result = SocketProfileApply(profile, sd, SOCKET_ROLE_CLIENT);
+        if (0 == result) {
+            result = connect(sd, (const struct sockaddr *) &options->address,
+                             sizeof(options->address));
+        }
+    }
+
+    // 连接建立后切换到非阻塞模式，大请求不会在对端的缓冲区写满后阻塞线程
+    if (0 == result) {
+        int flags = fcntl(sd, F_GETFL, 0);
+        result = (-1 == flags) ? -1 : fcntl(sd, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    if (-1 == result) {
+        int error = errno;
+        close(sd);
+        errno = error;
+        return -1;
+    }
+    return sd;
+}
+
+/**
+ * 连接出错时关闭并停用
+ * @param worker 负载线程
+ * @param connection 连接
+ */
+static void FailConnection(struct LoadWorker *worker, struct LoadConnection *connection) {
+    close(connection->sd);
+    connection->sd = -1;
+    connection->inFlight = false;
+    worker->errors++;
+}
+
+/**
+ * 继续发送在途请求，直到发完或者 socket 发送缓冲区已满，剩余部分等到可写时再发送
+ * @param worker 负载线程
+ * @param connection 连接
+ */
+static void SendPending(struct LoadWorker *worker, struct LoadConnection *connection) {
+    const struct LoadOptions *options = worker->options;
+    while (connection->sent < options->payloadSize) {
+        ssize_t sentSize = send(connection->sd, worker->payload + connection->sent,
+                                options->payloadSize - connection->sent, MSG_NOSIGNAL);
+        if (-1 == sentSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN != errno && EWOULDBLOCK != errno) {
+                FailConnection(worker, connection);
+            }
+            return;
+        }
+        connection->sent += (size_t) sentSize;
+    }
+}
+
+/**
+ * 开始发送一个请求
+ * @param worker 负载线程
+ * @param connection 连接
+ * @param now 当前时间
+ */
+static void SendRequest(struct LoadWorker *worker, struct LoadConnection *connection,
+                        uint64_t now) {
+    // 开环模式下从计划时间开始计算延迟，落后于计划时排队的时间也计入延迟
+    if (0 != worker->interval) {
+        connection->startedAt = connection->nextSendAt;
+        connection->nextSendAt += worker->interval;
+    } else {
+        connection->startedAt = now;
+    }
+    connection->sentAt = now;
+    connection->inFlight = true;
+    connection->sent = 0;
+    connection->received = 0;
+    SendPending(worker, connection);
+}
+
+/**
+ * 校验收齐的回显：帧头与请求相同，帧尾等于回显负载的 CRC32C
+ * @param worker 负载线程，回显在接收缓冲区中
+ * @return 一致返回 true
+ */
+static bool VerifyReply(const struct LoadWorker *worker) {
+    size_t payloadSize = worker->options->payloadSize - FRAME_HEADER_SIZE - FRAME_CHECKSUM_SIZE;
+    const char *payload = worker->buffer + FRAME_HEADER_SIZE;
+    return 0 == memcmp(worker->buffer, worker->payload, FRAME_HEADER_SIZE)
+           && Crc32c(payload, payloadSize) == FrameDecodeHeader(payload + payloadSize);
+}
+
+/**
+ * 接收已经到达的回显，收齐时记录延迟，校验时回显损坏的请求计为错误
+ * @param worker 负载线程
+ * @param connection 连接
+ */
+static void ReceiveReply(struct LoadWorker *worker, struct LoadConnection *connection) {
+    const struct LoadOptions *options = worker->options;
+
+    // 流 socket 上的回显分多次到达，接在已收到的部分之后，收齐后可以整个校验
+    ssize_t recvSize = recv(connection->sd, worker->buffer + connection->received,
+                            options->payloadSize - connection->received, MSG_DONTWAIT);
+    if (-1 == recvSize) {
+        if (EINTR != errno && EAGAIN != errno && EWOULDBLOCK != errno) {
+            FailConnection(worker, connection);
+        }
+        return;
+    }
+
+    if (LOAD_PROTOCOL_UDP == options->protocol) {
+        // 一个数据报就是一个完整的回显
+        connection->received = options->payloadSize;
+    } else if (0 == recvSize) {
+        // 服务器关闭了连接
+        FailConnection(worker, connection);
+        return;
+    } else {
+        connection->received += (size_t) recvSize;
+    }
+
+    if (connection->received >= options->payloadSize) {
+        if (options->integrity && !VerifyReply(worker)) {
+            worker->checksumErrors++;
+            worker->errors++;
+            connection->inFlight = false;
+            return;
+        }
+        HistogramRecord(&worker->latency, NowNanos() - connection->startedAt);
+        worker->requests++;
+        connection->inFlight = false;
+    }
+}
+
+/**
+ * 负载线程，直到结束时间前不断发送请求和接收回显
+ * @param arg LoadWorker
+ * @return NULL
+ */
+static void *RunLoadWorker(void *arg) {
+    struct LoadWorker *worker = (struct LoadWorker *) arg;
+    const struct LoadOptions *options = worker->options;
+    uint64_t timeout = options->timeout * 1000000ULL;
+
+    struct pollfd *pfds = (struct pollfd *) calloc((size_t) worker->connectionCount,
+                                                   sizeof(struct pollfd));
+    struct LoadConnection **polled = (struct LoadConnection **) calloc(
+            (size_t) worker->connectionCount, sizeof(struct LoadConnection *));
+    if (NULL == pfds || NULL == polled) {
+        worker->errors += (uint64_t) worker->connectionCount;
+        goto exit;
+    }
+
+    while (true) {
+        uint64_t now = NowNanos();
+        if (now >= worker->deadline) {
+            break;
+        }
+
+        // 发送到期的请求，并计算下一次需要醒来的时间
+        uint64_t wakeAt = worker->deadline;
+        int count = 0;
+        int alive = 0;
+        for (int i = 0; i < worker->connectionCount; i++) {
+            struct LoadConnection *connection = &worker->connections[i];
+            if (-1 == connection->sd) {
+                continue;
+            }
+
+            if (connection->inFlight && now - connection->sentAt > timeout) {
+                if (LOAD_PROTOCOL_UDP == options->protocol) {
+                    // 数据报丢失，继续发送下一个请求
+                    worker->errors++;
+                    connection->inFlight = false;
+                } else {
+                    // 流 socket 上迟到的回显无法与后续请求区分，只能关闭
+                    FailConnection(worker, connection);
+                    continue;
+                }
+            }
+            alive++;
+
+            if (!connection->inFlight) {
+                if (0 == worker->interval || now >= connection->nextSendAt) {
+                    SendRequest(worker, connection, now);
+                } else if (connection->nextSendAt < wakeAt) {
+                    wakeAt = connection->nextSendAt;
+                }
+            }
+
+            if (connection->inFlight) {
+                if (connection->sentAt + timeout < wakeAt) {
+                    wakeAt = connection->sentAt + timeout;
+                }
+                // 请求还没有发完时同时等待可写，回显照常接收，两端的缓冲区不会互相写满
+                pfds[count].fd = connection->sd;
+                pfds[count].events = POLLIN;
+                if (connection->sent < options->payloadSize) {
+                    pfds[count].events |= POLLOUT;
+                }
+                pfds[count].revents = 0;
+                polled[count] = connection;
+                count++;
+            }
+        }
+
+        // 全部连接都已出错
+        if (0 == alive) {
+            break;
+        }
+
+        // 等待回显或者下一个计划发送时间
+        now = NowNanos();
+        struct timespec wait;
+        uint64_t waitNanos = (wakeAt > now) ? wakeAt - now : 0;
+        wait.tv_sec = (time_t) (waitNanos / 1000000000ULL);
+        wait.tv_nsec = (long) (waitNanos % 1000000000ULL);
+
+        int ready = ppoll(pfds, (nfds_t) count, &wait, NULL);
+        if (-1 == ready) {
+            if (EINTR == errno) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < count && ready > 0; i++) {
+            if (0 == pfds[i].revents) {
+                continue;
+            }
+            ready--;
+            struct LoadConnection *connection = polled[i];
+            if (0 != (pfds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+                ReceiveReply(worker, connection);
+            }
+            if (-1 != connection->sd && connection->inFlight
+                && connection->sent < options->payloadSize) {
+                SendPending(worker, connection);
+            }
+        }
+    }
+
+    exit:
+    free(pfds);
+    free(polled);
+    return NULL;
+}
+
+int LoadGeneratorRun(const struct LoadOptions *options, struct LoadResult *result) {
+    memset(result, 0, sizeof(*result));
+    HistogramReset(&result->latency);
+
+    if (options->connections < 1 || options->threads < 1 || 0 == options->payloadSize
+        || (options->framed && options->payloadSize < FRAME_HEADER_SIZE)
+        || (options->integrity && options->payloadSize < FRAME_HEADER_SIZE + FRAME_CHECKSUM_SIZE)
+        || (LOAD_PROTOCOL_LOCAL == options->protocol && NULL == options->localName)
+        || NULL == SocketProfileGet(options->socketProfile)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int status = -1;
+    int threadCount = (options->threads < options->connections) ? options->threads
+                                                                : options->connections;
+    int started = 0;
+
+    struct LoadConnection *connections = (struct LoadConnection *) calloc(
+            (size_t) options->connections, sizeof(struct LoadConnection));
+    struct LoadWorker *workers = (struct LoadWorker *) calloc(
+            (size_t) threadCount, sizeof(struct LoadWorker));
+    char *payload = (char *) malloc(options->payloadSize);
+    if (NULL == connections || NULL == workers || NULL == payload) {
+        errno = ENOMEM;
+        goto exit;
+    }
+    memset(payload, 'x', options->payloadSize);
+    if (options->framed || options->integrity) {
+        // 服务器原样回显整个帧，回显的长度与请求相同
+        FrameEncodeHeader(payload, (uint32_t) (options->payloadSize - FRAME_HEADER_SIZE));
+    }
+    if (options->integrity) {
+        // 负载用变化的字节填充，错位和重复的数据也会改变校验和；帧尾与帧头一样按大端序存放
+        size_t checksumAt = options->payloadSize - FRAME_CHECKSUM_SIZE;
+        for (size_t i = FRAME_HEADER_SIZE; i < checksumAt; i++) {
+            payload[i] = (char) ('a' + i % 26);
+        }
+        FrameEncodeHeader(payload + checksumAt,
+                          Crc32c(payload + FRAME_HEADER_SIZE, checksumAt - FRAME_HEADER_SIZE));
+    }
+    for (int i = 0; i < options->connections; i++) {
+        connections[i].sd = -1;
+    }
+
+    // 先建立全部连接，连接失败时不开始运行
+    for (int i = 0; i < options->connections; i++) {
+        connections[i].sd = OpenConnection(options);
+        if (-1 == connections[i].sd) {
+            goto exit;
+        }
+    }
+
+    {
+        uint64_t start = NowNanos();
+        uint64_t interval = (options->rate > 0)
+                            ? (uint64_t) (1e9 * options->connections / options->rate) : 0;
+
+        // 连续的连接分给不同的线程
+        int offset = 0;
+        for (int w = 0; w < threadCount; w++) {
+            struct LoadWorker *worker = &workers[w];
+            worker->options = options;
+            worker->connectionCount = options->connections / threadCount
+                                      + ((w < options->connections % threadCount) ? 1 : 0);
+            worker->connections = connections + offset;
+            offset += worker->connectionCount;
+            worker->interval = interval;
+            worker->deadline = start + options->duration * 1000000ULL;
+            worker->payload = payload;
+            HistogramReset(&worker->latency);
+
+            // 开环模式下把各连接的发送时间均匀错开
+            for (int i = 0; i < worker->connectionCount; i++) {
+                int index = (int) (worker->connections - connections) + i;
+                worker->connections[i].nextSendAt =
+                        start + interval * (uint64_t) index / (uint64_t) options->connections;
+            }
+
+            worker->buffer = (char *) malloc(options->payloadSize);
+            if (NULL == worker->buffer) {
+                errno = ENOMEM;
+                break;
+            }
+
+            int error = pthread_create(&worker->thread, NULL, RunLoadWorker, worker);
+            if (0 != error) {
+                free(worker->buffer);
+                worker->buffer = NULL;
+                errno = error;
+                break;
+            }
+            started++;
+        }
+
+        // 汇总各线程的结果
+        for (int w = 0; w < started; w++) {
+            pthread_join(workers[w].thread, NULL);
+            result->requests += workers[w].requests;
+            result->errors += workers[w].errors;
+            result->checksumErrors += workers[w].checksumErrors;
+            HistogramMerge(&result->latency, &workers[w].latency);
+        }
+        result->elapsedNanos = NowNanos() - start;
+
+        if (started == threadCount) {
+            status = 0;
+        }
+    }
+
+    exit:
+    int error = errno;
+    if (NULL != connections) {
+        for (int i = 0; i < options->connections; i++) {
+            if (-1 != connections[i].sd) {
+                close(connections[i].sd);
+            }
+        }
+    }
+    if (NULL != workers) {
+        for (int w = 0; w < threadCount; w++) {
+            free(workers[w].buffer);
+        }
+    }
+    free(connections);
+    free(workers);
+    free(payload);
+    errno = error;
+    return status;
+}
@@ -0,0 +1,89 @@
+#ifndef ECHO_LOAD_GENERATOR_H
+#define ECHO_LOAD_GENERATOR_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <netinet/in.h> // sockaddr_in
+#include "Histogram.h"
+
+/**
+ * 负载使用的协议，对应 TCP、UDP 和本地 socket 服务器
+ */
+enum LoadProtocol {
+    LOAD_PROTOCOL_TCP = 0,
+    LOAD_PROTOCOL_UDP = 1,
+    LOAD_PROTOCOL_LOCAL = 2
+};
+
+/**
+ * 负载参数
+ */
+struct LoadOptions {
+    // 协议
+    int protocol;
+
+    // TCP 和 UDP 服务器地址
+    struct sockaddr_in address;
+
+    // 本地 socket 名称，不以 '/' 开头时在抽象命名空间中
+    const char *localName;
+
+    // 总连接数和线程数，连接平均分给各线程
+    int connections;
+    int threads;
+
+    // 每个请求的长度，分帧时包括帧头，校验时还包括帧尾
+    size_t payloadSize;
+
+    // 是否把请求编码为长度前缀帧，用于以分帧模式运行的流服务器
+    bool framed;
+
+    // 是否在帧尾附加负载的 CRC32C 并校验每个回显，用于启用了 integrity 的服务器，启用时同时分帧
+    bool integrity;
+
+    // 运行时间，单位毫秒
+    uint64_t duration;
+
+    // 开环模式下所有连接合计的每秒请求数，0 表示闭环：收到回显后立即发送下一个请求
+    double rate;
+
+    // 等待回显的最长时间，单位毫秒，超时的请求计为错误，主要针对 UDP 丢包
+    uint64_t timeout;
+
+    // 连接使用的调优方案，SocketProfileId
+    int socketProfile;
+};
+
+/**
+ * 负载结果
+ */
+struct LoadResult {
+    // 完成的请求数和失败或超时的请求数
+    uint64_t requests;
+    uint64_t errors;
+
+    // 校验时帧头或者帧尾与请求不一致的回显数，同时计入失败的请求数
+    uint64_t checksumErrors;
+
+    // 实际运行时间，单位纳秒
+    uint64_t elapsedNanos;
+
+    // 请求延迟，单位纳秒；开环模式下从计划发送时间算起，不会因为服务器变慢而少算排队时间
+    struct Histogram latency;
+};
+
+/**
+ * 用默认值初始化负载参数：TCP，1 个连接，1 个线程，64 字节请求，低延迟调优方案，闭环运行 10 秒
+ * @param options 负载参数
+ */
+void LoadOptionsInit(struct LoadOptions *options);
+
+/**
+ * 按参数建立连接并运行负载，每个连接同时只有一个请求在途
+ * @param options 负载参数
+ * @param result 负载结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int LoadGeneratorRun(const struct LoadOptions *options, struct LoadResult *result);
+
+#endif // ECHO_LOAD_GENERATOR_H
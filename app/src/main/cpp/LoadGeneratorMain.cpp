@@ -0,0 +1,166 @@
+#include "LoadGenerator.h"
+#include "SocketProfile.h"
+#include "Crc32c.h"
+#include <stdio.h> // printf, fprintf
+#include <stdlib.h> // atoi, atof, strtoull
+#include <errno.h> // errno
+#include <string.h> // strcmp, strerror
+#include <getopt.h> // getopt_long
+#include <arpa/inet.h> // inet_aton, htons
+
+/**
+ * 打印用法
+ * @param program 程序名
+ */
+static void PrintUsage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p, --protocol tcp|udp|local  server protocol (default tcp)\n"
+            "  -a, --address IP              server address (default 127.0.0.1)\n"
+            "  -P, --port PORT               server port\n"
+            "  -n, --name NAME               local socket name, abstract unless it starts with '/'\n"
+            "  -c, --connections N           total connections (default 1)\n"
+            "  -t, --threads N               threads (default 1)\n"
+            "  -s, --size BYTES              request size (default 64)\n"
+            "  -f, --framed                  send length-prefixed frames, size includes the header\n"
+            "  -I, --integrity               append a CRC32C trailer to each frame and verify\n"
+            "                                every echo, size includes header and trailer\n"
+            "  -d, --duration SECONDS        run time (default 10)\n"
+            "  -r, --rate REQUESTS           open-loop requests per second, 0 for closed loop\n"
+            "  -T, --timeout MILLISECONDS    reply timeout (default 1000)\n"
+            "  -S, --socket-profile NAME     default|low-latency|bulk-throughput|\n"
+            "                                many-idle-connections (default low-latency)\n",
+            program);
+}
+
+/**
+ * 打印结果
+ * @param result 负载结果
+ */
+static void PrintResult(const struct LoadResult *result) {
+    const struct Histogram *latency = &result->latency;
+    double seconds = (double) result->elapsedNanos / 1e9;
+
+    printf("requests   %llu\n", (unsigned long long) result->requests);
+    printf("errors     %llu\n", (unsigned long long) result->errors);
+    if (0 != result->checksumErrors) {
+        printf("corrupted  %llu\n", (unsigned long long) result->checksumErrors);
+    }
+    printf("throughput %.0f requests/s\n", (seconds > 0) ? (double) result->requests / seconds : 0.0);
+    if (0 == latency->totalCount) {
+        return;
+    }
+    printf("latency    mean %.1f us\n", (double) latency->sum / (double) latency->totalCount / 1e3);
+    printf("           p50 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+           (double) HistogramValueAtPercentile(latency, 50.0) / 1e3,
+           (double) HistogramValueAtPercentile(latency, 99.0) / 1e3,
+           (double) HistogramValueAtPercentile(latency, 99.9) / 1e3,
+           (double) latency->max / 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    struct LoadOptions options;
+    LoadOptionsInit(&options);
+    options.address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    static const struct option longOptions[] = {
+            {"protocol",    required_argument, NULL, 'p'},
+            {"address",     required_argument, NULL, 'a'},
+            {"port",        required_argument, NULL, 'P'},
+            {"name",        required_argument, NULL, 'n'},
+            {"connections", required_argument, NULL, 'c'},
+            {"threads",     required_argument, NULL, 't'},
+            {"size",        required_argument, NULL, 's'},
+            {"framed",      no_argument,       NULL, 'f'},
+            {"integrity",   no_argument,       NULL, 'I'},
+            {"duration",    required_argument, NULL, 'd'},
+            {"rate",        required_argument, NULL, 'r'},
+            {"timeout",     required_argument, NULL, 'T'},
+            {"socket-profile", required_argument, NULL, 'S'},
+            {"help",        no_argument,       NULL, 'h'},
+            {NULL, 0,                          NULL, 0}
+    };
+
+    int option;
+    while (-1 != (option = getopt_long(argc, argv, "p:a:P:n:c:t:s:fId:r:T:S:h", longOptions,
+                                       NULL))) {
+        switch (option) {
+            case 'p':
+                if (0 == strcmp(optarg, "tcp")) {
+                    options.protocol = LOAD_PROTOCOL_TCP;
+                } else if (0 == strcmp(optarg, "udp")) {
+                    options.protocol = LOAD_PROTOCOL_UDP;
+                } else if (0 == strcmp(optarg, "local")) {
+                    options.protocol = LOAD_PROTOCOL_LOCAL;
+                } else {
+                    PrintUsage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'a':
+                if (0 == inet_aton(optarg, &options.address.sin_addr)) {
+                    fprintf(stderr, "Invalid address %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'P':
+                options.address.sin_port = htons((unsigned short) atoi(optarg));
+                break;
+            case 'n':
+                options.localName = optarg;
+                break;
+            case 'c':
+                options.connections = atoi(optarg);
+                break;
+            case 't':
+                options.threads = atoi(optarg);
+                break;
+            case 's':
+                options.payloadSize = (size_t) strtoull(optarg, NULL, 10);
+                break;
+            case 'f':
+                options.framed = true;
+                break;
+            case 'I':
+                options.integrity = true;
+                break;
+            case 'd':
+                options.duration = (uint64_t) (atof(optarg) * 1000);
+                break;
+            case 'r':
+                options.rate = atof(optarg);
+                break;
+            case 'T':
+                options.timeout = strtoull(optarg, NULL, 10);
+                break;
+            case 'S':
+                options.socketProfile = SocketProfileFind(optarg);
+                if (-1 == options.socketProfile) {
+                    PrintUsage(argv[0]);
+                    return 2;
+                }
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (LOAD_PROTOCOL_LOCAL != options.protocol && 0 == options.address.sin_port) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    if (options.integrity) {
+        printf("crc32c     %s\n", Crc32cImplementationName(Crc32cGetImplementation()));
+    }
+
+    struct LoadResult result;
+    if (-1 == LoadGeneratorRun(&options, &result)) {
+        fprintf(stderr, "Load generator failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    PrintResult(&result);
+    return 0;
+}
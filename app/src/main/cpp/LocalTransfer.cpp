@@ -0,0 +1,276 @@
+#include "LocalTransfer.h"
+#include <errno.h> // errno
+#include <string.h> // memset, memcpy
+#include <unistd.h> // close, pwrite, ftruncate, syscall
+#include <fcntl.h> // fcntl, F_ADD_SEALS, F_GET_SEALS
+#include <sys/mman.h> // mmap, MFD_CLOEXEC, MFD_ALLOW_SEALING
+#include <sys/socket.h> // sendmsg, recvmsg, CMSG_SPACE
+#include <sys/stat.h> // fstat
+#include <sys/syscall.h> // __NR_memfd_create
+
+#ifndef MFD_ALLOW_SEALING
+#include <linux/memfd.h> // MFD_CLOEXEC, MFD_ALLOW_SEALING
+#endif
+
+// 大消息加的封：不能再写入、扩大或缩小
+#define PAYLOAD_SEALS (F_SEAL_SEAL | F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW)
+
+// 共享区域加的封：双方都要写入，只禁止改变长度
+#define REGION_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW)
+
+// 控制消息缓冲区，按 cmsghdr 对齐，放得下 LOCAL_MAX_DESCRIPTORS 个描述符
+union DescriptorControl {
+    char buffer[CMSG_SPACE(sizeof(int) * LOCAL_MAX_DESCRIPTORS)];
+    struct cmsghdr align;
+};
+
+ssize_t LocalSendDescriptors(int sd, const struct iovec *vectors, int count, const int *fds,
+                             int fdCount, int flags) {
+    if (fdCount < 0 || fdCount > LOCAL_MAX_DESCRIPTORS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = (struct iovec *) vectors;
+    message.msg_iovlen = (size_t) count;
+
+    union DescriptorControl control;
+    if (fdCount > 0) {
+        size_t fdsSize = sizeof(int) * (size_t) fdCount;
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.buffer;
+        message.msg_controllen = CMSG_SPACE(fdsSize);
+
+        struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(fdsSize);
+        memcpy(CMSG_DATA(header), fds, fdsSize);
+    }
+
+    return sendmsg(sd, &message, flags | MSG_NOSIGNAL);
+}
+
+ssize_t LocalReceiveDescriptors(int sd, const struct iovec *vectors, int count, int *fds,
+                                int *fdCount, int flags) {
+    int maxFdCount = *fdCount;
+    *fdCount = 0;
+
+    union DescriptorControl control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = (struct iovec *) vectors;
+    message.msg_iovlen = (size_t) count;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t recvSize = recvmsg(sd, &message, flags | MSG_CMSG_CLOEXEC);
+    if (-1 == recvSize) {
+        return -1;
+    }
+
+    // 收到的描述符总是全部取出，超过调用者容量的部分直接关闭
+    bool overflow = false;
+    for (struct cmsghdr *header = CMSG_FIRSTHDR(&message); NULL != header;
+         header = CMSG_NXTHDR(&message, header)) {
+        if (SOL_SOCKET != header->cmsg_level || SCM_RIGHTS != header->cmsg_type
+            || header->cmsg_len < CMSG_LEN(0)) {
+            continue;
+        }
+        size_t received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < received; i++) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            if (*fdCount < maxFdCount) {
+                fds[(*fdCount)++] = fd;
+            } else {
+                close(fd);
+                overflow = true;
+            }
+        }
+    }
+
+    // 截断的记录无法原样处理；放不下的描述符已经被内核关闭
+    if (overflow || 0 != (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (int i = 0; i < *fdCount; i++) {
+            close(fds[i]);
+        }
+        *fdCount = 0;
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return recvSize;
+}
+
+ssize_t LocalSendWithDescriptor(int sd, const struct iovec *vectors, int count, int fd,
+                                int flags) {
+    return LocalSendDescriptors(sd, vectors, count, &fd, (-1 == fd) ? 0 : 1, flags);
+}
+
+ssize_t LocalReceiveWithDescriptor(int sd, const struct iovec *vectors, int count, int *fd,
+                                   int flags) {
+    *fd = -1;
+    int fdCount = 1;
+    return LocalReceiveDescriptors(sd, vectors, count, fd, &fdCount, flags);
+}
+
+/**
+ * 创建允许加封的 memfd 并设置长度
+ * @param name memfd 名称
+ * @param size 长度
+ * @return memfd 描述符，内核不支持时返回 -1 并设置 errno 为 ENOSYS，失败返回 -1 并设置 errno
+ */
+static int NewMemfd(const char *name, size_t size) {
+#ifdef __NR_memfd_create
+    int fd = (int) syscall(__NR_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (-1 == fd) {
+        return -1;
+    }
+    if (-1 == ftruncate(fd, (off_t) size)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * 检查 memfd 已经加了给定的封并且长度至少为 size
+ * @param fd memfd 描述符
+ * @param seals 必须加的封
+ * @param size 长度
+ * @return 成功返回 0，不满足时返回 -1 并设置 errno 为 EINVAL，失败返回 -1 并设置 errno
+ */
+static int CheckMemfd(int fd, int seals, size_t size) {
+    int actualSeals = fcntl(fd, F_GET_SEALS);
+    if (-1 == actualSeals) {
+        return -1;
+    }
+    if (seals != (actualSeals & seals)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct stat status;
+    if (-1 == fstat(fd, &status)) {
+        return -1;
+    }
+    if ((uint64_t) status.st_size < size || 0 == size) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int LocalCreatePayload(const char *name, const void *data, size_t size) {
+    // 先设置长度再写入，写入失败时不会留下长度不对的 memfd
+    int fd = NewMemfd(name, size);
+    if (-1 == fd) {
+        return -1;
+    }
+
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t writtenSize = pwrite(fd, (const char *) data + offset, size - offset,
+                                     (off_t) offset);
+        if (-1 == writtenSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            goto fail;
+        }
+        offset += (size_t) writtenSize;
+    }
+
+    if (-1 == fcntl(fd, F_ADD_SEALS, PAYLOAD_SEALS)) {
+        goto fail;
+    }
+    return fd;
+
+    fail:
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+}
+
+const void *LocalMapPayload(int fd, size_t size) {
+    // 没有加封的 memfd 可能被发送方缩小，访问映射时会产生 SIGBUS
+    if (-1 == CheckMemfd(fd, F_SEAL_WRITE | F_SEAL_SHRINK, size)) {
+        return NULL;
+    }
+
+    void *address = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    return (MAP_FAILED == address) ? NULL : address;
+}
+
+int LocalCreateRegion(const char *name, size_t size) {
+    int fd = NewMemfd(name, size);
+    if (-1 == fd) {
+        return -1;
+    }
+    if (-1 == fcntl(fd, F_ADD_SEALS, REGION_SEALS)) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+void *LocalMapRegion(int fd, size_t size) {
+    // 同样要求禁止缩小，对方不能让映射的后半部分失效
+    if (-1 == CheckMemfd(fd, F_SEAL_SHRINK, size)) {
+        return NULL;
+    }
+
+    void *address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return (MAP_FAILED == address) ? NULL : address;
+}
+
+int LocalSendPayload(int sd, int fd, uint64_t size) {
+    struct iovec vector;
+    vector.iov_base = &size;
+    vector.iov_len = sizeof(size);
+
+    ssize_t sentSize;
+    do {
+        sentSize = LocalSendWithDescriptor(sd, &vector, 1, fd, 0);
+    } while (-1 == sentSize && EINTR == errno);
+    return (-1 == sentSize) ? -1 : 0;
+}
+
+int LocalReceivePayload(int sd, uint64_t *size) {
+    struct iovec vector;
+    vector.iov_base = size;
+    vector.iov_len = sizeof(*size);
+
+    int fd;
+    ssize_t recvSize;
+    do {
+        recvSize = LocalReceiveWithDescriptor(sd, &vector, 1, &fd, 0);
+    } while (-1 == recvSize && EINTR == errno);
+
+    if (-1 == recvSize) {
+        return -1;
+    }
+    if (0 == recvSize) {
+        errno = ECONNRESET;
+        return -1;
+    }
+    if (-1 == fd || sizeof(*size) != (size_t) recvSize) {
+        if (-1 != fd) {
+            close(fd);
+        }
+        errno = EBADMSG;
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,124 @@
+#ifndef ECHO_LOCAL_TRANSFER_H
+#define ECHO_LOCAL_TRANSFER_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <sys/types.h> // ssize_t
+#include <sys/uio.h> // iovec
+
+/**
+ * 本地 socket 上的描述符传递和 memfd 大消息
+ *     大消息模式下发送方把负载写入 memfd 并加封，只把 8 字节的负载长度和描述符（SCM_RIGHTS）
+ *     发给对方；接收方只读映射 memfd，负载不经过内核 socket 缓冲区复制
+ *     共享区域同样通过 memfd 传递，但双方读写映射，之后的数据交换不再经过 socket
+ */
+
+// 一条消息最多附带的描述符数
+#define LOCAL_MAX_DESCRIPTORS 64
+
+/**
+ * 用一次 sendmsg 发送数据，附带多个描述符
+ * @param sd 本地 socket 描述符
+ * @param vectors 数据向量
+ * @param count 数据向量数
+ * @param fds 附带的描述符
+ * @param fdCount 描述符数，0 到 LOCAL_MAX_DESCRIPTORS
+ * @param flags sendmsg 标志，总是加上 MSG_NOSIGNAL
+ * @return 发送的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t LocalSendDescriptors(int sd, const struct iovec *vectors, int count, const int *fds,
+                             int fdCount, int flags);
+
+/**
+ * 用一次 recvmsg 接收数据和多个描述符，描述符设置了 FD_CLOEXEC
+ * @param sd 本地 socket 描述符
+ * @param vectors 数据向量
+ * @param count 数据向量数
+ * @param fds 收到的描述符，由调用者关闭
+ * @param fdCount 传入 fds 的容量，返回收到的描述符数
+ * @param flags recvmsg 标志
+ * @return 接收的字节数，对端关闭返回 0；记录被截断或者描述符超过容量时关闭收到的全部描述符，
+ *         返回 -1 并设置 errno 为 EMSGSIZE，失败返回 -1 并设置 errno
+ */
+ssize_t LocalReceiveDescriptors(int sd, const struct iovec *vectors, int count, int *fds,
+                                int *fdCount, int flags);
+
+/**
+ * 用一次 sendmsg 发送数据，可以附带一个描述符
+ * @param sd 本地 socket 描述符
+ * @param vectors 数据向量
+ * @param count 数据向量数
+ * @param fd 附带的描述符，-1 表示不附带
+ * @param flags sendmsg 标志，总是加上 MSG_NOSIGNAL
+ * @return 发送的字节数，失败返回 -1 并设置 errno
+ */
+ssize_t LocalSendWithDescriptor(int sd, const struct iovec *vectors, int count, int fd,
+                                int flags);
+
+/**
+ * 用一次 recvmsg 接收数据和最多一个描述符，描述符设置了 FD_CLOEXEC
+ * @param sd 本地 socket 描述符
+ * @param vectors 数据向量
+ * @param count 数据向量数
+ * @param fd 收到的描述符，没有时为 -1，由调用者关闭
+ * @param flags recvmsg 标志
+ * @return 接收的字节数，对端关闭返回 0；记录或控制消息被截断时关闭收到的描述符，
+ *         返回 -1 并设置 errno 为 EMSGSIZE，失败返回 -1 并设置 errno
+ */
+ssize_t LocalReceiveWithDescriptor(int sd, const struct iovec *vectors, int count, int *fd,
+                                   int flags);
+
+/**
+ * 创建写入了负载的 memfd，并加封禁止再写入、扩大和缩小，接收方映射后内容不会再改变
+ * @param name memfd 名称，只用于调试
+ * @param data 负载
+ * @param size 负载长度
+ * @return memfd 描述符，内核不支持时返回 -1 并设置 errno 为 ENOSYS，失败返回 -1 并设置 errno
+ */
+int LocalCreatePayload(const char *name, const void *data, size_t size);
+
+/**
+ * 只读映射收到的 memfd，检查已经加封并且长度至少为 size
+ * @param fd memfd 描述符，映射后可以关闭
+ * @param size 负载长度
+ * @return 映射的地址，由调用者 munmap；没有加封或者长度不足时返回 NULL 并设置 errno 为 EINVAL，
+ *         失败返回 NULL 并设置 errno
+ */
+const void *LocalMapPayload(int fd, size_t size);
+
+/**
+ * 创建读写共享的 memfd 区域，内容为零，并加封禁止扩大和缩小，双方映射后都可以写入
+ * @param name memfd 名称，只用于调试
+ * @param size 区域长度
+ * @return memfd 描述符，内核不支持时返回 -1 并设置 errno 为 ENOSYS，失败返回 -1 并设置 errno
+ */
+int LocalCreateRegion(const char *name, size_t size);
+
+/**
+ * 读写映射收到的共享区域，检查已经加封禁止缩小并且长度至少为 size
+ * @param fd memfd 描述符，映射后可以关闭
+ * @param size 区域长度
+ * @return 映射的地址，由调用者 munmap；没有加封或者长度不足时返回 NULL 并设置 errno 为 EINVAL，
+ *         失败返回 NULL 并设置 errno
+ */
+void *LocalMapRegion(int fd, size_t size);
+
+/**
+ * 发送一个大消息：8 字节的负载长度作为记录的数据，memfd 作为附带的描述符
+ * @param sd 本地 socket 描述符
+ * @param fd memfd 描述符，发送后调用者仍然需要关闭
+ * @param size 负载长度
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int LocalSendPayload(int sd, int fd, uint64_t size);
+
+/**
+ * 接收一个大消息
+ * @param sd 本地 socket 描述符
+ * @param size 负载长度
+ * @return memfd 描述符，由调用者关闭；对端关闭时返回 -1 并设置 errno 为 ECONNRESET，
+ *         记录中没有描述符时返回 -1 并设置 errno 为 EBADMSG，失败返回 -1 并设置 errno
+ */
+int LocalReceivePayload(int sd, uint64_t *size);
+
+#endif // ECHO_LOCAL_TRANSFER_H
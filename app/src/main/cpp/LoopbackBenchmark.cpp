@@ -0,0 +1,341 @@
+#include "LoopbackBenchmark.h"
+#include "SocketProfile.h"
+#include "EventLoop.h"
+#include <stdlib.h> // malloc, free
+#include <errno.h> // errno
+#include <string.h> // memset
+#include <unistd.h> // close
+#include <time.h> // clock_gettime
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, bind, listen, connect, send, recv
+#include <netinet/in.h> // sockaddr_in, INADDR_LOOPBACK
+#include <arpa/inet.h> // htonl
+
+// 大块回显每次 send/recv 的长度
+#define BULK_CHUNK_SIZE (64 * 1024)
+
+/**
+ * 大块回显的发送线程
+ */
+struct BulkSender {
+    int sd;
+    const char *chunk;
+    size_t size;
+    int error;
+};
+
+/**
+ * 读取单调时钟
+ * @return 纳秒
+ */
+static uint64_t NowNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * 发送全部数据，被信号中断时重试
+ * @param sd 阻塞的 socket
+ * @param data 数据
+ * @param size 长度
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int SendAll(int sd, const char *data, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t sentSize = send(sd, data + offset, size - offset, MSG_NOSIGNAL);
+        if (-1 == sentSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        offset += (size_t) sentSize;
+    }
+    return 0;
+}
+
+/**
+ * 接收恰好 size 字节，每次只请求剩余的长度，SO_RCVLOWAT 不会让最后不足一批的数据卡住
+ * @param sd 阻塞的 socket
+ * @param buffer 缓冲区
+ * @param size 长度
+ * @return 成功返回 0，失败或者对端提前关闭返回 -1 并设置 errno
+ */
+static int ReceiveAll(int sd, char *buffer, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t recvSize = recv(sd, buffer + offset, size - offset, 0);
+        if (-1 == recvSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        if (0 == recvSize) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        offset += (size_t) recvSize;
+    }
+    return 0;
+}
+
+/**
+ * 连续发送大块数据
+ * @param arg BulkSender 实例
+ * @return NULL
+ */
+static void *RunBulkSender(void *arg) {
+    struct BulkSender *sender = (struct BulkSender *) arg;
+    for (size_t offset = 0; offset < sender->size; offset += BULK_CHUNK_SIZE) {
+        size_t size = sender->size - offset;
+        if (size > BULK_CHUNK_SIZE) {
+            size = BULK_CHUNK_SIZE;
+        }
+        if (-1 == SendAll(sender->sd, sender->chunk, size)) {
+            sender->error = errno;
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 事件循环线程入口
+ * @param arg EventLoop 实例
+ * @return NULL
+ */
+static void *RunServer(void *arg) {
+    EventLoopRun((struct EventLoop *) arg);
+    return NULL;
+}
+
+/**
+ * 构造应用了方案的回环 TCP 监听 socket
+ * @param profile 方案
+ * @param address 绑定到的地址
+ * @return 监听 socket，失败返回 -1 并设置 errno
+ */
+static int NewListener(const struct SocketProfile *profile, struct sockaddr_in *address) {
+    int sd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == sd) {
+        return -1;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sin_family = PF_INET;
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(*address);
+
+    if (-1 == SocketProfileApply(profile, sd, SOCKET_ROLE_LISTENER)
+        || -1 == bind(sd, (struct sockaddr *) address, sizeof(*address))
+        || -1 == getsockname(sd, (struct sockaddr *) address, &addressLength)
+        || -1 == listen(sd, profile->backlog)) {
+        int error = errno;
+        close(sd);
+        errno = error;
+        return -1;
+    }
+    return sd;
+}
+
+/**
+ * 构造应用了方案的客户端 socket 并连接到服务器
+ * @param profile 方案
+ * @param address 服务器地址
+ * @return 已连接的 socket，失败返回 -1 并设置 errno
+ */
+static int Connect(const struct SocketProfile *profile, const struct sockaddr_in *address) {
+    int sd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == sd) {
+        return -1;
+    }
+
+    // 缓冲区大小必须在连接之前设置，才能用于窗口缩放的协商
+    if (-1 == SocketProfileApply(profile, sd, SOCKET_ROLE_CLIENT)
+        || -1 == connect(sd, (const struct sockaddr *) address, sizeof(*address))) {
+        int error = errno;
+        close(sd);
+        errno = error;
+        return -1;
+    }
+    return sd;
+}
+
+/**
+ * 逐个交换消息，记录往返延迟和客户端缓冲区大小
+ * @param profile 方案
+ * @param address 服务器地址
+ * @param payloadSize 每条消息的长度
+ * @param exchanges 交换的消息数
+ * @param result 测试结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int RunExchanges(const struct SocketProfile *profile, const struct sockaddr_in *address,
+                        size_t payloadSize, int exchanges,
+                        struct LoopbackBenchmarkResult *result) {
+    int sd = Connect(profile, address);
+    if (-1 == sd) {
+        return -1;
+    }
+
+    int status = -1;
+    char *message = (char *) malloc(payloadSize);
+    char *echo = (char *) malloc(payloadSize);
+    if (NULL == message || NULL == echo) {
+        errno = ENOMEM;
+        goto exit;
+    }
+    memset(message, 'x', payloadSize);
+
+    for (int i = 0; i < exchanges; i++) {
+        uint64_t sentAt = NowNanos();
+        if (-1 == SendAll(sd, message, payloadSize) || -1 == ReceiveAll(sd, echo, payloadSize)) {
+            goto exit;
+        }
+        HistogramRecord(&result->latency, NowNanos() - sentAt);
+    }
+
+    {
+        socklen_t length = sizeof(result->receiveBufferSize);
+        getsockopt(sd, SOL_SOCKET, SO_RCVBUF, &result->receiveBufferSize, &length);
+        length = sizeof(result->sendBufferSize);
+        getsockopt(sd, SOL_SOCKET, SO_SNDBUF, &result->sendBufferSize, &length);
+    }
+    status = 0;
+
+    exit:
+    int error = errno;
+    free(message);
+    free(echo);
+    close(sd);
+    errno = error;
+    return status;
+}
+
+/**
+ * 一个线程发送、当前线程接收回显，测量大块回显的吞吐量
+ * @param profile 方案
+ * @param address 服务器地址
+ * @param bulkBytes 回显的字节数
+ * @param result 测试结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int RunBulk(const struct SocketProfile *profile, const struct sockaddr_in *address,
+                   size_t bulkBytes, struct LoopbackBenchmarkResult *result) {
+    int sd = Connect(profile, address);
+    if (-1 == sd) {
+        return -1;
+    }
+
+    int status = -1;
+    char *chunk = (char *) malloc(BULK_CHUNK_SIZE);
+    char *echo = (char *) malloc(BULK_CHUNK_SIZE);
+    struct BulkSender sender = {sd, chunk, bulkBytes, 0};
+    pthread_t thread;
+    if (NULL == chunk || NULL == echo) {
+        errno = ENOMEM;
+        goto exit;
+    }
+    memset(chunk, 'x', BULK_CHUNK_SIZE);
+
+    // 接收端每次只请求剩余的长度
+    if (-1 == SocketProfileSetReceiveLowWatermark(profile, sd)) {
+        goto exit;
+    }
+
+    {
+        uint64_t startedAt = NowNanos();
+        int error = pthread_create(&thread, NULL, RunBulkSender, &sender);
+        if (0 != error) {
+            errno = error;
+            goto exit;
+        }
+
+        size_t received = 0;
+        while (received < bulkBytes) {
+            size_t size = bulkBytes - received;
+            if (size > BULK_CHUNK_SIZE) {
+                size = BULK_CHUNK_SIZE;
+            }
+            if (-1 == ReceiveAll(sd, echo, size)) {
+                break;
+            }
+            received += size;
+        }
+        error = errno;
+
+        // 接收失败时关闭写方向，让阻塞的发送线程返回
+        if (received < bulkBytes) {
+            shutdown(sd, SHUT_RDWR);
+        }
+        pthread_join(thread, NULL);
+
+        result->bulkBytes = received;
+        result->bulkNanos = NowNanos() - startedAt;
+        if (received < bulkBytes) {
+            errno = (0 != sender.error) ? sender.error : error;
+            goto exit;
+        }
+    }
+    status = 0;
+
+    exit:
+    int error = errno;
+    free(chunk);
+    free(echo);
+    close(sd);
+    errno = error;
+    return status;
+}
+
+int LoopbackBenchmarkRun(const struct ServerOptions *options, size_t payloadSize, int exchanges,
+                         size_t bulkBytes, struct LoopbackBenchmarkResult *result) {
+    memset(result, 0, sizeof(*result));
+    HistogramReset(&result->latency);
+
+    const struct SocketProfile *socketProfile = SocketProfileGet(options->socketProfile);
+    if (NULL == socketProfile || 0 == payloadSize || exchanges < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct sockaddr_in address;
+    int listener = NewListener(socketProfile, &address);
+    if (-1 == listener) {
+        return -1;
+    }
+
+    struct EventLoop loop;
+    if (-1 == EventLoopInit(&loop, options)) {
+        int error = errno;
+        close(listener);
+        errno = error;
+        return -1;
+    }
+
+    int status = -1;
+    pthread_t thread;
+    int error = 0;
+    if (-1 == EventLoopAddListener(&loop, listener)) {
+        error = errno;
+    } else if (0 != (error = pthread_create(&thread, NULL, RunServer, &loop))) {
+        // 服务器线程没有启动
+    } else {
+        if (0 == RunExchanges(socketProfile, &address, payloadSize, exchanges, result)
+            && (0 == bulkBytes || 0 == RunBulk(socketProfile, &address, bulkBytes, result))) {
+            status = 0;
+        } else {
+            error = errno;
+        }
+        EventLoopStop(&loop);
+        pthread_join(thread, NULL);
+    }
+
+    EventLoopDestroy(&loop);
+    close(listener);
+    errno = error;
+    return status;
+}
@@ -0,0 +1,39 @@
+#ifndef ECHO_LOOPBACK_BENCHMARK_H
+#define ECHO_LOOPBACK_BENCHMARK_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include "Histogram.h"
+#include "ServerOptions.h"
+
+/**
+ * 一次回环基准测试的结果
+ */
+struct LoopbackBenchmarkResult {
+    // 小消息一问一答的往返延迟，单位纳秒
+    struct Histogram latency;
+
+    // 大块回显的字节数和耗时，单位纳秒
+    uint64_t bulkBytes;
+    uint64_t bulkNanos;
+
+    // 内核为客户端 socket 分配的接收和发送缓冲区，单位字节，反映每个连接占用的内存上限
+    int receiveBufferSize;
+    int sendBufferSize;
+};
+
+/**
+ * 在回环地址上按给定选项启动 epoll 事件循环服务器，客户端使用同一个调优方案；先逐个交换
+ * exchanges 条 payloadSize 字节的消息测量往返延迟，再由一个线程连续发送 bulkBytes 字节、
+ * 另一个线程同时接收回显测量吞吐量
+ * @param options 服务器选项，其中的调优方案同时用于客户端
+ * @param payloadSize 每条消息的长度
+ * @param exchanges 交换的消息数
+ * @param bulkBytes 大块回显的字节数，0 表示只测量延迟
+ * @param result 测试结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno，方案无效时 errno 为 EINVAL
+ */
+int LoopbackBenchmarkRun(const struct ServerOptions *options, size_t payloadSize, int exchanges,
+                         size_t bulkBytes, struct LoopbackBenchmarkResult *result);
+
+#endif // ECHO_LOOPBACK_BENCHMARK_H
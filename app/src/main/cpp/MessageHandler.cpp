@@ -0,0 +1,113 @@
+#include "MessageHandler.h"
+#include <stdlib.h> // realloc, free
+#include <errno.h> // errno
+#include <string.h> // memcpy, strcmp
+
+// 响应缓冲区第一次分配的最小容量
+#define OUTPUT_MIN_CAPACITY 256
+
+void HandlerOutputInit(struct HandlerOutput *output, size_t limit) {
+    output->data = NULL;
+    output->length = 0;
+    output->capacity = 0;
+    output->limit = limit;
+}
+
+void HandlerOutputDestroy(struct HandlerOutput *output) {
+    free(output->data);
+    output->data = NULL;
+    output->length = 0;
+    output->capacity = 0;
+}
+
+void HandlerOutputClear(struct HandlerOutput *output) {
+    output->length = 0;
+}
+
+char *HandlerOutputReserve(struct HandlerOutput *output, size_t size) {
+    if (size > output->limit - output->length) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    size_t needed = output->length + size;
+    if (needed > output->capacity || NULL == output->data) {
+        // 按两倍增长，不超过最大长度；预留 0 字节时也要分配，返回值才不为 NULL
+        size_t capacity = (0 == output->capacity) ? OUTPUT_MIN_CAPACITY : output->capacity * 2;
+        if (capacity < needed) {
+            capacity = needed;
+        }
+        if (capacity > output->limit) {
+            capacity = (output->limit > 0) ? output->limit : 1;
+        }
+        char *data = (char *) realloc(output->data, capacity);
+        if (NULL == data) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        output->data = data;
+        output->capacity = capacity;
+    }
+
+    char *reserved = output->data + output->length;
+    output->length = needed;
+    return reserved;
+}
+
+/**
+ * 原样回显
+ * @param request 请求
+ * @param length 请求长度
+ * @param output 响应缓冲区
+ * @return 成功返回 0，失败返回 -1
+ */
+static int HandleEcho(const char *request, size_t length, struct HandlerOutput *output) {
+    char *response = HandlerOutputReserve(output, length);
+    if (NULL == response) {
+        return -1;
+    }
+    memcpy(response, request, length);
+    return 0;
+}
+
+/**
+ * 按字节倒序回显
+ * @param request 请求
+ * @param length 请求长度
+ * @param output 响应缓冲区
+ * @return 成功返回 0，失败返回 -1
+ */
+static int HandleReverse(const char *request, size_t length, struct HandlerOutput *output) {
+    char *response = HandlerOutputReserve(output, length);
+    if (NULL == response) {
+        return -1;
+    }
+    for (size_t i = 0; i < length; i++) {
+        response[i] = request[length - 1 - i];
+    }
+    return 0;
+}
+
+/**
+ * 预设处理器，按 MessageHandlerId 排列
+ */
+static const struct MessageHandler handlers[MESSAGE_HANDLER_COUNT] = {
+        {"echo",    HandleEcho},
+        {"reverse", HandleReverse}
+};
+
+const struct MessageHandler *MessageHandlerGet(int id) {
+    if (id < 0 || id >= MESSAGE_HANDLER_COUNT) {
+        return NULL;
+    }
+    return &handlers[id];
+}
+
+int MessageHandlerFind(const char *name) {
+    for (int i = 0; i < MESSAGE_HANDLER_COUNT; i++) {
+        if (0 == strcmp(handlers[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
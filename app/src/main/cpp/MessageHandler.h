@@ -0,0 +1,95 @@
+#ifndef ECHO_MESSAGE_HANDLER_H
+#define ECHO_MESSAGE_HANDLER_H
+
+#include <stddef.h> // size_t
+
+/**
+ * 预设的消息处理器，取值与 com.liu.echo.ServerOptions 中的常量一致
+ */
+enum MessageHandlerId {
+    // 原样回显，没有处理线程时事件循环直接从缓冲区链发回，不经过处理器
+    MESSAGE_HANDLER_ECHO = 0,
+
+    // 按字节倒序回显
+    MESSAGE_HANDLER_REVERSE = 1,
+
+    MESSAGE_HANDLER_COUNT
+};
+
+/**
+ * 处理器写入响应的缓冲区，按需增长
+ */
+struct HandlerOutput {
+    // 响应数据，没有写入时为 NULL
+    char *data;
+
+    // 已经写入的长度和已经分配的容量
+    size_t length;
+    size_t capacity;
+
+    // 响应的最大长度
+    size_t limit;
+};
+
+/**
+ * 初始化响应缓冲区，第一次写入时才分配内存
+ * @param output 响应缓冲区
+ * @param limit 响应的最大长度
+ */
+void HandlerOutputInit(struct HandlerOutput *output, size_t limit);
+
+/**
+ * 释放响应缓冲区的内存
+ * @param output 响应缓冲区
+ */
+void HandlerOutputDestroy(struct HandlerOutput *output);
+
+/**
+ * 清空响应，保留已经分配的内存给下一条响应
+ * @param output 响应缓冲区
+ */
+void HandlerOutputClear(struct HandlerOutput *output);
+
+/**
+ * 在响应末尾预留空间，由调用者填写
+ * @param output 响应缓冲区
+ * @param size 预留的字节数
+ * @return 预留空间的开头，响应超过最大长度时返回 NULL 并设置 errno 为 EMSGSIZE，
+ *         内存不足时返回 NULL 并设置 errno 为 ENOMEM
+ */
+char *HandlerOutputReserve(struct HandlerOutput *output, size_t size);
+
+/**
+ * 按消息处理请求的处理器
+ *     分帧模式下每个完整帧的负载是一条请求，响应编码为一个帧发回；处理器可能在处理线程中运行，
+ *     同一个处理器会被多个线程同时调用，不能修改共享的状态
+ */
+struct MessageHandler {
+    // 处理器名称，用于日志和按名称查找
+    const char *name;
+
+    /**
+     * 处理一条请求
+     * @param request 请求负载，不包括帧头和校验模式下的帧尾
+     * @param length 请求长度
+     * @param output 响应缓冲区，开始时为空
+     * @return 成功返回 0，失败返回 -1，连接随后被关闭
+     */
+    int (*handle)(const char *request, size_t length, struct HandlerOutput *output);
+};
+
+/**
+ * 按编号查找处理器
+ * @param id MessageHandlerId
+ * @return 处理器，编号无效时返回 NULL
+ */
+const struct MessageHandler *MessageHandlerGet(int id);
+
+/**
+ * 按名称查找处理器
+ * @param name 处理器名称，如 "reverse"
+ * @return 处理器编号，名称无效时返回 -1
+ */
+int MessageHandlerFind(const char *name);
+
+#endif // ECHO_MESSAGE_HANDLER_H
@@ -0,0 +1,224 @@
+#include "Metrics.h"
+#include "BufferPool.h"
+#include <stdio.h> // snprintf
+#include <stdlib.h> // posix_memalign
+#include <string.h> // memset
+#include <errno.h> // errno
+#include <time.h> // clock_gettime
+#include <unistd.h> // close
+#include <pthread.h> // pthread_mutex_lock, pthread_mutex_unlock
+#include <sys/socket.h> // accept4, send
+
+/**
+ * 全部分片的注册表，只在取得、释放分片和生成快照时加锁，数据路径上不访问
+ */
+static struct {
+    pthread_mutex_t mutex;
+    struct MetricsShard *shards;
+} registry = {PTHREAD_MUTEX_INITIALIZER, NULL};
+
+/**
+ * 以 relaxed 方式读取其他线程写入的计数器
+ * @param counter 计数器
+ * @return 值
+ */
+static inline uint64_t LoadCounter(const uint64_t *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+struct MetricsShard *MetricsAcquireShard() {
+    pthread_mutex_lock(&registry.mutex);
+
+    struct MetricsShard *shard = registry.shards;
+    while (NULL != shard && shard->inUse) {
+        shard = shard->next;
+    }
+
+    if (NULL == shard) {
+        // 按缓存行对齐分配，相邻分片不会共享缓存行
+        void *memory = NULL;
+        if (0 == posix_memalign(&memory, METRICS_CACHE_LINE_SIZE, sizeof(struct MetricsShard))) {
+            shard = (struct MetricsShard *) memory;
+            memset(shard, 0, sizeof(*shard));
+            shard->serviceTimeMin = UINT64_MAX;
+            shard->next = registry.shards;
+            registry.shards = shard;
+        }
+    }
+
+    if (NULL != shard) {
+        shard->inUse = true;
+    }
+
+    pthread_mutex_unlock(&registry.mutex);
+    return shard;
+}
+
+void MetricsReleaseShard(struct MetricsShard *shard) {
+    if (NULL == shard) {
+        return;
+    }
+
+    // 分片本身不释放，它的计数仍然是累计值的一部分
+    pthread_mutex_lock(&registry.mutex);
+    shard->inUse = false;
+    pthread_mutex_unlock(&registry.mutex);
+}
+
+uint64_t MetricsNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+void MetricsRecordServiceTime(struct MetricsShard *shard, uint64_t nanos, uint64_t count) {
+    MetricsAdd(&shard->serviceTimeCounts[HistogramBucketIndex(nanos)], count);
+    MetricsAdd(&shard->serviceTimeCount, count);
+    MetricsAdd(&shard->serviceTimeSum, nanos * count);
+    if (nanos < shard->serviceTimeMin) {
+        __atomic_store_n(&shard->serviceTimeMin, nanos, __ATOMIC_RELAXED);
+    }
+    if (nanos > shard->serviceTimeMax) {
+        __atomic_store_n(&shard->serviceTimeMax, nanos, __ATOMIC_RELAXED);
+    }
+}
+
+void MetricsTakeSnapshot(struct MetricsSnapshot *snapshot) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    HistogramReset(&snapshot->serviceTime);
+
+    uint64_t closedConnections = 0;
+    struct Histogram *histogram = &snapshot->serviceTime;
+
+    pthread_mutex_lock(&registry.mutex);
+    for (struct MetricsShard *shard = registry.shards; NULL != shard; shard = shard->next) {
+        snapshot->acceptedConnections += LoadCounter(&shard->acceptedConnections);
+        closedConnections += LoadCounter(&shard->closedConnections);
+        snapshot->bytesIn += LoadCounter(&shard->bytesIn);
+        snapshot->bytesOut += LoadCounter(&shard->bytesOut);
+        snapshot->messagesIn += LoadCounter(&shard->messagesIn);
+        snapshot->messagesOut += LoadCounter(&shard->messagesOut);
+        snapshot->syscalls += LoadCounter(&shard->syscalls);
+        snapshot->eagain += LoadCounter(&shard->eagain);
+        snapshot->checksumErrors += LoadCounter(&shard->checksumErrors);
+        snapshot->backpressurePauses += LoadCounter(&shard->backpressurePauses);
+        snapshot->acceptPauses += LoadCounter(&shard->acceptPauses);
+
+        for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+            histogram->counts[i] += LoadCounter(&shard->serviceTimeCounts[i]);
+        }
+        histogram->totalCount += LoadCounter(&shard->serviceTimeCount);
+        histogram->sum += LoadCounter(&shard->serviceTimeSum);
+        uint64_t min = LoadCounter(&shard->serviceTimeMin);
+        uint64_t max = LoadCounter(&shard->serviceTimeMax);
+        if (min < histogram->min) {
+            histogram->min = min;
+        }
+        if (max > histogram->max) {
+            histogram->max = max;
+        }
+    }
+    pthread_mutex_unlock(&registry.mutex);
+
+    // 各计数器不是同时读取的，关闭数可能暂时多于接受数
+    snapshot->activeConnections = (snapshot->acceptedConnections > closedConnections)
+                                  ? snapshot->acceptedConnections - closedConnections : 0;
+
+    struct BufferPoolStats poolStats;
+    BufferPoolGetStats(&poolStats);
+    snapshot->bufferPoolSlabs = poolStats.slabCount;
+    snapshot->bufferPoolHugePageSlabs = poolStats.hugePageSlabCount;
+}
+
+size_t MetricsFormat(const struct MetricsSnapshot *snapshot, char *buffer, size_t size) {
+    const struct Histogram *histogram = &snapshot->serviceTime;
+
+    // 每条接收的消息平均使用的系统调用数
+    double syscallsPerMessage = (0 == snapshot->messagesIn) ? 0.0
+                                : (double) snapshot->syscalls / (double) snapshot->messagesIn;
+
+    int length = snprintf(
+            buffer, size,
+            "echo_connections_accepted_total %llu\n"
+            "echo_connections_active %llu\n"
+            "echo_bytes_in_total %llu\n"
+            "echo_bytes_out_total %llu\n"
+            "echo_messages_in_total %llu\n"
+            "echo_messages_out_total %llu\n"
+            "echo_syscalls_total %llu\n"
+            "echo_syscalls_per_message %.3f\n"
+            "echo_eagain_total %llu\n"
+            "echo_checksum_errors_total %llu\n"
+            "echo_backpressure_pauses_total %llu\n"
+            "echo_accept_pauses_total %llu\n"
+            "echo_service_time_nanoseconds{quantile=\"0.5\"} %llu\n"
+            "echo_service_time_nanoseconds{quantile=\"0.9\"} %llu\n"
+            "echo_service_time_nanoseconds{quantile=\"0.99\"} %llu\n"
+            "echo_service_time_nanoseconds{quantile=\"0.999\"} %llu\n"
+            "echo_service_time_nanoseconds_max %llu\n"
+            "echo_service_time_nanoseconds_sum %llu\n"
+            "echo_service_time_nanoseconds_count %llu\n"
+            "echo_buffer_pool_slabs %llu\n"
+            "echo_buffer_pool_huge_page_slabs %llu\n",
+            (unsigned long long) snapshot->acceptedConnections,
+            (unsigned long long) snapshot->activeConnections,
+            (unsigned long long) snapshot->bytesIn,
+            (unsigned long long) snapshot->bytesOut,
+            (unsigned long long) snapshot->messagesIn,
+            (unsigned long long) snapshot->messagesOut,
+            (unsigned long long) snapshot->syscalls,
+            syscallsPerMessage,
+            (unsigned long long) snapshot->eagain,
+            (unsigned long long) snapshot->checksumErrors,
+            (unsigned long long) snapshot->backpressurePauses,
+            (unsigned long long) snapshot->acceptPauses,
+            (unsigned long long) HistogramValueAtPercentile(histogram, 50.0),
+            (unsigned long long) HistogramValueAtPercentile(histogram, 90.0),
+            (unsigned long long) HistogramValueAtPercentile(histogram, 99.0),
+            (unsigned long long) HistogramValueAtPercentile(histogram, 99.9),
+            (unsigned long long) histogram->max,
+            (unsigned long long) histogram->sum,
+            (unsigned long long) histogram->totalCount,
+            (unsigned long long) snapshot->bufferPoolSlabs,
+            (unsigned long long) snapshot->bufferPoolHugePageSlabs);
+
+    if (length < 0) {
+        buffer[0] = 0;
+        return 0;
+    }
+    return ((size_t) length < size) ? (size_t) length : size - 1;
+}
+
+int MetricsServe(int sd) {
+    char text[METRICS_TEXT_SIZE];
+    struct MetricsSnapshot snapshot;
+
+    while (1) {
+        int clientSocket = accept4(sd, NULL, NULL, SOCK_CLOEXEC);
+        if (-1 == clientSocket) {
+            if (EINTR == errno || ECONNABORTED == errno) {
+                continue;
+            }
+            // 监听 socket 被 shutdown 后 accept 返回 EINVAL
+            return (EINVAL == errno) ? 0 : -1;
+        }
+
+        // 每个连接一份最新的快照，采集端读到 EOF 即完整
+        MetricsTakeSnapshot(&snapshot);
+        size_t length = MetricsFormat(&snapshot, text, sizeof(text));
+
+        size_t offset = 0;
+        while (offset < length) {
+            ssize_t sentSize = send(clientSocket, text + offset, length - offset, MSG_NOSIGNAL);
+            if (-1 == sentSize) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                break;
+            }
+            offset += (size_t) sentSize;
+        }
+
+        close(clientSocket);
+    }
+}
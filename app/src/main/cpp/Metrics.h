@@ -0,0 +1,139 @@
+#ifndef ECHO_METRICS_H
+#define ECHO_METRICS_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include "Histogram.h"
+
+// 缓存行大小，每个分片的计数器独占缓存行，不同线程的更新不会互相失效
+#define METRICS_CACHE_LINE_SIZE 64
+
+// 指标文本的最大长度
+#define METRICS_TEXT_SIZE 2048
+
+/**
+ * 一个事件循环的指标分片
+ *     每个分片只由运行对应事件循环的线程写入，写入是普通的读-改-写，不使用加锁或原子加法；
+ *     计数器用 relaxed 原子读写，快照线程可以随时读取而不会读到撕裂的值
+ */
+struct alignas(METRICS_CACHE_LINE_SIZE) MetricsShard {
+    // 接受和关闭的连接数，两者之差为活动连接数
+    uint64_t acceptedConnections;
+    uint64_t closedConnections;
+
+    // 接收和发送的字节数
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+
+    // 接收和发送的消息数，流式 socket 上每次成功的读或写计为一条消息，
+    // 数据报分段卸载时合并收发的一个缓冲区计为一条消息
+    uint64_t messagesIn;
+    uint64_t messagesOut;
+
+    // 数据路径上的系统调用数和其中返回 EAGAIN 的次数
+    uint64_t syscalls;
+    uint64_t eagain;
+
+    // 校验模式下 CRC32C 不匹配而丢弃的帧数
+    uint64_t checksumErrors;
+
+    // 发送积压而暂停读取连接的次数，处理器模式下等待处理线程不计入
+    uint64_t backpressurePauses;
+
+    // 描述符或者内存耗尽，accept 失败而暂停接受新连接的次数
+    uint64_t acceptPauses;
+
+    // 服务时间直方图：从收到消息到回显全部发出，单位纳秒
+    uint64_t serviceTimeCounts[HISTOGRAM_BUCKET_COUNT];
+    uint64_t serviceTimeCount;
+    uint64_t serviceTimeSum;
+    uint64_t serviceTimeMin;
+    uint64_t serviceTimeMax;
+
+    // 分片链表和是否有事件循环正在使用，只在注册表加锁时访问
+    struct MetricsShard *next;
+    bool inUse;
+};
+
+/**
+ * 全部分片合计的指标快照
+ */
+struct MetricsSnapshot {
+    uint64_t acceptedConnections;
+    uint64_t activeConnections;
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t messagesIn;
+    uint64_t messagesOut;
+    uint64_t syscalls;
+    uint64_t eagain;
+    uint64_t checksumErrors;
+    uint64_t backpressurePauses;
+    uint64_t acceptPauses;
+    struct Histogram serviceTime;
+
+    // 连接缓冲区池映射的 slab 数和其中由大页支持的数量
+    uint64_t bufferPoolSlabs;
+    uint64_t bufferPoolHugePageSlabs;
+};
+
+/**
+ * 为事件循环取得一个分片，优先复用已经释放的分片，复用的分片保留之前的计数
+ * @return 分片，内存不足时返回 NULL
+ */
+struct MetricsShard *MetricsAcquireShard();
+
+/**
+ * 事件循环停止后把分片交还注册表，计数仍然计入快照
+ * @param shard 分片，可以为 NULL
+ */
+void MetricsReleaseShard(struct MetricsShard *shard);
+
+/**
+ * 取得单调时钟的当前时间，用于计算服务时间
+ * @return 纳秒
+ */
+uint64_t MetricsNow();
+
+/**
+ * 增加分片中的计数器，只能由分片的所有者线程调用
+ * @param counter 计数器
+ * @param value 增量
+ */
+static inline void MetricsAdd(uint64_t *counter, uint64_t value) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * 记录服务时间，只能由分片的所有者线程调用
+ * @param shard 分片
+ * @param nanos 服务时间，单位纳秒
+ * @param count 具有同样服务时间的消息数，批量收发时一批消息共用一个时间
+ */
+void MetricsRecordServiceTime(struct MetricsShard *shard, uint64_t nanos, uint64_t count);
+
+/**
+ * 合计全部分片，包括已经释放的分片
+ * @param snapshot 快照
+ */
+void MetricsTakeSnapshot(struct MetricsSnapshot *snapshot);
+
+/**
+ * 把快照格式化为每行一个指标的文本，格式与 Prometheus 文本格式兼容
+ * @param snapshot 快照
+ * @param buffer 文本缓冲区
+ * @param size 缓冲区大小，METRICS_TEXT_SIZE 足够容纳全部指标
+ * @return 文本长度，不含结尾的 0 字节
+ */
+size_t MetricsFormat(const struct MetricsSnapshot *snapshot, char *buffer, size_t size);
+
+/**
+ * 在当前线程服务指标 socket：每接受一个连接就写入一份最新的指标文本然后关闭连接，
+ * 直到监听 socket 被 shutdown
+ * @param sd 已经处于监听状态的 socket
+ * @return socket 被 shutdown 时返回 0，失败返回 -1 并设置 errno
+ */
+int MetricsServe(int sd);
+
+#endif // ECHO_METRICS_H
@@ -0,0 +1,126 @@
+#include "NativeLog.h"
+#include <stdio.h> // vsnprintf, snprintf
+#include <stdarg.h> // va_list
+#include <string.h> // memcpy, strlen
+#include <atomic> // std::atomic
+
+// 丢弃计数一行的最大长度，包括换行符和 NULL 终止符："(<20 位数字> log messages dropped)\n"
+#define DROPPED_LINE_LENGTH 48
+
+/**
+ * 环形缓冲区中的一条日志记录
+ *     sequence 等于写入位置时记录空闲，等于写入位置 + 1 时记录已写好等待取出
+ */
+struct LogRecord {
+    std::atomic<size_t> sequence;
+    char message[NATIVE_LOG_MESSAGE_LENGTH];
+};
+
+/**
+ * 多生产者的有界环形缓冲区，写入方用 CAS 争抢位置，从不阻塞
+ */
+struct LogRing {
+    LogRecord records[NATIVE_LOG_CAPACITY];
+
+    // 下一个写入和取出的位置，分开在不同的缓存行上避免伪共享
+    alignas(64) std::atomic<size_t> tail;
+    alignas(64) std::atomic<size_t> head;
+
+    // 缓冲区满时丢弃的日志数
+    std::atomic<uint64_t> dropped;
+
+    LogRing() : tail(0), head(0), dropped(0) {
+        for (size_t i = 0; i < NATIVE_LOG_CAPACITY; i++) {
+            records[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+};
+
+static LogRing logRing;
+
+// 运行期日志级别
+static std::atomic<int> logLevel(LOG_LEVEL_DEBUG);
+
+void NativeLogSetLevel(int level) {
+    logLevel.store(level, std::memory_order_relaxed);
+}
+
+bool NativeLogIsEnabled(int level) {
+    return level >= logLevel.load(std::memory_order_relaxed);
+}
+
+void NativeLogWrite(const char *format, ...) {
+    // 争抢一个空闲的记录
+    LogRecord *record;
+    size_t position = logRing.tail.load(std::memory_order_relaxed);
+    while (true) {
+        record = &logRing.records[position & (NATIVE_LOG_CAPACITY - 1)];
+        size_t sequence = record->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        if (0 == difference) {
+            if (logRing.tail.compare_exchange_weak(position, position + 1,
+                                                   std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // 缓冲区已满，丢弃而不是等待取出
+            logRing.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = logRing.tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    // 直接格式化到记录中
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(record->message, NATIVE_LOG_MESSAGE_LENGTH, format, ap);
+    va_end(ap);
+
+    // 发布记录
+    record->sequence.store(position + 1, std::memory_order_release);
+}
+
+size_t NativeLogDrain(char *buffer, size_t bufferSize) {
+    size_t length = 0;
+    if (0 == bufferSize) {
+        return 0;
+    }
+
+    // 一条记录连同换行符最多 NATIVE_LOG_MESSAGE_LENGTH 字节，再留出丢弃计数一行和终止符的空间
+    while (length + NATIVE_LOG_MESSAGE_LENGTH + DROPPED_LINE_LENGTH <= bufferSize) {
+        size_t position = logRing.head.load(std::memory_order_relaxed);
+        LogRecord *record = &logRing.records[position & (NATIVE_LOG_CAPACITY - 1)];
+        size_t sequence = record->sequence.load(std::memory_order_acquire);
+        if (sequence != position + 1) {
+            // 下一条记录还没有写好
+            break;
+        }
+        if (!logRing.head.compare_exchange_strong(position, position + 1,
+                                                  std::memory_order_relaxed)) {
+            continue;
+        }
+
+        size_t messageLength = strlen(record->message);
+        memcpy(buffer + length, record->message, messageLength);
+        length += messageLength;
+        buffer[length++] = '\n';
+
+        // 释放记录给下一圈的写入者
+        record->sequence.store(position + NATIVE_LOG_CAPACITY, std::memory_order_release);
+    }
+
+    uint64_t dropped = logRing.dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0) {
+        int written = snprintf(buffer + length, bufferSize - length,
+                               "(%llu log messages dropped)\n", (unsigned long long) dropped);
+        // 缓冲区太小时 snprintf 截断，返回值是完整的长度
+        if (written > 0) {
+            length += ((size_t) written < bufferSize - length) ? (size_t) written
+                                                               : bufferSize - length - 1;
+        }
+    }
+
+    buffer[length] = '\0';
+    return length;
+}
@@ -0,0 +1,79 @@
+#ifndef ECHO_NATIVE_LOG_H
+#define ECHO_NATIVE_LOG_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+/**
+ * 日志级别，取值与 com.liu.echo.AbstractEchoActivity 中的常量一致
+ */
+enum LogLevel {
+    // 每次收发的细节，只在数据路径上使用
+    LOG_LEVEL_DEBUG = 0,
+
+    // 服务器和客户端的生命周期
+    LOG_LEVEL_INFO = 1,
+
+    // 可以继续运行的异常情况，比如回退到默认实现
+    LOG_LEVEL_WARN = 2,
+
+    // 不记录任何日志
+    LOG_LEVEL_NONE = 3
+};
+
+// 编译期日志级别，低于该级别的日志语句不会被编译进库中
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// 环形缓冲区中的日志记录数，必须是 2 的幂
+#define NATIVE_LOG_CAPACITY 1024
+
+// 单条日志记录的最大长度，包括 NULL 终止符
+#define NATIVE_LOG_MESSAGE_LENGTH 256
+
+/**
+ * 设置运行期日志级别
+ * @param level 最低记录的级别
+ */
+void NativeLogSetLevel(int level);
+
+/**
+ * 检查给定级别的日志是否会被记录
+ * @param level 日志级别
+ * @return 是否记录
+ */
+bool NativeLogIsEnabled(int level);
+
+/**
+ * 格式化一条日志写入环形缓冲区，不加锁也不调用 JNI，缓冲区满时丢弃并计数，
+ * 级别过滤由 NATIVE_LOG 完成
+ * @param format 格式
+ * @param ...
+ */
+void NativeLogWrite(const char *format, ...)
+__attribute__ ((format (printf, 1, 2)));
+
+/**
+ * 从环形缓冲区取出一批日志，每条以换行符结尾，自上次取出以来丢弃的日志数追加在最后
+ * @param buffer 输出缓冲区，以 NULL 终止
+ * @param bufferSize 缓冲区大小，不小于 2 * NATIVE_LOG_MESSAGE_LENGTH 才能保证取出日志
+ * @return 写入的长度，没有日志时返回 0
+ */
+size_t NativeLogDrain(char *buffer, size_t bufferSize);
+
+/**
+ * 按编译期和运行期级别过滤后记录日志，被过滤时不会计算参数
+ */
+#define NATIVE_LOG(level, ...) \
+    do { \
+        if ((level) >= LOG_COMPILE_LEVEL && NativeLogIsEnabled(level)) { \
+            NativeLogWrite(__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOGD(...) NATIVE_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOGI(...) NATIVE_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOGW(...) NATIVE_LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+
+#endif // ECHO_NATIVE_LOG_H
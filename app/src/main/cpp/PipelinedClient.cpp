@@ -0,0 +1,199 @@
+#include "PipelinedClient.h"
+#include <stdlib.h> // malloc, free
+#include <errno.h> // errno
+#include <string.h> // memset, memcpy, memcmp
+#include <fcntl.h> // fcntl, O_NONBLOCK
+#include <poll.h> // poll
+#include <time.h> // clock_gettime
+#include <sys/socket.h> // send, recv
+
+// 发送缓冲区中请求副本的总长度上限，小请求可以一次 send 发出多个
+#define STREAM_BUFFER_SIZE 65536
+
+// 接收缓冲区大小
+#define RECEIVE_BUFFER_SIZE 65536
+
+/**
+ * 读取单调时钟
+ * @return 纳秒
+ */
+static uint64_t NowNanos() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * 检查收到的数据是否与请求流中相同位置的数据一致，回显流是请求的不断重复
+ * @param payload 请求内容
+ * @param payloadSize 请求长度
+ * @param streamOffset 收到的数据在流中的位置
+ * @param data 收到的数据
+ * @param length 数据长度
+ * @return 一致返回 true
+ */
+static bool MatchesPayload(const char *payload, size_t payloadSize, uint64_t streamOffset,
+                           const char *data, size_t length) {
+    size_t offset = (size_t) (streamOffset % payloadSize);
+    while (length > 0) {
+        size_t size = payloadSize - offset;
+        if (size > length) {
+            size = length;
+        }
+        if (0 != memcmp(payload + offset, data, size)) {
+            return false;
+        }
+        data += size;
+        length -= size;
+        offset = 0;
+    }
+    return true;
+}
+
+int PipelinedClientRun(int sd, const char *payload, size_t payloadSize,
+                       unsigned requestCount, unsigned window, struct PipelineResult *result) {
+    memset(result, 0, sizeof(*result));
+    if (0 == payloadSize || 0 == window) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int status = -1;
+    char *stream = NULL;
+    char *receiveBuffer = NULL;
+    uint64_t *startTimes = NULL;
+    uint64_t start = NowNanos();
+
+    // 请求 i 在流中占 [i * payloadSize, (i + 1) * payloadSize)
+    uint64_t totalBytes = (uint64_t) requestCount * payloadSize;
+
+    // 发送缓冲区是请求的若干个副本，按流的位置循环发送
+    size_t copies = STREAM_BUFFER_SIZE / payloadSize;
+    if (copies < 1) {
+        copies = 1;
+    } else if (copies > window) {
+        copies = window;
+    }
+    size_t streamSize = copies * payloadSize;
+
+    int flags = fcntl(sd, F_GETFL, 0);
+    if (-1 == flags || -1 == fcntl(sd, F_SETFL, flags | O_NONBLOCK)) {
+        return -1;
+    }
+
+    stream = (char *) malloc(streamSize);
+    receiveBuffer = (char *) malloc(RECEIVE_BUFFER_SIZE);
+    startTimes = (uint64_t *) calloc(window, sizeof(uint64_t));
+    if (NULL == stream || NULL == receiveBuffer || NULL == startTimes) {
+        errno = ENOMEM;
+        goto exit;
+    }
+    for (size_t i = 0; i < copies; i++) {
+        memcpy(stream + i * payloadSize, payload, payloadSize);
+    }
+
+    while (result->completed < requestCount) {
+        // 在途请求未满窗口时可以继续发送，窗口限制的是已开始发送但未收齐回显的请求
+        uint64_t sendLimit = (result->completed + window) * payloadSize;
+        if (sendLimit > totalBytes) {
+            sendLimit = totalBytes;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = sd;
+        pfd.events = POLLIN;
+        if (result->sentBytes < sendLimit) {
+            pfd.events |= POLLOUT;
+        }
+        if (-1 == poll(&pfd, 1, -1)) {
+            if (EINTR == errno) {
+                continue;
+            }
+            goto exit;
+        }
+        if (0 != (pfd.revents & (POLLERR | POLLNVAL))) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(sd, SOL_SOCKET, SO_ERROR, &error, &length);
+            errno = (0 != error) ? error : EIO;
+            goto exit;
+        }
+
+        // 尽量填满发送缓冲区
+        while (result->sentBytes < sendLimit) {
+            size_t position = (size_t) (result->sentBytes % streamSize);
+            uint64_t length = sendLimit - result->sentBytes;
+            if (length > streamSize - position) {
+                length = streamSize - position;
+            }
+
+            ssize_t sentSize = send(sd, stream + position, (size_t) length, MSG_NOSIGNAL);
+            if (-1 == sentSize) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                    break;
+                }
+                goto exit;
+            }
+
+            // 记录这次发送中开始的请求的时间
+            uint64_t now = NowNanos();
+            uint64_t first = (result->sentBytes + payloadSize - 1) / payloadSize;
+            result->sentBytes += (uint64_t) sentSize;
+            for (uint64_t i = first; i * payloadSize < result->sentBytes; i++) {
+                startTimes[i % window] = now;
+            }
+        }
+
+        // 取走已经到达的回显
+        while (result->receivedBytes < result->sentBytes) {
+            ssize_t recvSize = recv(sd, receiveBuffer, RECEIVE_BUFFER_SIZE, 0);
+            if (-1 == recvSize) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                    break;
+                }
+                goto exit;
+            }
+            if (0 == recvSize) {
+                // 对端在回显完成前关闭了连接
+                errno = ECONNRESET;
+                goto exit;
+            }
+
+            if (!MatchesPayload(payload, payloadSize, result->receivedBytes, receiveBuffer,
+                                (size_t) recvSize)) {
+                errno = EBADMSG;
+                goto exit;
+            }
+
+            // 收齐的请求按顺序完成
+            uint64_t now = NowNanos();
+            result->receivedBytes += (uint64_t) recvSize;
+            while ((result->completed + 1) * payloadSize <= result->receivedBytes) {
+                uint64_t latency = now - startTimes[result->completed % window];
+                result->totalLatencyNanos += latency;
+                if (latency > result->maxLatencyNanos) {
+                    result->maxLatencyNanos = latency;
+                }
+                result->completed++;
+            }
+        }
+    }
+
+    status = 0;
+
+    exit:
+    int error = errno;
+    result->elapsedNanos = NowNanos() - start;
+    fcntl(sd, F_SETFL, flags);
+    free(stream);
+    free(receiveBuffer);
+    free(startTimes);
+    errno = error;
+    return status;
+}
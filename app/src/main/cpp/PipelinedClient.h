@@ -0,0 +1,40 @@
+#ifndef ECHO_PIPELINED_CLIENT_H
+#define ECHO_PIPELINED_CLIENT_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+/**
+ * 流水线请求的结果
+ */
+struct PipelineResult {
+    // 收齐回显的请求数
+    uint64_t completed;
+
+    // 发送和接收的字节数
+    uint64_t sentBytes;
+    uint64_t receivedBytes;
+
+    // 从发出第一个字节到收齐最后一个回显的耗时，单位纳秒
+    uint64_t elapsedNanos;
+
+    // 每个请求从开始发送到收齐回显的延迟之和与最大值，单位纳秒
+    uint64_t totalLatencyNanos;
+    uint64_t maxLatencyNanos;
+};
+
+/**
+ * 在已连接的 TCP socket 上以流水线方式发送 requestCount 个相同的请求，
+ * 最多 window 个请求同时在途，发送端保持忙碌的同时按顺序把回显与请求对应起来
+ * @param sd 已连接的 TCP socket，调用期间临时设为非阻塞
+ * @param payload 每个请求的内容
+ * @param payloadSize 请求长度
+ * @param requestCount 请求数
+ * @param window 最多同时在途的请求数
+ * @param result 结果
+ * @return 成功返回 0，失败返回 -1 并设置 errno，回显与请求不一致时 errno 为 EBADMSG
+ */
+int PipelinedClientRun(int sd, const char *payload, size_t payloadSize,
+                       unsigned requestCount, unsigned window, struct PipelineResult *result);
+
+#endif // ECHO_PIPELINED_CLIENT_H
@@ -0,0 +1,111 @@
+#ifndef ECHO_SERVER_OPTIONS_H
+#define ECHO_SERVER_OPTIONS_H
+
+#include "SocketProfile.h"
+#include "MessageHandler.h"
+
+// 默认的每个连接的缓冲区大小，与 com.liu.echo.ServerOptions 一致
+#define SERVER_DEFAULT_BUFFER_SIZE (256 * 1024)
+
+// 默认的忙轮询空闲退避时间，单位微秒，与 com.liu.echo.ServerOptions 一致
+#define SERVER_DEFAULT_BUSY_POLL_IDLE_MICROS 10000
+
+// 默认的发送积压高低水位，单位字节，与 com.liu.echo.ServerOptions 一致
+#define SERVER_DEFAULT_WRITE_HIGH_WATERMARK (64 * 1024)
+#define SERVER_DEFAULT_WRITE_LOW_WATERMARK (16 * 1024)
+
+/**
+ * 服务器使用的 I/O 后端，取值与 com.liu.echo.ServerOptions 中的常量一致
+ */
+enum IoBackend {
+    // 非阻塞 epoll 事件循环
+    IO_BACKEND_EPOLL = 0,
+
+    // io_uring，内核不支持时回退到默认实现
+    IO_BACKEND_IO_URING = 1,
+
+    // 单线程反应器上的协程，每个连接一个顺序执行的回显协程
+    IO_BACKEND_COROUTINE = 2
+};
+
+/**
+ * 启动服务器时选择的选项，对应 Java 层的 com.liu.echo.ServerOptions
+ */
+struct ServerOptions {
+    // I/O 后端
+    int backend;
+
+    // 流 socket 是否用 splice 零拷贝回显
+    bool zeroCopy;
+
+    // UDP 服务器每次系统调用收发的最大数据报数，0 表示只回显一个数据报后退出
+    int datagramBatchSize;
+
+    // 批量模式下是否启用 UDP_GRO/UDP_SEGMENT 分段卸载
+    bool segmentOffload;
+
+    // 每个流连接最多缓存的字节数，数据报服务器中为最大数据报长度
+    int bufferSize;
+
+    // 连接缓冲区池的 slab 是否优先使用大页
+    bool hugePages;
+
+    // 流 socket 是否按长度前缀帧回显，只回显完整的帧，启用时不使用零拷贝和 io_uring
+    bool framing;
+
+    // 流 socket 是否校验每个帧尾的 CRC32C，只回显校验通过的帧，遇到不匹配的帧时关闭连接；
+    // 启用时同时启用分帧，记录模式下忽略
+    bool integrity;
+
+    // 本地 socket 服务器是否使用 SOCK_SEQPACKET，逐条回显记录和记录附带的描述符，
+    // 启用时不使用零拷贝、分帧和 io_uring
+    bool seqPacket;
+
+    // 监听 socket 和接受的连接使用的调优方案，SocketProfileId
+    int socketProfile;
+
+    // epoll 事件循环是否忙轮询：零超时反复 epoll_wait，空闲超过 busyPollIdleMicros 后退回阻塞等待，
+    // 启用时不使用 io_uring
+    bool busyPoll;
+    int busyPollIdleMicros;
+
+    // 忙轮询线程绑定的 CPU 核心，-1 表示不绑定
+    int busyPollCpu;
+
+    // 分帧模式下处理每个帧的消息处理器，MessageHandlerId
+    int messageHandler;
+
+    // 运行消息处理器的工作窃取线程数，0 表示在 I/O 线程中直接处理；只用于分帧模式
+    int handlerThreads;
+
+    // 流回显连接尚未发出的字节数达到高水位时暂停读取，降到低水位以下才恢复；
+    // 高水位为 0 表示有任何数据没有发出就暂停读取，直到全部发出
+    int writeHighWatermark;
+    int writeLowWatermark;
+};
+
+/**
+ * 用默认值初始化服务器选项
+ * @param options 服务器选项
+ */
+static inline void ServerOptionsInit(struct ServerOptions *options) {
+    options->backend = IO_BACKEND_EPOLL;
+    options->zeroCopy = false;
+    options->datagramBatchSize = 0;
+    options->segmentOffload = false;
+    options->bufferSize = SERVER_DEFAULT_BUFFER_SIZE;
+    options->hugePages = false;
+    options->framing = false;
+    options->integrity = false;
+    options->seqPacket = false;
+    options->socketProfile = SOCKET_PROFILE_DEFAULT;
+    options->busyPoll = false;
+    options->busyPollIdleMicros = SERVER_DEFAULT_BUSY_POLL_IDLE_MICROS;
+    options->busyPollCpu = -1;
+    options->messageHandler = MESSAGE_HANDLER_ECHO;
+    options->handlerThreads = 0;
+    options->writeHighWatermark = SERVER_DEFAULT_WRITE_HIGH_WATERMARK;
+    options->writeLowWatermark = SERVER_DEFAULT_WRITE_LOW_WATERMARK;
+}
+
+#endif // ECHO_SERVER_OPTIONS_H
@@ -0,0 +1,531 @@
+#include "ShmRing.h"
+#include "LocalTransfer.h" // LocalCreateRegion, LocalMapRegion
+#include <errno.h> // errno
+#include <limits.h> // INT_MAX
+#include <poll.h> // poll, POLLHUP
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcpy, memset
+#include <time.h> // clock_gettime, timespec
+#include <unistd.h> // close, syscall, sysconf
+#include <sys/mman.h> // munmap
+#include <sys/syscall.h> // __NR_futex
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+
+// 通道头的魔数 "ESHM" 和布局版本
+#define SHM_CHANNEL_MAGIC 0x4553484du
+#define SHM_CHANNEL_VERSION 1u
+
+/**
+ * 自旋等待时提示处理器让出流水线
+ */
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * 阻塞收发的自旋次数，只有一个处理器在线时对方在自旋期间无法运行，直接进入 futex 等待
+ * @return 自旋次数
+ */
+static int GetSpinCount() {
+    static const int spinCount = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? SHM_RING_SPIN_COUNT : 0;
+    return spinCount;
+}
+
+/**
+ * 在共享的 futex 字上等待，区域可能由不同进程映射，不能使用 FUTEX_PRIVATE_FLAG
+ * @param word futex 字
+ * @param expected 仍然等于这个值时才睡眠
+ * @param timeout 相对超时，NULL 表示不超时
+ */
+static void FutexWait(uint32_t *word, uint32_t expected, const struct timespec *timeout) {
+    syscall(__NR_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+/**
+ * 唤醒在共享 futex 字上等待的线程
+ * @param word futex 字
+ * @param count 最多唤醒的线程数
+ */
+static void FutexWake(uint32_t *word, int count) {
+    syscall(__NR_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/**
+ * 对方已经声明等待时递增序号并唤醒它
+ *     发布位置和读取等待标志之间的全屏障与等待方设置标志后的全屏障配对，
+ *     不会出现双方都看不到对方更新的情况
+ * @param waiting 对方的等待标志
+ * @param sequence 对方等待的序号
+ */
+static void WakePeer(uint32_t *waiting, uint32_t *sequence) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(waiting, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(sequence, 1, __ATOMIC_RELEASE);
+        FutexWake(sequence, 1);
+    }
+}
+
+/**
+ * 记录在环中占用的长度
+ * @param size 负载长度
+ * @return 长度头加负载，按 SHM_RING_RECORD_ALIGNMENT 对齐
+ */
+static inline uint64_t RecordSize(uint64_t size) {
+    return (SHM_RING_RECORD_HEADER_SIZE + size + SHM_RING_RECORD_ALIGNMENT - 1)
+           & ~(uint64_t) (SHM_RING_RECORD_ALIGNMENT - 1);
+}
+
+/**
+ * 把数据复制到环中，可能跨越环的末尾
+ * @param ring 环
+ * @param position 写入位置
+ * @param data 数据
+ * @param size 长度
+ */
+static void CopyIn(struct ShmRing *ring, uint64_t position, const void *data, size_t size) {
+    size_t offset = (size_t) (position & (ring->capacity - 1));
+    size_t first = (size_t) ring->capacity - offset;
+    if (first >= size) {
+        memcpy(ring->data + offset, data, size);
+    } else {
+        memcpy(ring->data + offset, data, first);
+        memcpy(ring->data, (const char *) data + first, size - first);
+    }
+}
+
+/**
+ * 从环中复制数据，可能跨越环的末尾
+ * @param ring 环
+ * @param position 读取位置
+ * @param buffer 缓冲区
+ * @param size 长度
+ */
+static void CopyOut(const struct ShmRing *ring, uint64_t position, void *buffer, size_t size) {
+    size_t offset = (size_t) (position & (ring->capacity - 1));
+    size_t first = (size_t) ring->capacity - offset;
+    if (first >= size) {
+        memcpy(buffer, ring->data + offset, size);
+    } else {
+        memcpy(buffer, ring->data + offset, first);
+        memcpy((char *) buffer + first, ring->data, size - first);
+    }
+}
+
+int ShmRingTrySend(struct ShmRing *ring, const void *data, size_t size) {
+    uint64_t recordSize = RecordSize(size);
+    if (recordSize > ring->capacity) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (0 != __atomic_load_n(ring->closed, __ATOMIC_ACQUIRE)) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    struct ShmRingControl *control = ring->control;
+    uint64_t tail = ring->position;
+    if (tail + recordSize - ring->peerPosition > ring->capacity) {
+        ring->peerPosition = __atomic_load_n(&control->head, __ATOMIC_ACQUIRE);
+        if (tail + recordSize - ring->peerPosition > ring->capacity) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    // 记录从对齐的位置开始，长度头不会跨越环的末尾
+    uint32_t length = (uint32_t) size;
+    memcpy(ring->data + (tail & (ring->capacity - 1)), &length, sizeof(length));
+    CopyIn(ring, tail + SHM_RING_RECORD_HEADER_SIZE, data, size);
+
+    ring->position = tail + recordSize;
+    __atomic_store_n(&control->tail, ring->position, __ATOMIC_RELEASE);
+    WakePeer(&control->consumerWaiting, &control->dataSequence);
+    return 0;
+}
+
+ssize_t ShmRingTryReceive(struct ShmRing *ring, void *buffer, size_t size) {
+    struct ShmRingControl *control = ring->control;
+    uint64_t head = ring->position;
+    if (head == ring->peerPosition) {
+        ring->peerPosition = __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->peerPosition) {
+            // 对方关闭前写入的记录在关闭标志之前发布，看到关闭后再读一次写入位置
+            if (0 == __atomic_load_n(ring->closed, __ATOMIC_ACQUIRE)) {
+                errno = EAGAIN;
+                return -1;
+            }
+            ring->peerPosition = __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+            if (head == ring->peerPosition) {
+                errno = EPIPE;
+                return -1;
+            }
+        }
+    }
+
+    // 区域由对方写入，长度头不可信，检查记录没有超出已经发布的部分
+    uint32_t length;
+    memcpy(&length, ring->data + (head & (ring->capacity - 1)), sizeof(length));
+    uint64_t recordSize = RecordSize(length);
+    if (recordSize > ring->peerPosition - head) {
+        errno = EBADMSG;
+        return -1;
+    }
+    if (length > size) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    CopyOut(ring, head + SHM_RING_RECORD_HEADER_SIZE, buffer, length);
+
+    ring->position = head + recordSize;
+    __atomic_store_n(&control->head, ring->position, __ATOMIC_RELEASE);
+    WakePeer(&control->producerWaiting, &control->spaceSequence);
+    return (ssize_t) length;
+}
+
+/**
+ * 计算等待的截止时间
+ * @param timeoutMillis 超时毫秒数，小于 0 表示不超时
+ * @param deadline 单调时钟上的截止时间
+ */
+static void GetDeadline(int timeoutMillis, struct timespec *deadline) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    if (timeoutMillis >= 0) {
+        deadline->tv_sec += timeoutMillis / 1000;
+        deadline->tv_nsec += (long) (timeoutMillis % 1000) * 1000000L;
+        if (deadline->tv_nsec >= 1000000000L) {
+            deadline->tv_sec++;
+            deadline->tv_nsec -= 1000000000L;
+        }
+    }
+}
+
+/**
+ * 计算到截止时间的剩余时间
+ * @param deadline 截止时间
+ * @param remaining 剩余时间
+ * @return 还有剩余时间返回 true
+ */
+static bool GetRemaining(const struct timespec *deadline, struct timespec *remaining) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining->tv_sec = deadline->tv_sec - now.tv_sec;
+    remaining->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+    if (remaining->tv_nsec < 0) {
+        remaining->tv_sec--;
+        remaining->tv_nsec += 1000000000L;
+    }
+    return remaining->tv_sec >= 0;
+}
+
+/**
+ * 在序号上睡眠直到对方唤醒或者超时
+ *     先声明等待再用全屏障把它和随后的重新检查隔开；对方在重新检查之后才发布的更新一定能
+ *     看到等待标志并递增序号，序号已经改变时 futex 不会睡眠
+ * @param waiting 本方的等待标志
+ * @param sequence 本方等待的序号
+ * @param sequenceValue 声明等待之前读到的序号
+ * @param timeoutMillis 超时毫秒数，小于 0 表示不超时
+ * @param deadline 截止时间
+ * @return 已经超时返回 false
+ */
+static bool WaitForPeer(uint32_t *waiting, uint32_t *sequence, uint32_t sequenceValue,
+                        int timeoutMillis, const struct timespec *deadline) {
+    struct timespec remaining;
+    bool timedOut = false;
+    if (timeoutMillis < 0) {
+        FutexWait(sequence, sequenceValue, NULL);
+    } else if (GetRemaining(deadline, &remaining)) {
+        FutexWait(sequence, sequenceValue, &remaining);
+    } else {
+        timedOut = true;
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return !timedOut;
+}
+
+int ShmRingSend(struct ShmRing *ring, const void *data, size_t size, int timeoutMillis) {
+    struct ShmRingControl *control = ring->control;
+    struct timespec deadline;
+    bool hasDeadline = false;
+    int maxSpinCount = GetSpinCount();
+
+    for (int spinCount = 0;; spinCount++) {
+        if (0 == ShmRingTrySend(ring, data, size)) {
+            return 0;
+        }
+        if (EAGAIN != errno) {
+            return -1;
+        }
+        if (spinCount < maxSpinCount) {
+            CpuRelax();
+            continue;
+        }
+
+        if (!hasDeadline) {
+            GetDeadline(timeoutMillis, &deadline);
+            hasDeadline = true;
+        }
+        uint32_t sequenceValue = __atomic_load_n(&control->spaceSequence, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&control->producerWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (0 == ShmRingTrySend(ring, data, size)) {
+            __atomic_store_n(&control->producerWaiting, 0, __ATOMIC_RELAXED);
+            return 0;
+        }
+        if (EAGAIN != errno) {
+            __atomic_store_n(&control->producerWaiting, 0, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if (!WaitForPeer(&control->producerWaiting, &control->spaceSequence, sequenceValue,
+                   timeoutMillis, &deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+ssize_t ShmRingReceive(struct ShmRing *ring, void *buffer, size_t size, int timeoutMillis) {
+    struct ShmRingControl *control = ring->control;
+    struct timespec deadline;
+    bool hasDeadline = false;
+    int maxSpinCount = GetSpinCount();
+
+    for (int spinCount = 0;; spinCount++) {
+        ssize_t recvSize = ShmRingTryReceive(ring, buffer, size);
+        if (-1 != recvSize) {
+            return recvSize;
+        }
+        if (EAGAIN != errno) {
+            return -1;
+        }
+        if (spinCount < maxSpinCount) {
+            CpuRelax();
+            continue;
+        }
+
+        if (!hasDeadline) {
+            GetDeadline(timeoutMillis, &deadline);
+            hasDeadline = true;
+        }
+        uint32_t sequenceValue = __atomic_load_n(&control->dataSequence, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&control->consumerWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        recvSize = ShmRingTryReceive(ring, buffer, size);
+        if (-1 != recvSize || EAGAIN != errno) {
+            __atomic_store_n(&control->consumerWaiting, 0, __ATOMIC_RELAXED);
+            return recvSize;
+        }
+        if (!WaitForPeer(&control->consumerWaiting, &control->dataSequence, sequenceValue,
+                   timeoutMillis, &deadline)) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+}
+
+/**
+ * 设置本进程对一个单向环的视图
+ * @param ring 环
+ * @param header 通道头
+ * @param control 环的控制块
+ * @param data 环的数据区
+ * @param capacity 容量
+ * @param producer 本进程是否是生产者
+ */
+static void InitRing(struct ShmRing *ring, struct ShmChannelHeader *header,
+                     struct ShmRingControl *control, char *data, uint64_t capacity,
+                     bool producer) {
+    ring->control = control;
+    ring->closed = &header->closed;
+    ring->data = data;
+    ring->capacity = capacity;
+
+    uint64_t head = __atomic_load_n(&control->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+    ring->position = producer ? tail : head;
+    ring->peerPosition = producer ? head : tail;
+}
+
+/**
+ * 按角色设置通道的两个环
+ * @param channel 通道
+ * @param capacity 容量
+ * @param client 本进程是否是客户端
+ */
+static void InitRings(struct ShmChannel *channel, uint64_t capacity, bool client) {
+    struct ShmChannelHeader *header = channel->header;
+    char *requestData = (char *) channel->region + sizeof(struct ShmChannelHeader);
+    char *replyData = requestData + capacity;
+
+    if (client) {
+        InitRing(&channel->send, header, &header->requests, requestData, capacity, true);
+        InitRing(&channel->receive, header, &header->replies, replyData, capacity, false);
+    } else {
+        InitRing(&channel->receive, header, &header->requests, requestData, capacity, false);
+        InitRing(&channel->send, header, &header->replies, replyData, capacity, true);
+    }
+}
+
+int ShmChannelCreate(struct ShmChannel *channel, size_t capacity) {
+    uint64_t ringCapacity = SHM_CHANNEL_MIN_CAPACITY;
+    while (ringCapacity < capacity) {
+        ringCapacity <<= 1;
+    }
+
+    memset(channel, 0, sizeof(*channel));
+    channel->regionSize = sizeof(struct ShmChannelHeader) + 2 * (size_t) ringCapacity;
+    channel->fd = LocalCreateRegion("echo-shm", channel->regionSize);
+    if (-1 == channel->fd) {
+        return -1;
+    }
+    channel->region = LocalMapRegion(channel->fd, channel->regionSize);
+    if (NULL == channel->region) {
+        int error = errno;
+        close(channel->fd);
+        errno = error;
+        return -1;
+    }
+
+    // memfd 的内容为零，位置、标志和序号都从零开始
+    channel->header = (struct ShmChannelHeader *) channel->region;
+    channel->header->magic = SHM_CHANNEL_MAGIC;
+    channel->header->version = SHM_CHANNEL_VERSION;
+    channel->header->capacity = ringCapacity;
+    InitRings(channel, ringCapacity, true);
+    return 0;
+}
+
+int ShmChannelAttach(struct ShmChannel *channel, int fd, size_t regionSize) {
+    memset(channel, 0, sizeof(*channel));
+    channel->fd = fd;
+    channel->regionSize = regionSize;
+    if (regionSize < sizeof(struct ShmChannelHeader)) {
+        errno = EINVAL;
+        goto fail;
+    }
+    channel->region = LocalMapRegion(fd, regionSize);
+    if (NULL == channel->region) {
+        goto fail;
+    }
+    channel->header = (struct ShmChannelHeader *) channel->region;
+
+    {
+        // 只读取一次容量，之后使用本地副本，对方改写通道头不会让访问越界
+        uint64_t capacity = __atomic_load_n(&channel->header->capacity, __ATOMIC_RELAXED);
+        if (SHM_CHANNEL_MAGIC != channel->header->magic
+            || SHM_CHANNEL_VERSION != channel->header->version
+            || capacity < SHM_CHANNEL_MIN_CAPACITY || 0 != (capacity & (capacity - 1))
+            || sizeof(struct ShmChannelHeader) + 2 * capacity != regionSize) {
+            errno = EINVAL;
+            goto fail;
+        }
+        InitRings(channel, capacity, false);
+    }
+    return 0;
+
+    fail:
+    int error = errno;
+    if (NULL != channel->region) {
+        munmap(channel->region, regionSize);
+        channel->region = NULL;
+    }
+    close(fd);
+    channel->fd = -1;
+    errno = error;
+    return -1;
+}
+
+void ShmChannelClose(struct ShmChannel *channel) {
+    struct ShmChannelHeader *header = channel->header;
+    __atomic_store_n(&header->closed, 1, __ATOMIC_RELEASE);
+
+    // 不管对方是否声明了等待，都改变全部序号，正在进入等待的一方不会再睡眠
+    uint32_t *sequences[] = {
+            &header->requests.dataSequence, &header->requests.spaceSequence,
+            &header->replies.dataSequence, &header->replies.spaceSequence,
+    };
+    for (uint32_t *sequence : sequences) {
+        __atomic_fetch_add(sequence, 1, __ATOMIC_RELEASE);
+        FutexWake(sequence, INT_MAX);
+    }
+}
+
+void ShmChannelDestroy(struct ShmChannel *channel) {
+    if (NULL != channel->region) {
+        munmap(channel->region, channel->regionSize);
+        channel->region = NULL;
+    }
+    if (-1 != channel->fd) {
+        close(channel->fd);
+        channel->fd = -1;
+    }
+}
+
+/**
+ * 检查握手 socket 的对端是否已经关闭
+ * @param sd 本地 socket 描述符
+ * @return 已经关闭返回 true
+ */
+static bool IsPeerGone(int sd) {
+    struct pollfd descriptor;
+    descriptor.fd = sd;
+    descriptor.events = POLLRDHUP;
+    descriptor.revents = 0;
+    if (poll(&descriptor, 1, 0) <= 0) {
+        return false;
+    }
+    return 0 != (descriptor.revents & (POLLHUP | POLLRDHUP | POLLERR));
+}
+
+int ShmChannelSend(struct ShmChannel *channel, int sd, const void *data, size_t size) {
+    while (-1 == ShmRingSend(&channel->send, data, size, SHM_CHANNEL_POLL_MILLIS)) {
+        if (ETIMEDOUT != errno) {
+            return -1;
+        }
+        if (IsPeerGone(sd)) {
+            errno = ECONNRESET;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+ssize_t ShmChannelReceive(struct ShmChannel *channel, int sd, void *buffer, size_t size) {
+    while (true) {
+        ssize_t recvSize = ShmRingReceive(&channel->receive, buffer, size, SHM_CHANNEL_POLL_MILLIS);
+        if (-1 != recvSize || ETIMEDOUT != errno) {
+            return recvSize;
+        }
+        if (IsPeerGone(sd)) {
+            errno = ECONNRESET;
+            return -1;
+        }
+    }
+}
+
+int ShmChannelServeEcho(struct ShmChannel *channel, int sd) {
+    size_t bufferSize = (size_t) channel->receive.capacity;
+    char *buffer = (char *) malloc(bufferSize);
+    if (NULL == buffer) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while (true) {
+        ssize_t recvSize = ShmChannelReceive(channel, sd, buffer, bufferSize);
+        if (-1 == recvSize || -1 == ShmChannelSend(channel, sd, buffer, (size_t) recvSize)) {
+            break;
+        }
+    }
+
+    // 客户端关闭通道是正常结束；握手 socket 已经关闭说明客户端异常退出，errno 为 ECONNRESET
+    int result = (EPIPE == errno) ? 0 : -1;
+    int error = errno;
+    free(buffer);
+    errno = error;
+    return result;
+}
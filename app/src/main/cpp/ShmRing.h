@@ -0,0 +1,187 @@
+#ifndef ECHO_SHM_RING_H
+#define ECHO_SHM_RING_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t, uint64_t
+#include <sys/types.h> // ssize_t
+
+// 共享内存中各方独占的缓存行大小
+#define SHM_RING_CACHE_LINE_SIZE 64
+
+// 默认的单向环容量，必须是 2 的幂
+#define SHM_CHANNEL_DEFAULT_CAPACITY (1024 * 1024)
+
+// 最小的单向环容量
+#define SHM_CHANNEL_MIN_CAPACITY 4096
+
+// 每条记录的长度头，记录按 8 字节对齐，长度头不会跨越环的末尾
+#define SHM_RING_RECORD_HEADER_SIZE 4
+#define SHM_RING_RECORD_ALIGNMENT 8
+
+// 多处理器上阻塞收发在进入 futex 等待之前自旋检查的次数
+#define SHM_RING_SPIN_COUNT 4096
+
+// 服务器每等待这么久检查一次握手 socket，客户端进程退出时不会永远等待
+#define SHM_CHANNEL_POLL_MILLIS 100
+
+/**
+ * 单向环在共享内存中的控制块
+ *     生产者和消费者各自只写自己的缓存行；等待标志和序号组成事件计数，
+ *     只有对方已经声明等待时才调用 futex 唤醒，稳定收发时没有系统调用
+ */
+struct ShmRingControl {
+    // 生产者写：写入位置、是否在等待空间、数据序号（唤醒消费者时递增）
+    alignas(SHM_RING_CACHE_LINE_SIZE) uint64_t tail;
+    uint32_t producerWaiting;
+    uint32_t dataSequence;
+
+    // 消费者写：读取位置、是否在等待数据、空间序号（唤醒生产者时递增）
+    alignas(SHM_RING_CACHE_LINE_SIZE) uint64_t head;
+    uint32_t consumerWaiting;
+    uint32_t spaceSequence;
+};
+
+/**
+ * 共享区域开头的通道头，之后依次是请求环和回复环的数据区
+ */
+struct ShmChannelHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+
+    // 任一方关闭通道后置为 1，对方收完剩余的记录后收到 EPIPE
+    alignas(SHM_RING_CACHE_LINE_SIZE) uint32_t closed;
+
+    // 请求环：客户端生产、服务器消费；回复环：服务器生产、客户端消费
+    struct ShmRingControl requests;
+    struct ShmRingControl replies;
+};
+
+/**
+ * 本进程对一个单向环的视图
+ */
+struct ShmRing {
+    struct ShmRingControl *control;
+    uint32_t *closed;
+    char *data;
+    uint64_t capacity;
+
+    // 本方位置的私有副本：生产者是写入位置，消费者是读取位置
+    uint64_t position;
+
+    // 最近一次读到的对方位置，只有按它判断放不下或者没有数据时才重新读取对方的缓存行
+    uint64_t peerPosition;
+};
+
+/**
+ * 一个双向通道：映射的共享区域和其中的两个单向环
+ */
+struct ShmChannel {
+    int fd;
+    void *region;
+    size_t regionSize;
+    struct ShmChannelHeader *header;
+
+    // 本进程发送和接收使用的环，客户端和服务器方向相反
+    struct ShmRing send;
+    struct ShmRing receive;
+};
+
+/**
+ * 客户端创建通道：创建并加封 memfd，映射并初始化两个环
+ * @param channel 通道
+ * @param capacity 每个单向环的容量，向上取整到 2 的幂，不小于 SHM_CHANNEL_MIN_CAPACITY
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int ShmChannelCreate(struct ShmChannel *channel, size_t capacity);
+
+/**
+ * 服务器映射客户端通过本地 socket 传来的通道 memfd，检查通道头与区域大小一致
+ * @param channel 通道
+ * @param fd memfd 描述符，通道接管它，由 ShmChannelDestroy 关闭
+ * @param regionSize 客户端声明的区域大小
+ * @return 成功返回 0，区域无效返回 -1 并设置 errno 为 EINVAL，失败返回 -1 并设置 errno
+ */
+int ShmChannelAttach(struct ShmChannel *channel, int fd, size_t regionSize);
+
+/**
+ * 关闭通道并唤醒对方，对方收完剩余的记录后收到 EPIPE
+ * @param channel 通道
+ */
+void ShmChannelClose(struct ShmChannel *channel);
+
+/**
+ * 解除映射并关闭 memfd
+ * @param channel 通道
+ */
+void ShmChannelDestroy(struct ShmChannel *channel);
+
+/**
+ * 尝试写入一条记录，不阻塞
+ * @param ring 环
+ * @param data 数据
+ * @param size 长度
+ * @return 成功返回 0；空间不足返回 -1 并设置 errno 为 EAGAIN，记录超过容量返回 EMSGSIZE，
+ *         通道已关闭返回 EPIPE
+ */
+int ShmRingTrySend(struct ShmRing *ring, const void *data, size_t size);
+
+/**
+ * 写入一条记录，空间不足时先自旋再用 futex 等待
+ * @param ring 环
+ * @param data 数据
+ * @param size 长度
+ * @param timeoutMillis 最长等待时间，超时返回 -1 并设置 errno 为 ETIMEDOUT
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int ShmRingSend(struct ShmRing *ring, const void *data, size_t size, int timeoutMillis);
+
+/**
+ * 尝试读取一条记录，不阻塞
+ * @param ring 环
+ * @param buffer 缓冲区
+ * @param size 缓冲区大小
+ * @return 记录长度；没有记录返回 -1 并设置 errno 为 EAGAIN，缓冲区太小返回 EMSGSIZE 并保留记录，
+ *         通道已关闭并且没有剩余的记录返回 EPIPE
+ */
+ssize_t ShmRingTryReceive(struct ShmRing *ring, void *buffer, size_t size);
+
+/**
+ * 读取一条记录，没有记录时先自旋再用 futex 等待
+ * @param ring 环
+ * @param buffer 缓冲区
+ * @param size 缓冲区大小
+ * @param timeoutMillis 最长等待时间，超时返回 -1 并设置 errno 为 ETIMEDOUT
+ * @return 记录长度，失败返回 -1 并设置 errno
+ */
+ssize_t ShmRingReceive(struct ShmRing *ring, void *buffer, size_t size, int timeoutMillis);
+
+/**
+ * 经通道发送一条记录，每等待 SHM_CHANNEL_POLL_MILLIS 检查一次握手 socket，对方进程退出时不会永远等待
+ * @param channel 通道
+ * @param sd 传递 memfd 的本地 socket
+ * @param data 数据
+ * @param size 长度
+ * @return 成功返回 0，失败返回 -1 并设置 errno，对方已经退出时为 ECONNRESET
+ */
+int ShmChannelSend(struct ShmChannel *channel, int sd, const void *data, size_t size);
+
+/**
+ * 从通道接收一条记录，每等待 SHM_CHANNEL_POLL_MILLIS 检查一次握手 socket，对方进程退出时不会永远等待
+ * @param channel 通道
+ * @param sd 传递 memfd 的本地 socket
+ * @param buffer 缓冲区
+ * @param size 缓冲区大小
+ * @return 记录长度，失败返回 -1 并设置 errno，对方已经退出时为 ECONNRESET
+ */
+ssize_t ShmChannelReceive(struct ShmChannel *channel, int sd, void *buffer, size_t size);
+
+/**
+ * 服务器在当前线程回显通道中的全部请求，直到客户端关闭通道或者握手 socket
+ * @param channel 已经映射的通道
+ * @param sd 传递 memfd 的本地 socket，等待超时时检查客户端进程是否已经退出
+ * @return 客户端关闭返回 0，失败返回 -1 并设置 errno
+ */
+int ShmChannelServeEcho(struct ShmChannel *channel, int sd);
+
+#endif // ECHO_SHM_RING_H
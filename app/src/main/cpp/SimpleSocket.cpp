@@ -1,8 +1,7 @@
 //
 // Created by 刘璟博 on 2018/6/13.
 //
-#include "com_liu_echo_EchoServerActivity.h"
-#include "com_liu_echo_EchoClientActivity.h"
+#include <jni.h> // JNIEnv
 #include <stdio.h> // NULL
 #include <stdarg.h> // va_list, vsnprintf
 #include <errno.h> // errno
@@ -17,18 +16,17 @@
 #include <arpa/inet.h> // inet_ntop
 #include <unistd.h> // close, unlink
 #include <stddef.h> // offsetof
-
-// 最大数据缓冲区大小
-#define MAX_BUFFER_SIZE 80
+#include <stdlib.h> // malloc, free
 
 /**
  * TCP socket 服务开发的4个步骤 socket->bind->listen->accept
  * @param env
  * @param obj
  * @param port
+ * @param bufferSize 接收缓冲区大小
  */
 void Javatest_com_liu_echo_EchoServerActivity_nativeStartTcpServer
-        (JNIEnv *env, jobject obj, jint port) {
+        (JNIEnv *env, jobject obj, jint port, jint bufferSize) {
     /*
      * 1. 用 socket 函数来创建Socket
      *      int socket(int domain, int type, int protocol);
@@ -89,7 +87,8 @@ void Javatest_com_liu_echo_EchoServerActivity_nativeStartTcpServer
     /*
      * 6 接收并发送数据
      */
-    char buffer[MAX_BUFFER_SIZE];
+    // 按给定大小分配缓冲区，多留一个字节给结尾的 NULL
+    char *buffer = (char *) malloc((size_t) bufferSize + 1);
     ssize_t recvSize;
     ssize_t sentSize;
 
@@ -103,7 +102,7 @@ void Javatest_com_liu_echo_EchoServerActivity_nativeStartTcpServer
          *     buffer length: 数据缓冲区大小
          *     flags: 指定接收所需的额外标志
          */
-        recvSize = recv(clientSocket, buffer, MAX_BUFFER_SIZE - 1, 0);
+        recvSize = recv(clientSocket, buffer, (size_t) bufferSize, 0);
 
         // 以 NULL 结尾缓冲区形成一个字符串
         buffer[recvSize] = NULL;
@@ -127,7 +126,8 @@ void Javatest_com_liu_echo_EchoServerActivity_nativeStartTcpServer
         }
     }
 
-    // 关闭客户端
+    // 释放缓冲区并关闭客户端
+    free(buffer);
     close(clientSocket);
 
 }
@@ -196,8 +196,8 @@ void Javatest_com_liu_echo_EchoClientActivity_nativeStartTcpClient
     /*
      * 4 从 socket 接收
      */
-    // 4.1 创建消息缓冲区
-    char buffer[MAX_BUFFER_SIZE];
+    // 4.1 创建消息缓冲区，回显与消息一样长，多留一个字节给结尾的 NULL
+    char *buffer = (char *) malloc((size_t) messageSize + 1);
 
     // 4.2 接收
     /*
@@ -205,13 +205,14 @@ void Javatest_com_liu_echo_EchoClientActivity_nativeStartTcpClient
      *     socket descriptor: 指定接收数据的 socket 实例
      *     buffer pointer: 指向内存地址的指针，用于保存接收数据
      *     buffer length: 数据缓冲区大小
-     *     flags: 指定接收所需的额外标志
+     *     flags: 指定接收所需的额外标志，MSG_WAITALL 一直等到收满整个回显
      */
-    ssize_t recvSize = recv(clientSocket, buffer, MAX_BUFFER_SIZE - 1, 0);
+    ssize_t recvSize = recv(clientSocket, buffer, (size_t) messageSize, MSG_WAITALL);
 
     // 4.3 以 NULL 结尾缓冲区形成一个字符串
     buffer[recvSize] = NULL;
 
-    // 5 关闭 socket
+    // 5 释放缓冲区并关闭 socket
+    free(buffer);
     close(clientSocket);
 }
\ No newline at end of file
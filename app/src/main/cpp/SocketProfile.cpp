@@ -0,0 +1,153 @@
+#include "SocketProfile.h"
+#include <errno.h> // errno
+#include <string.h> // strcmp
+#include <sys/socket.h> // setsockopt, getsockopt, SOMAXCONN
+#include <netinet/in.h> // IPPROTO_TCP
+#include <netinet/tcp.h> // TCP_NODELAY, TCP_QUICKACK, TCP_NOTSENT_LOWAT
+
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+
+// 接收低水位最多为 socket 当前接收缓冲区（SO_RCVBUF）的几分之一
+#define RECEIVE_LOW_WATERMARK_DIVISOR 4
+
+// 大量空闲连接时每个方向的缓冲区，内核实际分配两倍
+#define IDLE_BUFFER_SIZE (16 * 1024)
+
+/**
+ * 预设方案，按 SocketProfileId 排列
+ */
+static const struct SocketProfile profiles[SOCKET_PROFILE_COUNT] = {
+        {"default",                 false, false, 0, 0, 0, 0, SOMAXCONN},
+        {"low-latency",             true,  true,  0, 0, 16 * 1024, 0, SOMAXCONN},
+        // 固定缓冲区会关闭自动调整，在回环和高带宽链路上反而更慢，所以大块数据只用接收低水位合并唤醒；
+        // 低水位需要的内存超过接收缓冲区时内核把窗口限制在低水位，窗口放不下一整批时收发双方互相等待。
+        // 32K 是相对默认接收缓冲区（tcp_rmem 的默认值 128K）选取的四分之一，实际设置时还按
+        // socket 当前的 SO_RCVBUF 限制，见 SocketProfileSetReceiveLowWatermark
+        {"bulk-throughput",         false, false, 0, 0, 0, 32 * 1024, SOMAXCONN},
+        {"many-idle-connections",   false, false, IDLE_BUFFER_SIZE, IDLE_BUFFER_SIZE, 4 * 1024, 0,
+                                                                                     65535}
+};
+
+const struct SocketProfile *SocketProfileGet(int id) {
+    if (id < 0 || id >= SOCKET_PROFILE_COUNT) {
+        return NULL;
+    }
+    return &profiles[id];
+}
+
+int SocketProfileFind(const char *name) {
+    for (int i = 0; i < SOCKET_PROFILE_COUNT; i++) {
+        if (0 == strcmp(profiles[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * 设置一个整数选项，值为 0 时不设置
+ * @param sd socket 描述符
+ * @param level 协议层
+ * @param name 选项
+ * @param value 选项值
+ * @param optional 内核不支持时是否忽略
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int SetOption(int sd, int level, int name, int value, bool optional) {
+    if (0 == value) {
+        return 0;
+    }
+    if (-1 == setsockopt(sd, level, name, &value, sizeof(value))) {
+        return (optional && ENOPROTOOPT == errno) ? 0 : -1;
+    }
+    return 0;
+}
+
+/**
+ * 设置接收和发送缓冲区大小
+ * @param profile 方案
+ * @param sd socket 描述符
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int SetBufferSizes(const struct SocketProfile *profile, int sd) {
+    if (-1 == SetOption(sd, SOL_SOCKET, SO_RCVBUF, profile->receiveBufferSize, false)) {
+        return -1;
+    }
+    return SetOption(sd, SOL_SOCKET, SO_SNDBUF, profile->sendBufferSize, false);
+}
+
+int SocketProfileApply(const struct SocketProfile *profile, int sd, int role) {
+    int domain;
+    int type;
+    socklen_t length = sizeof(domain);
+    if (-1 == getsockopt(sd, SOL_SOCKET, SO_DOMAIN, &domain, &length)) {
+        return -1;
+    }
+    length = sizeof(type);
+    if (-1 == getsockopt(sd, SOL_SOCKET, SO_TYPE, &type, &length)) {
+        return -1;
+    }
+    bool local = (AF_UNIX == domain);
+    bool tcp = !local && (SOCK_STREAM == type);
+
+    switch (role) {
+        case SOCKET_ROLE_LISTENER:
+            // 本地 socket 接受的连接不继承监听 socket 的选项，在接受时设置
+            if (local) {
+                return 0;
+            }
+            if (-1 == SetBufferSizes(profile, sd)) {
+                return -1;
+            }
+            break;
+
+        case SOCKET_ROLE_ACCEPTED:
+            if (local) {
+                return SetBufferSizes(profile, sd);
+            }
+            // TCP 连接从监听 socket 继承了其余选项
+            return tcp ? SetOption(sd, IPPROTO_TCP, TCP_QUICKACK, profile->quickAck, true) : 0;
+
+        case SOCKET_ROLE_CLIENT:
+            if (-1 == SetBufferSizes(profile, sd)) {
+                return -1;
+            }
+            if (tcp && -1 == SetOption(sd, IPPROTO_TCP, TCP_QUICKACK, profile->quickAck, true)) {
+                return -1;
+            }
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if (!tcp) {
+        return 0;
+    }
+    if (-1 == SetOption(sd, IPPROTO_TCP, TCP_NODELAY, profile->noDelay, false)) {
+        return -1;
+    }
+    return SetOption(sd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, profile->notSentLowWatermark, true);
+}
+
+int SocketProfileSetReceiveLowWatermark(const struct SocketProfile *profile, int sd) {
+    // 缓冲区被调小（固定的 SO_RCVBUF 或者 rmem_max 更小）时低水位跟着降低，否则窗口放不下一批数据，读取会卡住
+    int lowWatermark = profile->receiveLowWatermark;
+    if (lowWatermark > 0) {
+        int bufferSize = 0;
+        socklen_t length = sizeof(bufferSize);
+        if (-1 == getsockopt(sd, SOL_SOCKET, SO_RCVBUF, &bufferSize, &length)) {
+            return -1;
+        }
+        if (lowWatermark > bufferSize / RECEIVE_LOW_WATERMARK_DIVISOR) {
+            lowWatermark = bufferSize / RECEIVE_LOW_WATERMARK_DIVISOR;
+        }
+        if (lowWatermark < 1) {
+            lowWatermark = 1;
+        }
+    }
+    return SetOption(sd, SOL_SOCKET, SO_RCVLOWAT, lowWatermark, false);
+}
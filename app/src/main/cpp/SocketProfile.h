@@ -0,0 +1,99 @@
+#ifndef ECHO_SOCKET_PROFILE_H
+#define ECHO_SOCKET_PROFILE_H
+
+/**
+ * 预设的 socket 调优方案，取值与 com.liu.echo.ServerOptions 中的常量一致
+ */
+enum SocketProfileId {
+    // 不设置任何选项，使用内核默认值和缓冲区自动调整
+    SOCKET_PROFILE_DEFAULT = 0,
+
+    // 小消息请求/响应：关闭 Nagle，立即确认，限制内核中尚未发出的数据
+    SOCKET_PROFILE_LOW_LATENCY = 1,
+
+    // 大块数据：保留 Nagle 合并和缓冲区自动调整，按剩余长度读取的客户端攒够一批数据再唤醒
+    SOCKET_PROFILE_BULK_THROUGHPUT = 2,
+
+    // 大量空闲长连接：固定的小缓冲区限制每个连接占用的内核内存，加大接受队列
+    SOCKET_PROFILE_MANY_IDLE_CONNECTIONS = 3,
+
+    SOCKET_PROFILE_COUNT
+};
+
+/**
+ * socket 在连接中的角色，决定应用方案中的哪些选项
+ */
+enum SocketRole {
+    // 监听 socket 和服务器的数据报 socket；TCP 接受的连接从监听 socket 继承除 TCP_QUICKACK 外的选项
+    SOCKET_ROLE_LISTENER,
+
+    // 服务器接受的连接，只补上内核不从监听 socket 继承的选项
+    SOCKET_ROLE_ACCEPTED,
+
+    // 客户端 socket
+    SOCKET_ROLE_CLIENT
+};
+
+/**
+ * 一个调优方案，值为 0 的选项保持内核默认值
+ */
+struct SocketProfile {
+    // 方案名称，与 EchoLoad 的 -S 参数一致
+    const char *name;
+
+    // TCP_NODELAY：立即发出小的分段，不等待之前的数据被确认
+    bool noDelay;
+
+    // TCP_QUICKACK：建立连接时退出延迟确认；内核之后可能重新进入延迟确认模式
+    bool quickAck;
+
+    // SO_RCVBUF 和 SO_SNDBUF，单位字节；设置后内核不再自动调整，实际值为两倍并受 rmem_max/wmem_max 限制
+    int receiveBufferSize;
+    int sendBufferSize;
+
+    // TCP_NOTSENT_LOWAT：内核中尚未发出的数据超过该值时 socket 不再可写，减少排队延迟和内存占用
+    int notSentLowWatermark;
+
+    // SO_RCVLOWAT：阻塞读取至少等到这么多字节（或者请求的长度）才返回，
+    // 只由 SocketProfileSetReceiveLowWatermark 设置
+    int receiveLowWatermark;
+
+    // listen() 的 backlog，内核按 net.core.somaxconn 截断
+    int backlog;
+};
+
+/**
+ * 按编号查找方案
+ * @param id SocketProfileId
+ * @return 方案，编号无效时返回 NULL
+ */
+const struct SocketProfile *SocketProfileGet(int id);
+
+/**
+ * 按名称查找方案
+ * @param name 方案名称，如 "low-latency"
+ * @return 方案编号，名称无效时返回 -1
+ */
+int SocketProfileFind(const char *name);
+
+/**
+ * 按 socket 的协议族、类型和角色应用方案：TCP 选项只用于 TCP socket，缓冲区大小用于所有 socket，
+ * 内核不支持的可选选项（ENOPROTOOPT）被忽略
+ * @param profile 方案
+ * @param sd socket 描述符
+ * @param role SocketRole
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int SocketProfileApply(const struct SocketProfile *profile, int sd, int role);
+
+/**
+ * 设置方案的 SO_RCVLOWAT，不超过 socket 当前 SO_RCVBUF 的四分之一，应在调整接收缓冲区之后调用。
+ * poll/epoll 在数据少于该值时不报告可读，阻塞读取在请求的长度超过已到达的
+ * 数据时继续等待，所以只能用于每次只请求剩余长度的阻塞流 socket，否则不足一批的尾部数据会卡住
+ * @param profile 方案
+ * @param sd 阻塞的流 socket 描述符
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int SocketProfileSetReceiveLowWatermark(const struct SocketProfile *profile, int sd);
+
+#endif // ECHO_SOCKET_PROFILE_H
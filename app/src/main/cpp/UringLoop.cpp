@@ -0,0 +1,1069 @@
+#include "UringLoop.h"
+#include <stdlib.h> // malloc, calloc, realloc, free
+#include <errno.h> // errno
+#include <string.h> // memset
+#include <unistd.h> // close, read, write, syscall
+#include <fcntl.h> // fcntl
+#include <sys/socket.h> // shutdown, sockaddr_storage
+#include <sys/eventfd.h> // eventfd
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h> // io_uring_params, io_uring_sqe, io_uring_cqe
+#endif
+#endif
+
+#include <sys/syscall.h> // __NR_io_uring_setup, __NR_io_uring_enter, __NR_io_uring_register
+#include <sys/mman.h> // mmap, munmap
+
+// 需要 6.0 以上内核头文件：multishot recv 和单一提交者模式
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_RECV_MULTISHOT) \
+    && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+
+#ifdef HAVE_IO_URING
+
+// 提交队列深度
+#define URING_QUEUE_DEPTH 4096
+
+// 注册给内核的接收缓冲区数量，必须是 2 的幂且不超过 32768
+#define URING_BUFFER_COUNT 1024
+
+// 一个连接最多占用的缓冲区数：发送队列达到这个数量时取消 multishot recv，
+// 对端读得慢的连接不会耗尽全部连接共用的缓冲区
+#define URING_MAX_CONNECTION_BUFFERS (URING_BUFFER_COUNT / 16)
+
+// 暂停接收的连接发送队列降到这个数量时重新提交 multishot recv
+#define URING_RESUME_CONNECTION_BUFFERS (URING_MAX_CONNECTION_BUFFERS / 2)
+
+// 缓冲区组 ID
+#define URING_BUFFER_GROUP 0
+
+// 连接发送队列的结束标记
+#define NO_BUFFER 0xFFFF
+
+// 一条链接的 send 提交最多包含的请求数
+#define MAX_SEND_CHAIN 32
+
+// 描述符或者内存耗尽时暂停接受新连接的最长时间，单位毫秒
+#define ACCEPT_RETRY_MILLIS 100
+
+// URING_OP_WAKEUP 的 user_data 高位：eventfd 上的读取，或者暂停接受后的重试定时器
+#define WAKEUP_EVENTFD 0
+#define WAKEUP_ACCEPT_RETRY 1
+
+// user_data 低 3 位保存操作类型，高位保存连接指针或者下标
+#define OPERATION_BITS 3
+#define OPERATION_MASK ((1ULL << OPERATION_BITS) - 1)
+
+/**
+ * 提交请求的操作类型
+ */
+enum UringOperation {
+    URING_OP_ACCEPT = 1,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_RECVMSG,
+    URING_OP_SENDMSG,
+    URING_OP_WAKEUP,
+    URING_OP_CANCEL
+};
+
+/**
+ * 单个流连接的状态，连接在所有提交给内核的请求都完成之后才释放
+ */
+struct UringConnection {
+    // 客户端 socket
+    int fd;
+
+    // 连接正在关闭
+    bool closing;
+
+    // multishot recv 仍在内核中
+    bool recvArmed;
+
+    // 在缓冲区耗尽列表中
+    bool starved;
+
+    // 发送队列占用的缓冲区达到上限而暂停接收，降到恢复数量后重新提交 multishot recv
+    bool recvPaused;
+
+    // 已经提交取消请求，multishot recv 还没有结束；结束时的 -ECANCELED 不是错误
+    bool cancelPending;
+
+    // 在待发送列表中
+    bool flushQueued;
+
+    // 正在内核中执行的 send 请求数
+    unsigned sendsInFlight;
+
+    // 待回显缓冲区组成的先进先出队列及其中的缓冲区数
+    uint16_t sendHead;
+    uint16_t sendTail;
+    unsigned sendQueued;
+
+    // 连接链表
+    struct UringConnection *prev;
+    struct UringConnection *next;
+
+    // 待发送列表和缓冲区耗尽列表
+    struct UringConnection *nextFlush;
+    struct UringConnection *nextStarved;
+};
+
+static int UringSetup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int UringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int UringRegister(int ringFd, unsigned opcode, void *arg, unsigned argCount) {
+    return (int) syscall(__NR_io_uring_register, ringFd, opcode, arg, argCount);
+}
+
+/**
+ * io_uring 对 O_NONBLOCK 文件直接返回 EAGAIN 而不等待就绪，因此交给 io_uring 的 socket 必须是阻塞的
+ * @param fd 文件描述符
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+static int SetBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (-1 == flags) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+}
+
+static inline uint64_t MakeUserData(uint64_t value, enum UringOperation operation) {
+    return (value << OPERATION_BITS) | operation;
+}
+
+static inline uint64_t MakeUserData(struct UringConnection *connection,
+                                    enum UringOperation operation) {
+    return ((uint64_t) (uintptr_t) connection) | operation;
+}
+
+/**
+ * 发布本地提交队列尾部并进入内核
+ * @param loop 事件循环
+ * @param minComplete 最少等待完成的请求数，0 表示只提交不等待
+ * @return 内核消费的提交数，失败返回 -1 并设置 errno
+ */
+static int SubmitAndWait(struct UringLoop *loop, unsigned minComplete) {
+    struct UringQueues *queues = &loop->queues;
+    __atomic_store_n(queues->sqTail, queues->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned toSubmit = queues->sqLocalTail - __atomic_load_n(queues->sqHead, __ATOMIC_ACQUIRE);
+    MetricsAdd(&loop->metrics->syscalls, 1);
+    return UringEnter(loop->ringFd, toSubmit, minComplete,
+                      (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0);
+}
+
+/**
+ * 保证提交队列至少有给定数量的空闲条目，不够时先把已有的提交交给内核
+ * @param loop 事件循环
+ * @param count 需要的条目数
+ * @return 成功返回 0，失败返回 -1
+ */
+static int ReserveSqes(struct UringLoop *loop, unsigned count) {
+    struct UringQueues *queues = &loop->queues;
+    unsigned used = queues->sqLocalTail - __atomic_load_n(queues->sqHead, __ATOMIC_ACQUIRE);
+    if (queues->sqEntries - used >= count) {
+        return 0;
+    }
+    if (-1 == SubmitAndWait(loop, 0)) {
+        return -1;
+    }
+    used = queues->sqLocalTail - __atomic_load_n(queues->sqHead, __ATOMIC_ACQUIRE);
+    return (queues->sqEntries - used >= count) ? 0 : -1;
+}
+
+/**
+ * 取得一个清零的提交条目，调用者必须已经用 ReserveSqes 保留了空间
+ * @param loop 事件循环
+ * @return 提交条目
+ */
+static struct io_uring_sqe *NextSqe(struct UringLoop *loop) {
+    struct UringQueues *queues = &loop->queues;
+    unsigned index = queues->sqLocalTail & queues->sqMask;
+    struct io_uring_sqe *sqe = &queues->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    queues->sqArray[index] = index;
+    queues->sqLocalTail++;
+    return sqe;
+}
+
+/**
+ * 取得一个提交条目，提交队列已满时先提交
+ * @param loop 事件循环
+ * @return 提交条目，失败返回 NULL
+ */
+static struct io_uring_sqe *GetSqe(struct UringLoop *loop) {
+    if (-1 == ReserveSqes(loop, 1)) {
+        return NULL;
+    }
+    return NextSqe(loop);
+}
+
+/**
+ * 事件循环是否仍在运行，停止标志由 UringLoopStop 从其他线程清除
+ * @param loop 事件循环
+ * @return 没有请求停止时返回 true
+ */
+static inline bool IsRunning(struct UringLoop *loop) {
+    return __atomic_load_n(&loop->running, __ATOMIC_ACQUIRE);
+}
+
+static inline char *BufferAddress(struct UringLoop *loop, uint16_t bufferID) {
+    return loop->bufferMemory + (size_t) bufferID * loop->bufferSize;
+}
+
+/**
+ * 将缓冲区归还到内核的缓冲区环
+ * @param loop 事件循环
+ * @param bufferID 缓冲区 ID
+ */
+static void RecycleBuffer(struct UringLoop *loop, uint16_t bufferID) {
+    // C++ 中 __DECLARE_FLEX_ARRAY 展开的空结构体会让 bufs 偏移 8 字节，因此直接按数组访问环
+    struct io_uring_buf *buffer = (struct io_uring_buf *) loop->bufferRing
+                                  + (loop->bufferTail & (loop->bufferCount - 1));
+    buffer->addr = (uint64_t) (uintptr_t) BufferAddress(loop, bufferID);
+    buffer->len = (uint32_t) loop->bufferSize;
+    buffer->bid = bufferID;
+    loop->bufferTail++;
+    __atomic_store_n(&loop->bufferRing->tail, loop->bufferTail, __ATOMIC_RELEASE);
+    loop->buffersRecycled = true;
+}
+
+static void ArmAccept(struct UringLoop *loop, size_t index) {
+    struct io_uring_sqe *sqe = GetSqe(loop);
+    if (NULL != sqe) {
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = loop->listeners[index];
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = MakeUserData(index, URING_OP_ACCEPT);
+        loop->acceptArmed[index] = true;
+    }
+}
+
+/**
+ * 暂停接受新连接：不再提交 accept，新连接留在积压队列中，
+ * 等有连接关闭或者定时器到期后由 ResumeAccepting 重新提交
+ * @param loop 事件循环
+ */
+static void PauseAccepting(struct UringLoop *loop) {
+    // 定时器只读取超时值，所有事件循环共用
+    static struct __kernel_timespec retryTimeout = {0, (long long) ACCEPT_RETRY_MILLIS * 1000000};
+
+    if (loop->acceptPaused) {
+        return;
+    }
+    loop->acceptPaused = true;
+    MetricsAdd(&loop->metrics->acceptPauses, 1);
+
+    struct io_uring_sqe *sqe = GetSqe(loop);
+    if (NULL != sqe) {
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) (uintptr_t) &retryTimeout;
+        sqe->len = 1;
+        sqe->user_data = MakeUserData((uint64_t) WAKEUP_ACCEPT_RETRY, URING_OP_WAKEUP);
+    }
+}
+
+/**
+ * 恢复接受新连接，为已经停止的 multishot accept 重新提交
+ * @param loop 事件循环
+ */
+static void ResumeAccepting(struct UringLoop *loop) {
+    if (!loop->acceptPaused || !IsRunning(loop)) {
+        return;
+    }
+    loop->acceptPaused = false;
+    for (size_t i = 0; i < loop->listenerCount; i++) {
+        if (!loop->acceptArmed[i]) {
+            ArmAccept(loop, i);
+        }
+    }
+}
+
+static void ArmRecv(struct UringLoop *loop, struct UringConnection *connection) {
+    struct io_uring_sqe *sqe = GetSqe(loop);
+    if (NULL != sqe) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = connection->fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = MakeUserData(connection, URING_OP_RECV);
+        connection->recvArmed = true;
+    }
+}
+
+/**
+ * 取消连接的 multishot recv，内核随后以 -ECANCELED 结束它；取消请求本身的完成事件被忽略
+ * @param loop 事件循环
+ * @param connection 连接
+ */
+static void CancelRecv(struct UringLoop *loop, struct UringConnection *connection) {
+    struct io_uring_sqe *sqe = GetSqe(loop);
+    if (NULL != sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = MakeUserData(connection, URING_OP_RECV);
+        sqe->user_data = MakeUserData((uint64_t) 0, URING_OP_CANCEL);
+        connection->cancelPending = true;
+    }
+}
+
+static void ArmRecvmsg(struct UringLoop *loop, size_t index) {
+    struct io_uring_sqe *sqe = GetSqe(loop);
+    if (NULL != sqe) {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = loop->datagramSockets[index];
+        sqe->addr = (uint64_t) (uintptr_t) &loop->recvMessage;
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = MakeUserData(index, URING_OP_RECVMSG);
+        loop->datagramArmed[index] = true;
+    }
+}
+
+static void ArmWakeup(struct UringLoop *loop) {
+    struct io_uring_sqe *sqe = GetSqe(loop);
+    if (NULL != sqe) {
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = loop->wakeupFd;
+        sqe->addr = (uint64_t) (uintptr_t) &loop->wakeupValue;
+        sqe->len = sizeof(loop->wakeupValue);
+        sqe->user_data = MakeUserData((uint64_t) WAKEUP_EVENTFD, URING_OP_WAKEUP);
+    }
+}
+
+/**
+ * 将连接发送队列头部的缓冲区作为一条链接的 send 请求提交，链接保证同一连接的回显按顺序发送
+ * @param loop 事件循环
+ * @param connection 连接
+ */
+static void SubmitSendChain(struct UringLoop *loop, struct UringConnection *connection) {
+    unsigned count = 0;
+    for (uint16_t id = connection->sendHead;
+         NO_BUFFER != id && count < MAX_SEND_CHAIN;
+         id = loop->bufferNext[id]) {
+        count++;
+    }
+    if (0 == count || -1 == ReserveSqes(loop, count)) {
+        return;
+    }
+
+    uint16_t bufferID = connection->sendHead;
+    for (unsigned i = 0; i < count; i++) {
+        struct io_uring_sqe *sqe = NextSqe(loop);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = connection->fd;
+        sqe->addr = (uint64_t) (uintptr_t) (BufferAddress(loop, bufferID)
+                                            + loop->bufferOffsets[bufferID]);
+        sqe->len = loop->bufferLengths[bufferID];
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        if (i + 1 < count) {
+            sqe->flags = IOSQE_IO_LINK;
+        }
+        sqe->user_data = MakeUserData(connection, URING_OP_SEND);
+        bufferID = loop->bufferNext[bufferID];
+    }
+    connection->sendsInFlight = count;
+}
+
+static void QueueFlush(struct UringLoop *loop, struct UringConnection *connection) {
+    if (!connection->flushQueued) {
+        connection->flushQueued = true;
+        connection->nextFlush = loop->flushList;
+        loop->flushList = connection;
+    }
+}
+
+/**
+ * 如果连接正在关闭且内核中已经没有它的请求，释放连接
+ * @param loop 事件循环
+ * @param connection 连接
+ */
+static void ReleaseConnectionIfIdle(struct UringLoop *loop, struct UringConnection *connection) {
+    if (!connection->closing || connection->recvArmed || connection->sendsInFlight > 0
+        || connection->starved || connection->flushQueued) {
+        return;
+    }
+
+    close(connection->fd);
+
+    // 归还仍在发送队列中的缓冲区
+    uint16_t bufferID = connection->sendHead;
+    while (NO_BUFFER != bufferID) {
+        uint16_t next = loop->bufferNext[bufferID];
+        RecycleBuffer(loop, bufferID);
+        bufferID = next;
+    }
+
+    // 从连接链表中移除
+    if (NULL != connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        loop->connections = connection->next;
+    }
+    if (NULL != connection->next) {
+        connection->next->prev = connection->prev;
+    }
+    loop->connectionCount--;
+    MetricsAdd(&loop->metrics->closedConnections, 1);
+
+    free(connection);
+
+    // 关闭的连接释放了描述符，不必等到定时器到期
+    ResumeAccepting(loop);
+}
+
+/**
+ * 关闭连接，shutdown 会让内核中的请求尽快完成，之后再释放连接
+ * @param loop 事件循环
+ * @param connection 连接
+ */
+static void CloseConnection(struct UringLoop *loop, struct UringConnection *connection) {
+    if (!connection->closing) {
+        connection->closing = true;
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+    ReleaseConnectionIfIdle(loop, connection);
+}
+
+static void HandleAccept(struct UringLoop *loop, size_t index, int result, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        loop->acceptArmed[index] = false;
+    }
+
+    if (result >= 0) {
+        struct UringConnection *connection =
+                (struct UringConnection *) calloc(1, sizeof(struct UringConnection));
+        if (NULL == connection) {
+            close(result);
+        } else {
+            // 补上不从监听 socket 继承的选项，失败时仍然以默认值服务
+            if (NULL != loop->socketProfile) {
+                SocketProfileApply(loop->socketProfile, result, SOCKET_ROLE_ACCEPTED);
+            }
+
+            connection->fd = result;
+            connection->sendHead = NO_BUFFER;
+            connection->sendTail = NO_BUFFER;
+
+            // 加入连接链表
+            connection->next = loop->connections;
+            if (NULL != loop->connections) {
+                loop->connections->prev = connection;
+            }
+            loop->connections = connection;
+            loop->connectionCount++;
+            MetricsAdd(&loop->metrics->acceptedConnections, 1);
+
+            ArmRecv(loop, connection);
+        }
+    }
+
+    // 描述符或者内存耗尽时立即重新提交只会让 accept 反复失败，暂停一段时间
+    if (-EMFILE == result || -ENFILE == result || -ENOBUFS == result || -ENOMEM == result) {
+        PauseAccepting(loop);
+        return;
+    }
+
+    // multishot accept 终止后重新提交，监听 socket 本身失效时不再提交
+    if (!loop->acceptArmed[index] && !loop->acceptPaused && IsRunning(loop)
+        && -EBADF != result && -EINVAL != result && -ENOTSOCK != result) {
+        ArmAccept(loop, index);
+    }
+}
+
+static void HandleRecv(struct UringLoop *loop, struct UringConnection *connection,
+                       int result, unsigned flags) {
+    // 取消生效前 recv 也可能因为其他原因结束，无论哪种结束方式都不再有待完成的取消
+    bool cancelled = false;
+    if (!(flags & IORING_CQE_F_MORE)) {
+        connection->recvArmed = false;
+        cancelled = connection->cancelPending;
+        connection->cancelPending = false;
+    }
+
+    if (result > 0) {
+        uint16_t bufferID = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+        if (connection->closing) {
+            RecycleBuffer(loop, bufferID);
+        } else {
+            MetricsAdd(&loop->metrics->bytesIn, (uint64_t) result);
+            MetricsAdd(&loop->metrics->messagesIn, 1);
+            loop->bufferReceivedAt[bufferID] = MetricsNow();
+
+            // 追加到发送队列尾部
+            loop->bufferOffsets[bufferID] = 0;
+            loop->bufferLengths[bufferID] = (uint32_t) result;
+            loop->bufferNext[bufferID] = NO_BUFFER;
+            if (NO_BUFFER == connection->sendTail) {
+                connection->sendHead = bufferID;
+            } else {
+                loop->bufferNext[connection->sendTail] = bufferID;
+            }
+            connection->sendTail = bufferID;
+            connection->sendQueued++;
+            QueueFlush(loop, connection);
+
+            // 对端读得慢，发送队列积压到上限后停止接收；取消生效前已经接收的数据仍然入队
+            if (connection->sendQueued >= URING_MAX_CONNECTION_BUFFERS && !connection->recvPaused) {
+                connection->recvPaused = true;
+                MetricsAdd(&loop->metrics->backpressurePauses, 1);
+                if (connection->recvArmed) {
+                    CancelRecv(loop, connection);
+                }
+            }
+        }
+    } else if (-ENOBUFS == result) {
+        // 缓冲区耗尽，等有缓冲区归还时再重新接收；暂停接收的连接由发送完成时恢复
+        if (!connection->closing && !connection->starved && !connection->recvPaused) {
+            connection->starved = true;
+            connection->nextStarved = loop->starvedList;
+            loop->starvedList = connection;
+        }
+    } else if (-ECANCELED == result && cancelled) {
+        // 因发送积压取消的接收；取消完成前积压可能已经降下来，由下面按当前状态重新提交
+    } else {
+        // 客户端断开连接或者接收出错
+        CloseConnection(loop, connection);
+        return;
+    }
+
+    if (connection->closing) {
+        ReleaseConnectionIfIdle(loop, connection);
+    } else if (!connection->recvArmed && !connection->starved && !connection->recvPaused) {
+        ArmRecv(loop, connection);
+    }
+}
+
+static void HandleSend(struct UringLoop *loop, struct UringConnection *connection, int result) {
+    connection->sendsInFlight--;
+
+    uint16_t bufferID = connection->sendHead;
+    if (result > 0) {
+        MetricsAdd(&loop->metrics->bytesOut, (uint64_t) result);
+        MetricsAdd(&loop->metrics->messagesOut, 1);
+    }
+
+    if (NO_BUFFER != bufferID && result >= 0
+        && (uint32_t) result == loop->bufferLengths[bufferID]) {
+        // 整个缓冲区已经发送，出队并归还
+        MetricsRecordServiceTime(loop->metrics, MetricsNow() - loop->bufferReceivedAt[bufferID], 1);
+        connection->sendHead = loop->bufferNext[bufferID];
+        if (NO_BUFFER == connection->sendHead) {
+            connection->sendTail = NO_BUFFER;
+        }
+        connection->sendQueued--;
+        RecycleBuffer(loop, bufferID);
+
+        // 积压降到恢复数量后继续接收，取消还没有完成时由 HandleRecv 在收到 -ECANCELED 后提交
+        if (connection->recvPaused && connection->sendQueued <= URING_RESUME_CONNECTION_BUFFERS) {
+            connection->recvPaused = false;
+            if (!connection->closing && !connection->recvArmed && !connection->starved) {
+                ArmRecv(loop, connection);
+            }
+        }
+    } else if (NO_BUFFER != bufferID && result > 0) {
+        // 部分发送打断了链接，剩余部分在链完成后重新提交
+        loop->bufferOffsets[bufferID] += (uint32_t) result;
+        loop->bufferLengths[bufferID] -= (uint32_t) result;
+    } else if (-ECANCELED != result) {
+        CloseConnection(loop, connection);
+        return;
+    }
+
+    if (connection->closing) {
+        ReleaseConnectionIfIdle(loop, connection);
+    } else if (0 == connection->sendsInFlight && NO_BUFFER != connection->sendHead) {
+        QueueFlush(loop, connection);
+    }
+}
+
+static void HandleRecvmsg(struct UringLoop *loop, size_t index, int result, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        loop->datagramArmed[index] = false;
+    }
+
+    if (result > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        uint16_t bufferID = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+        char *buffer = BufferAddress(loop, bufferID);
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buffer;
+
+        // 缓冲区依次保存头部、发送者地址、控制消息和数据
+        size_t headerLength = sizeof(struct io_uring_recvmsg_out)
+                              + loop->recvMessage.msg_namelen
+                              + loop->recvMessage.msg_controllen;
+        socklen_t nameLength = out->namelen;
+        if (nameLength > loop->recvMessage.msg_namelen) {
+            nameLength = loop->recvMessage.msg_namelen;
+        }
+
+        struct io_uring_sqe *sqe = NULL;
+        if ((size_t) result >= headerLength) {
+            sqe = GetSqe(loop);
+        }
+        if (NULL == sqe) {
+            RecycleBuffer(loop, bufferID);
+        } else {
+            // 原样发回给发送者，消息结构以缓冲区 ID 为下标，直到发送完成前保持有效
+            struct iovec *vector = &loop->datagramVectors[bufferID];
+            vector->iov_base = buffer + headerLength;
+            vector->iov_len = (size_t) result - headerLength;
+
+            MetricsAdd(&loop->metrics->bytesIn, (uint64_t) vector->iov_len);
+            MetricsAdd(&loop->metrics->messagesIn, 1);
+            loop->bufferReceivedAt[bufferID] = MetricsNow();
+
+            struct msghdr *message = &loop->datagramMessages[bufferID];
+            memset(message, 0, sizeof(*message));
+            message->msg_name = buffer + sizeof(struct io_uring_recvmsg_out);
+            message->msg_namelen = nameLength;
+            message->msg_iov = vector;
+            message->msg_iovlen = 1;
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = loop->datagramSockets[index];
+            sqe->addr = (uint64_t) (uintptr_t) message;
+            sqe->len = 1;
+            sqe->user_data = MakeUserData((uint64_t) bufferID, URING_OP_SENDMSG);
+        }
+    } else if (-ENOBUFS == result) {
+        loop->datagramStarved = true;
+    }
+
+    if (!loop->datagramArmed[index] && IsRunning(loop) && -ENOBUFS != result
+        && -EBADF != result && -EINVAL != result && -ENOTSOCK != result) {
+        ArmRecvmsg(loop, index);
+    }
+}
+
+/**
+ * 处理一个完成事件
+ * @param loop 事件循环
+ * @param cqe 完成事件
+ */
+static void HandleCompletion(struct UringLoop *loop, const struct io_uring_cqe *cqe) {
+    uint64_t value = cqe->user_data >> OPERATION_BITS;
+    struct UringConnection *connection =
+            (struct UringConnection *) (uintptr_t) (cqe->user_data & ~OPERATION_MASK);
+
+    switch (cqe->user_data & OPERATION_MASK) {
+        case URING_OP_ACCEPT:
+            HandleAccept(loop, (size_t) value, cqe->res, cqe->flags);
+            break;
+
+        case URING_OP_RECV:
+            HandleRecv(loop, connection, cqe->res, cqe->flags);
+            break;
+
+        case URING_OP_SEND:
+            HandleSend(loop, connection, cqe->res);
+            break;
+
+        case URING_OP_RECVMSG:
+            HandleRecvmsg(loop, (size_t) value, cqe->res, cqe->flags);
+            break;
+
+        case URING_OP_SENDMSG:
+            if (cqe->res >= 0) {
+                MetricsAdd(&loop->metrics->bytesOut, (uint64_t) cqe->res);
+                MetricsAdd(&loop->metrics->messagesOut, 1);
+                MetricsRecordServiceTime(loop->metrics,
+                                         MetricsNow() - loop->bufferReceivedAt[value], 1);
+            }
+            RecycleBuffer(loop, (uint16_t) value);
+            break;
+
+        case URING_OP_WAKEUP:
+            if (WAKEUP_ACCEPT_RETRY == value) {
+                ResumeAccepting(loop);
+            } else if (IsRunning(loop)) {
+                ArmWakeup(loop);
+            }
+            break;
+
+        case URING_OP_CANCEL:
+            break;
+    }
+}
+
+int UringLoopInit(struct UringLoop *loop, size_t bufferSize,
+                  const struct SocketProfile *socketProfile) {
+    memset(loop, 0, sizeof(*loop));
+    loop->ringFd = -1;
+    loop->wakeupFd = -1;
+    loop->running = true;
+    loop->socketProfile = socketProfile;
+
+    // 以禁用状态创建，在运行线程上启用后该线程成为唯一提交者
+    // 不支持 SINGLE_ISSUER 的内核同样不支持 multishot recv，会在这里返回 EINVAL
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL
+                   | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_R_DISABLED;
+    params.cq_entries = URING_QUEUE_DEPTH * 4;
+
+    loop->ringFd = UringSetup(URING_QUEUE_DEPTH, &params);
+    if (-1 == loop->ringFd) {
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        UringLoopDestroy(loop);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    // 映射提交队列和完成队列
+    struct UringQueues *queues = &loop->queues;
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    queues->ringMemorySize = (sqSize > cqSize) ? sqSize : cqSize;
+    queues->ringMemory = mmap(NULL, queues->ringMemorySize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, loop->ringFd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == queues->ringMemory) {
+        queues->ringMemory = NULL;
+        goto fail;
+    }
+
+    queues->sqesMemorySize = params.sq_entries * sizeof(struct io_uring_sqe);
+    queues->sqes = (struct io_uring_sqe *) mmap(NULL, queues->sqesMemorySize,
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, loop->ringFd,
+                                                IORING_OFF_SQES);
+    if (MAP_FAILED == queues->sqes) {
+        queues->sqes = NULL;
+        goto fail;
+    }
+
+    {
+        char *ring = (char *) queues->ringMemory;
+        queues->sqHead = (unsigned *) (ring + params.sq_off.head);
+        queues->sqTail = (unsigned *) (ring + params.sq_off.tail);
+        queues->sqArray = (unsigned *) (ring + params.sq_off.array);
+        queues->sqMask = *(unsigned *) (ring + params.sq_off.ring_mask);
+        queues->sqEntries = params.sq_entries;
+        queues->sqLocalTail = *queues->sqTail;
+        queues->cqHead = (unsigned *) (ring + params.cq_off.head);
+        queues->cqTail = (unsigned *) (ring + params.cq_off.tail);
+        queues->cqMask = *(unsigned *) (ring + params.cq_off.ring_mask);
+        queues->cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+    }
+
+    // 每个缓冲区在数据之前预留 recvmsg 头部和发送者地址的空间
+    if (bufferSize > URING_MAX_BUFFER_SIZE) {
+        bufferSize = URING_MAX_BUFFER_SIZE;
+    }
+    loop->bufferCount = URING_BUFFER_COUNT;
+    loop->bufferSize = bufferSize + sizeof(struct io_uring_recvmsg_out)
+                       + sizeof(struct sockaddr_storage);
+    loop->bufferMemory = (char *) malloc(loop->bufferCount * loop->bufferSize);
+    loop->bufferOffsets = (uint32_t *) calloc(loop->bufferCount, sizeof(uint32_t));
+    loop->bufferLengths = (uint32_t *) calloc(loop->bufferCount, sizeof(uint32_t));
+    loop->bufferNext = (uint16_t *) calloc(loop->bufferCount, sizeof(uint16_t));
+    loop->bufferReceivedAt = (uint64_t *) calloc(loop->bufferCount, sizeof(uint64_t));
+    loop->datagramMessages = (struct msghdr *) calloc(loop->bufferCount, sizeof(struct msghdr));
+    loop->datagramVectors = (struct iovec *) calloc(loop->bufferCount, sizeof(struct iovec));
+    if (NULL == loop->bufferMemory || NULL == loop->bufferOffsets
+        || NULL == loop->bufferLengths || NULL == loop->bufferNext
+        || NULL == loop->bufferReceivedAt
+        || NULL == loop->datagramMessages || NULL == loop->datagramVectors) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    loop->metrics = MetricsAcquireShard();
+    if (NULL == loop->metrics) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    // 注册缓冲区环
+    loop->bufferRingSize = loop->bufferCount * sizeof(struct io_uring_buf);
+    loop->bufferRing = (struct io_uring_buf_ring *) mmap(NULL, loop->bufferRingSize,
+                                                         PROT_READ | PROT_WRITE,
+                                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == loop->bufferRing) {
+        loop->bufferRing = NULL;
+        goto fail;
+    }
+    {
+        struct io_uring_buf_reg registration;
+        memset(&registration, 0, sizeof(registration));
+        registration.ring_addr = (uint64_t) (uintptr_t) loop->bufferRing;
+        registration.ring_entries = loop->bufferCount;
+        registration.bgid = URING_BUFFER_GROUP;
+        if (-1 == UringRegister(loop->ringFd, IORING_REGISTER_PBUF_RING, &registration, 1)) {
+            goto fail;
+        }
+    }
+    for (unsigned i = 0; i < loop->bufferCount; i++) {
+        RecycleBuffer(loop, (uint16_t) i);
+    }
+    loop->buffersRecycled = false;
+
+    // 数据报接收模板，只接收发送者地址
+    loop->recvMessage.msg_namelen = sizeof(struct sockaddr_storage);
+
+    loop->wakeupFd = eventfd(0, EFD_CLOEXEC);
+    if (-1 == loop->wakeupFd) {
+        goto fail;
+    }
+    ArmWakeup(loop);
+
+    return 0;
+
+    fail:
+    int error = errno;
+    UringLoopDestroy(loop);
+    errno = error;
+    return -1;
+}
+
+int UringLoopAddListener(struct UringLoop *loop, int sd) {
+    if (-1 == SetBlocking(sd)) {
+        return -1;
+    }
+
+    int *listeners = (int *) realloc(loop->listeners, (loop->listenerCount + 1) * sizeof(int));
+    if (NULL == listeners) {
+        errno = ENOMEM;
+        return -1;
+    }
+    loop->listeners = listeners;
+
+    bool *armed = (bool *) realloc(loop->acceptArmed, (loop->listenerCount + 1) * sizeof(bool));
+    if (NULL == armed) {
+        errno = ENOMEM;
+        return -1;
+    }
+    loop->acceptArmed = armed;
+
+    loop->listeners[loop->listenerCount] = sd;
+    loop->acceptArmed[loop->listenerCount] = false;
+    ArmAccept(loop, loop->listenerCount);
+    loop->listenerCount++;
+    return 0;
+}
+
+int UringLoopAddDatagramSocket(struct UringLoop *loop, int sd) {
+    if (-1 == SetBlocking(sd)) {
+        return -1;
+    }
+
+    int *sockets = (int *) realloc(loop->datagramSockets,
+                                   (loop->datagramSocketCount + 1) * sizeof(int));
+    if (NULL == sockets) {
+        errno = ENOMEM;
+        return -1;
+    }
+    loop->datagramSockets = sockets;
+
+    bool *armed = (bool *) realloc(loop->datagramArmed,
+                                   (loop->datagramSocketCount + 1) * sizeof(bool));
+    if (NULL == armed) {
+        errno = ENOMEM;
+        return -1;
+    }
+    loop->datagramArmed = armed;
+
+    loop->datagramSockets[loop->datagramSocketCount] = sd;
+    loop->datagramArmed[loop->datagramSocketCount] = false;
+    ArmRecvmsg(loop, loop->datagramSocketCount);
+    loop->datagramSocketCount++;
+    return 0;
+}
+
+int UringLoopRun(struct UringLoop *loop) {
+    struct UringQueues *queues = &loop->queues;
+
+    // 在运行线程上启用环
+    if (!loop->enabled) {
+        if (-1 == UringRegister(loop->ringFd, IORING_REGISTER_ENABLE_RINGS, NULL, 0)) {
+            return -1;
+        }
+        loop->enabled = true;
+    }
+
+    while (IsRunning(loop)) {
+        // 一次系统调用同时提交上一轮产生的请求并等待新的完成事件
+        if (-1 == SubmitAndWait(loop, 1)) {
+            if (EINTR != errno && EAGAIN != errno && EBUSY != errno) {
+                return -1;
+            }
+        }
+
+        unsigned head = *queues->cqHead;
+        unsigned tail = __atomic_load_n(queues->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            HandleCompletion(loop, &queues->cqes[head & queues->cqMask]);
+            head++;
+        }
+        __atomic_store_n(queues->cqHead, head, __ATOMIC_RELEASE);
+
+        // 为本轮收到数据的连接提交链接的 send 请求
+        while (NULL != loop->flushList) {
+            struct UringConnection *connection = loop->flushList;
+            loop->flushList = connection->nextFlush;
+            connection->flushQueued = false;
+            if (connection->closing) {
+                ReleaseConnectionIfIdle(loop, connection);
+            } else if (0 == connection->sendsInFlight) {
+                SubmitSendChain(loop, connection);
+            }
+        }
+
+        // 有缓冲区归还后，恢复因缓冲区耗尽而停止的接收
+        if (loop->buffersRecycled) {
+            loop->buffersRecycled = false;
+            struct UringConnection *starved = loop->starvedList;
+            loop->starvedList = NULL;
+            while (NULL != starved) {
+                struct UringConnection *connection = starved;
+                starved = connection->nextStarved;
+                connection->starved = false;
+                if (connection->closing) {
+                    ReleaseConnectionIfIdle(loop, connection);
+                } else if (!connection->recvPaused) {
+                    ArmRecv(loop, connection);
+                }
+            }
+            if (loop->datagramStarved) {
+                loop->datagramStarved = false;
+                for (size_t i = 0; i < loop->datagramSocketCount; i++) {
+                    if (!loop->datagramArmed[i]) {
+                        ArmRecvmsg(loop, i);
+                    }
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+void UringLoopStop(struct UringLoop *loop) {
+    __atomic_store_n(&loop->running, false, __ATOMIC_RELEASE);
+
+    // 完成 eventfd 上的读取以唤醒 io_uring_enter
+    uint64_t value = 1;
+    write(loop->wakeupFd, &value, sizeof(value));
+}
+
+void UringLoopDestroy(struct UringLoop *loop) {
+    // 同步取消内核中全部请求，之后才能释放它们引用的内存
+    if (-1 != loop->ringFd && loop->enabled) {
+        struct io_uring_sync_cancel_reg cancel;
+        memset(&cancel, 0, sizeof(cancel));
+        cancel.fd = -1;
+        cancel.flags = IORING_ASYNC_CANCEL_ANY;
+        cancel.timeout.tv_sec = -1;
+        cancel.timeout.tv_nsec = -1;
+        UringRegister(loop->ringFd, IORING_REGISTER_SYNC_CANCEL, &cancel, 1);
+    }
+
+    while (NULL != loop->connections) {
+        struct UringConnection *connection = loop->connections;
+        loop->connections = connection->next;
+        close(connection->fd);
+        free(connection);
+        MetricsAdd(&loop->metrics->closedConnections, 1);
+    }
+    loop->connectionCount = 0;
+    loop->flushList = NULL;
+    loop->starvedList = NULL;
+
+    if (-1 != loop->ringFd) {
+        close(loop->ringFd);
+        loop->ringFd = -1;
+    }
+    if (NULL != loop->queues.ringMemory) {
+        munmap(loop->queues.ringMemory, loop->queues.ringMemorySize);
+        loop->queues.ringMemory = NULL;
+    }
+    if (NULL != loop->queues.sqes) {
+        munmap(loop->queues.sqes, loop->queues.sqesMemorySize);
+        loop->queues.sqes = NULL;
+    }
+    if (NULL != loop->bufferRing) {
+        munmap(loop->bufferRing, loop->bufferRingSize);
+        loop->bufferRing = NULL;
+    }
+    if (-1 != loop->wakeupFd) {
+        close(loop->wakeupFd);
+        loop->wakeupFd = -1;
+    }
+
+    free(loop->bufferMemory);
+    free(loop->bufferOffsets);
+    free(loop->bufferLengths);
+    free(loop->bufferNext);
+    free(loop->bufferReceivedAt);
+    free(loop->datagramMessages);
+    free(loop->datagramVectors);
+    free(loop->listeners);
+    free(loop->acceptArmed);
+    free(loop->datagramSockets);
+    free(loop->datagramArmed);
+    loop->bufferMemory = NULL;
+    loop->bufferOffsets = NULL;
+    loop->bufferLengths = NULL;
+    loop->bufferNext = NULL;
+    loop->bufferReceivedAt = NULL;
+    loop->datagramMessages = NULL;
+    loop->datagramVectors = NULL;
+    loop->listeners = NULL;
+    loop->acceptArmed = NULL;
+    loop->datagramSockets = NULL;
+    loop->datagramArmed = NULL;
+
+    MetricsReleaseShard(loop->metrics);
+    loop->metrics = NULL;
+}
+
+#else // HAVE_IO_URING
+
+// 编译环境没有足够新的 io_uring 头文件，始终报告不支持，由调用者回退
+
+int UringLoopInit(struct UringLoop *loop, size_t bufferSize,
+                  const struct SocketProfile *socketProfile) {
+    memset(loop, 0, sizeof(*loop));
+    loop->ringFd = -1;
+    loop->wakeupFd = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+int UringLoopAddListener(struct UringLoop *loop, int sd) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int UringLoopAddDatagramSocket(struct UringLoop *loop, int sd) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int UringLoopRun(struct UringLoop *loop) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void UringLoopStop(struct UringLoop *loop) {
+}
+
+void UringLoopDestroy(struct UringLoop *loop) {
+}
+
+#endif // HAVE_IO_URING
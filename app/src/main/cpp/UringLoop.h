@@ -0,0 +1,167 @@
+#ifndef ECHO_URING_LOOP_H
+#define ECHO_URING_LOOP_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint16_t, uint32_t, uint64_t
+#include <sys/socket.h> // msghdr
+#include <sys/uio.h> // iovec
+#include "Metrics.h"
+#include "SocketProfile.h"
+
+// 每个接收缓冲区的最大大小，全部缓冲区预先分配，更大的消息由多个缓冲区依次接收
+#define URING_MAX_BUFFER_SIZE 16384
+
+struct UringConnection;
+
+/**
+ * io_uring 提交队列和完成队列的映射
+ */
+struct UringQueues {
+    // 提交队列
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqArray;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe *sqes;
+
+    // 本地维护的提交队列尾部，进入内核前才发布给内核
+    unsigned sqLocalTail;
+
+    // 完成队列
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+
+    // 映射的内存区域，提交队列和完成队列共用一次映射
+    void *ringMemory;
+    size_t ringMemorySize;
+    size_t sqesMemorySize;
+};
+
+/**
+ * 基于 io_uring 的事件循环
+ *     流 socket 使用 multishot accept 和 multishot recv，接收缓冲区来自注册给内核的缓冲区环，
+ *     同一连接的回显以链接的 send 提交保证顺序，发送队列积压到上限的连接暂停接收；
+ *     数据报 socket 使用 multishot recvmsg 和 sendmsg。
+ *     每次 io_uring_enter 都同时提交和收割一批请求。
+ */
+struct UringLoop {
+    // io_uring 实例
+    int ringFd;
+    struct UringQueues queues;
+
+    // 缓冲区环和缓冲区内存
+    struct io_uring_buf_ring *bufferRing;
+    size_t bufferRingSize;
+    char *bufferMemory;
+    unsigned bufferCount;
+    size_t bufferSize;
+    uint16_t bufferTail;
+
+    // 以缓冲区 ID 为下标的发送状态：待发送数据偏移、长度和连接内发送队列的下一个缓冲区
+    uint32_t *bufferOffsets;
+    uint32_t *bufferLengths;
+    uint16_t *bufferNext;
+
+    // 以缓冲区 ID 为下标的数据接收时间，用于记录服务时间
+    uint64_t *bufferReceivedAt;
+
+    // 以缓冲区 ID 为下标的数据报发送消息
+    struct msghdr *datagramMessages;
+    struct iovec *datagramVectors;
+
+    // 数据报 socket 的 multishot recvmsg 模板消息
+    struct msghdr recvMessage;
+
+    // 用于跨线程停止事件循环的 eventfd
+    int wakeupFd;
+    uint64_t wakeupValue;
+
+    // 停止标志，由 UringLoopStop 从其他线程清除，用 __atomic 读写
+    bool running;
+
+    // 监听 socket 和数据报 socket
+    int *listeners;
+    bool *acceptArmed;
+    size_t listenerCount;
+    int *datagramSockets;
+    bool *datagramArmed;
+    size_t datagramSocketCount;
+
+    // 描述符或者内存耗尽而暂停接受新连接，有连接关闭或者重试定时器到期后恢复
+    bool acceptPaused;
+
+    // 本轮是否有缓冲区归还给内核
+    bool buffersRecycled;
+
+    // 是否有数据报 socket 因缓冲区耗尽而停止接收
+    bool datagramStarved;
+
+    // 环是否已经在运行线程上启用
+    bool enabled;
+
+    // 接受的连接补充应用的调优方案，默认方案时为 NULL
+    const struct SocketProfile *socketProfile;
+
+    // 活动连接链表及数量
+    struct UringConnection *connections;
+    size_t connectionCount;
+
+    // 本轮需要提交发送链的连接
+    struct UringConnection *flushList;
+
+    // 因缓冲区耗尽而停止接收的连接
+    struct UringConnection *starvedList;
+
+    // 指标分片，只由运行事件循环的线程写入
+    struct MetricsShard *metrics;
+};
+
+/**
+ * 初始化 io_uring 事件循环，内核不支持 multishot 接收或缓冲区环时失败
+ * @param loop 事件循环
+ * @param bufferSize 每个接收缓冲区的大小，超过 URING_MAX_BUFFER_SIZE 时按 URING_MAX_BUFFER_SIZE 分配
+ * @param socketProfile 接受的连接补充应用的调优方案，NULL 表示不设置
+ * @return 成功返回 0，失败返回 -1 并设置 errno，调用者可据此回退到其他实现
+ */
+int UringLoopInit(struct UringLoop *loop, size_t bufferSize,
+                  const struct SocketProfile *socketProfile);
+
+/**
+ * 添加一个已经处于监听状态的流 socket，TCP 和本地 UNIX socket 均可
+ * @param loop 事件循环
+ * @param sd 监听 socket 描述符，会被设置为阻塞模式
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int UringLoopAddListener(struct UringLoop *loop, int sd);
+
+/**
+ * 添加一个已经绑定的数据报 socket，收到的数据报回显给发送者
+ * @param loop 事件循环
+ * @param sd 数据报 socket 描述符，会被设置为阻塞模式
+ * @return 成功返回 0，失败返回 -1 并设置 errno
+ */
+int UringLoopAddDatagramSocket(struct UringLoop *loop, int sd);
+
+/**
+ * 在当前线程运行事件循环，直到调用 UringLoopStop 或者发生致命错误
+ * @param loop 事件循环
+ * @return 正常停止返回 0，失败返回 -1 并设置 errno
+ */
+int UringLoopRun(struct UringLoop *loop);
+
+/**
+ * 请求停止事件循环，可以从任何线程调用
+ * @param loop 事件循环
+ */
+void UringLoopStop(struct UringLoop *loop);
+
+/**
+ * 关闭全部客户端连接并释放事件循环资源，监听和数据报 socket 由调用者关闭
+ * @param loop 事件循环
+ */
+void UringLoopDestroy(struct UringLoop *loop);
+
+#endif // ECHO_URING_LOOP_H
@@ -1,21 +0,0 @@
-/* DO NOT EDIT THIS FILE - it is machine generated */
-#include <jni.h>
-/* Header for class com_liu_echo_LocalSocketActivity */
-
-#ifndef _Included_com_liu_echo_LocalSocketActivity
-#define _Included_com_liu_echo_LocalSocketActivity
-#ifdef __cplusplus
-extern "C" {
-#endif
-/*
- * Class:     com_liu_echo_LocalSocketActivity
- * Method:    nativeStartLocalServer
- * Signature: (Ljava/lang/String;)V
- */
-JNIEXPORT void JNICALL Java_com_liu_echo_LocalSocketActivity_nativeStartLocalServer
-  (JNIEnv *, jobject, jstring);
-
-#ifdef __cplusplus
-}
-#endif
-#endif
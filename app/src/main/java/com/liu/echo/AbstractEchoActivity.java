@@ -11,6 +11,27 @@ import android.widget.TextView;
 
 public abstract class AbstractEchoActivity extends Activity implements View.OnClickListener {
 
+    /** 原生日志级别：每次收发的细节 */
+    public static final int LOG_LEVEL_DEBUG = 0;
+
+    /** 原生日志级别：服务器和客户端的生命周期 */
+    public static final int LOG_LEVEL_INFO = 1;
+
+    /** 原生日志级别：回退到默认实现等异常情况 */
+    public static final int LOG_LEVEL_WARN = 2;
+
+    /** 原生日志级别：不记录 */
+    public static final int LOG_LEVEL_NONE = 3;
+
+    /** 取出原生日志的间隔，单位毫秒 */
+    private static final long LOG_DRAIN_INTERVAL = 100;
+
+    /** 指标服务器的本地 socket 名称，在抽象命名空间中 */
+    public static final String STATS_SOCKET_NAME = "com.liu.echo.stats";
+
+    /** 指标服务器线程，整个进程只启动一个 */
+    private static Thread statsThread;
+
     /** 端口号 */
     protected EditText portEdit;
 
@@ -26,6 +47,18 @@ public abstract class AbstractEchoActivity extends Activity implements View.OnCl
     /** 布局 ID */
     private final int layoutID;
 
+    /** UI 线程的 Handler，定期取出原生日志 */
+    private final Handler logHandler = new Handler();
+
+    /** 定期取出原生日志的任务 */
+    private final Runnable logDrainer = new Runnable() {
+        @Override
+        public void run() {
+            drainNativeLog();
+            logHandler.postDelayed(this, LOG_DRAIN_INTERVAL);
+        }
+    };
+
     /**
      * 构造函数
      * @param layoutID
@@ -46,6 +79,13 @@ public abstract class AbstractEchoActivity extends Activity implements View.OnCl
 
         startButton.setOnClickListener(this);
 
+        logHandler.postDelayed(logDrainer, LOG_DRAIN_INTERVAL);
+    }
+
+    @Override
+    protected void onDestroy() {
+        logHandler.removeCallbacks(logDrainer);
+        super.onDestroy();
     }
 
     @Override
@@ -84,6 +124,8 @@ public abstract class AbstractEchoActivity extends Activity implements View.OnCl
         runOnUiThread(new Runnable() {
             @Override
             public void run() {
+                // 先取出之前的原生日志，保持与原生代码中的记录顺序一致
+                drainNativeLog();
                 logMessageDirect(message);
             }
         });
@@ -99,6 +141,68 @@ public abstract class AbstractEchoActivity extends Activity implements View.OnCl
         logScroll.fullScroll(View.FOCUS_DOWN);
     }
 
+    /**
+     * 在 UI 线程上把原生日志环形缓冲区中的日志批量追加到日志视图
+     */
+    protected void drainNativeLog() {
+        String batch;
+        boolean drained = false;
+        while (null != (batch = nativeDrainLog())) {
+            logView.append(batch);
+            drained = true;
+        }
+        if (drained) {
+            logScroll.fullScroll(View.FOCUS_DOWN);
+        }
+    }
+
+    /**
+     * 取出原生日志环形缓冲区中的一批日志
+     * @return 以换行符分隔的日志，没有日志时返回 null
+     */
+    private static native String nativeDrainLog();
+
+    /**
+     * 设置原生日志的运行期级别，低于该级别的日志不会被格式化和记录
+     * @param level LOG_LEVEL_DEBUG、LOG_LEVEL_INFO、LOG_LEVEL_WARN 或 LOG_LEVEL_NONE
+     */
+    protected static native void nativeSetLogLevel(int level);
+
+    /**
+     * 启动指标服务器线程，已经启动时什么也不做；服务器随进程一直运行
+     */
+    protected static synchronized void startStatsServer() {
+        if (statsThread != null) {
+            return;
+        }
+
+        statsThread = new Thread("EchoStats") {
+            @Override
+            public void run() {
+                try {
+                    nativeStartStatsServer(STATS_SOCKET_NAME);
+                } catch (Exception e) {
+                    // 指标只是附加功能，失败时不影响服务器
+                }
+            }
+        };
+        statsThread.setDaemon(true);
+        statsThread.start();
+    }
+
+    /**
+     * 合计全部服务器事件循环的指标
+     * @return 每行一个指标的文本
+     */
+    protected static native String nativeGetMetrics();
+
+    /**
+     * 在当前线程运行指标服务器，每个连接得到一份最新的指标文本
+     * @param name 本地 socket 名称
+     * @throws Exception
+     */
+    private static native void nativeStartStatsServer(String name) throws Exception;
+
     /**
      * 抽象异步 echo 任务
      */
@@ -0,0 +1,118 @@
+package com.liu.echo;
+
+import java.io.Closeable;
+import java.io.IOException;
+
+/**
+ * 原生 TCP 连接池，按 ip:port 保持已连接的空闲连接，重复请求时省去 TCP 握手，
+ * 可以被多个线程同时使用
+ */
+public class ConnectionPool implements Closeable {
+
+    /** 原生连接池句柄，关闭后仍然用于归还借出的连接，最后一个连接归还后由原生代码释放 */
+    private final long pool;
+
+    /** 是否已经关闭 */
+    private boolean closed;
+
+    /** 已经通过关闭检查、还没有从 nativeAcquire 返回的调用数，降到 0 之前不能放弃原生连接池 */
+    private int acquiring;
+
+    /**
+     * 构造函数
+     * @param maxPerHost 每个主机最多的连接数，必须为正数
+     * @param idleTimeoutMillis 空闲连接的最长保留时间，单位毫秒，0 表示归还时直接关闭
+     * @throws IllegalArgumentException 连接数不为正数或者保留时间为负数
+     * @throws IOException 构造失败
+     */
+    public ConnectionPool(int maxPerHost, int idleTimeoutMillis) throws IOException {
+        this(maxPerHost, idleTimeoutMillis, ServerOptions.SOCKET_PROFILE_LOW_LATENCY);
+    }
+
+    /**
+     * 构造函数
+     * @param maxPerHost 每个主机最多的连接数，必须为正数
+     * @param idleTimeoutMillis 空闲连接的最长保留时间，单位毫秒，0 表示归还时直接关闭
+     * @param socketProfile 新建连接使用的 socket 调优方案，ServerOptions.SOCKET_PROFILE_* 之一
+     * @throws IllegalArgumentException 连接数不为正数、保留时间为负数或者调优方案未知
+     * @throws IOException 构造失败
+     */
+    public ConnectionPool(int maxPerHost, int idleTimeoutMillis, int socketProfile)
+            throws IOException {
+        pool = nativeCreate(maxPerHost, idleTimeoutMillis, socketProfile);
+    }
+
+    /**
+     * 借出一个到给定地址的连接，用完后调用 EchoClient.close() 归还
+     * @param ip IP 地址
+     * @param port 端口号
+     * @param timeoutMillis 主机连接数已达上限时等待归还的最长时间，单位毫秒，小于 0 表示一直等待
+     * @return 客户端
+     * @throws IllegalStateException 连接池已经关闭
+     * @throws IOException 连接失败、等待超时或者等待期间连接池被关闭
+     */
+    public EchoClient acquire(String ip, int port, int timeoutMillis) throws IOException {
+        synchronized (this) {
+            if (closed) {
+                throw new IllegalStateException("Connection pool is closed");
+            }
+            acquiring++;
+        }
+        long connection;
+        try {
+            connection = nativeAcquire(pool, ip, port, timeoutMillis);
+        } finally {
+            synchronized (this) {
+                if (0 == --acquiring && closed) {
+                    nativeDestroy(pool);
+                }
+            }
+        }
+        return new EchoClient(nativeGetSocket(connection), this, connection);
+    }
+
+    /**
+     * 归还借出的连接，连接池关闭后归还的连接直接关闭
+     * @param connection 连接句柄
+     * @param reusable 连接是否可以复用
+     */
+    void release(long connection, boolean reusable) {
+        nativeRelease(pool, connection, reusable);
+    }
+
+    /**
+     * 关闭空闲连接，等待中的 acquire 以 IOException 失败，之后的 acquire 抛出 IllegalStateException；
+     * 借出的连接仍然可以归还，全部归还后释放原生连接池
+     */
+    @Override
+    public synchronized void close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+
+        // 唤醒等待的 acquire，最后一个返回的调用者放弃原生连接池
+        nativeClose(pool);
+        if (0 == acquiring) {
+            nativeDestroy(pool);
+        }
+    }
+
+    private static native long nativeCreate(int maxPerHost, int idleTimeoutMillis,
+                                            int socketProfile) throws IOException;
+
+    private static native long nativeAcquire(long pool, String ip, int port, int timeoutMillis)
+            throws IOException;
+
+    private static native int nativeGetSocket(long connection);
+
+    private static native void nativeRelease(long pool, long connection, boolean reusable);
+
+    private static native void nativeClose(long pool);
+
+    private static native void nativeDestroy(long pool);
+
+    static {
+        System.loadLibrary("Echo");
+    }
+}
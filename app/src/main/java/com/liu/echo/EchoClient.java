@@ -0,0 +1,187 @@
+package com.liu.echo;
+
+import java.io.Closeable;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+
+/**
+ * 原生 socket 客户端，直接在调用者提供的直接 ByteBuffer 上收发，
+ * 数据不经过 Java 字符串转换和复制，可以是任意二进制内容
+ */
+public class EchoClient implements Closeable {
+
+    /** socket 描述符，关闭后为 -1 */
+    private int sd;
+
+    /** 借出连接的连接池，不是从连接池借出时为 null */
+    private final ConnectionPool pool;
+
+    /** 连接池中的连接句柄 */
+    private final long connection;
+
+    /** 收发是否都成功完成，出错或者对端关闭的连接不再归还给连接池复用 */
+    private boolean reusable = true;
+
+    /**
+     * 构造函数
+     * @param sd 已连接的 socket 描述符
+     */
+    private EchoClient(int sd) {
+        this(sd, null, 0);
+    }
+
+    /**
+     * 构造函数
+     * @param sd 已连接的 socket 描述符
+     * @param pool 借出连接的连接池
+     * @param connection 连接池中的连接句柄
+     */
+    EchoClient(int sd, ConnectionPool pool, long connection) {
+        this.sd = sd;
+        this.pool = pool;
+        this.connection = connection;
+    }
+
+    /**
+     * 连接到给定地址的 TCP 服务器
+     * @param ip IP 地址
+     * @param port 端口号
+     * @return 客户端
+     * @throws IOException 连接失败
+     */
+    public static EchoClient connectTcp(String ip, int port) throws IOException {
+        return connectTcp(ip, port, ServerOptions.SOCKET_PROFILE_DEFAULT);
+    }
+
+    /**
+     * 用给定的 socket 调优方案连接到 TCP 服务器
+     * @param ip IP 地址
+     * @param port 端口号
+     * @param socketProfile ServerOptions.SOCKET_PROFILE_* 之一
+     * @return 客户端
+     * @throws IOException 连接失败
+     */
+    public static EchoClient connectTcp(String ip, int port, int socketProfile)
+            throws IOException {
+        return new EchoClient(nativeConnectTcp(ip, port, socketProfile));
+    }
+
+    /**
+     * 构造只和给定地址收发数据报的 UDP 客户端
+     * @param ip IP 地址
+     * @param port 端口号
+     * @return 客户端
+     * @throws IOException 构造失败
+     */
+    public static EchoClient connectUdp(String ip, int port) throws IOException {
+        return connectUdp(ip, port, ServerOptions.SOCKET_PROFILE_DEFAULT);
+    }
+
+    /**
+     * 用给定的 socket 调优方案构造 UDP 客户端，数据报 socket 只使用方案中的缓冲区大小
+     * @param ip IP 地址
+     * @param port 端口号
+     * @param socketProfile ServerOptions.SOCKET_PROFILE_* 之一
+     * @return 客户端
+     * @throws IOException 构造失败
+     */
+    public static EchoClient connectUdp(String ip, int port, int socketProfile)
+            throws IOException {
+        return new EchoClient(nativeConnectUdp(ip, port, socketProfile));
+    }
+
+    /**
+     * 发送缓冲区中 position 到 limit 之间的数据，并把 position 前移发送的字节数
+     * @param buffer 直接 ByteBuffer
+     * @return 发送的字节数，TCP 可能只发送一部分
+     * @throws IOException 发送失败
+     */
+    public int send(ByteBuffer buffer) throws IOException {
+        int sentSize;
+        try {
+            sentSize = nativeSend(sd, buffer, buffer.position(), buffer.remaining());
+        } catch (IOException e) {
+            reusable = false;
+            throw e;
+        }
+        buffer.position(buffer.position() + sentSize);
+        return sentSize;
+    }
+
+    /**
+     * 接收到缓冲区的 position 处，最多到 limit，并把 position 前移收到的字节数
+     * @param buffer 直接 ByteBuffer
+     * @return 收到的字节数，TCP 连接被对端关闭时返回 0
+     * @throws IOException 接收失败
+     */
+    public int receive(ByteBuffer buffer) throws IOException {
+        int receivedSize;
+        try {
+            receivedSize = nativeReceive(sd, buffer, buffer.position(), buffer.remaining());
+        } catch (IOException e) {
+            reusable = false;
+            throw e;
+        }
+        if (0 == receivedSize && buffer.hasRemaining()) {
+            // 对端已经关闭连接
+            reusable = false;
+        }
+        buffer.position(buffer.position() + receivedSize);
+        return receivedSize;
+    }
+
+    /**
+     * 以流水线方式在 TCP 连接上发送 requestCount 个相同的请求，最多 window 个请求同时在途，
+     * 回显按顺序与请求核对，吞吐量受带宽而不是往返时间限制，统计结果写入原生日志
+     * @param payload 直接 ByteBuffer，position 到 limit 之间的数据为请求内容，position 不变
+     * @param requestCount 请求数
+     * @param window 最多同时在途的请求数
+     * @return 收齐回显的请求数
+     * @throws IOException 收发失败或者回显与请求不一致
+     */
+    public int pipeline(ByteBuffer payload, int requestCount, int window) throws IOException {
+        try {
+            return nativePipeline(sd, payload, payload.position(), payload.remaining(),
+                    requestCount, window);
+        } catch (IOException e) {
+            reusable = false;
+            throw e;
+        }
+    }
+
+    /**
+     * 关闭 socket，从连接池借出的连接则归还给连接池
+     */
+    @Override
+    public void close() {
+        if (-1 != sd) {
+            if (null != pool) {
+                pool.release(connection, reusable);
+            } else {
+                nativeClose(sd);
+            }
+            sd = -1;
+        }
+    }
+
+    private static native int nativeConnectTcp(String ip, int port, int socketProfile)
+            throws IOException;
+
+    private static native int nativeConnectUdp(String ip, int port, int socketProfile)
+            throws IOException;
+
+    private static native int nativeSend(int sd, ByteBuffer buffer, int offset, int length)
+            throws IOException;
+
+    private static native int nativeReceive(int sd, ByteBuffer buffer, int offset, int length)
+            throws IOException;
+
+    private static native int nativePipeline(int sd, ByteBuffer buffer, int offset, int length,
+                                             int requestCount, int window) throws IOException;
+
+    private static native void nativeClose(int sd);
+
+    static {
+        System.loadLibrary("Echo");
+    }
+}
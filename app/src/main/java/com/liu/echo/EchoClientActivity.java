@@ -1,13 +1,48 @@
 package com.liu.echo;
 
 import android.os.Bundle;
+import android.view.View;
+import android.widget.Button;
 import android.widget.EditText;
 
+import java.io.IOException;
+import java.nio.ByteBuffer;
+
 /**
  * Echo 客户端
  */
 public class EchoClientActivity extends AbstractEchoActivity {
 
+    /**
+     * 接收回显的最大长度
+     */
+    private static final int RECEIVE_BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * UDP 基准测试中每个数据报的长度，未填写分段大小时使用
+     */
+    private static final int BENCHMARK_SEGMENT_SIZE = 1400;
+
+    /**
+     * UDP 基准测试中每种方式发送的总字节数
+     */
+    private static final int BENCHMARK_UDP_BYTES = 64 * 1024 * 1024;
+
+    /**
+     * 一问一答基准测试的消息长度
+     */
+    private static final int BENCHMARK_PAYLOAD_SIZE = 64;
+
+    /**
+     * 一问一答基准测试中每个方案交换的消息数
+     */
+    private static final int BENCHMARK_EXCHANGES = 10000;
+
+    /**
+     * socket 调优方案基准测试中每个方案大块回显的字节数
+     */
+    private static final int BENCHMARK_BULK_BYTES = 16 * 1024 * 1024;
+
     /**
      * IP 地址
      */
@@ -18,6 +53,16 @@ public class EchoClientActivity extends AbstractEchoActivity {
      */
     private EditText messageEdit;
 
+    /**
+     * UDP 分段大小编辑
+     */
+    private EditText segmentEdit;
+
+    /**
+     * 基准测试按钮
+     */
+    private Button benchmarkButton;
+
     /**
      * 构造函数
      */
@@ -31,6 +76,22 @@ public class EchoClientActivity extends AbstractEchoActivity {
 
         ipEdit = findViewById(R.id.ip_edit);
         messageEdit = findViewById(R.id.message_edit);
+        segmentEdit = findViewById(R.id.segment_edit);
+        benchmarkButton = findViewById(R.id.benchmark_button);
+
+        benchmarkButton.setOnClickListener(this);
+    }
+
+    @Override
+    public void onClick(View v) {
+        if (v == benchmarkButton) {
+            Integer segmentSize = getSegmentSize();
+            BenchmarkTask benchmarkTask = new BenchmarkTask(
+                    (segmentSize != null) ? segmentSize : BENCHMARK_SEGMENT_SIZE);
+            benchmarkTask.start();
+        } else {
+            super.onClick(v);
+        }
     }
 
     @Override
@@ -38,24 +99,91 @@ public class EchoClientActivity extends AbstractEchoActivity {
         String ip = ipEdit.getText().toString();
         Integer port = getPort();
         String message = messageEdit.getText().toString();
+        Integer segmentSize = getSegmentSize();
 
         if ((0 != ip.length()) && (port != null) && (0 != message.length())) {
-            ClientTask clientTask = new ClientTask(ip, port, message);
+            ClientTask clientTask = new ClientTask(ip, port, message,
+                    (segmentSize != null) ? segmentSize : 0);
             clientTask.start();
         }
     }
 
     /**
-     * 根据给定服务器 IP 地址和端口号启动 TCP 客户端，并发送给定消息
+     * 以整型获取 UDP 分段大小
+     * @return 未填写或者不是正整数时返回 null
+     */
+    private Integer getSegmentSize() {
+        Integer segmentSize;
+
+        try {
+            segmentSize = Integer.valueOf(segmentEdit.getText().toString());
+        } catch (NumberFormatException e) {
+            segmentSize = null;
+        }
+
+        return ((segmentSize != null) && (segmentSize > 0)) ? segmentSize : null;
+    }
+
+    /**
+     * 根据给定服务器 IP 地址和端口号启动 TCP 客户端，发送给定消息并接收完整的回显
      *
      * @param ip
      * @param port
      * @param message
+     * @param bufferSize 接收缓冲区的分段大小，每次 readv 读入多个分段
+     * @param socketProfile socket 调优方案，ServerOptions.SOCKET_PROFILE_* 之一
+     * @param integrity 是否把消息作为带 CRC32C 帧尾的帧发送并校验回显，服务器需要启用
+     *                  ServerOptions.integrity；回显损坏时抛出 IOException
+     * @throws Exception
+     */
+    private native void nativeStartTcpClient(String ip, int port, String message, int bufferSize,
+                                             int socketProfile, boolean integrity)
+            throws Exception;
+
+    /**
+     * 根据给定服务器 IP 地址和端口号启动 UDP 客户端，并发送给定消息
+     *
+     * @param ip
+     * @param port
+     * @param message
+     * @param segmentSize 大于 0 并且小于消息长度时由内核把消息切分成该长度的多个数据报发送（UDP_SEGMENT）
+     * @param socketProfile socket 调优方案，ServerOptions.SOCKET_PROFILE_* 之一
+     * @throws Exception
+     */
+    private native void nativeStartUdpClient(String ip, int port, String message, int segmentSize,
+                                             int socketProfile) throws Exception;
+
+    /**
+     * 在回环地址上比较逐个数据报收发和 UDP 分段卸载（UDP_SEGMENT/UDP_GRO）的吞吐量，结果写入日志
+     *
+     * @param segmentSize 每个数据报的长度
+     * @param totalBytes 每种方式发送的总字节数
      * @throws Exception
      */
-    private native void nativeStartTcpClient(String ip, int port, String message) throws Exception;
+    private native void nativeRunUdpBenchmark(int segmentSize, int totalBytes) throws Exception;
 
-    private native void nativeStartUdpClient(String ip, int port, String message) throws Exception;
+    /**
+     * 在回环地址上依次用每个 socket 调优方案运行服务器和客户端，比较一问一答的 p50/p99 延迟、
+     * 大块回显的吞吐量和内核分配的缓冲区大小，结果写入日志
+     *
+     * @param payloadSize 一问一答的消息长度
+     * @param exchanges 每个方案交换的消息数
+     * @param bulkBytes 每个方案大块回显的字节数
+     * @throws Exception
+     */
+    private native void nativeRunSocketProfileBenchmark(int payloadSize, int exchanges,
+                                                        int bulkBytes) throws Exception;
+
+    /**
+     * 在回环地址上比较阻塞等待的服务器和忙轮询服务器的一问一答延迟，p50/p99/p99.9 写入日志
+     *
+     * @param payloadSize 消息长度
+     * @param exchanges 每种模式交换的消息数
+     * @param idleMicros 忙轮询退回阻塞等待之前的空闲时间，单位微秒
+     * @throws Exception
+     */
+    private native void nativeRunBusyPollBenchmark(int payloadSize, int exchanges, int idleMicros)
+            throws Exception;
 
     private class ClientTask extends AbstractEchoTask {
         /**
@@ -73,24 +201,67 @@ public class EchoClientActivity extends AbstractEchoActivity {
          */
         private final String message;
 
+        /**
+         * UDP 分段大小，0 表示不分段
+         */
+        private final int segmentSize;
+
         /**
          * 构造函数
          *
          * @param ip
          * @param port
          * @param message
+         * @param segmentSize 大于 0 并且小于消息长度时由内核把消息切分成多个数据报发送
          */
-        public ClientTask(String ip, int port, String message) {
+        public ClientTask(String ip, int port, String message, int segmentSize) {
             this.ip = ip;
             this.port = port;
             this.message = message;
+            this.segmentSize = segmentSize;
+        }
+
+        /**
+         * 通过直接缓冲区把消息发给 UDP 服务器并接收回显
+         *
+         * @throws IOException
+         */
+        private void echo() throws IOException {
+            byte[] messageBytes = message.getBytes();
+
+            ByteBuffer sendBuffer = ByteBuffer.allocateDirect(messageBytes.length);
+            sendBuffer.put(messageBytes);
+            sendBuffer.flip();
+
+            ByteBuffer receiveBuffer = ByteBuffer.allocateDirect(RECEIVE_BUFFER_SIZE);
+
+            EchoClient client = EchoClient.connectUdp(ip, port);
+            try {
+                int sentSize = client.send(sendBuffer);
+                logMessage(String.format("Sent %d bytes: %s", sentSize, message));
+
+                int receivedSize = client.receive(receiveBuffer);
+                receiveBuffer.flip();
+                byte[] receivedBytes = new byte[receivedSize];
+                receiveBuffer.get(receivedBytes);
+                logMessage(String.format("Received %d bytes: %s", receivedSize,
+                        new String(receivedBytes)));
+            } finally {
+                client.close();
+            }
         }
 
         @Override
         protected void onBackground() {
             logMessage("Starting client.");
             try {
-                nativeStartUdpClient(ip, port, message);
+                if ((segmentSize > 0) && (message.getBytes().length > segmentSize)) {
+                    // 分段发送和合并接收都在原生代码中完成，回显写入原生日志
+                    nativeStartUdpClient(ip, port, message, segmentSize,
+                            ServerOptions.SOCKET_PROFILE_DEFAULT);
+                } else {
+                    echo();
+                }
             } catch (Throwable e) {
                 logMessage(e.getMessage());
             }
@@ -98,4 +269,48 @@ public class EchoClientActivity extends AbstractEchoActivity {
             logMessage("Client terminated.");
         }
     }
+
+    private class BenchmarkTask extends AbstractEchoTask {
+        /**
+         * UDP 基准测试中每个数据报的长度
+         */
+        private final int segmentSize;
+
+        /**
+         * 构造函数
+         *
+         * @param segmentSize UDP 基准测试中每个数据报的长度
+         */
+        public BenchmarkTask(int segmentSize) {
+            this.segmentSize = segmentSize;
+        }
+
+        @Override
+        protected void onPreExecute() {
+            super.onPreExecute();
+            benchmarkButton.setEnabled(false);
+        }
+
+        @Override
+        protected void onBackground() {
+            logMessage("Starting benchmark.");
+            try {
+                nativeRunUdpBenchmark(segmentSize, BENCHMARK_UDP_BYTES);
+                nativeRunSocketProfileBenchmark(BENCHMARK_PAYLOAD_SIZE, BENCHMARK_EXCHANGES,
+                        BENCHMARK_BULK_BYTES);
+                nativeRunBusyPollBenchmark(BENCHMARK_PAYLOAD_SIZE, BENCHMARK_EXCHANGES,
+                        new ServerOptions().busyPollIdleMicros);
+            } catch (Throwable e) {
+                logMessage(e.getMessage());
+            }
+
+            logMessage("Benchmark terminated.");
+        }
+
+        @Override
+        protected void onPostExecute() {
+            super.onPostExecute();
+            benchmarkButton.setEnabled(true);
+        }
+    }
 }
@@ -21,16 +21,50 @@ public class EchoServerActivity extends AbstractEchoActivity {
     /**
      * 根据给定端口启动TCP服务器
      * @param port
+     * @param options 服务器选项，为 null 时使用默认值
      * @throws Exception
      */
-    private native void nativeStartTcpServer(int port) throws Exception;
+    private native void nativeStartTcpServer(int port, ServerOptions options) throws Exception;
 
     /**
      * 根据给定端口启动UDP服务
      * @param port
+     * @param options 服务器选项，为 null 时使用默认值
      * @throws Exception
      */
-    private native void nativeStartUdpServer(int port) throws Exception;
+    private native void nativeStartUdpServer(int port, ServerOptions options) throws Exception;
+
+    /**
+     * 根据给定端口启动分片TCP服务器，每个工作线程用 SO_REUSEPORT 绑定同一端口并运行自己的事件循环。
+     * 可以用 nativeStopTcpServer 排空全部工作线程，但不能交接
+     * @param port
+     * @param options 服务器选项，为 null 时使用默认值；工作线程总是使用 epoll 事件循环
+     * @param workerCount 工作线程数，小于等于 0 表示使用 CPU 核心数
+     * @param pinToCores 是否将工作线程绑定到 CPU 核心
+     * @throws Exception
+     */
+    private native void nativeStartShardedTcpServer(int port, ServerOptions options,
+                                                    int workerCount, boolean pinToCores)
+            throws Exception;
+
+    /**
+     * 停止最早启动的TCP服务器。不给交接名称时停止接受新连接，每个连接回显完已经收到的数据后关闭；
+     * 给出交接名称时把监听 socket 和空闲的连接交给在该名称上等待的新实例，升级期间客户端不会被拒绝。
+     * 只发出请求，nativeStartTcpServer 在全部连接交出或者关闭后返回
+     * @param handoffName nativeTakeOverTcpServer 等待的本地 socket 名称，为 null 时只排空
+     * @throws Exception
+     */
+    private native void nativeStopTcpServer(String handoffName) throws Exception;
+
+    /**
+     * 在本地 socket 名称上等待正在运行的TCP服务器交接，接手它的监听 socket 和连接继续服务，
+     * 直到被 nativeStopTcpServer 停止或者再次交出
+     * @param handoffName 交接用的本地 socket 名称
+     * @param options 服务器选项，为 null 时使用默认值
+     * @throws Exception
+     */
+    private native void nativeTakeOverTcpServer(String handoffName, ServerOptions options)
+            throws Exception;
 
     /**
      * 服务器端任务
@@ -50,11 +84,13 @@ public class EchoServerActivity extends AbstractEchoActivity {
         @Override
         protected void onBackground() {
             logMessage("Starting server.");
+            startStatsServer();
             try {
-                nativeStartUdpServer(port);
+                nativeStartUdpServer(port, new ServerOptions());
             } catch (Exception e) {
                 logMessage(e.getMessage());
             }
+            logMessage(nativeGetMetrics());
             logMessage("Server terminated.");
         }
     }
@@ -10,6 +10,21 @@ import java.io.InputStream;
 import java.io.OutputStream;
 
 public class LocalSocketActivity extends AbstractEchoActivity {
+    /**
+     * 大消息模式下通过 memfd 回显的负载长度
+     */
+    private static final int LARGE_PAYLOAD_SIZE = 8 * 1024 * 1024;
+
+    /**
+     * 共享内存通道握手 socket 名称的后缀
+     */
+    private static final String SHM_SOCKET_SUFFIX = ".shm";
+
+    /**
+     * 经过共享内存通道回显的往返次数
+     */
+    private static final int SHM_MESSAGE_COUNT = 10000;
+
     /**
      * 消息编辑
      */
@@ -28,6 +43,17 @@ public class LocalSocketActivity extends AbstractEchoActivity {
         messageEdit = findViewById(R.id.message_edit);
     }
 
+    @Override
+    protected void onDestroy() {
+        // 共享内存服务器线程阻塞在本地代码中，退出时请求它停止
+        try {
+            nativeStopShmServer();
+        } catch (Exception e) {
+            // 没有服务器在运行
+        }
+        super.onDestroy();
+    }
+
     @Override
     protected void onStartButtonClicked() {
         String name = portEdit.getText().toString();
@@ -47,6 +73,9 @@ public class LocalSocketActivity extends AbstractEchoActivity {
             ServerTask serverTask = new ServerTask(socketName);
             serverTask.start();
 
+            ShmServerTask shmServerTask = new ShmServerTask(socketName + SHM_SOCKET_SUFFIX);
+            shmServerTask.start();
+
             ClientTask clientTask = new ClientTask(socketName, message);
             clientTask.start();
 
@@ -68,9 +97,46 @@ public class LocalSocketActivity extends AbstractEchoActivity {
      * 启动绑定到给定名称的本地 UNIX socket 服务器
      *
      * @param name 名称
+     * @param options 服务器选项，为 null 时使用默认值
+     * @throws Exception 可能的IO流异常
+     */
+    private native void nativeStartLocalServer(String name, ServerOptions options)
+            throws Exception;
+
+    /**
+     * 把负载放进 memfd，通过 SCM_RIGHTS 发给以记录模式运行的本地服务器，映射回显的 memfd 并校验
+     *
+     * @param name 名称
+     * @param payloadSize 负载长度
+     * @throws Exception 可能的IO流异常
+     */
+    private native void nativeSendLocalPayload(String name, int payloadSize) throws Exception;
+
+    /**
+     * 启动共享内存通道回显服务器，本地 socket 只用于接收客户端传来的通道 memfd
+     *
+     * @param name 握手 socket 名称
+     * @throws Exception 可能的IO流异常
+     */
+    private native void nativeStartShmServer(String name) throws Exception;
+
+    /**
+     * 停止共享内存通道回显服务器：不再接受新的客户端，关闭正在服务的通道
+     *
+     * @throws Exception 没有服务器在运行
+     */
+    private native void nativeStopShmServer() throws Exception;
+
+    /**
+     * 创建共享内存通道交给服务器，经过通道逐条回显消息并记录往返延迟
+     *
+     * @param name 握手 socket 名称
+     * @param message 消息
+     * @param count 往返次数
      * @throws Exception 可能的IO流异常
      */
-    private native void nativeStartLocalServer(String name) throws Exception;
+    private native void nativeSendShmMessages(String name, String message, int count)
+            throws Exception;
 
     /**
      * 启动本地 UNIX socket 客户端
@@ -79,8 +145,8 @@ public class LocalSocketActivity extends AbstractEchoActivity {
      * @throws Exception 可能的异常
      */
     private void startLocalClient(String name, String message) throws Exception {
-        // 构造一个本地 socket
-        LocalSocket clientSocket = new LocalSocket();
+        // 构造一个保留消息边界的本地 socket，一次读取得到一整条回显
+        LocalSocket clientSocket = new LocalSocket(LocalSocket.SOCKET_SEQPACKET);
         try {
             // 设置 socket 名称空间
             LocalSocketAddress.Namespace namespace;
@@ -142,15 +208,48 @@ public class LocalSocketActivity extends AbstractEchoActivity {
         @Override
         protected void onBackground() {
             logMessage("Starting server.");
+            startStatsServer();
             try {
-                nativeStartLocalServer(name);
+                ServerOptions options = new ServerOptions();
+                options.seqPacket = true;
+                nativeStartLocalServer(name, options);
             } catch (Exception e) {
                 logMessage(e.getMessage());
             }
+            logMessage(nativeGetMetrics());
             logMessage("Server terminated.");
         }
     }
 
+    /**
+     * 共享内存通道服务器任务
+     */
+    private class ShmServerTask extends Thread {
+        /**
+         * 握手 socket 名称
+         */
+        private final String name;
+
+        /**
+         * 构造函数
+         *
+         * @param name 握手 socket 名称
+         */
+        public ShmServerTask(String name) {
+            this.name = name;
+            setDaemon(true);
+        }
+
+        @Override
+        public void run() {
+            try {
+                nativeStartShmServer(name);
+            } catch (Exception e) {
+                logMessage(e.getMessage());
+            }
+        }
+    }
+
     private class ClientTask extends Thread {
         /**
          * Socket 名称
@@ -173,6 +272,17 @@ public class LocalSocketActivity extends AbstractEchoActivity {
 
             try {
                 startLocalClient(name, message);
+
+                // 大消息只传递描述符
+                logMessage(String.format("Echoing %d bytes through a memfd...", LARGE_PAYLOAD_SIZE));
+                nativeSendLocalPayload(name, LARGE_PAYLOAD_SIZE);
+                logMessage("Large payload echoed.");
+
+                // 小消息经过共享内存通道往返，不经过 socket
+                logMessage(String.format("Echoing %d messages through shared memory...",
+                        SHM_MESSAGE_COUNT));
+                nativeSendShmMessages(name + SHM_SOCKET_SUFFIX, message, SHM_MESSAGE_COUNT);
+                logMessage("Shared memory messages echoed.");
             } catch (Exception e) {
                 logMessage(e.getMessage());
             }
@@ -0,0 +1,121 @@
+package com.liu.echo;
+
+/**
+ * 原生服务器选项，启动服务器时由原生代码读取各字段
+ */
+public class ServerOptions {
+
+    /** 非阻塞 epoll 事件循环 */
+    public static final int BACKEND_EPOLL = 0;
+
+    /** io_uring，内核不支持时回退到默认实现 */
+    public static final int BACKEND_IO_URING = 1;
+
+    /** 单线程反应器上的 C++20 协程，每个连接一个顺序执行的回显协程 */
+    public static final int BACKEND_COROUTINE = 2;
+
+    /** 不设置 socket 选项，使用内核默认值和缓冲区自动调整 */
+    public static final int SOCKET_PROFILE_DEFAULT = 0;
+
+    /** 小消息请求/响应：TCP_NODELAY、TCP_QUICKACK，TCP_NOTSENT_LOWAT 为 16K */
+    public static final int SOCKET_PROFILE_LOW_LATENCY = 1;
+
+    /** 大块数据：保留 Nagle 合并和缓冲区自动调整，按剩余长度读取的客户端使用 32K 的 SO_RCVLOWAT */
+    public static final int SOCKET_PROFILE_BULK_THROUGHPUT = 2;
+
+    /** 大量空闲长连接：16K 的 SO_RCVBUF/SO_SNDBUF，TCP_NOTSENT_LOWAT 为 4K，backlog 为 65535 */
+    public static final int SOCKET_PROFILE_MANY_IDLE_CONNECTIONS = 3;
+
+    /** 原样回显帧的负载 */
+    public static final int MESSAGE_HANDLER_ECHO = 0;
+
+    /** 按字节倒序回显帧的负载 */
+    public static final int MESSAGE_HANDLER_REVERSE = 1;
+
+    /** I/O 后端 */
+    public int backend = BACKEND_EPOLL;
+
+    /** 流 socket 是否用 splice() 经管道零拷贝回显，数据不进入用户空间 */
+    public boolean zeroCopy = false;
+
+    /** UDP 服务器每次 recvmmsg/sendmmsg 收发的最大数据报数，0 表示只回显一个数据报后退出 */
+    public int datagramBatchSize = 0;
+
+    /**
+     * 批量模式下是否启用 UDP 分段卸载：内核把相同长度的数据报合并后一次交给服务器（UDP_GRO），
+     * 服务器再把合并的缓冲区一次发回并由内核按原长度切分（UDP_SEGMENT），内核不支持时忽略
+     */
+    public boolean segmentOffload = false;
+
+    /**
+     * 每个流连接最多缓存的字节数，大消息按需分配分段并用 readv/sendmsg 一次读写多个分段；
+     * 数据报服务器中为最大数据报长度，超过 65535 时按 65535 计算
+     */
+    public int bufferSize = 256 * 1024;
+
+    /**
+     * 连接缓冲区池是否用 mmap(MAP_HUGETLB) 映射大页，系统没有预留大页时回退到普通页并建议使用透明大页；
+     * 一经启用对进程中之后映射的全部 slab 生效
+     */
+    public boolean hugePages = false;
+
+    /**
+     * TCP 和本地 socket 服务器是否按长度前缀帧回显：每帧以大端序 32 位负载长度开头，只回显完整的帧，
+     * 一次读取得到的多个帧合并为一次发送；帧的总长度不能超过 bufferSize。启用时忽略 zeroCopy 并使用 epoll
+     */
+    public boolean framing = false;
+
+    /**
+     * 是否校验负载完整性：每帧的负载之后跟着大端序的 CRC32C，计入帧头的长度；
+     * 服务器只回显校验通过的帧，遇到损坏的帧时关闭连接。启用时同时启用 framing
+     */
+    public boolean integrity = false;
+
+    /**
+     * 本地 socket 服务器是否使用 SOCK_SEQPACKET：保留消息边界，每条记录原样回显为一条记录，
+     * 记录附带的描述符（SCM_RIGHTS）随回显发回，用于 memfd 大消息；
+     * 记录最长为 bufferSize，并且不超过 64 个 16K 分段。启用时忽略 zeroCopy 和 framing 并使用 epoll
+     */
+    public boolean seqPacket = false;
+
+    /**
+     * 监听 socket 和接受的连接使用的 socket 调优方案（SOCKET_PROFILE_*），同时决定监听 backlog；
+     * TCP 连接从监听 socket 继承大部分选项，本地 socket 的缓冲区在接受连接时设置
+     */
+    public int socketProfile = SOCKET_PROFILE_DEFAULT;
+
+    /**
+     * epoll 事件循环是否忙轮询：以零超时反复 epoll_wait，不让出 CPU，省去每条消息的调度器唤醒延迟；
+     * 连接设置 SO_BUSY_POLL 和 SO_PREFER_BUSY_POLL（需要 CAP_NET_ADMIN，没有权限时忽略）。
+     * 空闲超过 busyPollIdleMicros 后退回阻塞等待，有事件后恢复空转。启用时不使用 io_uring
+     */
+    public boolean busyPoll = false;
+
+    /** 忙轮询退回阻塞等待之前的空闲时间，单位微秒 */
+    public int busyPollIdleMicros = 10000;
+
+    /** 忙轮询线程绑定的 CPU 核心，应当是没有其他负载的专用核心，-1 表示不绑定 */
+    public int busyPollCpu = -1;
+
+    /**
+     * 分帧模式下处理每个帧负载的处理器（MESSAGE_HANDLER_*），响应编码为一个帧发回；
+     * 其他模式下忽略
+     */
+    public int messageHandler = MESSAGE_HANDLER_ECHO;
+
+    /**
+     * 分帧模式下运行处理器的工作窃取线程池的线程数，0 表示在 I/O 线程中直接处理。
+     * 大于 0 时慢的请求不阻塞 I/O 线程和其他连接，同一连接的响应仍然按请求顺序发回
+     */
+    public int handlerThreads = 0;
+
+    /**
+     * 流回显的发送积压高水位，单位字节：客户端读取太慢时服务器先继续读取并积压回显，
+     * 连接尚未发出的数据达到这个长度后暂停读取，让发送方慢下来；积压不超过 bufferSize。
+     * 0 表示有任何数据没有发出就暂停读取。分帧、记录和零拷贝模式下总是按 0 处理
+     */
+    public int writeHighWatermark = 64 * 1024;
+
+    /** 暂停读取后积压降到这个长度以下才恢复读取，不能超过 writeHighWatermark */
+    public int writeLowWatermark = 16 * 1024;
+}
@@ -0,0 +1,92 @@
+/**
+ * 缓冲区链测试
+ *     分段增长、跨分段读写、部分写出后的复制和空闲时归还分段
+ */
+#include "TestSupport.h"
+#include "BufferChain.h"
+#include "BufferPool.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp
+#include <errno.h> // errno
+#include <unistd.h> // read, close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socketpair
+
+/**
+ * 缓冲区链：分段增长、跨分段读写和部分写出后的复制
+ */
+static void TestBufferChain() {
+    const size_t size = 100000;
+    const size_t segmentSizes[] = {1, 7, 4096, 65536};
+
+    for (size_t segmentSize : segmentSizes) {
+        int input[2];
+        int output[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, input);
+        socketpair(AF_UNIX, SOCK_STREAM, 0, output);
+
+        char *payload = NewPayload(size, 7);
+        struct Sender sender = {input[0], payload, size, 0};
+        pthread_t thread;
+        pthread_create(&thread, NULL, RunSender, &sender);
+
+        struct BufferChain chain;
+        CHECK(0 == BufferChainInit(&chain, segmentSize, size), "init failed");
+
+        // 读到收满整个消息为止，检查分段数不超过容量
+        while (BufferChainPending(&chain) < size) {
+            ssize_t readSize = BufferChainRead(&chain, input[1]);
+            if (readSize <= 0) {
+                break;
+            }
+        }
+        pthread_join(thread, NULL);
+        CHECK(BufferChainPending(&chain) == size, "segment %zu: read %zu of %zu bytes",
+              segmentSize, BufferChainPending(&chain), size);
+        CHECK(chain.segmentCount <= chain.maxSegments, "segment count exceeds capacity");
+        if (chain.length == chain.capacity) {
+            CHECK(-1 == BufferChainRead(&chain, input[1]) && ENOBUFS == errno,
+                  "segment %zu: read into a full chain should fail", segmentSize);
+        }
+
+        // 复制出的数据与发送的一致
+        char *copy = (char *) malloc(size);
+        CHECK(size == BufferChainCopyOut(&chain, copy, size), "copy out is short");
+        CHECK(0 == memcmp(copy, payload, size), "segment %zu: copied data differs", segmentSize);
+
+        // 分多次写出，中途复制剩余的部分
+        size_t written = 0;
+        while (BufferChainPending(&chain) > 0) {
+            ssize_t writtenSize = BufferChainWrite(&chain, output[0]);
+            if (writtenSize <= 0) {
+                break;
+            }
+            written += (size_t) writtenSize;
+
+            char *echo = (char *) malloc(size);
+            ReceiveAll(output[1], echo, (size_t) writtenSize);
+            CHECK(0 == memcmp(echo, payload + written - writtenSize, (size_t) writtenSize),
+                  "segment %zu: written data differs at %zu", segmentSize, written);
+            free(echo);
+
+            size_t remaining = BufferChainCopyOut(&chain, copy, size);
+            CHECK(remaining == size - written && 0 == memcmp(copy, payload + written, remaining),
+                  "segment %zu: pending data differs after %zu bytes", segmentSize, written);
+        }
+        CHECK(written == size, "segment %zu: wrote %zu of %zu bytes", segmentSize, written, size);
+        CHECK(0 == chain.offset && 0 == chain.length, "drained chain should be reset");
+
+        free(copy);
+        free(payload);
+        BufferChainDestroy(&chain);
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+    }
+}
+
+int main() {
+    TestBufferChain();
+    return ReportTestResult();
+}
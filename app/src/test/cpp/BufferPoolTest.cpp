@@ -0,0 +1,80 @@
+/**
+ * 缓冲区池测试
+ *     同一线程中归还的缓冲区被复用，其他线程归还的缓冲区不会丢失，大量空闲的缓冲区链不占用分段
+ */
+#include "TestSupport.h"
+#include "BufferPool.h"
+#include "BufferChain.h"
+#include <stdlib.h> // calloc, free
+#include <string.h> // memset
+#include <errno.h> // errno
+#include <unistd.h> // close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socketpair, socket
+
+/**
+ * 在另一个线程归还缓冲区
+ * @param arg 缓冲区，大小为 16K
+ * @return NULL
+ */
+static void *RunRelease(void *arg) {
+    BufferPoolRelease(arg, 16384);
+    return NULL;
+}
+
+/**
+ * 缓冲区池：同一线程中归还的缓冲区被复用，其他线程归还的缓冲区不会丢失，
+ * 大量空闲的缓冲区链不占用分段
+ */
+static void TestBufferPool() {
+    void *buffer = BufferPoolAcquire(16384);
+    CHECK(NULL != buffer, "acquire failed");
+    memset(buffer, 1, 16384);
+    BufferPoolRelease(buffer, 16384);
+    CHECK(buffer == BufferPoolAcquire(10000), "released buffer should be reused");
+
+    // 其他线程归还的缓冲区经全局空闲链表回到借用线程
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunRelease, buffer);
+    pthread_join(thread, NULL);
+
+    // 不在尺寸等级范围内的请求直接分配
+    const size_t unpooledSizes[] = {1, 2048, 1 << 20};
+    for (size_t size : unpooledSizes) {
+        void *unpooled = BufferPoolAcquire(size);
+        CHECK(NULL != unpooled, "acquire of %zu bytes failed", size);
+        BufferPoolRelease(unpooled, size);
+    }
+
+    // 读到 EAGAIN 的空闲链归还分段，反复借用不会映射新的 slab
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, pair);
+    const size_t chainCount = 10000;
+    struct BufferChain *chains =
+            (struct BufferChain *) calloc(chainCount, sizeof(struct BufferChain));
+
+    struct BufferPoolStats before;
+    BufferPoolGetStats(&before);
+    for (size_t i = 0; i < chainCount; i++) {
+        CHECK(0 == BufferChainInit(&chains[i], 16384, 256 * 1024), "init failed");
+        CHECK(-1 == BufferChainRead(&chains[i], pair[1]) && EAGAIN == errno,
+              "empty socket should return EAGAIN");
+        CHECK(0 == chains[i].segmentCount, "idle chain should not hold segments");
+    }
+    struct BufferPoolStats after;
+    BufferPoolGetStats(&after);
+    CHECK(after.slabCount - before.slabCount <= 1, "idle chains mapped %llu slabs",
+          (unsigned long long) (after.slabCount - before.slabCount));
+
+    for (size_t i = 0; i < chainCount; i++) {
+        BufferChainDestroy(&chains[i]);
+    }
+    free(chains);
+    close(pair[0]);
+    close(pair[1]);
+}
+
+int main() {
+    TestBufferPool();
+    return ReportTestResult();
+}
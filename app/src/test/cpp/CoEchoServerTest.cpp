@@ -0,0 +1,213 @@
+/**
+ * 协程回显服务器测试
+ *     大消息回显、大量并发连接下协程帧的复用，停止时取消等待中的连接，以及描述符耗尽时的退避
+ */
+#include "TestSupport.h"
+#include "CoEchoServer.h"
+#include "CoReactor.h"
+#include "ServerOptions.h"
+#include <stdio.h> // snprintf
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp, strerror
+#include <errno.h> // errno
+#include <unistd.h> // close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, listen, connect, recv
+#include <sys/resource.h> // getrlimit, setrlimit
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h> // htonl, htons
+
+/**
+ * 运行协程服务器的线程
+ */
+struct CoServerThread {
+    struct CoEchoServer *server;
+    int result;
+};
+
+static void *RunCoEchoServer(void *arg) {
+    struct CoServerThread *thread = (struct CoServerThread *) arg;
+    thread->result = CoEchoServerRun(thread->server);
+    return NULL;
+}
+
+/**
+ * 同时打开一批连接，每个连接回显一条消息后关闭
+ * @param port 服务器端口
+ * @param count 连接数
+ * @return 全部连接回显一致返回 true
+ */
+static bool EchoOnConcurrentConnections(unsigned short port, int count) {
+    int *sockets = (int *) malloc(count * sizeof(int));
+    bool echoed = true;
+    for (int i = 0; i < count; i++) {
+        sockets[i] = ConnectLoopback(SOCK_STREAM, port);
+        echoed = echoed && (-1 != sockets[i]);
+    }
+
+    // 全部连接都发出消息后再依次接收，服务器需要同时挂起全部连接的协程
+    const size_t messageSize = 100;
+    char echo[messageSize];
+    for (int i = 0; echoed && i < count; i++) {
+        char *message = NewPayload(messageSize, (unsigned) i);
+        echoed = (0 == SendAll(sockets[i], message, messageSize));
+        free(message);
+    }
+    for (int i = 0; echoed && i < count; i++) {
+        char *message = NewPayload(messageSize, (unsigned) i);
+        echoed = (messageSize == ReceiveAll(sockets[i], echo, messageSize))
+                 && (0 == memcmp(message, echo, messageSize));
+        free(message);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (-1 != sockets[i]) {
+            close(sockets[i]);
+        }
+    }
+    free(sockets);
+    return echoed;
+}
+
+/**
+ * 协程服务器：不同缓冲区大小下的大消息回显；并发连接结束后协程帧回到帧池，
+ * 第二批连接不再申请内存；停止时等待中的连接协程以 ECANCELED 退出并关闭连接
+ */
+static void TestCoroutineEcho() {
+    const int bufferSizes[] = {1, 4096, SERVER_DEFAULT_BUFFER_SIZE};
+    const size_t payloadSizes[] = {1, 4095, 4097, 65536, (1 << 20) + 3, 8 << 20};
+    const int connectionCount = 200;
+
+    for (int bufferSize : bufferSizes) {
+        struct ServerOptions options;
+        ServerOptionsInit(&options);
+        options.backend = IO_BACKEND_COROUTINE;
+        options.bufferSize = bufferSize;
+
+        unsigned short port = 0;
+        int listener = NewListener(&port);
+        CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+        struct CoEchoServer server;
+        CHECK(0 == CoEchoServerInit(&server, &options), "coroutine server init failed");
+        CHECK(0 == CoEchoServerAddListener(&server, listener), "add listener failed");
+        struct CoServerThread serverThread = {&server, -1};
+        pthread_t thread;
+        pthread_create(&thread, NULL, RunCoEchoServer, &serverThread);
+
+        char name[64];
+        snprintf(name, sizeof(name), "coroutine buffer %d", bufferSize);
+        for (size_t size : payloadSizes) {
+            if (1 != bufferSize || size <= 65536) {
+                CheckStreamEcho(name, port, size);
+            }
+        }
+        uint64_t closed = (1 == bufferSize) ? 4 : 6;
+
+        // 两批并发连接，第二批复用第一批归还的协程帧
+        CHECK(EchoOnConcurrentConnections(port, connectionCount),
+              "%s: concurrent echo failed", name);
+        closed += connectionCount;
+        CHECK(WaitForCounter(&server.metrics->closedConnections, closed),
+              "%s: connections were not closed", name);
+        uint64_t allocations = __atomic_load_n(&server.reactor.frames.allocations,
+                                               __ATOMIC_RELAXED);
+        CHECK(EchoOnConcurrentConnections(port, connectionCount),
+              "%s: concurrent echo failed", name);
+        closed += connectionCount;
+        CHECK(WaitForCounter(&server.metrics->closedConnections, closed),
+              "%s: connections were not closed", name);
+        CHECK(allocations == __atomic_load_n(&server.reactor.frames.allocations,
+                                             __ATOMIC_RELAXED),
+              "%s: frames allocated per connection", name);
+
+        // 停止时仍然打开的连接由服务器关闭
+        int sd = ConnectLoopback(SOCK_STREAM, port);
+        CHECK(-1 != sd && 0 == SendAll(sd, "ping", 4), "%s: connect failed", name);
+        char echo[4];
+        CHECK(4 == ReceiveAll(sd, echo, sizeof(echo)), "%s: no echo", name);
+
+        CoEchoServerStop(&server);
+        pthread_join(thread, NULL);
+        CHECK(0 == serverThread.result, "%s: run failed", name);
+        CHECK(0 == server.connectionCount && 0 == server.reactor.frames.liveFrames,
+              "%s: %zu connections and %zu frames left", name, server.connectionCount,
+              server.reactor.frames.liveFrames);
+        CHECK(0 == recv(sd, echo, sizeof(echo), 0), "%s: connection left open", name);
+        close(sd);
+
+        CoEchoServerDestroy(&server);
+        close(listener);
+    }
+}
+
+/**
+ * 描述符耗尽：接受协程暂停一段时间后重试，不停止服务器，描述符释放后积压的连接照常回显
+ */
+static void TestAcceptExhaustion() {
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.backend = IO_BACKEND_COROUTINE;
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+    struct CoEchoServer server;
+    CHECK(0 == CoEchoServerInit(&server, &options), "coroutine server init failed");
+    CHECK(0 == CoEchoServerAddListener(&server, listener), "add listener failed");
+    struct CoServerThread serverThread = {&server, -1};
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunCoEchoServer, &serverThread);
+
+    // 客户 socket 先创建好，再用降低的上限和复制的描述符占满描述符表
+    int client = socket(PF_INET, SOCK_STREAM, 0);
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = 256;
+    setrlimit(RLIMIT_NOFILE, &lowered);
+    int fillers[256];
+    int fillerCount = 0;
+    while (fillerCount < 256) {
+        int fd = dup(client);
+        if (-1 == fd) {
+            break;
+        }
+        fillers[fillerCount++] = fd;
+    }
+
+    uint64_t pauses = __atomic_load_n(&server.metrics->acceptPauses, __ATOMIC_RELAXED);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    CHECK(0 == connect(client, (struct sockaddr *) &address, sizeof(address)),
+          "connect failed: %s", strerror(errno));
+    CHECK(WaitForCounter(&server.metrics->acceptPauses, pauses + 1), "accept never paused");
+
+    // 每 100 毫秒重试一次，而不是反复 accept
+    usleep(300000);
+    uint64_t retries = __atomic_load_n(&server.metrics->acceptPauses, __ATOMIC_RELAXED) - pauses;
+    CHECK(retries < 10, "accept retried %llu times while out of descriptors",
+          (unsigned long long) retries);
+
+    for (int i = 0; i < fillerCount; i++) {
+        close(fillers[i]);
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+    CheckSocketEcho("accept after descriptors freed", client, 100);
+    close(client);
+
+    CoEchoServerStop(&server);
+    pthread_join(thread, NULL);
+    CHECK(0 == serverThread.result, "run failed: %s", strerror(server.error));
+    CoEchoServerDestroy(&server);
+    close(listener);
+}
+
+int main() {
+    TestCoroutineEcho();
+    TestAcceptExhaustion();
+    return ReportTestResult();
+}
@@ -0,0 +1,195 @@
+/**
+ * 连接池测试
+ *     空闲连接被复用，主机的连接数达到上限时借出等待超时，不可复用和空闲超时的连接被关闭，
+ *     关闭时唤醒等待的借出者，借出的连接归还后才释放连接池
+ */
+#include "TestSupport.h"
+#include "ConnectionPool.h"
+#include "SocketProfile.h"
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include <errno.h> // errno
+#include <unistd.h> // close, usleep
+#include <fcntl.h> // fcntl
+#include <pthread.h> // pthread_create, pthread_join
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h> // htonl, htons
+
+/**
+ * 借出和归还：复用空闲连接，达到上限时等待超时，不可复用的连接关闭后可以新建
+ */
+static void TestConnectionReuse() {
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    struct ConnectionPool pool;
+    CHECK(0 == ConnectionPoolInit(&pool, 1, 60000, SocketProfileGet(SOCKET_PROFILE_LOW_LATENCY)),
+          "connection pool init failed");
+
+    // 监听 socket 的 backlog 完成握手，不需要 accept
+    struct PooledConnection *connection = ConnectionPoolAcquire(&pool, &address, 1000);
+    CHECK(NULL != connection && 1 == pool.created, "first acquire should connect");
+    if (NULL == connection) {
+        ConnectionPoolDestroy(&pool);
+        close(listener);
+        return;
+    }
+    int sd = connection->sd;
+
+    // 唯一的连接已经借出
+    errno = 0;
+    CHECK(NULL == ConnectionPoolAcquire(&pool, &address, 50) && ETIMEDOUT == errno,
+          "acquire beyond the limit should time out");
+
+    ConnectionPoolRelease(&pool, connection, true);
+    connection = ConnectionPoolAcquire(&pool, &address, 1000);
+    CHECK(NULL != connection && sd == connection->sd && 1 == pool.reused,
+          "released connection should be reused");
+
+    // 出错的连接不再复用，连接数随之减少
+    ConnectionPoolRelease(&pool, connection, false);
+    connection = ConnectionPoolAcquire(&pool, &address, 1000);
+    CHECK(NULL != connection && 2 == pool.created, "broken connection should be replaced");
+    if (NULL != connection) {
+        ConnectionPoolRelease(&pool, connection, true);
+    }
+
+    ConnectionPoolDestroy(&pool);
+    close(listener);
+}
+
+/**
+ * 空闲超时：超过保留时间的空闲连接在下一次借出时关闭，借出新建的连接
+ */
+static void TestIdleEviction() {
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    struct ConnectionPool pool;
+    CHECK(0 == ConnectionPoolInit(&pool, 4, 10, SocketProfileGet(SOCKET_PROFILE_DEFAULT)),
+          "connection pool init failed");
+    struct PooledConnection *connection = ConnectionPoolAcquire(&pool, &address, 1000);
+    CHECK(NULL != connection, "acquire failed");
+    if (NULL != connection) {
+        ConnectionPoolRelease(&pool, connection, true);
+        usleep(50000);
+        connection = ConnectionPoolAcquire(&pool, &address, 1000);
+        CHECK(NULL != connection && 1 == pool.evicted && 0 == pool.reused && 2 == pool.created,
+              "idle connection should be evicted");
+        if (NULL != connection) {
+            ConnectionPoolRelease(&pool, connection, true);
+        }
+    }
+
+    ConnectionPoolDestroy(&pool);
+    close(listener);
+}
+
+/**
+ * 每个主机的连接数上限不为正数时初始化失败
+ */
+static void TestInvalidLimit() {
+    struct ConnectionPool pool;
+    const int limits[] = {0, -1};
+    for (int limit : limits) {
+        errno = 0;
+        CHECK(-1 == ConnectionPoolInit(&pool, limit, 1000, SocketProfileGet(SOCKET_PROFILE_DEFAULT))
+              && EINVAL == errno, "connection limit %d accepted", limit);
+    }
+}
+
+/**
+ * 在另一个线程中等待借出的调用者
+ */
+struct Borrower {
+    struct ConnectionPool *pool;
+    const struct sockaddr_in *address;
+    struct PooledConnection *connection;
+    int error;
+};
+
+static void *RunBorrower(void *arg) {
+    struct Borrower *borrower = (struct Borrower *) arg;
+    borrower->connection = ConnectionPoolAcquire(borrower->pool, borrower->address, -1);
+    borrower->error = errno;
+    return NULL;
+}
+
+/**
+ * 关闭：等待中的借出者被唤醒并以 ECANCELED 失败，之后的借出同样失败；
+ * 放弃连接池时仍有借出的连接，连接归还时被关闭，连接池随之释放
+ */
+static void TestCloseWithBorrowers() {
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    struct ConnectionPool *pool = (struct ConnectionPool *) malloc(sizeof(struct ConnectionPool));
+    CHECK(0 == ConnectionPoolInit(pool, 1, 60000, SocketProfileGet(SOCKET_PROFILE_DEFAULT)),
+          "connection pool init failed");
+    struct PooledConnection *connection = ConnectionPoolAcquire(pool, &address, 1000);
+    CHECK(NULL != connection, "acquire failed");
+    if (NULL == connection) {
+        ConnectionPoolDestroy(pool);
+        free(pool);
+        close(listener);
+        return;
+    }
+
+    // 唯一的连接已经借出，另一个线程一直等待
+    struct Borrower borrower = {pool, &address, NULL, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunBorrower, &borrower);
+    usleep(50000);
+
+    ConnectionPoolClose(pool);
+    pthread_join(thread, NULL);
+    CHECK(NULL == borrower.connection && ECANCELED == borrower.error,
+          "waiting borrower was not cancelled: %d", borrower.error);
+    errno = 0;
+    CHECK(NULL == ConnectionPoolAcquire(pool, &address, 0) && ECANCELED == errno,
+          "acquire after close should fail");
+
+    // 借出的连接仍然可用，归还时关闭并释放连接池
+    int sd = connection->sd;
+    ConnectionPoolDetach(pool);
+    CHECK(-1 != fcntl(sd, F_GETFD), "borrowed connection closed before release");
+    ConnectionPoolRelease(pool, connection, true);
+    CHECK(-1 == fcntl(sd, F_GETFD), "connection released after close was kept open");
+
+    // 没有使用者时放弃立即释放
+    pool = (struct ConnectionPool *) malloc(sizeof(struct ConnectionPool));
+    CHECK(0 == ConnectionPoolInit(pool, 1, 60000, SocketProfileGet(SOCKET_PROFILE_DEFAULT)),
+          "connection pool init failed");
+    connection = ConnectionPoolAcquire(pool, &address, 1000);
+    if (NULL != connection) {
+        sd = connection->sd;
+        ConnectionPoolRelease(pool, connection, true);
+        ConnectionPoolClose(pool);
+        CHECK(-1 == fcntl(sd, F_GETFD), "idle connection kept open after close");
+    }
+    ConnectionPoolDetach(pool);
+    close(listener);
+}
+
+int main() {
+    TestInvalidLimit();
+    TestConnectionReuse();
+    TestIdleEviction();
+    TestCloseWithBorrowers();
+    return ReportTestResult();
+}
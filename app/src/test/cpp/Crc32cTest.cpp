@@ -0,0 +1,46 @@
+/**
+ * CRC32C 测试
+ *     标准测试向量，硬件实现与可移植实现的一致性，分段计算与一次计算的一致性
+ */
+#include "TestSupport.h"
+#include "Crc32c.h"
+#include <stdlib.h> // free
+#include <string.h> // memset
+
+/**
+ * CRC32C：标准测试向量；硬件实现在任意的起始对齐和长度上与可移植实现一致，分段计算与一次计算一致
+ */
+static void TestCrc32c() {
+    CHECK(0xe3069283u == Crc32c("123456789", 9), "crc32c check value is %08x",
+          Crc32c("123456789", 9));
+    char zeros[32];
+    memset(zeros, 0, sizeof(zeros));
+    CHECK(0x8a9136aau == Crc32c(zeros, sizeof(zeros)), "crc32c of 32 zeros is %08x",
+          Crc32c(zeros, sizeof(zeros)));
+    CHECK(0 == Crc32c(zeros, 0), "crc32c of nothing should be 0");
+
+    // 覆盖对齐前缀、三路交错的长块和短块以及结尾的零散字节
+    const size_t size = 3 * 8192 * 2 + 3 * 256 + 100;
+    char *data = NewPayload(size + 8, 23);
+    const size_t lengths[] = {0, 1, 7, 8, 9, 767, 768, 769, 24575, 24576, 24577, size};
+    for (size_t align = 0; align < 8; align++) {
+        for (size_t length : lengths) {
+            uint32_t portable = Crc32cUpdateWith(CRC32C_PORTABLE, 0, data + align, length);
+            uint32_t hardware = Crc32cUpdateWith(CRC32C_HARDWARE, 0, data + align, length);
+            CHECK(portable == hardware, "crc32c %s differs at offset %zu length %zu",
+                  Crc32cImplementationName(Crc32cGetImplementation()), align, length);
+
+            size_t half = length / 3;
+            uint32_t split = Crc32cUpdate(Crc32cUpdate(0, data + align, half),
+                                          data + align + half, length - half);
+            CHECK(portable == split, "split crc32c differs at offset %zu length %zu", align,
+                  length);
+        }
+    }
+    free(data);
+}
+
+int main() {
+    TestCrc32c();
+    return ReportTestResult();
+}
@@ -0,0 +1,214 @@
+/**
+ * 数据报批量回显测试
+ *     recvmmsg/sendmmsg 一次回显多个数据报，接近 UDP 上限的数据报不会被截断，
+ *     分段卸载时合并接收并按原来的分段长度发回
+ */
+#include "TestSupport.h"
+#include "DatagramBatch.h"
+#include <stdio.h> // fprintf
+#include <stdlib.h> // malloc, free
+#include <string.h> // memset, memcmp, strerror
+#include <errno.h> // errno, ENOPROTOOPT
+#include <unistd.h> // close
+#include <sys/socket.h> // socket, bind, setsockopt, send, recv
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h> // htonl, ntohs
+
+/**
+ * 数据报批量回显：接近 UDP 上限的数据报不会被截断
+ */
+static void TestDatagramEcho() {
+    const size_t payloadSizes[] = {1, 80, 81, 8192, 65507};
+
+    int server = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server, (struct sockaddr *) &address, sizeof(address));
+    socklen_t addressLength = sizeof(address);
+    getsockname(server, (struct sockaddr *) &address, &addressLength);
+
+    // 接收缓冲区要放得下最大的数据报
+    int receiveBufferSize = 1 << 20;
+    setsockopt(server, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    struct DatagramBatch batch;
+    CHECK(0 == DatagramBatchInit(&batch, 4, DATAGRAM_COALESCED_BUFFER_SIZE, false),
+          "datagram batch init failed");
+
+    int client = ConnectLoopback(SOCK_DGRAM, ntohs(address.sin_port));
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    for (size_t size : payloadSizes) {
+        char *payload = NewPayload(size, (unsigned) size);
+        char *echo = (char *) malloc(size + 1);
+
+        CHECK((ssize_t) size == send(client, payload, size, 0), "datagram send failed");
+        CHECK(1 == DatagramBatchEcho(&batch, server), "datagram echo failed");
+        ssize_t receivedSize = recv(client, echo, size + 1, 0);
+        CHECK((ssize_t) size == receivedSize && 0 == memcmp(payload, echo, size),
+              "datagram of %zu bytes: received %zd bytes", size, receivedSize);
+
+        free(echo);
+        free(payload);
+    }
+
+    DatagramBatchDestroy(&batch);
+    close(client);
+    close(server);
+}
+
+/**
+ * 数据报批量回显：一次 recvmmsg 取走已经到达的多个数据报，一次 sendmmsg 按顺序发回；
+ * 超过批量容量的数据报留给下一次回显
+ */
+static void TestDatagramBatch() {
+    const size_t payloadSizes[] = {1, 500, 1472, 9000, 3, 64};
+    const size_t datagramCount = sizeof(payloadSizes) / sizeof(payloadSizes[0]);
+    const int capacity = 4;
+
+    int server = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server, (struct sockaddr *) &address, sizeof(address));
+    socklen_t addressLength = sizeof(address);
+    getsockname(server, (struct sockaddr *) &address, &addressLength);
+    int receiveBufferSize = 1 << 20;
+    setsockopt(server, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    struct DatagramBatch batch;
+    CHECK(0 == DatagramBatchInit(&batch, capacity, 9000, false), "datagram batch init failed");
+    int client = ConnectLoopback(SOCK_DGRAM, ntohs(address.sin_port));
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    char *payloads[datagramCount];
+    for (size_t i = 0; i < datagramCount; i++) {
+        payloads[i] = NewPayload(payloadSizes[i], (unsigned) i + 100);
+        CHECK((ssize_t) payloadSizes[i] == send(client, payloads[i], payloadSizes[i], 0),
+              "datagram send failed");
+    }
+
+    // 回环上发送返回时数据报已经进入服务器的接收队列
+    CHECK(capacity == DatagramBatchEcho(&batch, server), "first batch should be full");
+    CHECK((int) datagramCount - capacity == DatagramBatchEcho(&batch, server),
+          "second batch should take the rest");
+
+    char echo[9001];
+    for (size_t i = 0; i < datagramCount; i++) {
+        ssize_t receivedSize = recv(client, echo, sizeof(echo), 0);
+        CHECK((ssize_t) payloadSizes[i] == receivedSize
+              && 0 == memcmp(payloads[i], echo, payloadSizes[i]),
+              "datagram %zu of %zu bytes: received %zd bytes", i, payloadSizes[i], receivedSize);
+        free(payloads[i]);
+    }
+
+    DatagramBatchDestroy(&batch);
+    close(client);
+    close(server);
+}
+
+/**
+ * 分段卸载：一次 UDP_SEGMENT 发送的多个数据报在服务器合并接收，按原来的分段长度发回；
+ * 启用 UDP_GRO 的客户端收到合并的缓冲区和分段长度，未启用的客户端收到原样的数据报。
+ * 内核不支持时跳过
+ */
+static void TestSegmentOffload() {
+    const size_t segmentSize = 1400;
+    const size_t payloadSize = 10 * segmentSize + 500;
+    const uint64_t segmentCount = (payloadSize + segmentSize - 1) / segmentSize;
+
+    int server = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server, (struct sockaddr *) &address, sizeof(address));
+    socklen_t addressLength = sizeof(address);
+    getsockname(server, (struct sockaddr *) &address, &addressLength);
+    int receiveBufferSize = 1 << 20;
+    setsockopt(server, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
+    if (-1 == DatagramEnableGro(server)) {
+        CHECK(ENOPROTOOPT == errno, "enable GRO failed: %s", strerror(errno));
+        fprintf(stderr, "UDP segmentation offload is not available, skipped.\n");
+        close(server);
+        return;
+    }
+
+    struct DatagramBatch batch;
+    CHECK(0 == DatagramBatchInit(&batch, 16, DATAGRAM_COALESCED_BUFFER_SIZE, true),
+          "datagram batch init failed");
+    char *payload = NewPayload(payloadSize, 7);
+    char *echo = (char *) malloc(DATAGRAM_COALESCED_BUFFER_SIZE);
+
+    // 启用合并接收的客户端
+    int client = ConnectLoopback(SOCK_DGRAM, ntohs(address.sin_port));
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+    CHECK(0 == DatagramEnableGro(client), "enable GRO on client failed: %s", strerror(errno));
+    CHECK((ssize_t) payloadSize == DatagramSendSegmented(client, NULL, payload, payloadSize,
+                                                         segmentSize),
+          "segmented send failed: %s", strerror(errno));
+
+    // 服务器按线上的分段计数，无论内核合并成几个缓冲区
+    while (batch.datagrams < segmentCount) {
+        if (DatagramBatchEcho(&batch, server) <= 0) {
+            CHECK(false, "segmented echo failed: %s", strerror(errno));
+            break;
+        }
+    }
+    CHECK(segmentCount == batch.datagrams, "server counted %llu datagrams",
+          (unsigned long long) batch.datagrams);
+
+    size_t receivedSize = 0;
+    while (receivedSize < payloadSize) {
+        size_t receivedSegmentSize = 0;
+        ssize_t size = DatagramReceiveCoalesced(client, NULL, echo,
+                                                DATAGRAM_COALESCED_BUFFER_SIZE,
+                                                &receivedSegmentSize);
+        if (size <= 0 || receivedSize + (size_t) size > payloadSize) {
+            CHECK(false, "coalesced receive returned %zd: %s", size, strerror(errno));
+            break;
+        }
+        CHECK((size_t) size <= segmentSize || segmentSize == receivedSegmentSize,
+              "coalesced %zd bytes with segment size %zu", size, receivedSegmentSize);
+        CHECK(0 == memcmp(payload + receivedSize, echo, (size_t) size),
+              "coalesced echo differs at %zu", receivedSize);
+        receivedSize += (size_t) size;
+    }
+    close(client);
+
+    // 未启用合并接收的客户端收到与发送时相同长度的数据报
+    client = ConnectLoopback(SOCK_DGRAM, ntohs(address.sin_port));
+    setsockopt(client, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+    CHECK((ssize_t) payloadSize == DatagramSendSegmented(client, NULL, payload, payloadSize,
+                                                         segmentSize),
+          "segmented send failed: %s", strerror(errno));
+    while (batch.datagrams < 2 * segmentCount) {
+        if (DatagramBatchEcho(&batch, server) <= 0) {
+            CHECK(false, "segmented echo failed: %s", strerror(errno));
+            break;
+        }
+    }
+    for (size_t offset = 0; offset < payloadSize; offset += segmentSize) {
+        size_t expected = (payloadSize - offset < segmentSize) ? payloadSize - offset : segmentSize;
+        ssize_t size = recv(client, echo, DATAGRAM_COALESCED_BUFFER_SIZE, 0);
+        CHECK((ssize_t) expected == size && 0 == memcmp(payload + offset, echo, expected),
+              "datagram at %zu: received %zd bytes, expected %zu", offset, size, expected);
+    }
+    close(client);
+
+    free(echo);
+    free(payload);
+    DatagramBatchDestroy(&batch);
+    close(server);
+}
+
+int main() {
+    TestDatagramEcho();
+    TestDatagramBatch();
+    TestSegmentOffload();
+    return ReportTestResult();
+}
@@ -0,0 +1,307 @@
+/**
+ * epoll 事件循环测试
+ *     以不同的缓冲区大小在 TCP 和本地 socket 上回显从 1 字节到数 MB 的消息，包括 splice 零拷贝模式，
+ *     逐字节比较回显与发送的数据；发送积压时按水位暂停读取；忙轮询模式的空转、退避和唤醒；
+ *     描述符耗尽时暂停接受而不空转
+ */
+#include "TestSupport.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include <stdio.h> // snprintf
+#include <stddef.h> // offsetof
+#include <stdlib.h> // malloc, free
+#include <string.h> // strerror, memcmp
+#include <errno.h> // errno
+#include <unistd.h> // close, read, usleep
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, bind, listen, connect, shutdown
+#include <sys/time.h> // timeval
+#include <sys/un.h> // sockaddr_un
+#include <sys/resource.h> // getrlimit, setrlimit
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h> // htonl, htons
+
+/**
+ * epoll 事件循环：各种缓冲区大小下回显各种长度的消息，包括零拷贝模式
+ */
+static void TestEventLoopEcho() {
+    struct Case {
+        int bufferSize;
+        bool zeroCopy;
+        size_t maxPayloadSize;
+    };
+    const struct Case cases[] = {
+            {1,                          false, 65536},
+            {80,                         false, 1 << 20},
+            {4096,                       false, 8 << 20},
+            {SERVER_DEFAULT_BUFFER_SIZE, false, 8 << 20},
+            {SERVER_DEFAULT_BUFFER_SIZE, true,  8 << 20},
+    };
+    const size_t payloadSizes[] = {1, 79, 80, 81, 16383, 16385, 65536, (1 << 20) + 3, 8 << 20};
+
+    for (const struct Case &testCase : cases) {
+        struct ServerOptions options;
+        ServerOptionsInit(&options);
+        options.bufferSize = testCase.bufferSize;
+        options.zeroCopy = testCase.zeroCopy;
+
+        unsigned short port = 0;
+        int listener = NewListener(&port);
+        CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+        struct EventLoop loop;
+        CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+        CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+        pthread_t thread;
+        pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+        char name[64];
+        snprintf(name, sizeof(name), "epoll buffer %d%s", testCase.bufferSize,
+                 testCase.zeroCopy ? " splice" : "");
+        for (size_t size : payloadSizes) {
+            if (size <= testCase.maxPayloadSize) {
+                CheckStreamEcho(name, port, size);
+            }
+        }
+
+        EventLoopStop(&loop);
+        pthread_join(thread, NULL);
+        EventLoopDestroy(&loop);
+        close(listener);
+    }
+}
+
+/**
+ * 发送积压：客户端不读取时服务器继续读取直到高水位，然后暂停读取，
+ * 积压不超过缓冲区大小；客户端开始读取后恢复，回显完整；无效的水位被拒绝
+ */
+static void TestWriteBackpressure() {
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.bufferSize = 64 * 1024;
+    options.writeHighWatermark = 16 * 1024;
+    options.writeLowWatermark = 4 * 1024;
+
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+    CHECK(16 * 1024 == loop.writeHighWatermark && 4 * 1024 == loop.writeLowWatermark,
+          "stream echo should use the watermarks");
+    CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t loopThread;
+    pthread_create(&loopThread, NULL, RunEventLoop, &loop);
+
+    // 复用的指标分片保留之前的计数
+    uint64_t pausesBefore = __atomic_load_n(&loop.metrics->backpressurePauses, __ATOMIC_RELAXED);
+    uint64_t bytesInBefore = __atomic_load_n(&loop.metrics->bytesIn, __ATOMIC_RELAXED);
+    uint64_t bytesOutBefore = __atomic_load_n(&loop.metrics->bytesOut, __ATOMIC_RELAXED);
+
+    // 远多于两端 socket 缓冲区的数据，客户端先不读取
+    size_t size = 32 * 1024 * 1024;
+    char *data = NewPayload(size, 25);
+    int sd = ConnectLoopback(SOCK_STREAM, port);
+    struct Sender sender = {sd, data, size, 0};
+    pthread_t senderThread;
+    pthread_create(&senderThread, NULL, RunSender, &sender);
+
+    uint64_t bytesIn = WaitForSteadyCounter(&loop.metrics->bytesIn) - bytesInBefore;
+    uint64_t bytesOut = __atomic_load_n(&loop.metrics->bytesOut, __ATOMIC_RELAXED) - bytesOutBefore;
+    CHECK(bytesIn < size, "server kept reading from a client that does not read");
+    CHECK(bytesIn - bytesOut <= (uint64_t) options.bufferSize,
+          "backlog %llu exceeds the buffer size",
+          (unsigned long long) (bytesIn - bytesOut));
+    CHECK(__atomic_load_n(&loop.metrics->backpressurePauses, __ATOMIC_RELAXED) > pausesBefore,
+          "pause not counted");
+
+    char *echo = (char *) malloc(size);
+    size_t receivedSize = ReceiveAll(sd, echo, size);
+    if (receivedSize != size) {
+        shutdown(sd, SHUT_RDWR);
+    }
+    pthread_join(senderThread, NULL);
+    CHECK(receivedSize == size && 0 == memcmp(data, echo, size),
+          "backpressure: received %zu of %zu bytes", receivedSize, size);
+    close(sd);
+    free(echo);
+    free(data);
+
+    EventLoopStop(&loop);
+    pthread_join(loopThread, NULL);
+    EventLoopDestroy(&loop);
+    close(listener);
+
+    // 低水位不能高于高水位
+    options.writeLowWatermark = options.writeHighWatermark + 1;
+    CHECK(-1 == EventLoopInit(&loop, &options) && EINVAL == errno,
+          "low watermark above high watermark accepted");
+}
+
+/**
+ * 忙轮询事件循环：有数据时空转，空闲超过退避时间后退回阻塞等待，之后到达的数据仍然被及时回显；
+ * 退避时间为 0 时与阻塞的事件循环相同
+ */
+static void TestBusyPollEcho() {
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.busyPoll = true;
+    options.busyPollIdleMicros = -1;
+
+    struct EventLoop loop;
+    CHECK(-1 == EventLoopInit(&loop, &options) && EINVAL == errno,
+          "negative busy poll idle time accepted");
+
+    const int idleTimes[] = {2000, 0};
+    for (int idleMicros : idleTimes) {
+        options.busyPollIdleMicros = idleMicros;
+        options.busyPollCpu = 0;
+
+        unsigned short port = 0;
+        int listener = NewListener(&port);
+        CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+        CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+        CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+        pthread_t thread;
+        pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+        char name[64];
+        snprintf(name, sizeof(name), "busy poll idle %d us", idleMicros);
+        CheckStreamEcho(name, port, 100);
+        CheckStreamEcho(name, port, 1 << 20);
+
+        // 空闲超过退避时间，事件循环阻塞在 epoll_wait 中，新连接的数据仍然能把它唤醒
+        usleep(20000);
+        CheckStreamEcho(name, port, 100);
+
+        EventLoopStop(&loop);
+        pthread_join(thread, NULL);
+        if (idleMicros > 0) {
+            CHECK(loop.busyPollSpins > 0, "%s: no empty rounds", name);
+            CHECK(loop.busyPollSleeps > 0, "%s: never backed off", name);
+        } else {
+            CHECK(0 == loop.busyPollSpins, "%s: spun %llu rounds", name,
+                  (unsigned long long) loop.busyPollSpins);
+        }
+        EventLoopDestroy(&loop);
+        close(listener);
+    }
+}
+
+/**
+ * epoll 事件循环在本地流 socket 上回显，与 TCP 连接共用同一个循环
+ */
+static void TestLocalStreamEcho() {
+    const size_t payloadSizes[] = {1, 16385, (1 << 20) + 3};
+
+    // 抽象命名空间中的名称，不需要清理文件
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    int nameLength = snprintf(address.sun_path + 1, sizeof(address.sun_path) - 1,
+                              "echo-stream-test-%d", (int) getpid());
+    socklen_t addressLength = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + nameLength);
+    int localListener = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK(0 == bind(localListener, (struct sockaddr *) &address, addressLength)
+          && 0 == listen(localListener, SOMAXCONN), "local listen failed: %s", strerror(errno));
+
+    unsigned short port = 0;
+    int tcpListener = NewListener(&port);
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+    CHECK(0 == EventLoopAddListener(&loop, localListener)
+          && 0 == EventLoopAddListener(&loop, tcpListener), "add listeners failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+    for (size_t size : payloadSizes) {
+        int sd = socket(AF_UNIX, SOCK_STREAM, 0);
+        CHECK(0 == connect(sd, (struct sockaddr *) &address, addressLength),
+              "local connect failed: %s", strerror(errno));
+        struct timeval timeout = {RECEIVE_TIMEOUT, 0};
+        setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        CheckSocketEcho("epoll local", sd, size);
+        close(sd);
+        CheckStreamEcho("epoll tcp beside local", port, size);
+    }
+
+    EventLoopStop(&loop);
+    pthread_join(thread, NULL);
+    EventLoopDestroy(&loop);
+    close(tcpListener);
+    close(localListener);
+}
+
+/**
+ * 描述符耗尽：accept 失败后暂停接受，事件循环不空转；描述符释放后接受积压的连接并回显
+ */
+static void TestAcceptExhaustion() {
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+    CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+    // 客户 socket 先创建好，再用降低的上限和复制的描述符占满描述符表
+    int client = socket(PF_INET, SOCK_STREAM, 0);
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = 256;
+    setrlimit(RLIMIT_NOFILE, &lowered);
+    int fillers[256];
+    int fillerCount = 0;
+    while (fillerCount < 256) {
+        int fd = dup(client);
+        if (-1 == fd) {
+            break;
+        }
+        fillers[fillerCount++] = fd;
+    }
+
+    uint64_t pauses = __atomic_load_n(&loop.metrics->acceptPauses, __ATOMIC_RELAXED);
+    uint64_t syscalls = __atomic_load_n(&loop.metrics->syscalls, __ATOMIC_RELAXED);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    CHECK(0 == connect(client, (struct sockaddr *) &address, sizeof(address)),
+          "connect failed: %s", strerror(errno));
+    CHECK(WaitForCounter(&loop.metrics->acceptPauses, pauses + 1), "accept never paused");
+
+    // 暂停期间每 100 毫秒重试一次，水平触发的监听 socket 不会让事件循环空转
+    usleep(300000);
+    uint64_t spent = __atomic_load_n(&loop.metrics->syscalls, __ATOMIC_RELAXED) - syscalls;
+    CHECK(spent < 100, "event loop spun: %llu syscalls while out of descriptors",
+          (unsigned long long) spent);
+
+    for (int i = 0; i < fillerCount; i++) {
+        close(fillers[i]);
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+    CheckSocketEcho("accept after descriptors freed", client, 100);
+    close(client);
+
+    EventLoopStop(&loop);
+    pthread_join(thread, NULL);
+    EventLoopDestroy(&loop);
+    close(listener);
+}
+
+int main() {
+    TestEventLoopEcho();
+    TestLocalStreamEcho();
+    TestWriteBackpressure();
+    TestBusyPollEcho();
+    TestAcceptExhaustion();
+    return ReportTestResult();
+}
@@ -0,0 +1,181 @@
+/**
+ * 长度前缀帧测试
+ *     帧流以任意的边界到达时完整的帧按顺序回显，超过缓冲区的帧关闭连接；
+ *     校验模式下损坏的帧和放不下帧尾的帧关闭连接并计入校验错误
+ */
+#include "TestSupport.h"
+#include "Frame.h"
+#include "Crc32c.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp, memset
+#include <unistd.h> // close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // shutdown, recv
+
+/**
+ * epoll 事件循环分帧模式：各种长度的帧以任意的边界到达，完整的帧按顺序原样回显；
+ * 超过缓冲区容量的帧关闭连接
+ */
+static void TestFramedEcho() {
+    const int bufferSizes[] = {80, 4096, SERVER_DEFAULT_BUFFER_SIZE};
+
+    for (int bufferSize : bufferSizes) {
+        struct ServerOptions options;
+        ServerOptionsInit(&options);
+        options.bufferSize = bufferSize;
+        options.framing = true;
+        options.zeroCopy = true;
+
+        unsigned short port = 0;
+        int listener = NewListener(&port);
+        struct EventLoop loop;
+        CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+        CHECK(!loop.zeroCopy, "framing should disable zero copy");
+        CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+        pthread_t loopThread;
+        pthread_create(&loopThread, NULL, RunEventLoop, &loop);
+
+        // 负载长度从 0 到最大，帧的总长度不超过缓冲区大小
+        size_t maxPayload = (size_t) bufferSize - FRAME_HEADER_SIZE;
+        size_t streamSize = 0;
+        size_t frameCount = 0;
+        for (size_t payload = 0; payload <= maxPayload; payload = payload * 2 + 1) {
+            streamSize += FRAME_HEADER_SIZE + payload;
+            frameCount++;
+        }
+        // 最后一帧恰好等于缓冲区大小
+        streamSize += (size_t) bufferSize;
+        frameCount++;
+
+        char *stream = NewPayload(streamSize, (unsigned) bufferSize);
+        size_t offset = 0;
+        for (size_t payload = 0; payload <= maxPayload; payload = payload * 2 + 1) {
+            FrameEncodeHeader(stream + offset, (uint32_t) payload);
+            offset += FRAME_HEADER_SIZE + payload;
+        }
+        FrameEncodeHeader(stream + offset, (uint32_t) maxPayload);
+
+        uint64_t messagesBefore = __atomic_load_n(&loop.metrics->messagesIn, __ATOMIC_RELAXED);
+        int sd = ConnectLoopback(SOCK_STREAM, port);
+        struct Sender sender = {sd, stream, streamSize, 0};
+        pthread_t senderThread;
+        pthread_create(&senderThread, NULL, RunChunkedSender, &sender);
+        char *echo = (char *) malloc(streamSize);
+        size_t receivedSize = ReceiveAll(sd, echo, streamSize);
+        if (receivedSize != streamSize) {
+            shutdown(sd, SHUT_RDWR);
+        }
+        pthread_join(senderThread, NULL);
+        CHECK(receivedSize == streamSize && 0 == memcmp(stream, echo, streamSize),
+              "framed buffer %d: received %zu of %zu bytes", bufferSize, receivedSize, streamSize);
+        uint64_t messagesAfter = __atomic_load_n(&loop.metrics->messagesIn, __ATOMIC_RELAXED);
+        CHECK(messagesAfter - messagesBefore == frameCount,
+              "framed buffer %d: counted %llu of %zu frames", bufferSize, (unsigned long long) (messagesAfter - messagesBefore), frameCount);
+
+        // 帧的总长度超过缓冲区大小，服务器关闭连接
+        char header[FRAME_HEADER_SIZE];
+        FrameEncodeHeader(header, (uint32_t) bufferSize);
+        CHECK(0 == SendAll(sd, header, sizeof(header)), "sending oversized header failed");
+        CHECK(0 == recv(sd, echo, 1, 0), "framed buffer %d: oversized frame should close", bufferSize);
+
+        free(echo);
+        free(stream);
+        close(sd);
+        EventLoopStop(&loop);
+        pthread_join(loopThread, NULL);
+        EventLoopDestroy(&loop);
+        close(listener);
+    }
+}
+
+/**
+ * epoll 事件循环校验模式：带 CRC32C 帧尾的帧以任意的边界到达、跨越缓冲区链的分段，
+ * 校验通过的帧按顺序原样回显；负载损坏或者帧短于帧尾时关闭连接并计入校验错误
+ */
+static void TestIntegrityEcho() {
+    const int bufferSizes[] = {80, 4096, SERVER_DEFAULT_BUFFER_SIZE};
+
+    for (int bufferSize : bufferSizes) {
+        struct ServerOptions options;
+        ServerOptionsInit(&options);
+        options.bufferSize = bufferSize;
+        options.integrity = true;
+
+        unsigned short port = 0;
+        int listener = NewListener(&port);
+        struct EventLoop loop;
+        CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+        CHECK(loop.framing && loop.checksums, "integrity should enable checked framing");
+        CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+        pthread_t loopThread;
+        pthread_create(&loopThread, NULL, RunEventLoop, &loop);
+
+        // 负载长度从 0 到最大，最后一帧恰好等于缓冲区大小
+        size_t maxPayload = (size_t) bufferSize - FRAME_HEADER_SIZE - FRAME_CHECKSUM_SIZE;
+        size_t streamSize = 0;
+        for (size_t payload = 0; payload <= maxPayload; payload = payload * 2 + 1) {
+            streamSize += FRAME_HEADER_SIZE + payload + FRAME_CHECKSUM_SIZE;
+        }
+        streamSize += (size_t) bufferSize;
+
+        char *stream = NewPayload(streamSize, (unsigned) bufferSize + 1);
+        size_t offset = 0;
+        for (size_t payload = 0; payload <= maxPayload; payload = payload * 2 + 1) {
+            EncodeCheckedFrame(stream + offset, payload);
+            offset += FRAME_HEADER_SIZE + payload + FRAME_CHECKSUM_SIZE;
+        }
+        EncodeCheckedFrame(stream + offset, maxPayload);
+
+        // 复用的指标分片保留之前的计数
+        uint64_t errorsBefore = __atomic_load_n(&loop.metrics->checksumErrors, __ATOMIC_RELAXED);
+        int sd = ConnectLoopback(SOCK_STREAM, port);
+        struct Sender sender = {sd, stream, streamSize, 0};
+        pthread_t senderThread;
+        pthread_create(&senderThread, NULL, RunChunkedSender, &sender);
+        char *echo = (char *) malloc(streamSize);
+        size_t receivedSize = ReceiveAll(sd, echo, streamSize);
+        if (receivedSize != streamSize) {
+            shutdown(sd, SHUT_RDWR);
+        }
+        pthread_join(senderThread, NULL);
+        CHECK(receivedSize == streamSize && 0 == memcmp(stream, echo, streamSize),
+              "checked buffer %d: received %zu of %zu bytes", bufferSize, receivedSize, streamSize);
+        CHECK(errorsBefore == __atomic_load_n(&loop.metrics->checksumErrors, __ATOMIC_RELAXED),
+              "checked buffer %d: intact frames counted as corrupted", bufferSize);
+
+        // 最后一帧的负载翻转一位，服务器不回显并关闭连接
+        offset = streamSize - (size_t) bufferSize;
+        stream[offset + FRAME_HEADER_SIZE + maxPayload / 2] ^= 0x10;
+        CHECK(0 == SendAll(sd, stream + offset, (size_t) bufferSize), "sending corrupted frame failed");
+        CHECK(0 == recv(sd, echo, 1, 0), "checked buffer %d: corrupted frame should close", bufferSize);
+        close(sd);
+        CHECK(WaitForCounter(&loop.metrics->checksumErrors, errorsBefore + 1),
+              "checked buffer %d: corrupted frame not counted", bufferSize);
+
+        // 帧的长度放不下帧尾
+        sd = ConnectLoopback(SOCK_STREAM, port);
+        char frame[FRAME_HEADER_SIZE + FRAME_CHECKSUM_SIZE - 1];
+        memset(frame, 0, sizeof(frame));
+        FrameEncodeHeader(frame, FRAME_CHECKSUM_SIZE - 1);
+        CHECK(0 == SendAll(sd, frame, sizeof(frame)), "sending short frame failed");
+        CHECK(0 == recv(sd, echo, 1, 0), "checked buffer %d: short frame should close", bufferSize);
+        close(sd);
+        CHECK(WaitForCounter(&loop.metrics->checksumErrors, errorsBefore + 2),
+              "checked buffer %d: short frame not counted", bufferSize);
+
+        free(echo);
+        free(stream);
+        EventLoopStop(&loop);
+        pthread_join(loopThread, NULL);
+        EventLoopDestroy(&loop);
+        close(listener);
+    }
+}
+
+int main() {
+    TestFramedEcho();
+    TestIntegrityEcho();
+    return ReportTestResult();
+}
@@ -0,0 +1,218 @@
+/**
+ * 消息处理器和处理线程池测试
+ *     线程池内外的响应按请求顺序发回，慢的请求不阻塞其他连接，停止时释放仍在处理的帧
+ */
+#include "TestSupport.h"
+#include "MessageHandler.h"
+#include "HandlerPool.h"
+#include "Frame.h"
+#include "Crc32c.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include "Metrics.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcpy, memcmp
+#include <unistd.h> // close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // shutdown
+#include <time.h> // nanosleep
+
+/**
+ * 按长度 0 到最大的负载构造帧流，最后一帧恰好等于缓冲区大小
+ * @param bufferSize 缓冲区大小
+ * @param checksums 是否附加 CRC32C 帧尾
+ * @param streamSize 帧流的长度
+ * @return 帧流，由调用者释放
+ */
+static char *NewFrameStream(int bufferSize, bool checksums, size_t *streamSize) {
+    size_t trailerSize = checksums ? FRAME_CHECKSUM_SIZE : 0;
+    size_t maxPayload = (size_t) bufferSize - FRAME_HEADER_SIZE - trailerSize;
+    *streamSize = 0;
+    for (size_t payload = 0; payload < maxPayload; payload = payload * 2 + 1) {
+        *streamSize += FRAME_HEADER_SIZE + payload + trailerSize;
+    }
+    *streamSize += (size_t) bufferSize;
+
+    char *stream = NewPayload(*streamSize, (unsigned) bufferSize + 2);
+    size_t offset = 0;
+    for (size_t payload = 0; offset < *streamSize; payload = payload * 2 + 1) {
+        if (payload > maxPayload) {
+            payload = maxPayload;
+        }
+        if (checksums) {
+            EncodeCheckedFrame(stream + offset, payload);
+        } else {
+            FrameEncodeHeader(stream + offset, (uint32_t) payload);
+        }
+        offset += FRAME_HEADER_SIZE + payload + trailerSize;
+    }
+    return stream;
+}
+
+/**
+ * 慢请求的处理时间，单位毫秒
+ */
+#define SLOW_HANDLER_MILLIS 300
+
+/**
+ * 以 's' 开头的请求先等待 SLOW_HANDLER_MILLIS 再原样回显，其他请求直接回显
+ */
+static int HandleSlowEcho(const char *request, size_t length, struct HandlerOutput *output) {
+    if (length > 0 && 's' == request[0]) {
+        struct timespec delay = {0, SLOW_HANDLER_MILLIS * 1000000L};
+        nanosleep(&delay, NULL);
+    }
+    char *response = HandlerOutputReserve(output, length);
+    if (NULL == response) {
+        return -1;
+    }
+    memcpy(response, request, length);
+    return 0;
+}
+
+static const struct MessageHandler slowEchoHandler = {"slow-echo", HandleSlowEcho};
+
+/**
+ * 消息处理器：倒序处理器在 I/O 线程和线程池中、有无校验帧尾、帧是否超过分段时都按请求顺序
+ * 发回倒序的负载；
+ * 线程池中慢的请求不阻塞其他连接，排在它后面的请求被空闲线程窃取；
+ * 停止时仍在处理的帧在线程池停止后释放
+ */
+static void TestMessageHandlers() {
+    // 缓冲区大于一个分段时，后面的帧放不进复用的帧，需要重新分配
+    const int bufferSizes[] = {4096, 65536};
+    const int threadCounts[] = {0, 2};
+
+    for (int bufferSize : bufferSizes) {
+        for (int threads : threadCounts) {
+            for (int checked = 0; checked < 2; checked++) {
+                struct ServerOptions options;
+                ServerOptionsInit(&options);
+                options.bufferSize = bufferSize;
+                options.framing = true;
+                options.integrity = (1 == checked);
+                options.messageHandler = MESSAGE_HANDLER_REVERSE;
+                options.handlerThreads = threads;
+
+                unsigned short port = 0;
+                int listener = NewListener(&port);
+                struct EventLoop loop;
+                CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+                CHECK(NULL != loop.handler && (threads > 0) == (NULL != loop.handlerPool),
+                      "handler %d threads: handler not set up", threads);
+                CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+                pthread_t loopThread;
+                pthread_create(&loopThread, NULL, RunEventLoop, &loop);
+
+                // 期望的响应：帧头不变，负载倒序，校验模式下重新计算帧尾
+                size_t streamSize = 0;
+                char *stream = NewFrameStream(options.bufferSize, options.integrity, &streamSize);
+                char *expected = (char *) malloc(streamSize);
+                size_t trailerSize = options.integrity ? FRAME_CHECKSUM_SIZE : 0;
+                size_t frameCount = 0;
+                for (size_t offset = 0; offset < streamSize; frameCount++) {
+                    size_t payload = FrameDecodeHeader(stream + offset) - trailerSize;
+                    memcpy(expected + offset, stream + offset, FRAME_HEADER_SIZE);
+                    for (size_t i = 0; i < payload; i++) {
+                        expected[offset + FRAME_HEADER_SIZE + i] =
+                                stream[offset + FRAME_HEADER_SIZE + payload - 1 - i];
+                    }
+                    if (options.integrity) {
+                        EncodeCheckedFrame(expected + offset, payload);
+                    }
+                    offset += FRAME_HEADER_SIZE + payload + trailerSize;
+                }
+
+                int sd = ConnectLoopback(SOCK_STREAM, port);
+                struct Sender sender = {sd, stream, streamSize, 0};
+                pthread_t senderThread;
+                pthread_create(&senderThread, NULL, RunChunkedSender, &sender);
+                char *echo = (char *) malloc(streamSize);
+                size_t receivedSize = ReceiveAll(sd, echo, streamSize);
+                if (receivedSize != streamSize) {
+                    shutdown(sd, SHUT_RDWR);
+                }
+                pthread_join(senderThread, NULL);
+                CHECK(receivedSize == streamSize && 0 == memcmp(expected, echo, streamSize),
+                      "reverse %d bytes %d threads checked %d: received %zu of %zu bytes",
+                      bufferSize, threads, checked, receivedSize, streamSize);
+                close(sd);
+                if (NULL != loop.handlerPool) {
+                    CHECK(frameCount == __atomic_load_n(&loop.handlerPool->executedTasks,
+                                                        __ATOMIC_RELAXED),
+                          "reverse %d threads: frames not handled by the pool", threads);
+                }
+
+                free(echo);
+                free(expected);
+                free(stream);
+                EventLoopStop(&loop);
+                pthread_join(loopThread, NULL);
+                EventLoopDestroy(&loop);
+                close(listener);
+            }
+        }
+    }
+
+    // 慢的请求占用一个处理线程，另一个连接的请求仍然马上得到响应
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.framing = true;
+    options.handlerThreads = 2;
+
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+    loop.handler = &slowEchoHandler;
+    CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t loopThread;
+    pthread_create(&loopThread, NULL, RunEventLoop, &loop);
+
+    char slowFrame[FRAME_HEADER_SIZE + 1];
+    FrameEncodeHeader(slowFrame, 1);
+    slowFrame[FRAME_HEADER_SIZE] = 's';
+    char fastFrame[FRAME_HEADER_SIZE + 1];
+    FrameEncodeHeader(fastFrame, 1);
+    fastFrame[FRAME_HEADER_SIZE] = 'f';
+    char reply[FRAME_HEADER_SIZE + 1];
+
+    // 复用的指标分片保留之前的计数
+    int slow = ConnectLoopback(SOCK_STREAM, port);
+    int fast = ConnectLoopback(SOCK_STREAM, port);
+    uint64_t messagesIn = __atomic_load_n(&loop.metrics->messagesIn, __ATOMIC_RELAXED);
+    CHECK(0 == SendAll(slow, slowFrame, sizeof(slowFrame)), "sending slow frame failed");
+    CHECK(WaitForCounter(&loop.metrics->messagesIn, messagesIn + 1), "slow frame not received");
+
+    // 第一帧交给空闲的线程，第二帧排在慢请求的队列中，被空闲的线程窃取
+    uint64_t startedAt = MetricsNow();
+    for (int i = 0; i < 4; i++) {
+        CHECK(0 == SendAll(fast, fastFrame, sizeof(fastFrame)), "sending fast frame failed");
+        CHECK(sizeof(reply) == ReceiveAll(fast, reply, sizeof(reply))
+              && 0 == memcmp(fastFrame, reply, sizeof(reply)), "fast frame %d not echoed", i);
+    }
+    CHECK(MetricsNow() - startedAt < SLOW_HANDLER_MILLIS * 1000000ULL,
+          "fast frames blocked behind the slow one");
+    CHECK(__atomic_load_n(&loop.handlerPool->stolenTasks, __ATOMIC_RELAXED) > 0,
+          "no task stolen from the busy worker");
+    CHECK(sizeof(reply) == ReceiveAll(slow, reply, sizeof(reply))
+          && 0 == memcmp(slowFrame, reply, sizeof(reply)), "slow frame not echoed");
+    close(fast);
+    close(slow);
+
+    // 停止时仍在处理的帧没有连接可以交还
+    slow = ConnectLoopback(SOCK_STREAM, port);
+    messagesIn = __atomic_load_n(&loop.metrics->messagesIn, __ATOMIC_RELAXED);
+    CHECK(0 == SendAll(slow, slowFrame, sizeof(slowFrame)), "sending slow frame failed");
+    CHECK(WaitForCounter(&loop.metrics->messagesIn, messagesIn + 1), "slow frame not received");
+    EventLoopStop(&loop);
+    pthread_join(loopThread, NULL);
+    EventLoopDestroy(&loop);
+    close(slow);
+    close(listener);
+}
+
+int main() {
+    TestMessageHandlers();
+    return ReportTestResult();
+}
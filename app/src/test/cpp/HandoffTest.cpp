@@ -0,0 +1,101 @@
+/**
+ * 服务器交接测试
+ *     监听 socket 和连接在消息边界上交给新实例，客户端感觉不到切换；排空时关闭空闲的连接
+ */
+#include "TestSupport.h"
+#include "Handoff.h"
+#include "Frame.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp
+#include <unistd.h> // read, close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, socketpair, recv
+
+/**
+ * 服务器交接：监听 socket 和空闲的连接交给新实例，停在不完整帧上的连接等帧回显完才交出，
+ * 旧实例的监听 socket 关闭后新实例继续接受连接；新实例排空时关闭空闲的连接
+ */
+static void TestHandoff() {
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.framing = true;
+
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    struct EventLoop oldLoop;
+    CHECK(0 == EventLoopInit(&oldLoop, &options), "event loop init failed");
+    CHECK(0 == EventLoopAddListener(&oldLoop, listener), "add listener failed");
+    pthread_t oldThread;
+    pthread_create(&oldThread, NULL, RunEventLoop, &oldLoop);
+
+    int idle = ConnectLoopback(SOCK_STREAM, port);
+    int busy = ConnectLoopback(SOCK_STREAM, port);
+    CHECK(EchoFrame(idle, 100, 1) && EchoFrame(busy, 100, 2), "echo before handoff failed");
+
+    // 旧实例已经读入半个帧
+    const size_t payloadSize = 1000;
+    char *frame = NewPayload(FRAME_HEADER_SIZE + payloadSize, 3);
+    FrameEncodeHeader(frame, (uint32_t) payloadSize);
+    uint64_t bytesIn = __atomic_load_n(&oldLoop.metrics->bytesIn, __ATOMIC_RELAXED);
+    CHECK(0 == SendAll(busy, frame, 500), "sending half a frame failed");
+    CHECK(WaitForCounter(&oldLoop.metrics->bytesIn, bytesIn + 500), "half a frame not read");
+
+    struct EventLoop newLoop;
+    CHECK(0 == EventLoopInit(&newLoop, &options), "event loop init failed");
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair);
+    CHECK(0 == EventLoopAddHandoff(&newLoop, pair[1]), "add handoff failed");
+    pthread_t newThread;
+    pthread_create(&newThread, NULL, RunEventLoop, &newLoop);
+
+    // 新实例收到监听 socket 和空闲的连接，不完整的帧留在旧实例
+    EventLoopHandoff(&oldLoop, pair[0]);
+    CHECK(WaitForCounter(&newLoop.metrics->acceptedConnections, 1),
+          "idle connection not handed off");
+    CHECK(EchoFrame(idle, 200, 4), "idle connection failed after handoff");
+    CHECK(1 == EventLoopConnectionCount(&oldLoop) && EventLoopIsDraining(&oldLoop),
+          "the connection with half a frame should stay with the old server");
+
+    // 帧完整后回显，连接交出，旧实例结束
+    char *echo = (char *) malloc(FRAME_HEADER_SIZE + payloadSize);
+    CHECK(0 == SendAll(busy, frame + 500, FRAME_HEADER_SIZE + payloadSize - 500)
+          && FRAME_HEADER_SIZE + payloadSize
+             == ReceiveAll(busy, echo, FRAME_HEADER_SIZE + payloadSize)
+          && 0 == memcmp(frame, echo, FRAME_HEADER_SIZE + payloadSize),
+          "completing the frame failed during drain");
+    pthread_join(oldThread, NULL);
+    CHECK(0 == oldLoop.connectionCount, "the old server should hand off every connection");
+    EventLoopDestroy(&oldLoop);
+    close(listener);
+    free(echo);
+    free(frame);
+
+    // 新实例服务交出的连接，并继续在同一个端口上接受连接
+    CHECK(EchoFrame(busy, 300, 5), "busy connection failed after handoff");
+    int fresh = ConnectLoopback(SOCK_STREAM, port);
+    CHECK(-1 != fresh && EchoFrame(fresh, 400, 6), "new connection failed after handoff");
+    CHECK(3 == __atomic_load_n(&newLoop.metrics->acceptedConnections, __ATOMIC_RELAXED),
+          "the new server should own every connection");
+
+    // 排空新实例：空闲的连接被关闭，事件循环返回
+    EventLoopDrain(&newLoop);
+    pthread_join(newThread, NULL);
+    char byte;
+    CHECK(0 == recv(idle, &byte, 1, 0) && 0 == recv(busy, &byte, 1, 0)
+          && 0 == recv(fresh, &byte, 1, 0), "drain should close idle connections");
+    for (size_t i = 0; i < newLoop.listenerCount; i++) {
+        close(newLoop.listeners[i]->fd);
+    }
+    EventLoopDestroy(&newLoop);
+
+    close(fresh);
+    close(busy);
+    close(idle);
+}
+
+int main() {
+    TestHandoff();
+    return ReportTestResult();
+}
@@ -0,0 +1,113 @@
+/**
+ * 直方图测试
+ *     百分位数的相对误差不超过分桶精度，精确的最小值和最大值，合并后的计数
+ */
+#include "TestSupport.h"
+#include "Histogram.h"
+
+/**
+ * 记录 1 到 100000 的均匀分布：各百分位数在分桶精度内，最大值不超过精确的最大值
+ */
+static void TestPercentiles() {
+    struct Histogram histogram;
+    HistogramReset(&histogram);
+    const uint64_t count = 100000;
+    for (uint64_t value = 1; value <= count; value++) {
+        HistogramRecord(&histogram, value);
+    }
+    CHECK(count == histogram.totalCount && 1 == histogram.min && count == histogram.max,
+          "count, min or max wrong");
+    CHECK(count * (count + 1) / 2 == histogram.sum, "sum wrong");
+
+    // 每个 2 的幂区间 64 个子桶，相对误差不超过 1/64
+    const double percentiles[] = {50.0, 90.0, 99.0, 99.9};
+    for (double percentile : percentiles) {
+        uint64_t expected = (uint64_t) (percentile / 100.0 * (double) count);
+        uint64_t value = HistogramValueAtPercentile(&histogram, percentile);
+        CHECK(value >= expected && value <= expected + expected / 64,
+              "p%.1f is %llu, expected about %llu", percentile, (unsigned long long) value,
+              (unsigned long long) expected);
+    }
+    CHECK(count == HistogramValueAtPercentile(&histogram, 100.0), "p100 should be the max");
+
+    // 合并后计数加倍，百分位数不变
+    struct Histogram merged;
+    HistogramReset(&merged);
+    HistogramMerge(&merged, &histogram);
+    HistogramMerge(&merged, &histogram);
+    CHECK(2 * count == merged.totalCount && 1 == merged.min && count == merged.max,
+          "merged count, min or max wrong");
+    CHECK(HistogramValueAtPercentile(&histogram, 50.0) == HistogramValueAtPercentile(&merged, 50.0),
+          "merging a histogram with itself should keep the median");
+}
+
+/**
+ * 桶的下标随值单调不减，超过可记录的最大值时按最大值计算
+ */
+static void TestBucketIndex() {
+    int previous = HistogramBucketIndex(0);
+    for (uint64_t value = 1; value < ((uint64_t) 1 << 40); value = value * 3 / 2 + 1) {
+        int index = HistogramBucketIndex(value);
+        CHECK(index >= previous && index < HISTOGRAM_BUCKET_COUNT, "bucket of %llu is %d",
+              (unsigned long long) value, index);
+        previous = index;
+    }
+    CHECK(HistogramBucketIndex(UINT64_MAX) == HistogramBucketIndex((uint64_t) 1 << HISTOGRAM_VALUE_BITS),
+          "values beyond the range should share the last bucket");
+    CHECK(HistogramBucketIndex(UINT64_MAX) < HISTOGRAM_BUCKET_COUNT, "last bucket out of range");
+}
+
+/**
+ * 分桶精度：只有一个较小值和一个很大的值时，中位数是较小值所在桶的上界，
+ * 小于 128 的值精确，之后不超过值的 1/64，在桶的起点处接近 1/64
+ */
+static void TestBucketPrecision() {
+    // 小于 2^12 的值逐一检查，之后检查每个 2 的幂附近和中间的值
+    uint64_t values[4096 + 5 * 40];
+    int count = 0;
+    for (uint64_t value = 1; value < 4096; value++) {
+        values[count++] = value;
+    }
+    for (int bits = 12; bits < 52; bits++) {
+        uint64_t power = (uint64_t) 1 << bits;
+        const uint64_t candidates[] = {power - 1, power, power + 1, power + power / 2,
+                                       power + power / 64};
+        for (uint64_t value : candidates) {
+            values[count++] = value;
+        }
+    }
+
+    const uint64_t maxValue = ((uint64_t) 1 << HISTOGRAM_VALUE_BITS) - 1;
+    struct Histogram histogram;
+    double worst = 0.0;
+    for (int i = 0; i < count; i++) {
+        uint64_t value = values[i];
+        HistogramReset(&histogram);
+        HistogramRecord(&histogram, value);
+        HistogramRecord(&histogram, UINT64_MAX);
+        uint64_t median = HistogramValueAtPercentile(&histogram, 50.0);
+
+        // 超出范围的值按最大值记录
+        uint64_t recorded = (value > maxValue) ? maxValue : value;
+        if (recorded < 128) {
+            CHECK(recorded == median, "%llu reported as %llu", (unsigned long long) recorded,
+                  (unsigned long long) median);
+        } else {
+            CHECK(median >= recorded && median - recorded <= recorded / 64,
+                  "%llu reported as %llu", (unsigned long long) recorded,
+                  (unsigned long long) median);
+        }
+        double error = (double) (median - recorded) / (double) recorded;
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    CHECK(worst > 1.0 / 65 && worst <= 1.0 / 64, "worst relative error %.5f", worst);
+}
+
+int main() {
+    TestPercentiles();
+    TestBucketIndex();
+    TestBucketPrecision();
+    return ReportTestResult();
+}
@@ -0,0 +1,96 @@
+/**
+ * 负载生成器测试
+ *     对 epoll 服务器运行闭环和开环负载，请求数与直方图记录数一致；
+ *     大请求在发送中途取走回显，不会与服务器互相阻塞而超过运行时间
+ */
+#include "TestSupport.h"
+#include "LoadGenerator.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // strerror
+#include <errno.h> // errno
+#include <unistd.h> // close
+#include <pthread.h> // pthread_create, pthread_join
+#include <arpa/inet.h> // htonl, htons
+
+/**
+ * 对 epoll 服务器运行一次负载并检查结果
+ * @param name 负载的描述
+ * @param options 负载参数，地址由本函数填写
+ * @param port 服务器端口
+ * @param result 负载结果
+ */
+static void RunLoad(const char *name, struct LoadOptions *options, unsigned short port,
+                    struct LoadResult *result) {
+    options->address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    options->address.sin_port = htons(port);
+
+    CHECK(0 == LoadGeneratorRun(options, result), "%s: %s", name, strerror(errno));
+    CHECK(result->requests > 0 && 0 == result->errors && 0 == result->checksumErrors,
+          "%s: %llu requests, %llu errors", name, (unsigned long long) result->requests,
+          (unsigned long long) result->errors);
+    CHECK(result->requests == result->latency.totalCount, "%s: %llu requests, %llu latencies",
+          name, (unsigned long long) result->requests,
+          (unsigned long long) result->latency.totalCount);
+    CHECK(result->latency.min > 0 && result->latency.max <= result->elapsedNanos,
+          "%s: latency out of range", name);
+
+    // 运行时间之后最多再等一个回显超时
+    uint64_t limit = (options->duration + options->timeout) * 1000000ULL;
+    CHECK(result->elapsedNanos >= options->duration * 1000000ULL && result->elapsedNanos <= limit,
+          "%s: ran %llu ms", name, (unsigned long long) (result->elapsedNanos / 1000000));
+}
+
+/**
+ * 闭环、开环、分帧校验和大请求的负载
+ */
+static void TestLoadGenerator() {
+    struct ServerOptions serverOptions;
+    ServerOptionsInit(&serverOptions);
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &serverOptions), "event loop init failed");
+    CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+    struct LoadResult *result = (struct LoadResult *) malloc(sizeof(struct LoadResult));
+    struct LoadOptions options;
+
+    // 闭环：4 个连接分给 2 个线程
+    LoadOptionsInit(&options);
+    options.connections = 4;
+    options.threads = 2;
+    options.duration = 200;
+    RunLoad("closed loop", &options, port, result);
+
+    // 开环：按固定速率发送，请求数接近速率乘以运行时间
+    LoadOptionsInit(&options);
+    options.duration = 500;
+    options.rate = 200;
+    RunLoad("open loop", &options, port, result);
+    CHECK(result->requests >= 50 && result->requests <= 101, "open loop: %llu requests",
+          (unsigned long long) result->requests);
+
+    // 大请求：回显在请求发完之前就占满两端的缓冲区
+    LoadOptionsInit(&options);
+    options.payloadSize = 16 << 20;
+    options.duration = 200;
+    options.timeout = 5000;
+    RunLoad("16 MB requests", &options, port, result);
+
+    free(result);
+    EventLoopStop(&loop);
+    pthread_join(thread, NULL);
+    EventLoopDestroy(&loop);
+    close(listener);
+}
+
+int main() {
+    TestLoadGenerator();
+    return ReportTestResult();
+}
@@ -0,0 +1,130 @@
+/**
+ * 本地 socket 记录模式测试
+ *     SOCK_SEQPACKET 上检查记录边界和 memfd 描述符的回显
+ */
+#include "TestSupport.h"
+#include "LocalTransfer.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include <stdio.h> // snprintf, printf
+#include <stdlib.h> // malloc, free
+#include <string.h> // memset, strerror, memcmp
+#include <errno.h> // errno
+#include <unistd.h> // getpid, close
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, bind, listen, connect, setsockopt, send, recv
+#include <sys/time.h> // timeval
+#include <sys/un.h> // sockaddr_un
+#include <sys/mman.h> // munmap
+#include <sys/stat.h> // fstat
+
+/**
+ * 本地 socket 记录模式：每条记录原样回显为一条记录，附带的 memfd 随回显发回；
+ * 超过最大长度的记录关闭连接
+ */
+static void TestSeqPacketEcho() {
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.seqPacket = true;
+    options.framing = true;
+
+    // 抽象命名空间中的名称，不需要清理文件
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    int nameLength = snprintf(address.sun_path + 1, sizeof(address.sun_path) - 1,
+                              "echo-seqpacket-test-%d", (int) getpid());
+    socklen_t addressLength = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + 1 + nameLength);
+
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    CHECK(0 == bind(listener, (struct sockaddr *) &address, addressLength)
+          && 0 == listen(listener, SOMAXCONN), "seqpacket listen failed: %s", strerror(errno));
+
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+    CHECK(loop.messages && !loop.framing, "seqpacket should take precedence over framing");
+    CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+    int sd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    CHECK(0 == connect(sd, (struct sockaddr *) &address, addressLength),
+          "seqpacket connect failed: %s", strerror(errno));
+    struct timeval timeout;
+    timeout.tv_sec = RECEIVE_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int sendBufferSize = 1 << 20;
+    setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize));
+
+    // 连续发送的记录逐条回显，长度不变
+    const size_t recordSizes[] = {1, 80, 16385, SERVER_DEFAULT_BUFFER_SIZE};
+    const size_t recordCount = sizeof(recordSizes) / sizeof(recordSizes[0]);
+    char *records[recordCount];
+    for (size_t i = 0; i < recordCount; i++) {
+        records[i] = NewPayload(recordSizes[i], (unsigned) i);
+        CHECK((ssize_t) recordSizes[i] == send(sd, records[i], recordSizes[i], MSG_NOSIGNAL),
+              "sending a %zu byte record failed: %s", recordSizes[i], strerror(errno));
+    }
+    char *echo = (char *) malloc(SERVER_DEFAULT_BUFFER_SIZE * 2);
+    for (size_t i = 0; i < recordCount; i++) {
+        ssize_t recvSize = recv(sd, echo, SERVER_DEFAULT_BUFFER_SIZE * 2, 0);
+        CHECK(recvSize == (ssize_t) recordSizes[i]
+              && 0 == memcmp(echo, records[i], recordSizes[i]),
+              "record %zu: received %zd of %zu bytes", i, recvSize, recordSizes[i]);
+        free(records[i]);
+    }
+
+    // 大消息只传递 memfd，回显的描述符指向同一个文件
+    const size_t payloadSize = 8 << 20;
+    char *payload = NewPayload(payloadSize, 17);
+    int payloadFd = LocalCreatePayload("echo-test", payload, payloadSize);
+    if (-1 == payloadFd && ENOSYS == errno) {
+        printf("memfd is not available, skipping descriptor passing.\n");
+    } else {
+        CHECK(-1 != payloadFd, "memfd create failed: %s", strerror(errno));
+        CHECK(0 == LocalSendPayload(sd, payloadFd, payloadSize), "sending memfd failed");
+
+        uint64_t echoSize = 0;
+        int echoFd = LocalReceivePayload(sd, &echoSize);
+        CHECK(-1 != echoFd && payloadSize == echoSize, "receiving memfd failed: %s",
+              strerror(errno));
+        if (-1 != echoFd) {
+            struct stat sent;
+            struct stat received;
+            fstat(payloadFd, &sent);
+            fstat(echoFd, &received);
+            CHECK(sent.st_ino == received.st_ino, "echoed descriptor is a different file");
+
+            const void *mapped = LocalMapPayload(echoFd, (size_t) echoSize);
+            CHECK(NULL != mapped && 0 == memcmp(mapped, payload, payloadSize),
+                  "mapped payload differs");
+            if (NULL != mapped) {
+                munmap((void *) mapped, (size_t) echoSize);
+            }
+            close(echoFd);
+        }
+        close(payloadFd);
+    }
+    free(payload);
+
+    // 超过最大长度的记录被截断，服务器关闭连接
+    char *oversized = NewPayload(SERVER_DEFAULT_BUFFER_SIZE + 1, 3);
+    CHECK(SERVER_DEFAULT_BUFFER_SIZE + 1
+          == send(sd, oversized, SERVER_DEFAULT_BUFFER_SIZE + 1, MSG_NOSIGNAL),
+          "sending an oversized record failed: %s", strerror(errno));
+    CHECK(0 == recv(sd, echo, 1, 0), "oversized record should close the connection");
+    free(oversized);
+
+    free(echo);
+    close(sd);
+    EventLoopStop(&loop);
+    pthread_join(thread, NULL);
+    EventLoopDestroy(&loop);
+    close(listener);
+}
+
+int main() {
+    TestSeqPacketEcho();
+    return ReportTestResult();
+}
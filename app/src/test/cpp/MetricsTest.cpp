@@ -0,0 +1,54 @@
+/**
+ * 指标测试
+ *     各分片的计数合计到快照，释放的分片被复用并保留计数，快照按文本格式输出
+ */
+#include "TestSupport.h"
+#include "Metrics.h"
+#include <string.h> // strstr
+
+/**
+ * 两个分片的计数和服务时间合计到快照中，释放后再取得的分片保留之前的计数
+ */
+static void TestSnapshot() {
+    struct MetricsSnapshot before;
+    MetricsTakeSnapshot(&before);
+
+    struct MetricsShard *first = MetricsAcquireShard();
+    struct MetricsShard *second = MetricsAcquireShard();
+    CHECK(NULL != first && NULL != second && first != second, "acquire shards failed");
+    if (NULL == first || NULL == second) {
+        return;
+    }
+    MetricsAdd(&first->bytesIn, 100);
+    MetricsAdd(&second->bytesIn, 23);
+    MetricsAdd(&second->checksumErrors, 2);
+    MetricsRecordServiceTime(first, 5000, 3);
+
+    struct MetricsSnapshot after;
+    MetricsTakeSnapshot(&after);
+    CHECK(123 == after.bytesIn - before.bytesIn, "bytes in not summed");
+    CHECK(2 == after.checksumErrors - before.checksumErrors, "checksum errors not summed");
+    CHECK(3 == after.serviceTime.totalCount - before.serviceTime.totalCount,
+          "service time not recorded");
+
+    // 事件循环退出后分片的计数仍然计入总数
+    MetricsReleaseShard(second);
+    struct MetricsShard *reused = MetricsAcquireShard();
+    CHECK(second == reused, "released shard should be reused");
+    MetricsTakeSnapshot(&after);
+    CHECK(123 == after.bytesIn - before.bytesIn, "released shard lost its counts");
+
+    char text[4096];
+    size_t length = MetricsFormat(&after, text, sizeof(text));
+    CHECK(length > 0 && length < sizeof(text) && NULL != strstr(text, "echo_bytes_in_total ")
+          && NULL != strstr(text, "echo_service_time_nanoseconds_count "),
+          "formatted metrics incomplete");
+
+    MetricsReleaseShard(reused);
+    MetricsReleaseShard(first);
+}
+
+int main() {
+    TestSnapshot();
+    return ReportTestResult();
+}
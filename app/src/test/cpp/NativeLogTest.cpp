@@ -0,0 +1,121 @@
+/**
+ * 原生日志测试
+ *     级别过滤，缓冲区写满并且有日志被丢弃时取出的内容不超出输出缓冲区
+ */
+#include "TestSupport.h"
+#include "NativeLog.h"
+#include <stdio.h> // sscanf
+#include <stdlib.h> // malloc, free
+#include <string.h> // memset, strlen, strcmp, strchr
+
+// 与 nativeDrainLog 的栈上缓冲区大小相同
+#define DRAIN_BUFFER_SIZE (16 * 1024)
+
+// 输出缓冲区之后的保护字节
+#define GUARD_SIZE 64
+
+/**
+ * 取出全部日志并丢弃
+ */
+static void DrainAll() {
+    char buffer[DRAIN_BUFFER_SIZE];
+    while (0 != NativeLogDrain(buffer, sizeof(buffer))) {
+    }
+}
+
+/**
+ * 日志级别：低于运行期级别的日志不计算参数也不写入
+ */
+static void TestLogLevel() {
+    DrainAll();
+    NativeLogSetLevel(LOG_LEVEL_INFO);
+    CHECK(!NativeLogIsEnabled(LOG_LEVEL_DEBUG) && NativeLogIsEnabled(LOG_LEVEL_WARN),
+          "info level filters debug only");
+
+    int evaluated = 0;
+    LOGD("debug %d", ++evaluated);
+    LOGI("info %d", 1);
+    CHECK(0 == evaluated, "filtered log evaluated its arguments");
+
+    char buffer[DRAIN_BUFFER_SIZE];
+    CHECK(7 == NativeLogDrain(buffer, sizeof(buffer)), "drained %zu bytes", strlen(buffer));
+    CHECK(0 == strcmp("info 1\n", buffer), "drained \"%s\"", buffer);
+    CHECK(0 == NativeLogDrain(buffer, sizeof(buffer)) && '\0' == buffer[0], "ring not empty");
+    NativeLogSetLevel(LOG_LEVEL_DEBUG);
+}
+
+/**
+ * 缓冲区写满：最长的记录恰好填到输出缓冲区末尾时，丢弃计数一行仍然放得下，不越界；
+ * 逐批取出的记录数加上丢弃数等于写入数
+ */
+static void TestDrainWithDrops() {
+    DrainAll();
+
+    // 62 条 255 字节和 1 条 254 字节的记录连同换行符占用输出缓冲区的 16127 字节，
+    // 再取一条 255 字节的记录就恰好填到倒数第二个字节
+    char longMessage[NATIVE_LOG_MESSAGE_LENGTH];
+    memset(longMessage, 'x', sizeof(longMessage));
+    longMessage[NATIVE_LOG_MESSAGE_LENGTH - 1] = '\0';
+    const int longCount = 62;
+    for (int i = 0; i < longCount; i++) {
+        NativeLogWrite("%s", longMessage);
+    }
+    NativeLogWrite("%s", longMessage + 1);
+
+    // 写满环形缓冲区后继续写入，多出的记录被丢弃
+    const int floodCount = 2 * NATIVE_LOG_CAPACITY;
+    for (int i = 0; i < floodCount; i++) {
+        NativeLogWrite("%s", longMessage);
+    }
+    const int written = longCount + 1 + floodCount;
+
+    char *buffer = (char *) malloc(DRAIN_BUFFER_SIZE + GUARD_SIZE);
+    memset(buffer + DRAIN_BUFFER_SIZE, 0x5a, GUARD_SIZE);
+    int drained = 0;
+    unsigned long long dropped = 0;
+    size_t length;
+    while (0 != (length = NativeLogDrain(buffer, DRAIN_BUFFER_SIZE))) {
+        CHECK(length < DRAIN_BUFFER_SIZE && length == strlen(buffer), "drained %zu bytes",
+              length);
+        for (char *line = buffer; '\0' != *line;) {
+            char *end = strchr(line, '\n');
+            CHECK(NULL != end, "unterminated line");
+            if (NULL == end) {
+                break;
+            }
+            unsigned long long count;
+            if (1 == sscanf(line, "(%llu log messages dropped)", &count)) {
+                dropped += count;
+            } else {
+                drained++;
+            }
+            line = end + 1;
+        }
+    }
+    for (int i = 0; i < GUARD_SIZE; i++) {
+        CHECK(0x5a == (unsigned char) buffer[DRAIN_BUFFER_SIZE + i],
+              "drain wrote past the buffer at +%d", i);
+    }
+    free(buffer);
+
+    CHECK(NATIVE_LOG_CAPACITY == drained, "drained %d records", drained);
+    CHECK(written == drained + (int) dropped, "%d written, %d drained, %llu dropped", written,
+          drained, dropped);
+
+    // 很小的输出缓冲区只放得下截断的丢弃计数
+    NativeLogWrite("%s", "kept");
+    for (int i = 0; i < NATIVE_LOG_CAPACITY; i++) {
+        NativeLogWrite("flood %d", i);
+    }
+    char small[16 + GUARD_SIZE];
+    memset(small, 0x5a, sizeof(small));
+    CHECK(15 == NativeLogDrain(small, 16) && '\0' == small[15], "small drain not truncated");
+    CHECK(0x5a == (unsigned char) small[16], "small drain wrote past the buffer");
+    DrainAll();
+}
+
+int main() {
+    TestLogLevel();
+    TestDrainWithDrops();
+    return ReportTestResult();
+}
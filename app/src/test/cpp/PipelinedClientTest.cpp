@@ -0,0 +1,332 @@
+/**
+ * 流水线客户端测试
+ *     通过 epoll 服务器回显各种长度和窗口的请求；在途请求不超过窗口；
+ *     发送缓冲区很小时部分发送后继续；按流的位置把回显与请求对应，损坏或者不完整的回显报错
+ */
+#include "TestSupport.h"
+#include "PipelinedClient.h"
+#include "EventLoop.h"
+#include "ServerOptions.h"
+#include "SocketProfile.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // strerror, memcpy
+#include <errno.h> // errno
+#include <unistd.h> // close
+#include <poll.h> // poll
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // accept, recv, setsockopt
+#include <netinet/in.h> // IPPROTO_TCP
+#include <netinet/tcp.h> // TCP_NODELAY
+
+// 对端判断客户端已经停止发送的空闲时间，单位毫秒
+#define PEER_IDLE_MILLIS 200
+
+// 对端的接收缓冲区大小
+#define PEER_BUFFER_SIZE 65536
+
+/**
+ * 按脚本回显的对端，在单独的线程中运行
+ */
+struct EchoPeer {
+    int listener;
+
+    // 先只接收不回显，客户端停止发送后再开始回显
+    bool hold;
+
+    // 是否按变化的小块回显，让一个回显跨越多次接收
+    bool chunked;
+
+    // 回显流中被改写的字节位置，-1 表示不改写
+    long long corruptAt;
+
+    // 回显这么多字节后关闭连接，-1 表示回显到客户端关闭为止
+    long long closeAt;
+
+    // 开始回显之前收到的字节数
+    size_t heldBytes;
+};
+
+/**
+ * 把数据回显给客户端，按脚本分块、改写或者截断
+ * @param peer 对端
+ * @param sd socket 描述符
+ * @param data 数据，可能被改写
+ * @param size 长度
+ * @param echoed 已经回显的字节数
+ * @return 继续回显返回 true，到达 closeAt 或者发送失败返回 false
+ */
+static bool PeerEcho(struct EchoPeer *peer, int sd, char *data, size_t size,
+                     unsigned long long *echoed) {
+    static const size_t chunkSizes[] = {1, 7, 333, 4096};
+    static size_t nextChunk = 0;
+
+    if (-1 != peer->closeAt && *echoed + size > (unsigned long long) peer->closeAt) {
+        size = (size_t) ((unsigned long long) peer->closeAt - *echoed);
+    }
+    if (-1 != peer->corruptAt && (unsigned long long) peer->corruptAt >= *echoed
+        && (unsigned long long) peer->corruptAt < *echoed + size) {
+        data[(unsigned long long) peer->corruptAt - *echoed] ^= 0x5a;
+    }
+
+    while (size > 0) {
+        size_t chunk = size;
+        if (peer->chunked) {
+            chunk = chunkSizes[nextChunk++ % (sizeof(chunkSizes) / sizeof(chunkSizes[0]))];
+            if (chunk > size) {
+                chunk = size;
+            }
+        }
+        if (-1 == SendAll(sd, data, chunk)) {
+            return false;
+        }
+        data += chunk;
+        size -= chunk;
+        *echoed += chunk;
+    }
+    return -1 == peer->closeAt || *echoed < (unsigned long long) peer->closeAt;
+}
+
+/**
+ * 对端线程：接受一个连接，按脚本回显直到客户端关闭
+ * @param arg EchoPeer
+ * @return NULL
+ */
+static void *RunEchoPeer(void *arg) {
+    struct EchoPeer *peer = (struct EchoPeer *) arg;
+    int sd = accept(peer->listener, NULL, NULL);
+    if (-1 == sd) {
+        return NULL;
+    }
+
+    // 小块回显不能等前一块的确认，否则每块都要等客户端的延迟确认
+    int noDelay = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    char *buffer = (char *) malloc(PEER_BUFFER_SIZE);
+    unsigned long long echoed = 0;
+    size_t length = 0;
+
+    // 先收下客户端在没有回显时能发出的全部数据
+    if (peer->hold) {
+        struct pollfd pfd;
+        pfd.fd = sd;
+        pfd.events = POLLIN;
+        while (length < PEER_BUFFER_SIZE && 1 == poll(&pfd, 1, PEER_IDLE_MILLIS)) {
+            ssize_t recvSize = recv(sd, buffer + length, PEER_BUFFER_SIZE - length, 0);
+            if (recvSize <= 0) {
+                break;
+            }
+            length += (size_t) recvSize;
+        }
+        peer->heldBytes = length;
+    }
+
+    bool echoing = PeerEcho(peer, sd, buffer, length, &echoed);
+    while (echoing) {
+        ssize_t recvSize = recv(sd, buffer, PEER_BUFFER_SIZE, 0);
+        if (recvSize <= 0) {
+            break;
+        }
+        echoing = PeerEcho(peer, sd, buffer, (size_t) recvSize, &echoed);
+    }
+
+    free(buffer);
+    close(sd);
+    return NULL;
+}
+
+/**
+ * 对脚本对端运行一次流水线请求
+ * @param peer 对端，listener 由本函数创建和关闭
+ * @param payloadSize 请求长度
+ * @param requestCount 请求数
+ * @param window 窗口
+ * @param sendBufferSize 客户端的发送缓冲区大小，0 表示使用默认值
+ * @param result 结果
+ * @return PipelinedClientRun 的返回值，errno 为它设置的错误号
+ */
+static int RunAgainstPeer(struct EchoPeer *peer, size_t payloadSize, unsigned requestCount,
+                          unsigned window, int sendBufferSize, struct PipelineResult *result) {
+    unsigned short port = 0;
+    peer->listener = NewListener(&port);
+    CHECK(-1 != peer->listener, "listen failed: %s", strerror(errno));
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunEchoPeer, peer);
+
+    int sd = ConnectLoopback(SOCK_STREAM, port);
+    CHECK(-1 != sd, "connect failed: %s", strerror(errno));
+    if (0 != sendBufferSize) {
+        setsockopt(sd, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize));
+    }
+
+    char *payload = NewPayload(payloadSize, (unsigned) payloadSize);
+    int status = PipelinedClientRun(sd, payload, payloadSize, requestCount, window, result);
+    int error = errno;
+
+    free(payload);
+    close(sd);
+    pthread_join(thread, NULL);
+    close(peer->listener);
+    errno = error;
+    return status;
+}
+
+/**
+ * 初始化按原样回显的对端
+ * @param peer 对端
+ */
+static void EchoPeerInit(struct EchoPeer *peer) {
+    memset(peer, 0, sizeof(*peer));
+    peer->listener = -1;
+    peer->corruptAt = -1;
+    peer->closeAt = -1;
+}
+
+/**
+ * 通过 epoll 服务器回显：小于、等于和大于发送缓冲区副本总长度的请求，窗口从 1 到 64；
+ * 服务器使用低延迟方案，分几次写出的回显不会因为 Nagle 算法等待客户端的延迟确认
+ */
+static void TestPipelinedEcho() {
+    const size_t payloadSizes[] = {1, 100, 65536, 200000};
+    const unsigned windows[] = {1, 8, 64};
+
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    options.socketProfile = SOCKET_PROFILE_LOW_LATENCY;
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(-1 != listener, "listen failed: %s", strerror(errno));
+
+    // 接受的连接从监听 socket 继承 TCP_NODELAY
+    CHECK(0 == SocketProfileApply(SocketProfileGet(options.socketProfile), listener,
+                                  SOCKET_ROLE_LISTENER), "apply profile failed");
+
+    struct EventLoop loop;
+    CHECK(0 == EventLoopInit(&loop, &options), "event loop init failed");
+    CHECK(0 == EventLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunEventLoop, &loop);
+
+    for (size_t payloadSize : payloadSizes) {
+        char *payload = NewPayload(payloadSize, (unsigned) payloadSize);
+        for (unsigned window : windows) {
+            unsigned requestCount = (payloadSize > 65536) ? 20 : 500;
+            int sd = ConnectLoopback(SOCK_STREAM, port);
+            struct PipelineResult result;
+            int status = PipelinedClientRun(sd, payload, payloadSize, requestCount, window,
+                                            &result);
+            CHECK(0 == status, "%zu bytes, window %u: %s", payloadSize, window, strerror(errno));
+            CHECK(requestCount == result.completed
+                  && (uint64_t) requestCount * payloadSize == result.sentBytes
+                  && result.sentBytes == result.receivedBytes,
+                  "%zu bytes, window %u: %llu completed, %llu sent, %llu received", payloadSize,
+                  window, (unsigned long long) result.completed,
+                  (unsigned long long) result.sentBytes,
+                  (unsigned long long) result.receivedBytes);
+            CHECK(result.maxLatencyNanos > 0 && result.maxLatencyNanos <= result.elapsedNanos
+                  && result.totalLatencyNanos >= result.maxLatencyNanos,
+                  "%zu bytes, window %u: latency out of range", payloadSize, window);
+            close(sd);
+        }
+        free(payload);
+    }
+
+    // 无效的参数
+    int sd = ConnectLoopback(SOCK_STREAM, port);
+    struct PipelineResult result;
+    CHECK(-1 == PipelinedClientRun(sd, "x", 1, 1, 0, &result) && EINVAL == errno,
+          "zero window should be rejected");
+    CHECK(-1 == PipelinedClientRun(sd, "x", 0, 1, 1, &result) && EINVAL == errno,
+          "empty payload should be rejected");
+    close(sd);
+
+    EventLoopStop(&loop);
+    pthread_join(thread, NULL);
+    EventLoopDestroy(&loop);
+    close(listener);
+}
+
+/**
+ * 窗口限制：对端不回显时客户端恰好发出 window 个请求后停下，开始回显后全部完成
+ */
+static void TestWindowLimit() {
+    const size_t payloadSize = 100;
+    const unsigned windows[] = {1, 4, 32};
+
+    for (unsigned window : windows) {
+        struct EchoPeer peer;
+        EchoPeerInit(&peer);
+        peer.hold = true;
+
+        struct PipelineResult result;
+        CHECK(0 == RunAgainstPeer(&peer, payloadSize, 100, window, 0, &result),
+              "window %u: %s", window, strerror(errno));
+        CHECK(window * payloadSize == peer.heldBytes, "window %u: %zu bytes in flight", window,
+              peer.heldBytes);
+        CHECK(100 == result.completed && result.sentBytes == result.receivedBytes,
+              "window %u: %llu completed", window, (unsigned long long) result.completed);
+    }
+}
+
+/**
+ * 部分发送：发送缓冲区很小、对端按小块回显时，大请求由多次部分发送完成，
+ * 发送中途也取走回显而不会互相阻塞
+ */
+static void TestPartialSend() {
+    struct EchoPeer peer;
+    EchoPeerInit(&peer);
+    peer.chunked = true;
+
+    const size_t payloadSize = 1 << 20;
+    struct PipelineResult result;
+    CHECK(0 == RunAgainstPeer(&peer, payloadSize, 8, 4, 4096, &result), "partial send: %s",
+          strerror(errno));
+    CHECK(8 == result.completed && 8 * payloadSize == result.sentBytes
+          && result.sentBytes == result.receivedBytes,
+          "partial send: %llu completed, %llu sent, %llu received",
+          (unsigned long long) result.completed, (unsigned long long) result.sentBytes,
+          (unsigned long long) result.receivedBytes);
+}
+
+/**
+ * 回显匹配：跨越请求边界的小块回显按顺序完成；损坏的回显返回 EBADMSG，
+ * 之前的请求仍然计为完成；回显不完整时返回 ECONNRESET
+ */
+static void TestReplyMatching() {
+    const size_t payloadSize = 1000;
+    struct PipelineResult result;
+
+    struct EchoPeer peer;
+    EchoPeerInit(&peer);
+    peer.chunked = true;
+    CHECK(0 == RunAgainstPeer(&peer, payloadSize, 50, 8, 0, &result), "chunked echo: %s",
+          strerror(errno));
+    CHECK(50 == result.completed, "chunked echo: %llu completed",
+          (unsigned long long) result.completed);
+
+    // 第 3 个回显中间的一个字节被改写
+    EchoPeerInit(&peer);
+    peer.corruptAt = 2 * payloadSize + payloadSize / 2;
+    CHECK(-1 == RunAgainstPeer(&peer, payloadSize, 50, 8, 0, &result) && EBADMSG == errno,
+          "corrupted echo should fail with EBADMSG: %s", strerror(errno));
+    CHECK(result.completed <= 2 && result.receivedBytes <= (uint64_t) peer.corruptAt,
+          "corrupted echo: %llu completed, %llu received", (unsigned long long) result.completed,
+          (unsigned long long) result.receivedBytes);
+
+    // 回显一个半请求后关闭
+    EchoPeerInit(&peer);
+    peer.closeAt = payloadSize + payloadSize / 2;
+    CHECK(-1 == RunAgainstPeer(&peer, payloadSize, 50, 8, 0, &result) && ECONNRESET == errno,
+          "truncated echo should fail with ECONNRESET: %s", strerror(errno));
+    CHECK(1 == result.completed && (uint64_t) peer.closeAt == result.receivedBytes,
+          "truncated echo: %llu completed, %llu received", (unsigned long long) result.completed,
+          (unsigned long long) result.receivedBytes);
+}
+
+int main() {
+    TestPipelinedEcho();
+    TestWindowLimit();
+    TestPartialSend();
+    TestReplyMatching();
+    return ReportTestResult();
+}
@@ -0,0 +1,217 @@
+/**
+ * 共享内存通道测试
+ *     环的回绕、满和关闭，以及经过握手 socket 传递区域后的回显；对方进程退出时收发不会永远等待
+ */
+#include "TestSupport.h"
+#include "ShmRing.h"
+#include "LocalTransfer.h"
+#include <stdio.h> // printf
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp, memcpy, strerror
+#include <errno.h> // errno
+#include <unistd.h> // close, usleep
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, socketpair, send
+
+/**
+ * 共享内存通道服务器线程的参数和结果
+ */
+struct ShmServer {
+    int sd;
+    int result;
+    int error;
+};
+
+/**
+ * 接收客户端传来的区域并回显，直到客户端关闭
+ * @param argument ShmServer
+ * @return NULL
+ */
+static void *RunShmServer(void *argument) {
+    struct ShmServer *server = (struct ShmServer *) argument;
+    server->result = -1;
+
+    uint64_t regionSize = 0;
+    int fd = LocalReceivePayload(server->sd, &regionSize);
+    struct ShmChannel channel;
+    if (-1 != fd && 0 == ShmChannelAttach(&channel, fd, (size_t) regionSize)) {
+        server->result = ShmChannelServeEcho(&channel, server->sd);
+        server->error = errno;
+        ShmChannelDestroy(&channel);
+    } else {
+        server->error = errno;
+    }
+    return NULL;
+}
+
+/**
+ * 创建通道并把区域交给新的服务器线程
+ * @param channel 客户端通道
+ * @param sd 客户端的握手 socket
+ * @param server 服务器参数
+ * @param thread 服务器线程
+ * @return 成功返回 true
+ */
+static bool StartShmServer(struct ShmChannel *channel, int *sd, struct ShmServer *server,
+                           pthread_t *thread) {
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair);
+    *sd = pair[0];
+    server->sd = pair[1];
+    pthread_create(thread, NULL, RunShmServer, server);
+
+    if (-1 == ShmChannelCreate(channel, SHM_CHANNEL_MIN_CAPACITY)) {
+        return false;
+    }
+    return 0 == LocalSendPayload(*sd, channel->fd, channel->regionSize);
+}
+
+/**
+ * 共享内存通道：单进程内检查环的记录边界、回绕、满、不可信长度和关闭；
+ * 再经过握手 socket 把区域交给服务器线程回显，客户端关闭通道或者直接退出时服务器都能结束
+ */
+static void TestShmChannel() {
+    struct ShmChannel client;
+    if (-1 == ShmChannelCreate(&client, 1) && ENOSYS == errno) {
+        printf("memfd is not available, skipping shared memory channel.\n");
+        return;
+    }
+    CHECK(SHM_CHANNEL_MIN_CAPACITY == client.send.capacity, "capacity should round up");
+
+    // 同一进程中的另一个视图扮演服务器
+    struct ShmChannel server;
+    CHECK(0 == ShmChannelAttach(&server, dup(client.fd), client.regionSize), "attach failed");
+    struct ShmChannel truncated;
+    CHECK(-1 == ShmChannelAttach(&truncated, dup(client.fd), client.regionSize - 8)
+          && EINVAL == errno, "a region of the wrong size should be rejected");
+
+    char *record = NewPayload(SHM_CHANNEL_MIN_CAPACITY, 5);
+    char *echo = (char *) malloc(SHM_CHANNEL_MIN_CAPACITY);
+    CHECK(-1 == ShmRingTrySend(&client.send, record, SHM_CHANNEL_MIN_CAPACITY)
+          && EMSGSIZE == errno, "a record larger than the ring should be rejected");
+    CHECK(-1 == ShmRingTryReceive(&server.receive, echo, SHM_CHANNEL_MIN_CAPACITY)
+          && EAGAIN == errno, "an empty ring should not block");
+
+    // 每轮写满环再全部读出，记录长度和环容量互质，位置逐轮错开并回绕
+    size_t sentCount = 0;
+    size_t receivedCount = 0;
+    for (int round = 0; round < 16; round++) {
+        while (0 == ShmRingTrySend(&client.send, record + sentCount % 7, 1000 + sentCount % 7)) {
+            sentCount++;
+        }
+        CHECK(EAGAIN == errno, "a full ring should report EAGAIN");
+        CHECK(-1 == ShmRingTryReceive(&server.receive, echo, 10) && EMSGSIZE == errno,
+              "a short buffer should leave the record in place");
+        ssize_t recvSize;
+        while (-1 != (recvSize = ShmRingTryReceive(&server.receive, echo,
+                                                   SHM_CHANNEL_MIN_CAPACITY))) {
+            size_t expected = 1000 + receivedCount % 7;
+            CHECK((ssize_t) expected == recvSize
+                  && 0 == memcmp(echo, record + receivedCount % 7, expected),
+                  "record %zu: received %zd of %zu bytes", receivedCount, recvSize, expected);
+            receivedCount++;
+        }
+    }
+    CHECK(sentCount == receivedCount && sentCount > 16, "sent %zu records, received %zu",
+          sentCount, receivedCount);
+
+    // 对方写坏的长度头不能让接收越过已经发布的部分
+    CHECK(0 == ShmRingTrySend(&client.send, record, 8), "send failed");
+    uint32_t badLength = SHM_CHANNEL_MIN_CAPACITY - 8;
+    memcpy(client.send.data + (client.send.position - 16) % SHM_CHANNEL_MIN_CAPACITY,
+           &badLength, sizeof(badLength));
+    CHECK(-1 == ShmRingTryReceive(&server.receive, echo, SHM_CHANNEL_MIN_CAPACITY)
+          && EBADMSG == errno, "a corrupt length should be rejected");
+    server.receive.position = client.send.position;
+
+    // 关闭后先收完剩余的记录再收到 EPIPE
+    CHECK(0 == ShmRingTrySend(&client.send, record, 0), "an empty record should be sent");
+    ShmChannelClose(&client);
+    CHECK(-1 == ShmRingTrySend(&client.send, record, 1) && EPIPE == errno,
+          "sending after close should fail");
+    CHECK(0 == ShmRingTryReceive(&server.receive, echo, SHM_CHANNEL_MIN_CAPACITY),
+          "the empty record should arrive after close");
+    CHECK(-1 == ShmRingReceive(&server.receive, echo, SHM_CHANNEL_MIN_CAPACITY, 0)
+          && EPIPE == errno, "receiving from a closed empty ring should fail");
+    ShmChannelDestroy(&server);
+    ShmChannelDestroy(&client);
+
+    // 经过握手 socket 交给服务器线程：一问一答，中间停顿让服务器进入 futex 等待再被唤醒
+    struct ShmServer echoServer;
+    pthread_t thread;
+    int sd;
+    CHECK(StartShmServer(&client, &sd, &echoServer, &thread), "channel handoff failed: %s",
+          strerror(errno));
+    const size_t maxSize = SHM_CHANNEL_MIN_CAPACITY - SHM_RING_RECORD_HEADER_SIZE;
+    for (size_t i = 0; i < 20000; i++) {
+        size_t size = (i * 131) % (maxSize + 1);
+        if (0 == i % 5000) {
+            usleep(20000);
+        }
+        CHECK(0 == ShmRingSend(&client.send, record, size, RECEIVE_TIMEOUT * 1000),
+              "request %zu failed: %s", i, strerror(errno));
+        ssize_t recvSize = ShmRingReceive(&client.receive, echo, SHM_CHANNEL_MIN_CAPACITY,
+                                          RECEIVE_TIMEOUT * 1000);
+        if ((ssize_t) size != recvSize || 0 != memcmp(echo, record, size)) {
+            CHECK(false, "reply %zu: received %zd of %zu bytes", i, recvSize, size);
+            break;
+        }
+    }
+    ShmChannelClose(&client);
+    pthread_join(thread, NULL);
+    CHECK(0 == echoServer.result, "server should finish cleanly after close: %s",
+          strerror(echoServer.error));
+    ShmChannelDestroy(&client);
+    close(sd);
+    close(echoServer.sd);
+
+    // 客户端不关闭通道直接退出，服务器在下一次等待超时后发现握手 socket 已经关闭
+    CHECK(StartShmServer(&client, &sd, &echoServer, &thread), "channel handoff failed");
+    CHECK(0 == ShmRingSend(&client.send, record, 1, RECEIVE_TIMEOUT * 1000)
+          && 1 == ShmRingReceive(&client.receive, echo, 1, RECEIVE_TIMEOUT * 1000),
+          "echo before exit failed");
+    close(sd);
+    pthread_join(thread, NULL);
+    CHECK(-1 == echoServer.result && ECONNRESET == echoServer.error,
+          "server should notice the client exit");
+    ShmChannelDestroy(&client);
+    close(echoServer.sd);
+
+    free(echo);
+    free(record);
+}
+
+/**
+ * 握手 socket 的对端已经关闭：没有记录可收、环满无法发送时都以 ECONNRESET 结束，不会永远等待
+ */
+static void TestShmPeerGone() {
+    struct ShmChannel channel;
+    if (-1 == ShmChannelCreate(&channel, SHM_CHANNEL_MIN_CAPACITY)) {
+        printf("memfd is not available, skipping shared memory peer check.\n");
+        return;
+    }
+    int pair[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair);
+    close(pair[1]);
+
+    char record[256] = {0};
+    errno = 0;
+    CHECK(-1 == ShmChannelReceive(&channel, pair[0], record, sizeof(record))
+          && ECONNRESET == errno, "receive from a gone peer: %s", strerror(errno));
+
+    // 客户端的发送环就是服务器的接收环，没有人读取，写满后发送只能等待
+    while (0 == ShmRingTrySend(&channel.send, record, sizeof(record))) {
+    }
+    errno = 0;
+    CHECK(-1 == ShmChannelSend(&channel, pair[0], record, sizeof(record))
+          && ECONNRESET == errno, "send to a gone peer: %s", strerror(errno));
+
+    close(pair[0]);
+    ShmChannelDestroy(&channel);
+}
+
+int main() {
+    TestShmChannel();
+    TestShmPeerGone();
+    return ReportTestResult();
+}
@@ -0,0 +1,133 @@
+/**
+ * socket 调优方案测试
+ *     各角色实际设置的选项，以及每个方案下的回环基准测试都能完成
+ */
+#include "TestSupport.h"
+#include "SocketProfile.h"
+#include "LoopbackBenchmark.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // memset, strerror
+#include <errno.h> // errno
+#include <unistd.h> // close
+#include <sys/socket.h> // socket, getsockopt, setsockopt, bind, listen, connect
+#include <netinet/in.h> // sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY, TCP_NOTSENT_LOWAT, TCP_QUICKACK
+#include <arpa/inet.h> // htonl, ntohs
+
+/**
+ * 读取一个整数 socket 选项
+ * @param sd socket 描述符
+ * @param level 协议层
+ * @param name 选项
+ * @return 选项值，失败返回 -1
+ */
+static int GetIntOption(int sd, int level, int name) {
+    int value = -1;
+    socklen_t length = sizeof(value);
+    if (-1 == getsockopt(sd, level, name, &value, &length)) {
+        return -1;
+    }
+    return value;
+}
+
+/**
+ * socket 调优方案：按名称查找，TCP 客户端和监听 socket 上实际设置的选项，接受的连接继承
+ * 监听 socket 的选项，接收低水位只在显式调用时设置；每个方案下的回环基准测试都能完成
+ */
+static void TestSocketProfiles() {
+    for (int id = 0; id < SOCKET_PROFILE_COUNT; id++) {
+        CHECK(id == SocketProfileFind(SocketProfileGet(id)->name), "profile %d lookup", id);
+    }
+    CHECK(-1 == SocketProfileFind("fastest"), "unknown profile name");
+    CHECK(NULL == SocketProfileGet(-1) && NULL == SocketProfileGet(SOCKET_PROFILE_COUNT),
+          "profile id out of range");
+
+    // 低延迟客户端：关闭 Nagle，限制未发出的数据，不设置接收低水位
+    const struct SocketProfile *lowLatency = SocketProfileGet(SOCKET_PROFILE_LOW_LATENCY);
+    int sd = socket(PF_INET, SOCK_STREAM, 0);
+    CHECK(0 == SocketProfileApply(lowLatency, sd, SOCKET_ROLE_CLIENT), "apply low-latency");
+    CHECK(1 == GetIntOption(sd, IPPROTO_TCP, TCP_NODELAY), "low-latency TCP_NODELAY");
+    CHECK(lowLatency->notSentLowWatermark == GetIntOption(sd, IPPROTO_TCP, TCP_NOTSENT_LOWAT),
+          "low-latency TCP_NOTSENT_LOWAT");
+    CHECK(1 == GetIntOption(sd, SOL_SOCKET, SO_RCVLOWAT), "client SO_RCVLOWAT untouched");
+    close(sd);
+
+    // 大块数据：只有按剩余长度读取的调用者显式设置接收低水位
+    const struct SocketProfile *bulk = SocketProfileGet(SOCKET_PROFILE_BULK_THROUGHPUT);
+    sd = socket(PF_INET, SOCK_STREAM, 0);
+    CHECK(0 == SocketProfileApply(bulk, sd, SOCKET_ROLE_CLIENT), "apply bulk-throughput");
+    CHECK(0 == GetIntOption(sd, IPPROTO_TCP, TCP_NODELAY), "bulk keeps Nagle");
+    CHECK(0 == SocketProfileSetReceiveLowWatermark(bulk, sd), "set SO_RCVLOWAT");
+    int expected = GetIntOption(sd, SOL_SOCKET, SO_RCVBUF) / 4;
+    if (expected > bulk->receiveLowWatermark) {
+        expected = bulk->receiveLowWatermark;
+    }
+    CHECK(expected == GetIntOption(sd, SOL_SOCKET, SO_RCVLOWAT), "bulk SO_RCVLOWAT %d",
+          GetIntOption(sd, SOL_SOCKET, SO_RCVLOWAT));
+
+    // 接收缓冲区调小后，低水位按实际缓冲区的四分之一限制
+    int bufferSize = 8 * 1024;
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+    CHECK(0 == SocketProfileSetReceiveLowWatermark(bulk, sd), "set SO_RCVLOWAT on a small buffer");
+    CHECK(GetIntOption(sd, SOL_SOCKET, SO_RCVBUF) / 4 == GetIntOption(sd, SOL_SOCKET, SO_RCVLOWAT),
+          "SO_RCVLOWAT %d not clamped to SO_RCVBUF %d", GetIntOption(sd, SOL_SOCKET, SO_RCVLOWAT),
+          GetIntOption(sd, SOL_SOCKET, SO_RCVBUF));
+    close(sd);
+
+    // 大量空闲连接：固定的小缓冲区，内核报告两倍的值；数据报 socket 同样设置缓冲区
+    const struct SocketProfile *idle = SocketProfileGet(SOCKET_PROFILE_MANY_IDLE_CONNECTIONS);
+    sd = socket(PF_INET, SOCK_DGRAM, 0);
+    CHECK(0 == SocketProfileApply(idle, sd, SOCKET_ROLE_LISTENER), "apply to datagram socket");
+    CHECK(2 * idle->receiveBufferSize == GetIntOption(sd, SOL_SOCKET, SO_RCVBUF),
+          "idle SO_RCVBUF %d", GetIntOption(sd, SOL_SOCKET, SO_RCVBUF));
+    CHECK(2 * idle->sendBufferSize == GetIntOption(sd, SOL_SOCKET, SO_SNDBUF),
+          "idle SO_SNDBUF %d", GetIntOption(sd, SOL_SOCKET, SO_SNDBUF));
+    close(sd);
+
+    // TCP 接受的连接继承监听 socket 的选项，事件循环只需要补上 TCP_QUICKACK
+    int listener = socket(PF_INET, SOCK_STREAM, 0);
+    CHECK(0 == SocketProfileApply(lowLatency, listener, SOCKET_ROLE_LISTENER),
+          "apply to listener");
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addressLength = sizeof(address);
+    bind(listener, (struct sockaddr *) &address, sizeof(address));
+    listen(listener, lowLatency->backlog);
+    getsockname(listener, (struct sockaddr *) &address, &addressLength);
+    int client = ConnectLoopback(SOCK_STREAM, ntohs(address.sin_port));
+    int accepted = accept(listener, NULL, NULL);
+    CHECK(-1 != client && -1 != accepted, "connect to tuned listener failed");
+    CHECK(1 == GetIntOption(accepted, IPPROTO_TCP, TCP_NODELAY), "accepted TCP_NODELAY");
+    CHECK(lowLatency->notSentLowWatermark
+          == GetIntOption(accepted, IPPROTO_TCP, TCP_NOTSENT_LOWAT), "accepted TCP_NOTSENT_LOWAT");
+    CHECK(0 == SocketProfileApply(lowLatency, accepted, SOCKET_ROLE_ACCEPTED), "apply accepted");
+    close(accepted);
+    close(client);
+    close(listener);
+
+    // 每个方案下回环服务器的一问一答和大块回显都完整完成
+    struct LoopbackBenchmarkResult *result = (struct LoopbackBenchmarkResult *) malloc(
+            sizeof(struct LoopbackBenchmarkResult));
+    struct ServerOptions options;
+    ServerOptionsInit(&options);
+    for (int id = 0; id < SOCKET_PROFILE_COUNT; id++) {
+        const size_t bulkBytes = (4 << 20) + 3;
+        options.socketProfile = id;
+        int status = LoopbackBenchmarkRun(&options, 100, 200, bulkBytes, result);
+        CHECK(0 == status, "%s benchmark failed: %s", SocketProfileGet(id)->name,
+              strerror(errno));
+        CHECK(200 == result->latency.totalCount, "%s exchanges", SocketProfileGet(id)->name);
+        CHECK(bulkBytes == result->bulkBytes, "%s bulk bytes", SocketProfileGet(id)->name);
+    }
+    options.socketProfile = SOCKET_PROFILE_COUNT;
+    CHECK(-1 == LoopbackBenchmarkRun(&options, 100, 1, 0, result) && EINVAL == errno,
+          "benchmark rejects unknown profile");
+    free(result);
+}
+
+int main() {
+    TestSocketProfiles();
+    return ReportTestResult();
+}
@@ -0,0 +1,206 @@
+#include "TestSupport.h"
+#include "Frame.h"
+#include "EventLoop.h"
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp, memset, strerror
+#include <errno.h> // errno
+#include <unistd.h> // close, usleep
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, connect, send, recv
+#include <sys/time.h> // timeval
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h> // htonl
+
+int testFailures = 0;
+
+char *NewPayload(size_t size, unsigned seed) {
+    char *payload = (char *) malloc(size + 1);
+    uint32_t state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1664525u + 1013904223u;
+        payload[i] = (char) (state >> 24);
+    }
+    return payload;
+}
+
+int SendAll(int sd, const char *data, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t sentSize = send(sd, data + offset, size - offset, MSG_NOSIGNAL);
+        if (-1 == sentSize) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        offset += (size_t) sentSize;
+    }
+    return 0;
+}
+
+size_t ReceiveAll(int sd, char *buffer, size_t size) {
+    size_t offset = 0;
+    while (offset < size) {
+        ssize_t recvSize = recv(sd, buffer + offset, size - offset, 0);
+        if (-1 == recvSize && EINTR == errno) {
+            continue;
+        }
+        if (recvSize <= 0) {
+            break;
+        }
+        offset += (size_t) recvSize;
+    }
+    return offset;
+}
+
+void *RunSender(void *arg) {
+    struct Sender *sender = (struct Sender *) arg;
+    sender->result = SendAll(sender->sd, sender->data, sender->size);
+    return NULL;
+}
+
+int NewListener(unsigned short *port) {
+    int sd = socket(PF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    if (-1 == bind(sd, (struct sockaddr *) &address, sizeof(address))
+        || -1 == listen(sd, SOMAXCONN)) {
+        close(sd);
+        return -1;
+    }
+
+    socklen_t addressLength = sizeof(address);
+    getsockname(sd, (struct sockaddr *) &address, &addressLength);
+    *port = ntohs(address.sin_port);
+    return sd;
+}
+
+int ConnectLoopback(int type, unsigned short port) {
+    int sd = socket(PF_INET, type, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (-1 == connect(sd, (struct sockaddr *) &address, sizeof(address))) {
+        close(sd);
+        return -1;
+    }
+
+    struct timeval timeout;
+    timeout.tv_sec = RECEIVE_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sd;
+}
+
+void CheckStreamEcho(const char *name, unsigned short port, size_t size) {
+    int sd = ConnectLoopback(SOCK_STREAM, port);
+    CHECK(-1 != sd, "%s: connect failed: %s", name, strerror(errno));
+    if (-1 == sd) {
+        return;
+    }
+    CheckSocketEcho(name, sd, size);
+    close(sd);
+}
+
+void CheckSocketEcho(const char *name, int sd, size_t size) {
+    char *payload = NewPayload(size, (unsigned) size);
+    char *echo = (char *) malloc(size + 1);
+
+    struct Sender sender = {sd, payload, size, 0};
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunSender, &sender);
+    size_t receivedSize = ReceiveAll(sd, echo, size);
+    if (receivedSize != size) {
+        // 回显不完整时服务器可能因为发送阻塞而停止读取，关闭连接让发送线程退出
+        shutdown(sd, SHUT_RDWR);
+    }
+    pthread_join(thread, NULL);
+
+    CHECK(0 == sender.result, "%s: sending %zu bytes failed", name, size);
+    CHECK(receivedSize == size, "%s: received %zu of %zu bytes", name, receivedSize, size);
+    CHECK(receivedSize != size || 0 == memcmp(payload, echo, size),
+          "%s: echo of %zu bytes differs", name, size);
+
+    free(echo);
+    free(payload);
+}
+
+void *RunEventLoop(void *arg) {
+    EventLoopRun((struct EventLoop *) arg);
+    return NULL;
+}
+
+void *RunChunkedSender(void *arg) {
+    struct Sender *sender = (struct Sender *) arg;
+    const size_t chunkSizes[] = {1, 3, 2, 4093, 7, 65536, 5};
+    size_t offset = 0;
+    for (size_t i = 0; offset < sender->size; i++) {
+        size_t size = chunkSizes[i % (sizeof(chunkSizes) / sizeof(chunkSizes[0]))];
+        if (size > sender->size - offset) {
+            size = sender->size - offset;
+        }
+        if (-1 == SendAll(sender->sd, sender->data + offset, size)) {
+            sender->result = -1;
+            return NULL;
+        }
+        offset += size;
+    }
+    sender->result = 0;
+    return NULL;
+}
+
+bool EchoFrame(int sd, size_t payloadSize, unsigned seed) {
+    size_t frameSize = FRAME_HEADER_SIZE + payloadSize;
+    char *frame = NewPayload(frameSize, seed);
+    FrameEncodeHeader(frame, (uint32_t) payloadSize);
+    char *echo = (char *) malloc(frameSize);
+    bool echoed = (0 == SendAll(sd, frame, frameSize))
+                  && (frameSize == ReceiveAll(sd, echo, frameSize))
+                  && (0 == memcmp(frame, echo, frameSize));
+    free(echo);
+    free(frame);
+    return echoed;
+}
+
+bool WaitForCounter(const uint64_t *counter, uint64_t expected) {
+    for (int i = 0; i < RECEIVE_TIMEOUT * 1000; i++) {
+        if (__atomic_load_n(counter, __ATOMIC_RELAXED) >= expected) {
+            return true;
+        }
+        usleep(1000);
+    }
+    return false;
+}
+
+void EncodeCheckedFrame(char *frame, size_t payloadSize) {
+    FrameEncodeHeader(frame, (uint32_t) (payloadSize + FRAME_CHECKSUM_SIZE));
+    FrameEncodeHeader(frame + FRAME_HEADER_SIZE + payloadSize,
+                      Crc32c(frame + FRAME_HEADER_SIZE, payloadSize));
+}
+
+uint64_t WaitForSteadyCounter(const uint64_t *counter) {
+    uint64_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    for (int i = 0; i < RECEIVE_TIMEOUT * 10; i++) {
+        usleep(100000);
+        uint64_t current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+        if (current == value) {
+            break;
+        }
+        value = current;
+    }
+    return value;
+}
+
+int ReportTestResult() {
+    if (0 != testFailures) {
+        fprintf(stderr, "%d checks failed.\n", testFailures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+#ifndef ECHO_TEST_SUPPORT_H
+#define ECHO_TEST_SUPPORT_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+#include <stdio.h> // fprintf
+
+// 等待回显的最长时间，单位秒，超时说明回显丢失了数据
+#define RECEIVE_TIMEOUT 10
+
+// 失败的检查数，由各测试的 CHECK 累加
+extern int testFailures;
+
+#define CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            testFailures++; \
+        } \
+    } while (0)
+
+/**
+ * 发送线程的参数，消息在单独的线程中发送，接收方同时读取回显，大消息才不会互相阻塞
+ */
+struct Sender {
+    int sd;
+    const char *data;
+    size_t size;
+    int result;
+};
+
+/**
+ * 生成可以逐字节校验的测试数据
+ * @param size 长度
+ * @param seed 种子，不同的消息内容不同
+ * @return 数据，由调用者释放
+ */
+char *NewPayload(size_t size, unsigned seed);
+
+/**
+ * 发送全部数据
+ * @param sd socket 描述符
+ * @param data 数据
+ * @param size 长度
+ * @return 成功返回 0，失败返回 -1
+ */
+int SendAll(int sd, const char *data, size_t size);
+
+/**
+ * 接收给定长度的数据
+ * @param sd socket 描述符
+ * @param buffer 缓冲区
+ * @param size 长度
+ * @return 实际接收的长度，对端关闭、出错或超时时小于 size
+ */
+size_t ReceiveAll(int sd, char *buffer, size_t size);
+
+/**
+ * 发送线程：发送 Sender 中的全部数据，结果写入 result
+ * @param arg Sender
+ * @return NULL
+ */
+void *RunSender(void *arg);
+
+/**
+ * 创建监听回环地址随机端口的 TCP socket
+ * @param port 分配的端口号
+ * @return socket 描述符
+ */
+int NewListener(unsigned short *port);
+
+/**
+ * 连接到回环地址上的端口
+ * @param type socket 类型
+ * @param port 端口号
+ * @return socket 描述符，失败返回 -1
+ */
+int ConnectLoopback(int type, unsigned short port);
+
+/**
+ * 通过 TCP 服务器回显一条消息并逐字节比较
+ * @param name 服务器的描述
+ * @param port 服务器端口
+ * @param size 消息长度
+ */
+void CheckStreamEcho(const char *name, unsigned short port, size_t size);
+
+/**
+ * 在已经连接的流 socket 上回显一条消息并逐字节比较，socket 由调用者关闭
+ * @param name 服务器的描述
+ * @param sd socket 描述符
+ * @param size 消息长度
+ */
+void CheckSocketEcho(const char *name, int sd, size_t size);
+
+/**
+ * 运行事件循环的线程
+ * @param arg EventLoop
+ * @return NULL
+ */
+void *RunEventLoop(void *arg);
+
+/**
+ * 按变化的块大小发送数据，让帧头和负载在服务器端跨越多次读取
+ */
+void *RunChunkedSender(void *arg);
+
+/**
+ * 在连接上回显一个帧并比较
+ * @param sd socket 描述符
+ * @param payloadSize 负载长度
+ * @param seed 内容种子
+ * @return 回显完整并且一致返回 true
+ */
+bool EchoFrame(int sd, size_t payloadSize, unsigned seed);
+
+/**
+ * 等待事件循环的计数达到给定值
+ * @param counter 指标计数
+ * @param expected 期望值
+ * @return 在超时之前达到返回 true
+ */
+bool WaitForCounter(const uint64_t *counter, uint64_t expected);
+
+/**
+ * 在帧中写入帧头和负载的 CRC32C 帧尾
+ * @param frame 帧，负载已经写好
+ * @param payloadSize 负载长度，不包括帧尾
+ */
+void EncodeCheckedFrame(char *frame, size_t payloadSize);
+
+/**
+ * 等待计数器在一段时间内不再变化
+ * @param counter 计数器
+ * @return 稳定后的值
+ */
+uint64_t WaitForSteadyCounter(const uint64_t *counter);
+
+/**
+ * 输出检查结果，作为测试程序的退出码
+ * @return 全部通过返回 0，否则返回 1
+ */
+int ReportTestResult();
+
+#endif // ECHO_TEST_SUPPORT_H
@@ -0,0 +1,172 @@
+/**
+ * io_uring 事件循环测试
+ *     大消息由多个提供的缓冲区依次接收并按顺序发回；对端不读取时连接占用的缓冲区有上限；
+ *     描述符耗尽时暂停接受而不是反复提交；内核不支持时跳过
+ */
+#include "TestSupport.h"
+#include "UringLoop.h"
+#include "ServerOptions.h"
+#include <stdio.h> // printf
+#include <stdlib.h> // malloc, free
+#include <string.h> // memcmp, memset, strerror
+#include <errno.h> // errno
+#include <unistd.h> // close, usleep, dup
+#include <pthread.h> // pthread_create, pthread_join
+#include <sys/socket.h> // socket, connect
+#include <sys/resource.h> // getrlimit, setrlimit
+#include <netinet/in.h> // sockaddr_in
+#include <arpa/inet.h> // htonl, htons
+
+/**
+ * 运行 io_uring 事件循环的线程
+ */
+static void *RunUringLoop(void *arg) {
+    UringLoopRun((struct UringLoop *) arg);
+    return NULL;
+}
+
+/**
+ * io_uring 事件循环：大消息由多个提供的缓冲区依次接收并按顺序发回；内核不支持时跳过
+ */
+static void TestUringLoopEcho() {
+    const size_t payloadSizes[] = {1, 16384, 16385, (1 << 20) + 3, 8 << 20};
+
+    struct UringLoop loop;
+    if (-1 == UringLoopInit(&loop, SERVER_DEFAULT_BUFFER_SIZE, NULL)) {
+        printf("io_uring is not available, skipping.\n");
+        return;
+    }
+
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(0 == UringLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunUringLoop, &loop);
+
+    for (size_t size : payloadSizes) {
+        CheckStreamEcho("io_uring", port, size);
+    }
+
+    UringLoopStop(&loop);
+    pthread_join(thread, NULL);
+    UringLoopDestroy(&loop);
+    close(listener);
+}
+
+/**
+ * 对端暂时不读取回显：发送队列积压到上限后暂停接收，其他连接不受影响；读取后恢复，回显完整且按顺序
+ */
+static void TestUringSlowReader() {
+    struct UringLoop loop;
+    if (-1 == UringLoopInit(&loop, SERVER_DEFAULT_BUFFER_SIZE, NULL)) {
+        printf("io_uring is not available, skipping.\n");
+        return;
+    }
+
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(0 == UringLoopAddListener(&loop, listener), "add listener failed");
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunUringLoop, &loop);
+
+    // 负载远大于全部缓冲区，不限制时一个连接会占满缓冲区环
+    const size_t size = 32 << 20;
+    char *payload = NewPayload(size, 3);
+    char *echo = (char *) malloc(size);
+    uint64_t pauses = __atomic_load_n(&loop.metrics->backpressurePauses, __ATOMIC_RELAXED);
+    int sd = ConnectLoopback(SOCK_STREAM, port);
+    struct Sender sender = {sd, payload, size, 0};
+    pthread_t senderThread;
+    pthread_create(&senderThread, NULL, RunSender, &sender);
+
+    CHECK(WaitForCounter(&loop.metrics->backpressurePauses, pauses + 1),
+          "receiving never paused for a slow reader");
+
+    // 积压的连接没有占满缓冲区环，其他连接照常回显
+    usleep(100000);
+    CheckStreamEcho("io_uring beside a slow reader", port, 1 << 20);
+
+    size_t received = ReceiveAll(sd, echo, size);
+    pthread_join(senderThread, NULL);
+    CHECK(0 == sender.result, "send failed");
+    CHECK(size == received && 0 == memcmp(payload, echo, size), "slow reader echo mismatch");
+    close(sd);
+    free(echo);
+    free(payload);
+
+    UringLoopStop(&loop);
+    pthread_join(thread, NULL);
+    UringLoopDestroy(&loop);
+    close(listener);
+}
+
+/**
+ * 描述符耗尽：multishot accept 失败后暂停，由定时器每 100 毫秒重试一次而不是立即重新提交，
+ * 描述符释放后积压的连接照常回显
+ */
+static void TestUringAcceptExhaustion() {
+    struct UringLoop loop;
+    if (-1 == UringLoopInit(&loop, SERVER_DEFAULT_BUFFER_SIZE, NULL)) {
+        printf("io_uring is not available, skipping.\n");
+        return;
+    }
+
+    unsigned short port = 0;
+    int listener = NewListener(&port);
+    CHECK(0 == UringLoopAddListener(&loop, listener), "add listener failed");
+
+    // 客户 socket 先创建好，再用降低的上限和复制的描述符占满描述符表；
+    // 内核在准备 accept 请求时记下描述符上限，所以要在事件循环提交 accept 之前降低
+    int client = socket(PF_INET, SOCK_STREAM, 0);
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    struct rlimit lowered = limit;
+    lowered.rlim_cur = 256;
+    setrlimit(RLIMIT_NOFILE, &lowered);
+    int fillers[256];
+    int fillerCount = 0;
+    while (fillerCount < 256) {
+        int fd = dup(client);
+        if (-1 == fd) {
+            break;
+        }
+        fillers[fillerCount++] = fd;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, RunUringLoop, &loop);
+
+    uint64_t pauses = __atomic_load_n(&loop.metrics->acceptPauses, __ATOMIC_RELAXED);
+    uint64_t syscalls = __atomic_load_n(&loop.metrics->syscalls, __ATOMIC_RELAXED);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = PF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    CHECK(0 == connect(client, (struct sockaddr *) &address, sizeof(address)),
+          "connect failed: %s", strerror(errno));
+    CHECK(WaitForCounter(&loop.metrics->acceptPauses, pauses + 1), "accept never paused");
+
+    usleep(300000);
+    uint64_t spent = __atomic_load_n(&loop.metrics->syscalls, __ATOMIC_RELAXED) - syscalls;
+    CHECK(spent < 100, "io_uring loop spun: %llu syscalls while out of descriptors",
+          (unsigned long long) spent);
+
+    for (int i = 0; i < fillerCount; i++) {
+        close(fillers[i]);
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+    CheckSocketEcho("io_uring accept after descriptors freed", client, 100);
+    close(client);
+
+    UringLoopStop(&loop);
+    pthread_join(thread, NULL);
+    UringLoopDestroy(&loop);
+    close(listener);
+}
+
+int main() {
+    TestUringLoopEcho();
+    TestUringSlowReader();
+    TestUringAcceptExhaustion();
+    return ReportTestResult();
+}